@@ -0,0 +1,1029 @@
+/*
+ * RGB to HA Conversion Benchmark
+ * Standalone kernel and pipeline benchmarks with machine-readable results
+ *
+ * Built as the rgbtoha_bench target; needs neither Qt nor the PixInsight
+ * runtime. Results are written to stdout as one JSON document.
+ *
+ *    rgbtoha_bench [section ...] [option ...]
+ *
+ * Sections (default: all):
+ *    sigmoid     sigmoid variants and the neural kernels built on them
+ *    pipeline    every conversion method and post-processing stage on
+ *                synthetic star fields
+ *    quality     Fast and Quality modes against Ultra: error bounds and
+ *                single-thread speedup targets of HAQualityProfile
+ *    enhance     local contrast at the default radius against the original
+ *                four-neighbour kernel, in both pipelines
+ *    stencil     HAStencil with each edge policy against a bounds-checked
+ *                loop, and the pyramid reduction against the same
+ *                reduction on the stencil and a plain copy
+ *    lut         conversion LUTs (HAColorLUT) of the per-pixel methods:
+ *                build time, error against the exact kernels, and
+ *                single-thread conversion speed with and without
+ *    mlp         a 3-16-16-1 network (HAMLPModel) with random weights: error
+ *                against double precision per kernel table (bound 1e-5),
+ *                and throughput for each thread count
+ *    tune        the startup calibration of the module (HATuner): every
+ *                candidate it times and the settings it picks; the machine
+ *                profile is neither read nor written
+ *    stream      out-of-core conversion from a FITS or XISF file to another
+ *                under a budget that forces a scratch file spill, against
+ *                the conversion in memory
+ *
+ * Options for the pipeline section (lists are comma separated):
+ *    --sizes=1,16          image sizes in megapixels, up to 200; the quality
+ *                          section uses the first. Larger sizes are not in
+ *                          the default: at 200 MP one f64 configuration
+ *                          needs 6.4 GB and the default set takes hours
+ *    --types=u8,u16,u32,f32,f64
+ *    --methods=0,1,2,3     Standard, Advanced Spectral, Adaptive Multi-Scale
+ *                          (ProcessMultiScale), Neural Approximation
+ *    --stages=convert,enhance,denoise,contrast,all
+ *    --threads=1,2,...     default: 1 and powers of two up to the hardware
+ *                          thread count
+ *    --repeat=N            timed runs per configuration, best kept (default 1)
+ *    --staged              also time the staged reference pipeline
+ *    --profile             print a per-stage timing table to stderr after
+ *                          each configuration (untimed extra run)
+ *    --trace=PREFIX        with --profile, also write a Chrome trace per
+ *                          configuration to PREFIX-<type>-<method>-<stages>-<threads>.json,
+ *                          PREFIX-staged-... for the staged pipeline
+ *
+ * The exit code is 1 if a measured error exceeds its documented bound, and
+ * 2, before anything runs, for an unknown section or option. Speedup
+ * targets are reported but not enforced, since they depend on the machine.
+ */
+
+#include "RGBToHAEngine.h"
+#include "RGBToHAImageIO.h"
+#include "RGBToHAStarField.h"
+#include "RGBToHATuner.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace pcl
+{
+
+namespace
+{
+
+// One JSON object of benchmark results
+class HABenchRecord
+{
+public:
+
+   HABenchRecord& Add( const char* key, const std::string& value )
+   {
+      Key( key );
+      m_text += '"' + value + '"';
+      return *this;
+   }
+
+   HABenchRecord& Add( const char* key, const char* value )
+   {
+      return Add( key, std::string( value ) );
+   }
+
+   HABenchRecord& Add( const char* key, double value )
+   {
+      char buffer[32];
+      std::snprintf( buffer, sizeof( buffer ), "%.6g", value );
+      Key( key );
+      m_text += buffer;
+      return *this;
+   }
+
+   HABenchRecord& Add( const char* key, bool value )
+   {
+      Key( key );
+      m_text += value ? "true" : "false";
+      return *this;
+   }
+
+   std::string ToString() const
+   {
+      return "{ " + m_text + " }";
+   }
+
+private:
+
+   void Key( const char* key )
+   {
+      if ( !m_text.empty() )
+         m_text += ", ";
+      m_text += '"' + std::string( key ) + "\": ";
+   }
+
+   std::string m_text;
+};
+
+struct HABenchOptions
+{
+   std::vector<double> sizes = { 1, 16 };
+   std::vector<std::string> types = { "u8", "u16", "u32", "f32", "f64" };
+   std::vector<int> methods = { 0, 1, 2, 3 };
+   std::vector<std::string> stages = { "convert", "enhance", "denoise", "contrast", "all" };
+   std::vector<int> threads;
+   int repeat = 1;
+   bool staged = false;
+   bool profile = false;
+   std::string tracePrefix;
+};
+
+struct HABenchContext
+{
+   HABenchOptions options;
+   std::vector<HABenchRecord> records;
+   bool boundsHeld = true;
+};
+
+double Now()
+{
+   return std::chrono::duration<double>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+// Repeats run until at least minSeconds have elapsed; returns seconds per call
+template <class F>
+double TimePerCall( F run, double minSeconds = 0.2 )
+{
+   run(); // warm up caches and lazy initialization
+   int calls = 0;
+   double start = Now(), elapsed;
+   do
+   {
+      run();
+      ++calls;
+   }
+   while ( ( elapsed = Now() - start ) < minSeconds );
+   return elapsed/calls;
+}
+
+// Peak resident set size of the process so far
+double PeakRSSMiB()
+{
+#ifdef _WIN32
+   PROCESS_MEMORY_COUNTERS counters;
+   if ( GetProcessMemoryInfo( GetCurrentProcess(), &counters, sizeof( counters ) ) )
+      return counters.PeakWorkingSetSize/1048576.0;
+   return 0;
+#else
+   rusage usage;
+   getrusage( RUSAGE_SELF, &usage );
+#ifdef __APPLE__
+   return usage.ru_maxrss/1048576.0; // bytes
+#else
+   return usage.ru_maxrss/1024.0;    // kilobytes
+#endif
+#endif
+}
+
+// Kernel tables usable on this CPU, scalar first
+std::vector<const HAConversionKernels*> AvailableKernels()
+{
+   std::vector<const HAConversionKernels*> tables;
+   for ( const HAConversionKernels* k : { HAConversionKernelsScalar(), HAConversionKernelsSSE42(),
+                                          HAConversionKernelsAVX2(), HAConversionKernelsAVX512(),
+                                          HAConversionKernelsNEON() } )
+      if ( k != nullptr && HACPUSupports( k->isa ) )
+         tables.push_back( k );
+   return tables;
+}
+
+/*
+ * Sigmoid variants on their own over a dense sweep of [-30,30], and the
+ * Neural Approximation kernels built on them over random pixels. Errors are
+ * against double precision libm.
+ */
+void BenchSigmoid( HABenchContext& context )
+{
+   const int n = 1 << 22;
+   std::vector<float> x( n ), y( n );
+   std::vector<double> expected( n );
+   for ( int i = 0; i < n; ++i )
+   {
+      x[i] = float( -30 + 60.0*i/( n - 1 ) );
+      expected[i] = 1/( 1 + std::exp( -double( x[i] ) ) );
+   }
+
+   const int pixels = 1 << 20;
+   std::vector<float> r( pixels ), g( pixels ), b( pixels ), out( pixels );
+   std::vector<double> rd( pixels ), gd( pixels ), bd( pixels ), reference( pixels );
+   std::mt19937 rng( 1 );
+   std::uniform_real_distribution<float> uniform( 0, 1 );
+   for ( int i = 0; i < pixels; ++i )
+   {
+      rd[i] = r[i] = uniform( rng );
+      gd[i] = g[i] = uniform( rng );
+      bd[i] = b[i] = uniform( rng );
+   }
+   HAKernels::ConvertNeuralApproximation( rd.data(), gd.data(), bd.data(), reference.data(), pixels );
+
+   for ( const HAConversionKernels* k : AvailableKernels() )
+   {
+      bool scalar = std::strcmp( k->isa, "scalar" ) == 0;
+      struct Variant { const char* name; HAMapKernel sigmoid; HARowKernel neural; double bound; };
+      const Variant variants[] = {
+         { scalar ? "libm" : "vector-exp", k->sigmoid, k->neural, 0 },
+         { "fast", k->fastSigmoid, k->neuralFast, HAFastSigmoidMaxError }
+      };
+
+      for ( const Variant& v : variants )
+      {
+         double seconds = TimePerCall( [&]() { v.sigmoid( x.data(), y.data(), n ); } );
+         double error = 0;
+         for ( int i = 0; i < n; ++i )
+            error = std::max( error, std::fabs( y[i] - expected[i] ) );
+         HABenchRecord record;
+         record.Add( "benchmark", "sigmoid" ).Add( "isa", k->isa ).Add( "variant", v.name )
+               .Add( "mpix_per_s", n/seconds/1e6 ).Add( "max_abs_error", error );
+         if ( v.bound > 0 )
+         {
+            record.Add( "error_bound", v.bound ).Add( "within_bound", error <= v.bound );
+            context.boundsHeld &= error <= v.bound;
+         }
+         context.records.push_back( record );
+
+         HAKernelArgs args;
+         seconds = TimePerCall( [&]() { v.neural( r.data(), g.data(), b.data(), out.data(), pixels, args ); } );
+         error = 0;
+         for ( int i = 0; i < pixels; ++i )
+            error = std::max( error, std::fabs( out[i] - reference[i] ) );
+         context.records.push_back( HABenchRecord().Add( "benchmark", "neural" ).Add( "isa", k->isa )
+                                    .Add( "variant", v.name ).Add( "mpix_per_s", pixels/seconds/1e6 )
+                                    .Add( "max_abs_error", error ) );
+      }
+   }
+}
+
+HAParameters StageParameters( int method, const std::string& stages )
+{
+   HAParameters params;
+   params.conversionMethod = method;
+   params.enhancementStrength = ( stages == "enhance" || stages == "all" ) ? 0.5 : 0.0;
+   params.noiseReduction = ( stages == "denoise" || stages == "all" ) ? 0.3 : 0.0;
+   params.contrastBoost = ( stages == "contrast" || stages == "all" ) ? 0.4 : 0.0;
+   return params;
+}
+
+template <typename T>
+void BenchPipelineType( HABenchContext& context, const char* typeName, double megapixels )
+{
+   static const char* methodNames[] = { "standard", "spectral", "multiscale", "neural" };
+   const HABenchOptions& options = context.options;
+
+   int width = int( std::sqrt( megapixels*1e6*1.5 ) );
+   int height = int( megapixels*1e6/width );
+   HAThreadPool::Configure( 0 );
+   HAStarField<T> image( width, height );
+   HASource<T> source = image.Source();
+   std::vector<T> output( std::size_t( width )*height );
+   HAView<T> view( output.data(), width );
+   const double mpix = double( width )*height/1e6;
+
+   for ( int method : options.methods )
+      for ( const std::string& stages : options.stages )
+      {
+         HAParameters params = StageParameters( method, stages );
+         for ( int pipeline = 0; pipeline < ( options.staged ? 2 : 1 ); ++pipeline )
+         {
+            double baseRate = 0;
+            int baseThreads = 0;
+            for ( int threads : options.threads )
+            {
+               HAThreadPool::Configure( threads );
+               double best = 0;
+               for ( int run = 0; run < options.repeat; ++run )
+               {
+                  double start = Now();
+                  if ( pipeline == 0 )
+                     HAFusedPipeline( params ).Run( source, view );
+                  else
+                     HAStagedPipeline( params ).Run( source, view );
+                  double seconds = Now() - start;
+                  if ( run == 0 || seconds < best )
+                     best = seconds;
+               }
+
+               if ( options.profile )
+               {
+                  HAProfiler profiler( HANumberOfThreads() );
+                  if ( pipeline == 0 )
+                     HAFusedPipeline( params ).Run( source, view, &profiler );
+                  else
+                     HAStagedPipeline( params ).Run( source, view, &profiler );
+                  std::fprintf( stderr, "%s", profiler.Summary().c_str() );
+                  if ( !options.tracePrefix.empty() )
+                     profiler.WriteChromeTrace( options.tracePrefix + '-' + ( pipeline ? "staged-" : "" ) + typeName + '-' +
+                                                methodNames[method] + '-' + stages + '-' + std::to_string( threads ) + ".json" );
+               }
+
+               double rate = mpix/best;
+               if ( baseThreads == 0 )
+               {
+                  baseRate = rate;
+                  baseThreads = threads;
+               }
+
+               context.records.push_back( HABenchRecord().Add( "benchmark", "pipeline" )
+                                          .Add( "pipeline", pipeline ? "staged" : "fused" )
+                                          .Add( "megapixels", mpix ).Add( "width", double( width ) )
+                                          .Add( "height", double( height ) ).Add( "type", typeName )
+                                          .Add( "method", methodNames[method] ).Add( "stages", stages )
+                                          .Add( "threads", double( threads ) ).Add( "seconds", best )
+                                          .Add( "mpix_per_s", rate )
+                                          .Add( "scaling_efficiency", ( rate/baseRate )/( double( threads )/baseThreads ) )
+                                          .Add( "peak_rss_mib", PeakRSSMiB() ) );
+               std::fprintf( stderr, "%s %.1f MP %s %s/%s %d threads: %.1f MPix/s\n",
+                             pipeline ? "staged" : "fused", mpix, typeName, methodNames[method], stages.c_str(),
+                             threads, rate );
+            }
+         }
+      }
+
+   HAThreadPool::Configure( 0 );
+}
+
+void BenchPipeline( HABenchContext& context )
+{
+   for ( double megapixels : context.options.sizes )
+      for ( const std::string& type : context.options.types )
+      {
+         if ( type == "u8" )
+            BenchPipelineType<std::uint8_t>( context, "u8", megapixels );
+         else if ( type == "u16" )
+            BenchPipelineType<std::uint16_t>( context, "u16", megapixels );
+         else if ( type == "u32" )
+            BenchPipelineType<std::uint32_t>( context, "u32", megapixels );
+         else if ( type == "f32" )
+            BenchPipelineType<float>( context, "f32", megapixels );
+         else if ( type == "f64" )
+            BenchPipelineType<double>( context, "f64", megapixels );
+      }
+}
+
+/*
+ * Every conversion method with all stages at their default strengths, in
+ * Fast and Quality mode, compared with Ultra on the same float32 star field.
+ * Timed on one thread, so speedups measure work rather than scaling.
+ */
+void BenchQuality( HABenchContext& context )
+{
+   static const char* methodNames[] = { "standard", "spectral", "multiscale", "neural" };
+
+   const double megapixels = context.options.sizes.empty() ? 1.0 : context.options.sizes.front();
+   const int width = int( std::sqrt( megapixels*1e6*1.5 ) );
+   const int height = int( megapixels*1e6/width );
+   HAThreadPool::Configure( 0 );
+   HAStarField<float> image( width, height );
+   HASource<float> source = image.Source();
+   std::vector<float> reference( std::size_t( width )*height ), output( reference.size() );
+
+   HAThreadPool::Configure( 1 );
+   for ( int method : context.options.methods )
+   {
+      HAParameters params = StageParameters( method, "all" );
+      params.qualityMode = 2;
+      double ultraSeconds = TimePerCall( [&]()
+      {
+         HAStagedPipeline( params ).Run( source, HAView<float>( reference.data(), width ) );
+      } );
+
+      for ( int mode = 0; mode < 2; ++mode )
+      {
+         const HAQualityProfile& profile = HAQualityProfileFor( mode );
+         params.qualityMode = mode;
+         double seconds = TimePerCall( [&]()
+         {
+            HAFusedPipeline( params ).Run( source, HAView<float>( output.data(), width ) );
+         } );
+
+         double maxError = 0, sumError = 0;
+         for ( std::size_t i = 0; i < output.size(); ++i )
+         {
+            double e = std::abs( double( output[i] ) - reference[i] );
+            maxError = std::max( maxError, e );
+            sumError += e;
+         }
+         double meanError = sumError/output.size();
+
+         bool held = maxError <= profile.maxError && meanError <= profile.meanError;
+         double speedup = ultraSeconds/seconds;
+         context.boundsHeld &= held;
+         context.records.push_back( HABenchRecord().Add( "benchmark", "quality" ).Add( "mode", profile.name )
+                                    .Add( "method", methodNames[method] ).Add( "megapixels", width*double( height )/1e6 )
+                                    .Add( "max_error", maxError ).Add( "max_error_bound", profile.maxError )
+                                    .Add( "mean_error", meanError ).Add( "mean_error_bound", profile.meanError )
+                                    .Add( "within_bound", held ).Add( "speedup", speedup )
+                                    .Add( "speedup_target", profile.minSpeedup )
+                                    .Add( "target_met", speedup >= profile.minSpeedup ) );
+      }
+   }
+   HAThreadPool::Configure( 0 );
+}
+
+/*
+ * Local contrast at the default radius 0 against the original kernel: the
+ * four direct neighbours, edge pixels equalized but not enhanced. The
+ * reference applies that kernel to the converted image of the staged
+ * pipeline; both pipelines must match it with enhancement enabled.
+ */
+void BenchEnhance( HABenchContext& context )
+{
+   static const char* pipelineNames[] = { "staged", "fused" };
+   static const double bounds[] = { 1e-12, 1e-5 };
+
+   const int width = 600, height = 400;
+   HAThreadPool::Configure( 0 );
+   HAStarField<double> image( width, height );
+   HASource<double> source = image.Source();
+   std::vector<double> converted( std::size_t( width )*height ), output( converted.size() );
+   HAStagedPipeline( StageParameters( 0, "convert" ) ).Run( source, HAView<double>( converted.data(), width ) );
+
+   const HAParameters params = StageParameters( 0, "enhance" );
+   HAMoments moments;
+   moments.Add( converted.data(), int( converted.size() ) );
+   const double mean = moments.Mean(), stdDev = moments.StdDev(), strength = params.enhancementStrength;
+
+   std::vector<double> reference( converted.size() );
+   for ( int y = 0; y < height; ++y )
+      for ( int x = 0; x < width; ++x )
+      {
+         const double* p = converted.data() + std::size_t( y )*width + x;
+         double pixel = *p;
+         if ( pixel > mean )
+            pixel += ( pixel - mean )/stdDev*strength*0.1;
+         if ( x > 0 && x < width - 1 && y > 0 && y < height - 1 )
+            pixel += ( pixel - ( p[-1] + p[1] + p[-width] + p[width] )/4 )*strength*0.2;
+         reference[std::size_t( y )*width + x] = std::min( std::max( pixel, 0.0 ), 1.0 );
+      }
+
+   for ( int pipeline = 0; pipeline < 2; ++pipeline )
+   {
+      if ( pipeline == 0 )
+         HAStagedPipeline( params ).Run( source, HAView<double>( output.data(), width ) );
+      else
+         HAFusedPipeline( params ).Run( source, HAView<double>( output.data(), width ) );
+
+      double maxError = 0;
+      for ( std::size_t i = 0; i < output.size(); ++i )
+         maxError = std::max( maxError, std::abs( output[i] - reference[i] ) );
+
+      bool held = maxError <= bounds[pipeline];
+      context.boundsHeld &= held;
+      context.records.push_back( HABenchRecord().Add( "benchmark", "enhance" ).Add( "pipeline", pipelineNames[pipeline] )
+                                 .Add( "radius", double( params.localContrastRadius ) ).Add( "max_error", maxError )
+                                 .Add( "max_error_bound", bounds[pipeline] ).Add( "within_bound", held ) );
+   }
+}
+
+/*
+ * HAStencil with every edge policy: a 7x7 box mean over a float32 star
+ * field against the same mean with a bounds check on every neighbour, the
+ * loop the stencil replaces. Then the pyramid reduction, which has no
+ * bounds checks to remove, against the same reduction on the stencil and a
+ * copy of the samples it reads, at tile size (in cache) and on the whole
+ * image. Single thread.
+ */
+void BenchStencil( HABenchContext& context )
+{
+   static const char* policyNames[] = { "clip", "mirror", "clamp", "zero" };
+   const int radius = 3;
+
+   const double megapixels = context.options.sizes.empty() ? 1.0 : context.options.sizes.front();
+   const int width = int( std::sqrt( megapixels*1e6*1.5 ) );
+   const int height = int( megapixels*1e6/width );
+   HAThreadPool::Configure( 0 );
+   HAStarField<float> image( width, height );
+   const HAView<const float> src( image.channel[0].data(), width );
+   const HARect rect( 0, 0, width, height );
+   std::vector<float> output( std::size_t( width )*height ), reference( output.size() ), scratch;
+   const HAView<float> dst( output.data(), width );
+
+   HAThreadPool::Configure( 1 );
+   for ( int policy = 0; policy < 4; ++policy )
+   {
+      const HAStencil<float> stencil( radius, HAEdgePolicy( policy ) );
+      const auto boxMean = []( const float* p, std::ptrdiff_t stride, int, int, const HAWindow& window )
+      {
+         float sum = 0;
+         for ( int dy = window.dy0; dy <= window.dy1; ++dy )
+            for ( int dx = window.dx0; dx <= window.dx1; ++dx )
+               sum += p[dy*stride + dx];
+         return sum/window.Count();
+      };
+      double seconds = TimePerCall( [&]()
+      {
+         stencil.Apply( src, dst, rect, width, height, boxMean, scratch );
+      } );
+
+      double checkedSeconds = TimePerCall( [&]()
+      {
+         for ( int y = 0; y < height; ++y )
+            for ( int x = 0; x < width; ++x )
+            {
+               float sum = 0;
+               int count = 0;
+               for ( int dy = -radius; dy <= radius; ++dy )
+                  for ( int dx = -radius; dx <= radius; ++dx )
+                  {
+                     int nx = x + dx, ny = y + dy;
+                     bool inside = nx >= 0 && nx < width && ny >= 0 && ny < height;
+                     if ( !inside )
+                     {
+                        if ( policy == 0 )
+                           continue;
+                        nx = stencil.Fold( nx, width );
+                        ny = stencil.Fold( ny, height );
+                     }
+                     sum += ( nx < 0 || ny < 0 ) ? 0.0f : src( nx, ny );
+                     ++count;
+                  }
+               reference[std::size_t( y )*width + x] = sum/count;
+            }
+      } );
+
+      double maxError = 0;
+      for ( std::size_t i = 0; i < output.size(); ++i )
+         maxError = std::max( maxError, std::abs( double( output[i] ) - reference[i] ) );
+
+      bool held = maxError <= 1e-6;
+      context.boundsHeld &= held;
+      context.records.push_back( HABenchRecord().Add( "benchmark", "stencil" ).Add( "kernel", "box7" )
+                                 .Add( "policy", policyNames[policy] ).Add( "megapixels", width*double( height )/1e6 )
+                                 .Add( "max_error", maxError ).Add( "max_error_bound", 1e-6 ).Add( "within_bound", held )
+                                 .Add( "ms", 1000*seconds ).Add( "checked_ms", 1000*checkedSeconds )
+                                 .Add( "speedup", checkedSeconds/seconds ) );
+   }
+
+   const int tileSide = HAFusedPipeline( HAParameters() ).TileHeight();
+   for ( int whole = 0; whole < 2; ++whole )
+   {
+      const HARect band = HAPyramid::Aligned( whole ? rect : HARect( 0, 0, tileSide, tileSide ), width, height );
+      std::vector<float> levelData[HAPyramid::Levels];
+      HAView<float> levels[HAPyramid::Levels];
+      levels[0] = HAView<float>( image.channel[0].data(), width );
+      for ( int k = 1; k < HAPyramid::Levels; ++k )
+      {
+         const HARect r = HAPyramid::LevelRect( band, k );
+         levelData[k].resize( std::size_t( r.Width() )*r.Height() );
+         levels[k] = HAView<float>( levelData[k].data(), r.Width(), r.x0, r.y0 );
+      }
+
+      double seconds = TimePerCall( [&]() { HAPyramid::Reduce( levels, band ); } );
+
+      // The same reduction on the stencil: the 2x2 mean at every sample of
+      // the finer level, even samples kept
+      std::vector<float> full;
+      const HAStencil<float> box( 1 );
+      double stencilSeconds = TimePerCall( [&]()
+      {
+         for ( int k = 1; k < HAPyramid::Levels; ++k )
+         {
+            const HARect fine = HAPyramid::LevelRect( band, k - 1 ), coarse = HAPyramid::LevelRect( band, k );
+            full.resize( std::size_t( fine.Width() )*fine.Height() );
+            const HAView<float> means( full.data(), fine.Width(), fine.x0, fine.y0 );
+            // The band starts at the origin: the finer level ends at fine.x1, fine.y1
+            box.Apply( levels[k-1], means, fine, fine.x1, fine.y1,
+               []( const float* p, std::ptrdiff_t stride, int, int, const HAWindow& window )
+               {
+                  return ( window.dx1 > 0 && window.dy1 > 0 ) ? ( p[0] + p[1] + p[stride] + p[stride + 1] )/4 : 0.0f;
+               } );
+            for ( int y = coarse.y0; y < coarse.y1; ++y )
+               for ( int x = coarse.x0; x < coarse.x1; ++x )
+                  levels[k]( x, y ) = means( 2*x, 2*y );
+         }
+      } );
+
+      double copySeconds = TimePerCall( [&]()
+      {
+         for ( int y = band.y0; y < band.y1; ++y )
+            std::copy( src.At( band.x0, y ), src.At( band.x1, y ), dst.At( band.x0, y ) );
+      } );
+
+      const double pixels = band.Area();
+      context.records.push_back( HABenchRecord().Add( "benchmark", "stencil" ).Add( "kernel", "pyramid_reduce" )
+                                 .Add( "levels", double( HAPyramid::Levels ) ).Add( "megapixels", pixels/1e6 )
+                                 .Add( "ns_per_pixel", 1e9*seconds/pixels )
+                                 .Add( "stencil_ns_per_pixel", 1e9*stencilSeconds/pixels )
+                                 .Add( "copy_ns_per_pixel", 1e9*copySeconds/pixels ) );
+   }
+   HAThreadPool::Configure( 0 );
+}
+
+// A 3-16-16-1 network (ReLU, ReLU, sigmoid) with He-initialized random weights
+std::vector<HAMLPModel::Layer> RandomMLPLayers( std::mt19937& rng )
+{
+   std::vector<HAMLPModel::Layer> layers;
+   int inputs = 3;
+   for ( int outputs : { 16, 16, 1 } )
+   {
+      HAMLPModel::Layer layer;
+      layer.outputs = outputs;
+      layer.activation = ( outputs > 1 ) ? HAActivation::ReLU : HAActivation::Sigmoid;
+      std::normal_distribution<float> normal( 0, std::sqrt( 2.0f/inputs ) );
+      for ( int i = 0; i < outputs*inputs; ++i )
+         layer.weights.push_back( normal( rng ) );
+      for ( int i = 0; i < outputs; ++i )
+         layer.bias.push_back( 0.1f*normal( rng ) );
+      layers.push_back( std::move( layer ) );
+      inputs = outputs;
+   }
+   return layers;
+}
+
+// Writes layers of RandomMLPLayers() as an HAMLPModel weight file
+void WriteMLPModel( const std::string& path, const std::vector<HAMLPModel::Layer>& layers )
+{
+   FILE* f = std::fopen( path.c_str(), "w" );
+   if ( f == nullptr )
+      throw std::runtime_error( "unable to write " + path );
+   std::fprintf( f, "rgbtoha-mlp 1\ninputs 3\n" );
+   for ( const HAMLPModel::Layer& layer : layers )
+   {
+      std::fprintf( f, "dense %d %s\n", layer.outputs, ( layer.activation == HAActivation::ReLU ) ? "relu" : "sigmoid" );
+      for ( float w : layer.weights )
+         std::fprintf( f, "%.9g ", w );
+      std::fprintf( f, "\n" );
+      for ( float b : layer.bias )
+         std::fprintf( f, "%.9g ", b );
+      std::fprintf( f, "\n" );
+   }
+   std::fclose( f );
+}
+
+/*
+ * Conversion through 17^3, 33^3 and 65^3 LUTs against the exact kernels, on
+ * the float32 star field with every post-processing stage disabled. Errors
+ * are reported both at the lattice cell centres (as HAColorLUT measures
+ * them) and over the image. Not bounded: the error is a property of the
+ * method's curvature, which the user trades against speed.
+ *
+ * Neural Approximation is measured with its built-in weights and with a
+ * loaded 3-16-16-1 model (RandomMLPLayers), the expensive case the LUT is
+ * for; HALUTPays() follows the speedups measured here.
+ */
+void BenchLUT( HABenchContext& context )
+{
+   static const char* methodNames[] = { "standard", "spectral", "multiscale", "neural" };
+
+   const double megapixels = context.options.sizes.empty() ? 1.0 : context.options.sizes.front();
+   const int width = int( std::sqrt( megapixels*1e6*1.5 ) );
+   const int height = int( megapixels*1e6/width );
+   HAThreadPool::Configure( 0 );
+   HAStarField<float> image( width, height );
+   HASource<float> source = image.Source();
+   std::vector<float> exact( std::size_t( width )*height ), output( exact.size() );
+
+   std::mt19937 rng( 2 );
+   const std::string modelPath = ( std::filesystem::temp_directory_path()/"rgbtoha_bench_lut_model.txt" ).string();
+   WriteMLPModel( modelPath, RandomMLPLayers( rng ) );
+
+   HAThreadPool::Configure( 1 );
+   std::vector<HAParameters> configurations;
+   for ( int method : context.options.methods )
+      if ( method != 2 ) // not a per-pixel method
+      {
+         configurations.push_back( StageParameters( method, "convert" ) );
+         if ( method == 3 )
+         {
+            configurations.push_back( configurations.back() );
+            configurations.back().neuralModelPath = modelPath;
+         }
+      }
+
+   for ( HAParameters params : configurations )
+   {
+      const int method = params.conversionMethod;
+      const std::string model = params.neuralModelPath.empty() ? "built-in" :
+                                HAMLPModel::Shared( params.neuralModelPath )->Shape();
+      double exactSeconds = TimePerCall( [&]()
+      {
+         HAFusedPipeline( params ).Run( source, HAView<float>( exact.data(), width ) );
+      } );
+
+      for ( int size : { 17, 33, 65 } )
+      {
+         params.lutSize = size;
+         const HAFusedPipeline pipeline( params );
+         double seconds = TimePerCall( [&]()
+         {
+            pipeline.Run( source, HAView<float>( output.data(), width ) );
+         } );
+
+         double maxError = 0, sumError = 0;
+         for ( std::size_t i = 0; i < output.size(); ++i )
+         {
+            double e = std::abs( double( output[i] ) - exact[i] );
+            maxError = std::max( maxError, e );
+            sumError += e;
+         }
+
+         const HAColorLUT& lut = *pipeline.LUT();
+         context.records.push_back( HABenchRecord().Add( "benchmark", "lut" ).Add( "method", methodNames[method] )
+                                    .Add( "model", model ).Add( "pays", HALUTPays( params ) )
+                                    .Add( "size", double( size ) ).Add( "build_ms", lut.BuildMilliseconds() )
+                                    .Add( "lattice_max_error", lut.MaxError() )
+                                    .Add( "lattice_mean_error", lut.MeanError() )
+                                    .Add( "image_max_error", maxError )
+                                    .Add( "image_mean_error", sumError/output.size() )
+                                    .Add( "exact_mpix_per_s", width*double( height )/1e6/exactSeconds )
+                                    .Add( "lut_mpix_per_s", width*double( height )/1e6/seconds )
+                                    .Add( "speedup", exactSeconds/seconds ) );
+      }
+   }
+   HAThreadPool::Configure( 0 );
+   std::filesystem::remove( modelPath );
+}
+
+/*
+ * The 3-16-16-1 network of RandomMLPLayers() over random pixels: single-thread
+ * speed and error against the double precision reference of every kernel
+ * table, exact and fast sigmoid,
+ * then the speed of the active kernels on the thread pool for each thread
+ * count. GFLOP/s counts a multiply-add as two operations. The error bound
+ * covers float32 accumulation and the fast sigmoid on this network.
+ */
+void BenchMLP( HABenchContext& context )
+{
+   std::mt19937 rng( 2 );
+   const HAMLPModel model( 3, RandomMLPLayers( rng ) );
+
+   const int pixels = 1 << 22;
+   std::vector<float> r( pixels ), g( pixels ), b( pixels ), out( pixels );
+   std::vector<double> rd( pixels ), gd( pixels ), bd( pixels ), reference( pixels );
+   std::uniform_real_distribution<float> uniform( 0, 1 );
+   for ( int i = 0; i < pixels; ++i )
+   {
+      rd[i] = r[i] = uniform( rng );
+      gd[i] = g[i] = uniform( rng );
+      bd[i] = b[i] = uniform( rng );
+   }
+   model.Reference( rd.data(), gd.data(), bd.data(), reference.data(), pixels );
+   const double flops = 2.0*model.MultiplyAdds();
+   const double bound = 1.0e-5;
+
+   HAThreadPool::Configure( 1 );
+   for ( const HAConversionKernels* k : AvailableKernels() )
+      for ( bool fast : { false, true } )
+      {
+         double seconds = TimePerCall( [&]() { model.Convert( r.data(), g.data(), b.data(), out.data(), pixels, fast, *k ); } );
+         double error = 0;
+         for ( int i = 0; i < pixels; ++i )
+            error = std::max( error, std::fabs( out[i] - reference[i] ) );
+         context.records.push_back( HABenchRecord().Add( "benchmark", "mlp" ).Add( "isa", k->isa )
+                                    .Add( "variant", fast ? "fast" : "exact" ).Add( "shape", model.Shape() )
+                                    .Add( "threads", 1.0 ).Add( "mpix_per_s", pixels/seconds/1e6 )
+                                    .Add( "gflops", pixels*flops/seconds/1e9 ).Add( "max_abs_error", error )
+                                    .Add( "error_bound", bound ).Add( "within_bound", error <= bound ) );
+         context.boundsHeld &= error <= bound;
+      }
+
+   for ( int threads : context.options.threads )
+   {
+      HAThreadPool::Configure( threads );
+      double seconds = TimePerCall( [&]() { model.Convert( r.data(), g.data(), b.data(), out.data(), pixels ); } );
+      context.records.push_back( HABenchRecord().Add( "benchmark", "mlp" ).Add( "isa", HAActiveConversionKernels().isa )
+                                 .Add( "variant", "exact" ).Add( "shape", model.Shape() )
+                                 .Add( "threads", double( threads ) ).Add( "mpix_per_s", pixels/seconds/1e6 )
+                                 .Add( "gflops", pixels*flops/seconds/1e9 ) );
+   }
+   HAThreadPool::Configure( 0 );
+}
+
+/*
+ * Out-of-core conversion of a 4 MP star field, as float32 FITS and uint16
+ * XISF: streamed file to file (HAFileStripSource to HAFileStripSink) on one
+ * thread, under a budget of about an eighth of the image in strips, so the
+ * unstretched output spills to a scratch file. The file written is read
+ * back and compared with HAFusedPipeline::Run on the image in memory.
+ */
+// Largest difference between a streamed and an in-memory conversion, in
+// units of the sample range
+const double StreamMaxError = 1e-6;
+
+template <typename T>
+void BenchStreamType( HABenchContext& context, const char* typeName, const char* extension )
+{
+   namespace fs = std::filesystem;
+
+   const int width = int( std::sqrt( 4e6*1.5 ) );
+   const int height = int( 4e6/width );
+   HAThreadPool::Configure( 0 );
+   HAStarField<T> image( width, height );
+   const HAParameters params = StageParameters( 0, "all" );
+
+   HAThreadPool::Configure( 1 );
+   std::vector<T> reference( std::size_t( width )*height );
+   HAFusedPipeline( params ).Run( image.Source(), HAView<T>( reference.data(), width ) );
+
+   const std::string stem = ( fs::temp_directory_path()/( std::string( "rgbtoha_bench_stream_" ) + typeName ) ).string();
+   const std::string input = stem + "_rgb" + extension, output = stem + "_ha" + extension;
+   {
+      HAImageWriter writer( input, width, height, 3, HASampleFormatOf<T>(), std::vector<std::string>() );
+      for ( int c = 0; c < 3; ++c )
+         writer.Write( image.channel[c].data(), sizeof( T )*image.channel[c].size() );
+      writer.Close();
+   }
+
+   const std::size_t budget = HAStreamingPipeline::WorkspaceBytesPerThread + 5*sizeof( T )*std::size_t( width )*( height/8 );
+   HARunSummary summary;
+   double start = Now();
+   {
+      HAImageReader reader( input );
+      HAImageWriter writer( output, width, height, 1, HASampleFormatOf<T>(), reader.Layout().keywords );
+      HAFileStripSource<T> source( reader );
+      HAFileStripSink<T> sink( writer );
+      summary = HAStreamingPipeline( params, budget ).Run( source, sink );
+      writer.Close();
+   }
+   const double seconds = Now() - start;
+
+   HAImage result = HAImageIO::Read( output );
+   fs::remove( input );
+   fs::remove( output );
+
+   const double unit = std::is_floating_point<T>::value ? 1.0 : double( std::numeric_limits<T>::max() );
+   double maxError = 0;
+   for ( std::size_t i = 0; i < reference.size(); ++i )
+      maxError = std::max( maxError, std::abs( double( result.Plane<T>( 0 )[i] ) - reference[i] )/unit );
+
+   const bool held = maxError <= StreamMaxError && summary.scratchFileBytes > 0 &&
+                     summary.stripRows < height;
+   context.boundsHeld &= held;
+   context.records.push_back( HABenchRecord().Add( "benchmark", "stream" ).Add( "type", typeName )
+                              .Add( "format", extension + 1 ).Add( "megapixels", width*double( height )/1e6 )
+                              .Add( "budget_mib", budget/1048576.0 ).Add( "strip_rows", double( summary.stripRows ) )
+                              .Add( "strips", std::ceil( height/double( summary.stripRows ) ) )
+                              .Add( "scratch_mib", summary.scratchFileBytes/1048576.0 )
+                              .Add( "working_mib", summary.workingBytes/1048576.0 )
+                              .Add( "max_error", maxError ).Add( "max_error_bound", StreamMaxError )
+                              .Add( "within_bound", held ).Add( "seconds", seconds ) );
+   HAThreadPool::Configure( 0 );
+}
+
+void BenchStream( HABenchContext& context )
+{
+   BenchStreamType<float>( context, "f32", ".fits" );
+   BenchStreamType<std::uint16_t>( context, "u16", ".xisf" );
+}
+
+/*
+ * The calibration HATuner runs when the module starts without a machine
+ * profile, timed as a whole, with the throughput of each candidate.
+ */
+void BenchTune( HABenchContext& context )
+{
+   std::vector<HATunerTrial> trials;
+   const double start = Now();
+   const HATuning tuning = HATuner::Calibrate( &trials );
+   const double seconds = Now() - start;
+
+   for ( const HATunerTrial& trial : trials )
+      context.records.push_back( HABenchRecord().Add( "benchmark", "tune" ).Add( "stage", trial.stage )
+                                 .Add( "candidate", trial.candidate ).Add( "mpix_per_s", trial.megapixelsPerSecond ) );
+   context.records.push_back( HABenchRecord().Add( "benchmark", "tune" ).Add( "stage", "result" )
+                              .Add( "machine", HATuner::MachineSignature() ).Add( "isa", tuning.isa )
+                              .Add( "tile_width", double( tuning.tileWidth ) )
+                              .Add( "tile_height", double( tuning.tileHeight ) )
+                              .Add( "threads", double( tuning.threads ) )
+                              .Add( "mpix_per_s", tuning.megapixelsPerSecond ).Add( "seconds", seconds ) );
+}
+
+template <typename V>
+std::vector<V> ParseList( const char* text )
+{
+   std::vector<V> values;
+   std::string item;
+   for ( const char* p = text; ; ++p )
+      if ( *p == ',' || *p == '\0' )
+      {
+         if ( !item.empty() )
+         {
+            if constexpr ( std::is_same<V, std::string>::value )
+               values.push_back( item );
+            else
+               values.push_back( V( std::atof( item.c_str() ) ) );
+         }
+         item.clear();
+         if ( *p == '\0' )
+            break;
+      }
+      else
+         item += *p;
+   return values;
+}
+
+// Applies --option=value arguments; returns false for unknown options
+bool ParseOption( HABenchOptions& options, const char* arg )
+{
+   auto value = [arg]( const char* name ) -> const char*
+   {
+      std::size_t n = std::strlen( name );
+      return ( std::strncmp( arg, name, n ) == 0 && arg[n] == '=' ) ? arg + n + 1 : nullptr;
+   };
+
+   if ( const char* v = value( "--sizes" ) )
+      options.sizes = ParseList<double>( v );
+   else if ( const char* v = value( "--types" ) )
+      options.types = ParseList<std::string>( v );
+   else if ( const char* v = value( "--methods" ) )
+      options.methods = ParseList<int>( v );
+   else if ( const char* v = value( "--stages" ) )
+      options.stages = ParseList<std::string>( v );
+   else if ( const char* v = value( "--threads" ) )
+      options.threads = ParseList<int>( v );
+   else if ( const char* v = value( "--repeat" ) )
+      options.repeat = std::max( 1, std::atoi( v ) );
+   else if ( const char* v = value( "--trace" ) )
+      options.tracePrefix = v;
+   else if ( std::strcmp( arg, "--staged" ) == 0 )
+      options.staged = true;
+   else if ( std::strcmp( arg, "--profile" ) == 0 )
+      options.profile = true;
+   else
+      return false;
+   return true;
+}
+
+} // namespace
+
+} // pcl
+
+int main( int argc, char** argv )
+{
+   using namespace pcl;
+
+   struct Section { const char* name; void (*run)( HABenchContext& ); };
+   const Section sections[] = {
+      { "sigmoid", BenchSigmoid },
+      { "pipeline", BenchPipeline },
+      { "quality", BenchQuality },
+      { "enhance", BenchEnhance },
+      { "stencil", BenchStencil },
+      { "lut", BenchLUT },
+      { "mlp", BenchMLP },
+      { "tune", BenchTune },
+      { "stream", BenchStream }
+   };
+
+   HABenchContext context;
+   std::vector<std::string> selected;
+   for ( int i = 1; i < argc; ++i )
+      if ( std::strncmp( argv[i], "--", 2 ) != 0 )
+         selected.push_back( argv[i] );
+      else if ( !ParseOption( context.options, argv[i] ) )
+      {
+         std::fprintf( stderr, "Unknown option: %s\n", argv[i] );
+         return 2;
+      }
+
+   const int hardwareThreads = std::max( 1, int( std::thread::hardware_concurrency() ) );
+   if ( context.options.threads.empty() )
+   {
+      for ( int n = 1; n < hardwareThreads; n *= 2 )
+         context.options.threads.push_back( n );
+      context.options.threads.push_back( hardwareThreads );
+   }
+
+   for ( const std::string& name : selected )
+      if ( std::none_of( std::begin( sections ), std::end( sections ),
+                         [&]( const Section& section ) { return name == section.name; } ) )
+      {
+         std::fprintf( stderr, "Unknown section: %s\n", name.c_str() );
+         return 2;
+      }
+
+   for ( const Section& section : sections )
+      if ( selected.empty() || std::find( selected.begin(), selected.end(), section.name ) != selected.end() )
+         section.run( context );
+
+   std::printf( "{\n  \"isa\": \"%s\",\n  \"hardware_threads\": %d,\n  \"peak_rss_mib\": %.6g,\n  \"results\": [\n",
+                HAActiveConversionKernels().isa, hardwareThreads, PeakRSSMiB() );
+   for ( std::size_t i = 0; i < context.records.size(); ++i )
+      std::printf( "    %s%s\n", context.records[i].ToString().c_str(), ( i + 1 < context.records.size() ) ? "," : "" );
+   std::printf( "  ]\n}\n" );
+
+   return context.boundsHeld ? 0 : 1;
+}
@@ -0,0 +1,246 @@
+/*
+ * RGB to HA Conversion Bilateral Grid for PixInsight
+ * Bilateral noise reduction at a cost independent of the spatial sigma
+ */
+
+#ifndef __RGBToHABilateralGrid_h
+#define __RGBToHABilateralGrid_h
+
+#include "RGBToHAKernels.h"
+
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+namespace pcl
+{
+
+/*
+ * Bilateral grid (Chen, Paris & Durand 2007). Every pixel is splatted with
+ * trilinear weights into a coarse (x, y, value) grid holding weighted sums
+ * and weights, the grid is blurred with a separable binomial kernel, and the
+ * result is sliced back out by trilinear interpolation. Cell sizes scale with
+ * the sigmas, so the work per pixel is a constant 8-cell splat and slice plus
+ * a blur over a grid that only shrinks as sigmaSpace grows. No transcendental
+ * functions are evaluated.
+ *
+ * Trilinear splat and slice each add 1/6 cell^2 of variance; the cell size is
+ * chosen so that together with the blur they give the requested sigmas.
+ *
+ * The grid lattice is anchored at image coordinate 0 and value 0, so filtering
+ * a rect only depends on the pixels within Halo() of it: tiles filtered
+ * independently produce the same result as one full-frame pass.
+ */
+class HABilateralGrid
+{
+public:
+
+   // Per-thread grid storage, reused between calls
+   struct Workspace
+   {
+      std::vector<float> grid, temp, zeros;
+
+      std::size_t Bytes() const
+      {
+         return sizeof( float )*( grid.capacity() + temp.capacity() + zeros.capacity() );
+      }
+   };
+
+   // taps is the binomial blur length per grid axis, 3 or 5
+   HABilateralGrid( double sigmaSpace, double sigmaColor, int taps = 5 )
+   {
+      m_blurRadius = ( taps <= 3 ) ? 1 : 2;
+      double blurVariance = ( m_blurRadius == 1 ) ? 0.5 : 1.0;
+      double cellSigma = std::sqrt( blurVariance + 1.0/3 );
+      m_cellSpace = sigmaSpace/cellSigma;
+      m_cellColor = sigmaColor/cellSigma;
+
+      if ( m_blurRadius == 1 )
+      {
+         m_taps[0] = 0.5f;
+         m_taps[1] = 0.25f;
+      }
+      else
+      {
+         m_taps[0] = 6.0f/16;
+         m_taps[1] = 4.0f/16;
+         m_taps[2] = 1.0f/16;
+      }
+   }
+
+   // Standard deviation of a Gaussian of the given sigma truncated to a
+   // (2*radius + 1)-tap window, per axis
+   static double TruncatedSigma( double sigma, int radius )
+   {
+      double sum = 0, sum2 = 0;
+      for ( int d = -radius; d <= radius; ++d )
+      {
+         double w = std::exp( -d*d/( 2*sigma*sigma ) );
+         sum += w;
+         sum2 += w*d*d;
+      }
+      return std::sqrt( sum2/sum );
+   }
+
+   // Input pixels needed on every side of the filtered rect
+   int Halo() const
+   {
+      return int( std::ceil( ( m_blurRadius + 2 )*m_cellSpace ) );
+   }
+
+   // Filters rect of src into dst, blended with the unfiltered value like
+   // HAKernels::ApplyNoiseReduction. src must cover rect inflated by Halo(),
+   // clipped to the width x height image.
+   void Apply( const HAView<const float>& src, const HAView<float>& dst, const HARect& rect,
+               int width, int height, float amount, Workspace& ws ) const
+   {
+      const HARect region = rect.Inflated( Halo(), HARect( 0, 0, width, height ) );
+      const float sx = float( 1/m_cellSpace );
+      const float sz = float( 1/m_cellColor );
+
+      // Grid extent: every cell the region splats into, plus blur padding on
+      // the value axis so the z blur needs no bounds checks
+      const int ox = int( region.x0*sx );
+      const int oy = int( region.y0*sx );
+      const int nx = int( ( region.x1 - 1 )*sx ) - ox + 2;
+      const int ny = int( ( region.y1 - 1 )*sx ) - oy + 2;
+      const int zPad = 2; // room for the widest blur on the value axis
+      const float t0 = m_taps[0], t1 = m_taps[1], t2 = m_taps[2];
+      const int nz = int( sz ) + 2 + 2*zPad;
+      const std::size_t cells = std::size_t( nx )*ny*nz;
+
+      ws.grid.assign( 2*cells, 0.0f );
+      ws.temp.resize( 2*cells );
+      ws.zeros.assign( 2*std::size_t( nx )*nz, 0.0f );
+      float* grid = ws.grid.data();
+      const std::size_t rowStride = std::size_t( 2 )*nx*nz;
+      const std::size_t colStride = std::size_t( 2 )*nz;
+
+      // Splat (value*weight, weight) pairs
+      for ( int y = region.y0; y < region.y1; ++y )
+      {
+         float fy = y*sx;
+         int iy = int( fy );
+         float ty = fy - iy;
+         for ( int x = region.x0; x < region.x1; ++x )
+         {
+            float v = src( x, y );
+            float fx = x*sx;
+            int ix = int( fx );
+            float tx = fx - ix;
+            float fz = HAKernels::Clamp01( v )*sz;
+            int iz = int( fz );
+            float tz = fz - iz;
+
+            float* c = grid + ( iy - oy )*rowStride + ( ix - ox )*colStride + 2*( iz + zPad );
+            float wy[2] = { 1 - ty, ty }, wx[2] = { 1 - tx, tx }, wz[2] = { 1 - tz, tz };
+            for ( int j = 0; j < 2; ++j )
+               for ( int i = 0; i < 2; ++i )
+               {
+                  float* p = c + j*rowStride + i*colStride;
+                  float wyx = wy[j]*wx[i];
+                  for ( int k = 0; k < 2; ++k )
+                  {
+                     float w = wyx*wz[k];
+                     p[2*k] += v*w;
+                     p[2*k+1] += w;
+                  }
+               }
+         }
+      }
+
+      // Separable blur: y and x across whole contiguous cell lines, then z
+      Blur( grid, ws.temp.data(), ny, rowStride, 1, rowStride, ws.zeros.data() );
+      Blur( ws.temp.data(), grid, nx, rowStride, ny, colStride, ws.zeros.data() );
+      for ( std::size_t line = 0, lines = std::size_t( nx )*ny; line < lines; ++line )
+      {
+         const float* in = grid + line*colStride;
+         float* out = ws.temp.data() + line*colStride;
+         for ( int z = 0; z < 2*zPad; ++z )
+            out[z] = out[colStride - 1 - z] = 0;
+         for ( int z = 2*zPad; z < int( colStride ) - 2*zPad; ++z )
+            out[z] = t0*in[z] + t1*( in[z - 2] + in[z + 2] ) + t2*( in[z - 4] + in[z + 4] );
+      }
+      grid = ws.temp.data();
+
+      // Slice, normalize and blend
+      for ( int y = rect.y0; y < rect.y1; ++y )
+      {
+         float fy = y*sx;
+         int iy = int( fy );
+         float ty = fy - iy;
+         for ( int x = rect.x0; x < rect.x1; ++x )
+         {
+            float v = src( x, y );
+            float fx = x*sx;
+            int ix = int( fx );
+            float tx = fx - ix;
+            float fz = HAKernels::Clamp01( v )*sz;
+            int iz = int( fz );
+            float tz = fz - iz;
+
+            const float* c = grid + ( iy - oy )*rowStride + ( ix - ox )*colStride + 2*( iz + zPad );
+            float wy[2] = { 1 - ty, ty }, wx[2] = { 1 - tx, tx }, wz[2] = { 1 - tz, tz };
+            float sum = 0, weight = 0;
+            for ( int j = 0; j < 2; ++j )
+               for ( int i = 0; i < 2; ++i )
+               {
+                  const float* p = c + j*rowStride + i*colStride;
+                  float wyx = wy[j]*wx[i];
+                  for ( int k = 0; k < 2; ++k )
+                  {
+                     float w = wyx*wz[k];
+                     sum += w*p[2*k];
+                     weight += w*p[2*k+1];
+                  }
+               }
+
+            float filtered = ( weight > 0 ) ? sum/weight : v;
+            dst( x, y ) = v*( 1 - amount ) + filtered*amount;
+         }
+      }
+   }
+
+private:
+
+   // Blurs count consecutive cells along one spatial axis, for each of outer
+   // blocks: in[block*blockStride + c*cellStride + z] for c in [0,count), with
+   // zero padding. Each cell is a contiguous run of cellStride floats.
+   void Blur( const float* in, float* out, int count, std::size_t blockStride, int outer,
+              std::size_t cellStride, const float* zeros ) const
+   {
+      const float t0 = m_taps[0], t1 = m_taps[1], t2 = m_taps[2];
+      for ( int block = 0; block < outer; ++block )
+      {
+         const float* src = in + block*blockStride;
+         float* dst = out + block*blockStride;
+         auto cell = [&]( int c ) { return ( c >= 0 && c < count ) ? src + c*cellStride : zeros; };
+         for ( int c = 0; c < count; ++c )
+         {
+            const float* m1 = cell( c - 1 );
+            const float* p0 = src + c*cellStride;
+            const float* p1 = cell( c + 1 );
+            float* o = dst + c*cellStride;
+            if ( m_blurRadius == 1 )
+               for ( std::size_t z = 0; z < cellStride; ++z )
+                  o[z] = t0*p0[z] + t1*( m1[z] + p1[z] );
+            else
+            {
+               const float* m2 = cell( c - 2 );
+               const float* p2 = cell( c + 2 );
+               for ( std::size_t z = 0; z < cellStride; ++z )
+                  o[z] = t0*p0[z] + t1*( m1[z] + p1[z] ) + t2*( m2[z] + p2[z] );
+            }
+         }
+      }
+   }
+
+   double m_cellSpace;
+   double m_cellColor;
+   int    m_blurRadius;
+   float  m_taps[3] = {};
+};
+
+} // pcl
+
+#endif   // __RGBToHABilateralGrid_h
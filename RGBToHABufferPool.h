@@ -0,0 +1,408 @@
+/*
+ * RGB to HA Conversion Buffer Pool for PixInsight
+ * Recycled page-backed buffers for full-frame intermediate planes
+ */
+
+#ifndef __RGBToHABufferPool_h
+#define __RGBToHABufferPool_h
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#ifdef __APPLE__
+#include <mach/mach.h>
+#include <sys/sysctl.h>
+#endif
+#endif
+
+namespace pcl
+{
+
+/*
+ * Module-wide pool of page-backed blocks for full-frame planes. Freshly
+ * mapped memory costs a page fault and a zeroing per page on first touch,
+ * which for a batch of large frames is gigabytes per frame; released blocks
+ * are kept instead, already faulted in, and handed to the next request of
+ * their size class, in this run or a later one.
+ *
+ * Size classes are four per power of two (1, 1.25, 1.5 and 1.75 times 2^k
+ * pages), so a recycled block is at most 25% larger than asked for. Blocks of
+ * HugePageBytes or more are aligned to and rounded up to that size and, on
+ * Linux, advised for transparent huge pages.
+ *
+ * Idle blocks are bounded by Capacity(), the least recently released going
+ * first, and are all unmapped when the system runs low on physical memory
+ * (less than PressureFraction of it available), checked whenever a block
+ * is released, or when a new mapping fails. The pool is disabled, every
+ * block unmapped on release, until a capacity is set.
+ */
+class HABufferPool
+{
+public:
+
+   static constexpr std::size_t HugePageBytes = std::size_t( 2 ) << 20;
+   static constexpr double PressureFraction = 0.1;
+
+   // Reuse counters since the pool was created
+   struct Statistics
+   {
+      std::uint64_t requests = 0;       // blocks acquired
+      std::uint64_t hits = 0;           // of them recycled
+      std::uint64_t bytesReused = 0;    // recycled instead of mapped afresh
+      std::uint64_t bytesMapped = 0;    // mapped afresh
+      std::size_t   liveBytes = 0;      // in use
+      std::size_t   idleBytes = 0;      // held for reuse
+      std::size_t   pressureReleases = 0;
+
+      double HitRate() const
+      {
+         return ( requests > 0 ) ? double( hits )/requests : 0.0;
+      }
+   };
+
+   explicit HABufferPool( std::size_t capacity = 0 ) :
+      m_capacity( capacity )
+   {
+   }
+
+   ~HABufferPool()
+   {
+      for ( const Block& b : m_idle )
+         Unmap( b );
+   }
+
+   HABufferPool( const HABufferPool& ) = delete;
+   HABufferPool& operator =( const HABufferPool& ) = delete;
+
+   static HABufferPool& Instance()
+   {
+      static HABufferPool pool;
+      return pool;
+   }
+
+   std::size_t Capacity() const
+   {
+      std::lock_guard<std::mutex> lock( m_mutex );
+      return m_capacity;
+   }
+
+   // Unmaps least recently released blocks to fit; 0 empties and disables
+   void SetCapacity( std::size_t bytes )
+   {
+      std::lock_guard<std::mutex> lock( m_mutex );
+      m_capacity = bytes;
+      Evict( 0 );
+   }
+
+   // Unmaps least recently released blocks until at most idleBytes are
+   // idle; by default, every idle block
+   void Trim( std::size_t idleBytes = 0 )
+   {
+      std::lock_guard<std::mutex> lock( m_mutex );
+      if ( idleBytes < m_capacity )
+         Evict( m_capacity - idleBytes );
+   }
+
+   Statistics Stats() const
+   {
+      std::lock_guard<std::mutex> lock( m_mutex );
+      Statistics s = m_stats;
+      s.idleBytes = m_idleBytes;
+      return s;
+   }
+
+   // Bytes of the block serving a request of bytes
+   static std::size_t ClassBytes( std::size_t bytes )
+   {
+      const std::size_t unit = ( bytes >= HugePageBytes ) ? HugePageBytes : PageBytes();
+      std::size_t units = std::max<std::size_t>( 1, ( bytes + unit - 1 )/unit );
+
+      // Rounded up to a multiple of 2^shift, 4 to 8 of them
+      int shift = 0;
+      while ( ( units - 1 ) >> ( shift + 3 ) != 0 )
+         ++shift;
+      units = ( ( units + ( std::size_t( 1 ) << shift ) - 1 ) >> shift ) << shift;
+      return units*unit;
+   }
+
+   // A block of at least bytes, recycled if one of its class is idle. The
+   // contents are undefined. Throws std::bad_alloc.
+   void* Acquire( std::size_t bytes, std::size_t& blockBytes )
+   {
+      blockBytes = ClassBytes( bytes );
+      {
+         std::lock_guard<std::mutex> lock( m_mutex );
+         ++m_stats.requests;
+         for ( std::size_t i = m_idle.size(); i-- > 0; )
+            if ( m_idle[i].bytes == blockBytes )
+            {
+               void* data = m_idle[i].data;
+               m_idle.erase( m_idle.begin() + i );
+               m_idleBytes -= blockBytes;
+               ++m_stats.hits;
+               m_stats.bytesReused += blockBytes;
+               m_stats.liveBytes += blockBytes;
+               return data;
+            }
+      }
+
+      void* data = Map( blockBytes );
+      if ( data == nullptr )
+      {
+         Trim();
+         data = Map( blockBytes );
+         if ( data == nullptr )
+            throw std::bad_alloc();
+      }
+      std::lock_guard<std::mutex> lock( m_mutex );
+      m_stats.bytesMapped += blockBytes;
+      m_stats.liveBytes += blockBytes;
+      return data;
+   }
+
+   // Returns a block from Acquire() for reuse
+   void Release( void* data, std::size_t blockBytes )
+   {
+      const bool pressure = Capacity() > 0 && MemoryPressure();
+      std::lock_guard<std::mutex> lock( m_mutex );
+      m_stats.liveBytes -= blockBytes;
+      if ( pressure && !m_idle.empty() )
+      {
+         ++m_stats.pressureReleases;
+         Evict( m_idleBytes );
+      }
+      if ( pressure || blockBytes > m_capacity )
+      {
+         Unmap( Block{ data, blockBytes } );
+         return;
+      }
+      Evict( blockBytes );
+      m_idle.push_back( Block{ data, blockBytes } );
+      m_idleBytes += blockBytes;
+   }
+
+   // True if less than PressureFraction of physical memory is available
+   static bool MemoryPressure()
+   {
+      std::uint64_t total = 0, available = 0;
+      if ( !PhysicalMemory( total, available ) || total == 0 )
+         return false;
+      return available < PressureFraction*double( total );
+   }
+
+   // Total and available physical memory, if the system reports them
+   static bool PhysicalMemory( std::uint64_t& total, std::uint64_t& available )
+   {
+#ifdef _WIN32
+      MEMORYSTATUSEX status;
+      status.dwLength = sizeof( status );
+      if ( !GlobalMemoryStatusEx( &status ) )
+         return false;
+      total = status.ullTotalPhys;
+      available = status.ullAvailPhys;
+      return true;
+#elif defined( __APPLE__ )
+      std::uint64_t memsize = 0;
+      std::size_t length = sizeof( memsize );
+      if ( sysctlbyname( "hw.memsize", &memsize, &length, nullptr, 0 ) != 0 )
+         return false;
+      vm_statistics64_data_t vm;
+      mach_msg_type_number_t count = HOST_VM_INFO64_COUNT;
+      if ( host_statistics64( mach_host_self(), HOST_VM_INFO64, host_info64_t( &vm ), &count ) != KERN_SUCCESS )
+         return false;
+      total = memsize;
+      available = std::uint64_t( vm.free_count + vm.inactive_count + vm.purgeable_count )*PageBytes();
+      return true;
+#else
+      std::FILE* f = std::fopen( "/proc/meminfo", "r" );
+      if ( f == nullptr )
+         return false;
+      char line[128];
+      unsigned long long kib;
+      int found = 0;
+      while ( found < 2 && std::fgets( line, sizeof( line ), f ) != nullptr )
+         if ( std::sscanf( line, "MemTotal: %llu kB", &kib ) == 1 )
+         {
+            total = std::uint64_t( kib ) << 10;
+            ++found;
+         }
+         else if ( std::sscanf( line, "MemAvailable: %llu kB", &kib ) == 1 )
+         {
+            available = std::uint64_t( kib ) << 10;
+            ++found;
+         }
+      std::fclose( f );
+      return found == 2;
+#endif
+   }
+
+private:
+
+   struct Block
+   {
+      void*       data;
+      std::size_t bytes;
+   };
+
+   std::vector<Block> m_idle; // least recently released first
+   std::size_t        m_idleBytes = 0;
+   std::size_t        m_capacity;
+   Statistics         m_stats;
+   mutable std::mutex m_mutex;
+
+   // Unmaps from the front until bytes more fit
+   void Evict( std::size_t bytes )
+   {
+      std::size_t n = 0;
+      while ( n < m_idle.size() && m_idleBytes + bytes > m_capacity )
+      {
+         Unmap( m_idle[n] );
+         m_idleBytes -= m_idle[n].bytes;
+         ++n;
+      }
+      m_idle.erase( m_idle.begin(), m_idle.begin() + n );
+   }
+
+   static std::size_t PageBytes()
+   {
+#ifdef _WIN32
+      SYSTEM_INFO info;
+      GetSystemInfo( &info );
+      return info.dwPageSize;
+#else
+      return std::size_t( sysconf( _SC_PAGESIZE ) );
+#endif
+   }
+
+   // Zeroed pages, or nullptr
+   static void* Map( std::size_t bytes )
+   {
+#ifdef _WIN32
+      return VirtualAlloc( nullptr, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE );
+#else
+      if ( bytes < HugePageBytes )
+      {
+         void* p = mmap( nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+         return ( p == MAP_FAILED ) ? nullptr : p;
+      }
+
+      // Over-map by one huge page and trim to an aligned range
+      void* p = mmap( nullptr, bytes + HugePageBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+      if ( p == MAP_FAILED )
+         return nullptr;
+      std::uint8_t* base = static_cast<std::uint8_t*>( p );
+      std::uint8_t* aligned = reinterpret_cast<std::uint8_t*>(
+         ( reinterpret_cast<std::uintptr_t>( base ) + HugePageBytes - 1 ) & ~std::uintptr_t( HugePageBytes - 1 ) );
+      if ( aligned > base )
+         munmap( base, aligned - base );
+      munmap( aligned + bytes, base + HugePageBytes - aligned );
+#ifdef MADV_HUGEPAGE
+      madvise( aligned, bytes, MADV_HUGEPAGE );
+#endif
+      return aligned;
+#endif
+   }
+
+   static void Unmap( const Block& b )
+   {
+#ifdef _WIN32
+      VirtualFree( b.data, 0, MEM_RELEASE );
+#else
+      munmap( b.data, b.bytes );
+#endif
+   }
+};
+
+/*
+ * Array of n trivially copyable T in a block of HABufferPool::Instance(),
+ * returned to the pool when destroyed. Move-only; the contents of a new
+ * buffer are undefined.
+ */
+template <typename T>
+class HABuffer
+{
+public:
+
+   HABuffer() = default;
+
+   explicit HABuffer( std::size_t n ) :
+      m_size( n )
+   {
+      if ( n > 0 )
+         m_data = static_cast<T*>( HABufferPool::Instance().Acquire( n*sizeof( T ), m_blockBytes ) );
+   }
+
+   ~HABuffer()
+   {
+      if ( m_data != nullptr )
+         HABufferPool::Instance().Release( m_data, m_blockBytes );
+   }
+
+   HABuffer( HABuffer&& x ) noexcept :
+      m_data( x.m_data ), m_size( x.m_size ), m_blockBytes( x.m_blockBytes )
+   {
+      x.m_data = nullptr;
+      x.m_size = x.m_blockBytes = 0;
+   }
+
+   HABuffer& operator =( HABuffer&& x ) noexcept
+   {
+      swap( x );
+      return *this;
+   }
+
+   HABuffer( const HABuffer& ) = delete;
+   HABuffer& operator =( const HABuffer& ) = delete;
+
+   void swap( HABuffer& x ) noexcept
+   {
+      std::swap( m_data, x.m_data );
+      std::swap( m_size, x.m_size );
+      std::swap( m_blockBytes, x.m_blockBytes );
+   }
+
+   T* data()
+   {
+      return m_data;
+   }
+
+   const T* data() const
+   {
+      return m_data;
+   }
+
+   std::size_t size() const
+   {
+      return m_size;
+   }
+
+   // Bytes of the underlying block
+   std::size_t Bytes() const
+   {
+      return m_blockBytes;
+   }
+
+private:
+
+   T*          m_data = nullptr;
+   std::size_t m_size = 0;
+   std::size_t m_blockBytes = 0;
+};
+
+} // pcl
+
+#endif   // __RGBToHABufferPool_h
@@ -0,0 +1,759 @@
+/*
+ * RGB to HA Conversion Command-Line Tool
+ * Headless batch conversion of FITS and XISF frames
+ *
+ * Built as the rgbtoha target from the same engine as the module; needs
+ * neither Qt nor the PixInsight runtime.
+ *
+ *    rgbtoha [option ...] input ...
+ *
+ * Inputs are files, directories (every .fit, .fits, .fts and .xisf file in
+ * them, outputs of a previous run excluded) and @LIST files naming one input
+ * per line. Each RGB frame is written as a single-channel HA frame in the
+ * same sample format, with the source FITS keywords and a HISTORY record.
+ *
+ * Options:
+ *    -o DIR, --output=DIR  output directory (default: next to each input)
+ *    --suffix=TEXT         appended to output file names (default _ha)
+ *    --format=fits|xisf    output format (default: that of each input)
+ *    --overwrite           replace existing outputs instead of skipping them
+ *    --method=0..3         Standard, Advanced Spectral, Adaptive Multi-Scale,
+ *                          Neural Approximation (default 0)
+ *    --enhancement=X       enhancement strength, 0 to 1 (default 0.5)
+ *    --radius=N            local contrast radius, 1 to 64, or 0 (the default)
+ *                          for the four direct neighbours
+ *    --noise=X             noise reduction, 0 to 1 (default 0.3)
+ *    --contrast=X          contrast boost, 0 to 1 (default 0.4)
+ *    --wavelength=NM       HA wavelength (default 656.28)
+ *    --no-adaptive         disable adaptive processing
+ *    --quality=fast|quality|ultra
+ *    --model=FILE          Neural Approximation runs the trained network in
+ *                          FILE (HAMLPModel weight file) instead of its
+ *                          built-in weights
+ *    --lut=N               convert a --model network through an N^3 lookup
+ *                          table (2 to 129, 0 = exact); its error against the
+ *                          exact network is printed before the first frame.
+ *                          Ignored for the other methods (HALUTPays)
+ *    --threads=N           worker threads (default: from the machine profile,
+ *                          else one per hardware thread), within the
+ *                          preferences' cap
+ *    --frames=N            frames converted concurrently (default: enough to
+ *                          keep every thread busy, from the first frame size)
+ *    --pool=MIB            idle frame and plane buffers kept for reuse by
+ *                          later frames (HABufferPool; default 1024, 0 =
+ *                          disabled)
+ *    --budget=MIB          memory for the frames in flight (default: the
+ *                          preferences' budget; the tighter of the two
+ *                          applies, 0 = no limit). A frame whose decoded
+ *                          image, result and working memory exceed it is
+ *                          converted straight from its file to the output
+ *                          file a strip at a time (HAStreamingPipeline),
+ *                          alone; Ultra cannot stream and fails instead
+ *    --scratch=DIR         where a streamed frame with contrast boost spills
+ *                          its unstretched result when that does not fit the
+ *                          budget (default: the system temporary directory)
+ *
+ * Decoding, conversion and encoding overlap: a reader thread decodes frames
+ * into a bounded queue, frame workers on the engine thread pool convert
+ * them, and a writer thread encodes the results from a second bounded queue.
+ * At most about three times --frames frames are held in memory, and under a
+ * memory budget only as many as fit it: the reader decodes a frame once the
+ * frames not yet written leave room for it (HAMemoryLedger), and idle pool
+ * buffers are trimmed to what the frames leave of the budget.
+ *
+ * The machine profile written by the module (HATuner) supplies the
+ * conversion kernels, tile size and thread count when it exists; the tool
+ * never calibrates itself. The module preferences (HAPreferences) apply
+ * too: the thread cap, CPU set and worker priority, and the memory budget
+ * as a cap on --budget and --pool.
+ *
+ * The exit code is 1 if any frame failed and 2 for invalid arguments.
+ */
+
+#include "RGBToHAEngine.h"
+#include "RGBToHAImageIO.h"
+#include "RGBToHAPreferences.h"
+#include "RGBToHATuner.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace pcl
+{
+
+namespace
+{
+
+/*
+ * Fixed-capacity FIFO between pipeline stages. Push() blocks while the
+ * queue is full, Pop() while it is empty; once Close() has been called,
+ * Pop() drains what is left and then returns nothing.
+ */
+template <typename T>
+class HABoundedQueue
+{
+public:
+
+   explicit HABoundedQueue( std::size_t capacity ) :
+      m_capacity( std::max( std::size_t( 1 ), capacity ) )
+   {
+   }
+
+   void Push( T item )
+   {
+      std::unique_lock<std::mutex> lock( m_mutex );
+      m_notFull.wait( lock, [this]() { return m_items.size() < m_capacity; } );
+      m_items.push_back( std::move( item ) );
+      m_notEmpty.notify_one();
+   }
+
+   std::optional<T> Pop()
+   {
+      std::unique_lock<std::mutex> lock( m_mutex );
+      m_notEmpty.wait( lock, [this]() { return !m_items.empty() || m_closed; } );
+      if ( m_items.empty() )
+         return std::nullopt;
+      T item = std::move( m_items.front() );
+      m_items.pop_front();
+      m_notFull.notify_one();
+      return item;
+   }
+
+   // No more items will be pushed
+   void Close()
+   {
+      std::lock_guard<std::mutex> lock( m_mutex );
+      m_closed = true;
+      m_notEmpty.notify_all();
+   }
+
+private:
+
+   std::deque<T>           m_items;
+   std::size_t             m_capacity;
+   bool                    m_closed = false;
+   std::mutex              m_mutex;
+   std::condition_variable m_notEmpty;
+   std::condition_variable m_notFull;
+};
+
+struct HACLIOptions
+{
+   HAParameters params;
+   std::vector<std::string> inputs;
+   std::string outputDir;
+   std::string suffix = "_ha";
+   std::string format;  // fits, xisf or empty for that of the input
+   bool overwrite = false;
+   int threads = 0;
+   int frames = 0;      // 0 = automatic
+   int poolMiB = 1024;  // HABufferPool capacity
+   int budgetMiB = 0;   // --budget, 0 = none
+   std::size_t budget = 0; // bytes, the tighter of --budget and the preferences' budget; 0 = no limit
+   std::string scratchDir;
+};
+
+// One frame on its way through the pipeline
+struct HAFrame
+{
+   int index = 0;
+   std::string input;
+   std::string output;
+   int width = 0;
+   int height = 0;
+   int channels = 0;
+   HASampleFormat format = HASampleFormat::Float32;
+   HAImage image;       // decoded RGB frame, then the HA result
+   bool streamed = false; // over the budget: converted file to file, not decoded
+   std::size_t bytes = 0; // held in the HAMemoryLedger until written
+   std::string error;   // nonempty if a stage failed
+   bool skipped = false;
+   double megapixels = 0;
+   double seconds = 0;  // conversion time
+};
+
+double Now()
+{
+   return std::chrono::duration<double>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+bool IsFrameFile( const std::string& path )
+{
+   return HAImageIO::IsFITS( path ) || HAImageIO::IsXISF( path );
+}
+
+// Inputs in command-line order; directory contents sorted by name
+std::vector<std::string> ExpandInputs( const HACLIOptions& options )
+{
+   namespace fs = std::filesystem;
+   std::vector<std::string> files;
+   for ( const std::string& input : options.inputs )
+      if ( input.size() > 1 && input[0] == '@' )
+      {
+         std::ifstream list( input.substr( 1 ) );
+         if ( !list )
+            throw std::runtime_error( "Unable to open input list " + input.substr( 1 ) );
+         for ( std::string line; std::getline( list, line ); )
+         {
+            line.erase( line.find_last_not_of( " \t\r" ) + 1 );
+            if ( !line.empty() && line[0] != '#' )
+               files.push_back( line );
+         }
+      }
+      else if ( fs::is_directory( input ) )
+      {
+         std::vector<std::string> entries;
+         for ( const fs::directory_entry& entry : fs::directory_iterator( input ) )
+         {
+            std::string path = entry.path().string();
+            std::string stem = entry.path().stem().string();
+            bool converted = stem.size() >= options.suffix.size() && !options.suffix.empty() &&
+                             stem.compare( stem.size() - options.suffix.size(), options.suffix.size(), options.suffix ) == 0;
+            if ( entry.is_regular_file() && IsFrameFile( path ) && !converted )
+               entries.push_back( path );
+         }
+         std::sort( entries.begin(), entries.end() );
+         files.insert( files.end(), entries.begin(), entries.end() );
+      }
+      else
+         files.push_back( input );
+   return files;
+}
+
+std::string OutputPath( const HACLIOptions& options, const std::string& input )
+{
+   namespace fs = std::filesystem;
+   fs::path in( input );
+   fs::path dir = options.outputDir.empty() ? in.parent_path() : fs::path( options.outputDir );
+   std::string ext = options.format.empty() ? in.extension().string() : '.' + options.format;
+   return ( dir/( in.stem().string() + options.suffix + ext ) ).string();
+}
+
+std::string HistoryCard( const std::string& text )
+{
+   std::string card = "HISTORY " + text;
+   card.resize( 80, ' ' );
+   return card;
+}
+
+bool ModelInUse( const HAParameters& params )
+{
+   return params.conversionMethod == 3 && !params.neuralModelPath.empty();
+}
+
+bool LUTInUse( const HAParameters& params )
+{
+   return params.lutSize > 0 && params.conversionMethod != 2 && !HAQualityProfileFor( params.qualityMode ).staged;
+}
+
+// Converts a decoded RGB frame to a single-channel frame of the same format
+template <typename T>
+HAImage ConvertFrame( const HAImage& frame, const HAParameters& params )
+{
+   HASource<T> source;
+   source.width = frame.width;
+   source.height = frame.height;
+   for ( int c = 0; c < 3; ++c )
+      source.channel[c] = frame.Plane<T>( c );
+   source.stride = frame.width;
+
+   HAImage result;
+   result.Allocate( frame.width, frame.height, 1, frame.format );
+   const HAView<T> output( result.Plane<T>( 0 ), frame.width );
+
+   if ( HAQualityProfileFor( params.qualityMode ).staged )
+      HAStagedPipeline( params ).Run( source, output );
+   else
+      HAFusedPipeline( params ).Run( source, output );
+   return result;
+}
+
+// The HISTORY card recording the conversion settings
+std::string ConversionHistory( const HAParameters& params )
+{
+   static const char* methods[] = { "Standard", "Advanced Spectral", "Adaptive Multi-Scale", "Neural Approximation" };
+   char history[96];
+   std::snprintf( history, sizeof( history ), "RGBToHA %s, %s, E=%.2f N=%.2f C=%.2f",
+                  methods[std::max( 0, std::min( params.conversionMethod, 3 ) )],
+                  HAQualityProfileFor( params.qualityMode ).name,
+                  params.enhancementStrength, params.noiseReduction, params.contrastBoost );
+   std::string text = history;
+   if ( params.localContrastRadius != 0 )
+      text += " R=" + std::to_string( params.localContrastRadius );
+   if ( ModelInUse( params ) )
+      text += " MLP=" + HAMLPModel::Shared( params.neuralModelPath )->Shape();
+   if ( LUTInUse( params ) )
+      text += " LUT=" + std::to_string( params.lutSize );
+   return HistoryCard( text );
+}
+
+/*
+ * Memory held by frames from decoding until they are written, within a
+ * budget. Acquire() blocks until a frame's bytes fit beside those of the
+ * frames already held, or no frame is held; Release() returns them and
+ * trims the idle buffers of the HABufferPool to what is left of the budget.
+ * A capacity of 0 means no limit.
+ */
+class HAMemoryLedger
+{
+public:
+
+   explicit HAMemoryLedger( std::size_t capacity ) : m_capacity( capacity )
+   {
+   }
+
+   void Acquire( std::size_t bytes )
+   {
+      std::unique_lock<std::mutex> lock( m_mutex );
+      m_released.wait( lock, [&]() { return m_capacity == 0 || m_used == 0 || m_used + bytes <= m_capacity; } );
+      m_used += bytes;
+   }
+
+   void Release( std::size_t bytes )
+   {
+      std::size_t left;
+      {
+         std::lock_guard<std::mutex> lock( m_mutex );
+         m_used -= bytes;
+         left = ( m_used < m_capacity ) ? m_capacity - m_used : 0;
+         m_released.notify_all();
+      }
+      if ( m_capacity > 0 )
+         HABufferPool::Instance().Trim( left );
+   }
+
+private:
+
+   std::size_t             m_capacity;
+   std::size_t             m_used = 0;
+   std::mutex              m_mutex;
+   std::condition_variable m_released;
+};
+
+// Memory converting a frame in memory takes: the pool blocks of the decoded
+// frame and the result plane, and the pipeline's working memory
+std::size_t FrameBytes( const HAFrame& frame, const HAParameters& params )
+{
+   const std::size_t plane = HAImageIO::ImageBytes( frame.width, frame.height, 1, frame.format );
+   const std::size_t working = HAQualityProfileFor( params.qualityMode ).staged ?
+                               HAStagedPipeline( params ).WorkingBytes( frame.width, frame.height ) :
+                               HAStreamingPipeline::WorkspaceBytesPerThread*HANumberOfThreads();
+   return HABufferPool::ClassBytes( plane*frame.channels ) + HABufferPool::ClassBytes( plane ) + working;
+}
+
+// Converts a frame over the budget from its file to the output file, a
+// strip at a time
+template <typename T>
+void StreamFrame( HAImageReader& reader, HAImageWriter& writer, const HACLIOptions& options )
+{
+   HAFileStripSource<T> source( reader );
+   HAFileStripSink<T> sink( writer );
+   HAStreamingPipeline( options.params, options.budget, options.scratchDir ).Run( source, sink );
+}
+
+void Convert( HAFrame& frame, const HACLIOptions& options )
+{
+   if ( frame.channels < 3 )
+      throw std::runtime_error( "not an RGB frame (" + std::to_string( frame.channels ) + " channel)" );
+
+   if ( frame.streamed )
+   {
+      double start = Now();
+      HAImageReader reader( frame.input );
+      std::vector<std::string> keywords = reader.Layout().keywords;
+      keywords.push_back( ConversionHistory( options.params ) );
+      HAImageWriter writer( frame.output, frame.width, frame.height, 1, frame.format, keywords );
+      switch ( frame.format )
+      {
+      case HASampleFormat::UInt8:   StreamFrame<std::uint8_t>( reader, writer, options ); break;
+      case HASampleFormat::UInt16:  StreamFrame<std::uint16_t>( reader, writer, options ); break;
+      case HASampleFormat::UInt32:  StreamFrame<std::uint32_t>( reader, writer, options ); break;
+      case HASampleFormat::Float32: StreamFrame<float>( reader, writer, options ); break;
+      case HASampleFormat::Float64: StreamFrame<double>( reader, writer, options ); break;
+      }
+      writer.Close();
+      frame.seconds = Now() - start;
+      return;
+   }
+
+   const HAImage& image = frame.image;
+   const HAParameters& params = options.params;
+   double start = Now();
+   HAImage result;
+   switch ( image.format )
+   {
+   case HASampleFormat::UInt8:   result = ConvertFrame<std::uint8_t>( image, params ); break;
+   case HASampleFormat::UInt16:  result = ConvertFrame<std::uint16_t>( image, params ); break;
+   case HASampleFormat::UInt32:  result = ConvertFrame<std::uint32_t>( image, params ); break;
+   case HASampleFormat::Float32: result = ConvertFrame<float>( image, params ); break;
+   case HASampleFormat::Float64: result = ConvertFrame<double>( image, params ); break;
+   }
+   frame.seconds = Now() - start;
+
+   result.keywords = image.keywords;
+   result.keywords.push_back( ConversionHistory( params ) );
+   frame.image = std::move( result );
+}
+
+// Reads a frame once the ledger admits it; a frame over the budget is
+// admitted alone, with the whole budget, and left in its file
+HAFrame Decode( const HACLIOptions& options, int index, const std::string& input, HAMemoryLedger& ledger )
+{
+   HAFrame frame;
+   frame.index = index;
+   frame.input = input;
+   frame.output = OutputPath( options, input );
+   try
+   {
+      if ( !IsFrameFile( input ) )
+         throw std::runtime_error( "not a FITS or XISF file" );
+      if ( !options.overwrite && std::filesystem::exists( frame.output ) )
+      {
+         frame.skipped = true;
+         frame.error = "output exists, use --overwrite to replace it";
+         return frame;
+      }
+      HAImageReader reader( input );
+      const HAImageLayout& layout = reader.Layout();
+      frame.width = layout.width;
+      frame.height = layout.height;
+      frame.channels = layout.channels;
+      frame.format = layout.format;
+      frame.megapixels = frame.width*double( frame.height )/1e6;
+
+      const std::size_t budget = options.budget;
+      std::size_t bytes = FrameBytes( frame, options.params );
+      if ( budget > 0 && bytes > budget )
+      {
+         if ( HAQualityProfileFor( options.params.qualityMode ).staged )
+            throw std::runtime_error( "Ultra quality needs " + std::to_string( bytes >> 20 ) + " MiB for this frame, over the " +
+                                      std::to_string( budget >> 20 ) + " MiB budget; use Quality mode or raise --budget" );
+         frame.streamed = true;
+         bytes = budget;
+      }
+      ledger.Acquire( bytes );
+      frame.bytes = bytes;
+      if ( !frame.streamed )
+         frame.image = HAImageIO::Read( input );
+   }
+   catch ( const std::exception& e )
+   {
+      frame.error = e.what();
+   }
+   return frame;
+}
+
+/*
+ * Frames converted at once. One frame's tiles already keep every thread busy
+ * when there are a few times more tiles than threads; smaller frames are
+ * converted side by side until that many tiles are in flight.
+ */
+int AutoFrames( const HAFrame& frame, const HAParameters& params )
+{
+   const int threads = HANumberOfThreads();
+   HAFusedPipeline pipeline( params );
+   double tiles = std::ceil( frame.width/double( pipeline.TileWidth() ) )*
+                  std::ceil( frame.height/double( pipeline.TileHeight() ) );
+   return std::max( 1, std::min( threads, int( std::ceil( 4.0*threads/std::max( 1.0, tiles ) ) ) ) );
+}
+
+void PrintUsage()
+{
+   std::fprintf( stderr,
+      "Usage: rgbtoha [option ...] input ...\n"
+      "Inputs: FITS/XISF files, directories, @LIST files\n"
+      "Options: -o DIR | --output=DIR, --suffix=TEXT, --format=fits|xisf, --overwrite,\n"
+      "         --method=0..3, --enhancement=X, --radius=N, --noise=X, --contrast=X, --wavelength=NM,\n"
+      "         --no-adaptive, --quality=fast|quality|ultra, --model=FILE, --lut=N, --threads=N,\n"
+      "         --frames=N, --pool=MIB, --budget=MIB, --scratch=DIR\n" );
+}
+
+// Applies one option; returns false if it is unknown or invalid
+bool ParseOption( HACLIOptions& options, const char* arg )
+{
+   auto value = [arg]( const char* name ) -> const char*
+   {
+      std::size_t n = std::strlen( name );
+      return ( std::strncmp( arg, name, n ) == 0 && arg[n] == '=' ) ? arg + n + 1 : nullptr;
+   };
+   auto unit = []( const char* v ) { return std::max( 0.0, std::min( std::atof( v ), 1.0 ) ); };
+
+   if ( const char* v = value( "--output" ) )
+      options.outputDir = v;
+   else if ( const char* v = value( "--suffix" ) )
+      options.suffix = v;
+   else if ( const char* v = value( "--format" ) )
+   {
+      options.format = v;
+      if ( options.format != "fits" && options.format != "xisf" )
+         return false;
+   }
+   else if ( const char* v = value( "--method" ) )
+      options.params.conversionMethod = std::max( 0, std::min( std::atoi( v ), 3 ) );
+   else if ( const char* v = value( "--enhancement" ) )
+      options.params.enhancementStrength = unit( v );
+   else if ( const char* v = value( "--radius" ) )
+   {
+      options.params.localContrastRadius = std::atoi( v );
+      if ( options.params.localContrastRadius < 0 || options.params.localContrastRadius > HAKernels::LocalContrastMaxRadius )
+         return false;
+   }
+   else if ( const char* v = value( "--noise" ) )
+      options.params.noiseReduction = unit( v );
+   else if ( const char* v = value( "--contrast" ) )
+      options.params.contrastBoost = unit( v );
+   else if ( const char* v = value( "--wavelength" ) )
+      options.params.haWavelength = std::atof( v );
+   else if ( const char* v = value( "--quality" ) )
+   {
+      static const char* modes[] = { "fast", "quality", "ultra" };
+      auto mode = std::find_if( std::begin( modes ), std::end( modes ), [v]( const char* m ) { return std::strcmp( m, v ) == 0; } );
+      if ( mode == std::end( modes ) )
+         return false;
+      options.params.qualityMode = int( mode - std::begin( modes ) );
+   }
+   else if ( const char* v = value( "--model" ) )
+      options.params.neuralModelPath = v;
+   else if ( const char* v = value( "--lut" ) )
+   {
+      options.params.lutSize = std::atoi( v );
+      if ( options.params.lutSize != 0 &&
+           ( options.params.lutSize < HAColorLUT::MinSize || options.params.lutSize > HAColorLUT::MaxSize ) )
+         return false;
+   }
+   else if ( const char* v = value( "--threads" ) )
+      options.threads = std::max( 0, std::atoi( v ) );
+   else if ( const char* v = value( "--frames" ) )
+      options.frames = std::max( 0, std::atoi( v ) );
+   else if ( const char* v = value( "--pool" ) )
+      options.poolMiB = std::max( 0, std::atoi( v ) );
+   else if ( const char* v = value( "--budget" ) )
+      options.budgetMiB = std::max( 0, std::atoi( v ) );
+   else if ( const char* v = value( "--scratch" ) )
+      options.scratchDir = v;
+   else if ( std::strcmp( arg, "--no-adaptive" ) == 0 )
+      options.params.adaptiveProcessing = false;
+   else if ( std::strcmp( arg, "--overwrite" ) == 0 )
+      options.overwrite = true;
+   else
+      return false;
+   return true;
+}
+
+} // namespace
+
+} // pcl
+
+int main( int argc, char** argv )
+{
+   using namespace pcl;
+
+   HACLIOptions options;
+   for ( int i = 1; i < argc; ++i )
+      if ( std::strcmp( argv[i], "-h" ) == 0 || std::strcmp( argv[i], "--help" ) == 0 )
+      {
+         PrintUsage();
+         return 0;
+      }
+      else if ( std::strcmp( argv[i], "-o" ) == 0 && i + 1 < argc )
+         options.outputDir = argv[++i];
+      else if ( std::strncmp( argv[i], "--", 2 ) != 0 )
+         options.inputs.push_back( argv[i] );
+      else if ( !ParseOption( options, argv[i] ) )
+      {
+         std::fprintf( stderr, "Invalid option: %s\n", argv[i] );
+         PrintUsage();
+         return 2;
+      }
+
+   std::vector<std::string> files;
+   try
+   {
+      files = ExpandInputs( options );
+   }
+   catch ( const std::exception& e )
+   {
+      std::fprintf( stderr, "%s\n", e.what() );
+      return 2;
+   }
+   if ( files.empty() )
+   {
+      std::fprintf( stderr, "No input frames.\n" );
+      PrintUsage();
+      return 2;
+   }
+   if ( !options.outputDir.empty() )
+      std::filesystem::create_directories( options.outputDir );
+
+   HAPreferences prefs;
+   if ( HAPreferences::Load( prefs ) )
+      HAPreferences::Apply( prefs );
+   HATuning tuning;
+   if ( HATuner::Load( tuning ) )
+      HATuner::Apply( tuning );
+   if ( options.threads > 0 )
+      HAThreadPool::Configure( options.threads );
+   options.budget = prefs.BudgetBytes( std::size_t( options.budgetMiB ) << 20 );
+   std::size_t poolBytes = ( options.poolMiB > 0 ) ? prefs.BudgetBytes( std::size_t( options.poolMiB ) << 20 ) : 0;
+   if ( options.budget > 0 )
+      poolBytes = std::min( poolBytes, options.budget );
+   HABufferPool::Instance().SetCapacity( poolBytes );
+
+   // The model is loaded once and shared by every frame
+   if ( ModelInUse( options.params ) )
+      try
+      {
+         std::shared_ptr<const HAMLPModel> model = HAMLPModel::Shared( options.params.neuralModelPath );
+         model->RequireConversionShape();
+         std::printf( "Neural model: %s (%s, %zu parameters)\n", options.params.neuralModelPath.c_str(),
+                      model->Shape().c_str(), model->Parameters() );
+      }
+      catch ( const std::exception& e )
+      {
+         std::fprintf( stderr, "%s\n", e.what() );
+         return 2;
+      }
+
+   if ( options.params.lutSize > 0 && !HALUTPays( options.params ) )
+   {
+      std::fprintf( stderr, "--lut ignored: it is only faster than exact conversion for --method=3 with --model\n" );
+      options.params.lutSize = 0;
+   }
+
+   // The conversion LUT is built once and shared by every frame
+   if ( LUTInUse( options.params ) )
+   {
+      HAFusedPipeline pipeline( options.params );
+      const HAColorLUT* lut = pipeline.LUT();
+      std::printf( "Conversion LUT: %d^3 points, built in %.1f ms, error against the exact method: "
+                   "max %.2e, mean %.2e\n", lut->Size(), lut->BuildMilliseconds(), lut->MaxError(), lut->MeanError() );
+   }
+
+   const double start = Now();
+   const int total = int( files.size() );
+
+   // Frames held from decoding until written, within the budget
+   HAMemoryLedger ledger( options.budget );
+
+   // The first frame that decodes sizes the pipeline
+   std::vector<HAFrame> early;
+   int next = 0;
+   while ( next < total && ( early.empty() || !early.back().error.empty() ) )
+   {
+      early.push_back( Decode( options, next, files[next], ledger ) );
+      ++next;
+   }
+   int frames = ( options.frames > 0 ) ? std::min( options.frames, total ) :
+                early.back().error.empty() ? AutoFrames( early.back(), options.params ) : 1;
+   if ( options.budget > 0 && early.back().bytes > 0 )
+      frames = std::max( 1, std::min( frames, int( options.budget/early.back().bytes ) ) );
+
+   HABoundedQueue<HAFrame> decoded( frames );
+   HABoundedQueue<HAFrame> converted( frames );
+
+   // Writer: encodes results and reports each frame as it completes
+   int written = 0, failed = 0, skipped = 0, streamed = 0;
+   double megapixels = 0, convertSeconds = 0;
+   std::thread writer( [&]()
+   {
+      while ( std::optional<HAFrame> frame = converted.Pop() )
+      {
+         if ( frame->error.empty() && !frame->streamed )
+            try
+            {
+               HAImageIO::Write( frame->output, frame->image );
+            }
+            catch ( const std::exception& e )
+            {
+               frame->error = e.what();
+            }
+
+         if ( frame->skipped )
+         {
+            ++skipped;
+            std::printf( "[%d/%d] %s: skipped, %s\n", frame->index + 1, total, frame->input.c_str(), frame->error.c_str() );
+         }
+         else if ( !frame->error.empty() )
+         {
+            ++failed;
+            std::printf( "[%d/%d] %s: FAILED, %s\n", frame->index + 1, total, frame->input.c_str(), frame->error.c_str() );
+         }
+         else
+         {
+            ++written;
+            streamed += frame->streamed;
+            megapixels += frame->megapixels;
+            convertSeconds += frame->seconds;
+            std::printf( "[%d/%d] %s -> %s  %s %dx%d  %.3f s%s\n", frame->index + 1, total, frame->input.c_str(),
+                         frame->output.c_str(), HASampleFormatName( frame->format ), frame->width, frame->height,
+                         frame->seconds, frame->streamed ? ", streamed" : "" );
+         }
+         std::fflush( stdout );
+
+         const std::size_t bytes = frame->bytes;
+         frame.reset();
+         ledger.Release( bytes );
+      }
+   } );
+
+   // Reader: decodes ahead of the frame workers, up to the queue capacity
+   std::thread reader( [&]()
+   {
+      for ( HAFrame& frame : early )
+         decoded.Push( std::move( frame ) );
+      for ( int i = next; i < total; ++i )
+         decoded.Push( Decode( options, i, files[i], ledger ) );
+      decoded.Close();
+   } );
+
+   // Frame workers. Each runs its frame's tile loops on the same pool, so
+   // threads not held by a frame worker help with the tiles of all frames.
+   HAParallelFor( frames, [&]( int, int )
+   {
+      while ( std::optional<HAFrame> frame = decoded.Pop() )
+      {
+         if ( frame->error.empty() )
+            try
+            {
+               Convert( *frame, options );
+            }
+            catch ( const std::exception& e )
+            {
+               frame->error = e.what();
+            }
+         converted.Push( std::move( *frame ) );
+      }
+   } );
+
+   reader.join();
+   converted.Close();
+   writer.join();
+
+   const double seconds = Now() - start;
+   std::printf( "%d of %d frames converted (%d failed, %d skipped), %.1f MP in %.2f s: %.1f MP/s, "
+                "%.3f s per frame converting; frames in flight: %d, threads: %d, kernels: %s\n",
+                written, total, failed, skipped, megapixels, seconds, ( seconds > 0 ) ? megapixels/seconds : 0.0,
+                ( written > 0 ) ? convertSeconds/written : 0.0, frames, HANumberOfThreads(),
+                HAActiveConversionKernels().isa );
+   const HABufferPool::Statistics pool = HABufferPool::Instance().Stats();
+   std::printf( "Buffer pool: %.0f%% of %llu buffers recycled, %.1f MiB not mapped afresh\n",
+                100*pool.HitRate(), (unsigned long long)pool.requests, pool.bytesReused/1048576.0 );
+   if ( options.budget > 0 )
+      std::printf( "Memory budget: %.0f MiB, %d frames streamed\n", options.budget/1048576.0, streamed );
+
+   return ( failed > 0 ) ? 1 : 0;
+}
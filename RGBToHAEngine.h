@@ -0,0 +1,1297 @@
+/*
+ * RGB to HA Conversion Engine for PixInsight
+ * Fused tile pipeline and staged reference pipeline
+ */
+
+#ifndef __RGBToHAEngine_h
+#define __RGBToHAEngine_h
+
+#include "RGBToHABilateralGrid.h"
+#include "RGBToHABufferPool.h"
+#include "RGBToHAKernels.h"
+#include "RGBToHALUT.h"
+#include "RGBToHAMLP.h"
+#include "RGBToHAProfiler.h"
+#include "RGBToHAPyramid.h"
+#include "RGBToHASIMD.h"
+#include "RGBToHAStageGraph.h"
+#include "RGBToHAThreadPool.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace pcl
+{
+
+// Processing parameters, as set on the process instance
+struct HAParameters
+{
+   int conversionMethod = 0;         // 0=Standard, 1=Advanced, 2=Adaptive, 3=Neural
+   double enhancementStrength = 0.5; // 0.0 to 1.0
+   int localContrastRadius = 0;      // local contrast window (2r + 1)^2, up to HAKernels::LocalContrastMaxRadius; 0=4 neighbours
+   double noiseReduction = 0.3;      // 0.0 to 1.0
+   double contrastBoost = 0.4;       // 0.0 to 1.0
+   double haWavelength = 656.28;     // HA wavelength in nm
+   bool adaptiveProcessing = true;   // Enable adaptive processing
+   int qualityMode = 1;              // 0=Fast, 1=Quality, 2=Ultra
+   int lutSize = 0;                  // 0=exact, else 3D LUT points per axis (Fast and Quality, per-pixel methods)
+   std::string neuralModelPath;      // Neural Approximation: HAMLPModel weight file, empty for the built-in weights
+};
+
+// True if a conversion LUT (lutSize) is faster than the exact conversion:
+// only for a loaded neural model, about 2.2x for a 3-16-16-1 network. The
+// linear methods and the built-in network convert at least as fast as the
+// interpolation, so a table would only add error (rgbtoha_bench lut). The
+// module and rgbtoha ignore lutSize otherwise; the pipelines honour it.
+inline bool HALUTPays( const HAParameters& params )
+{
+   return params.conversionMethod == 3 && !params.neuralModelPath.empty();
+}
+
+/*
+ * Execution profile of a qualityMode: what each mode computes, and what it
+ * promises. Errors are measured against Ultra on the same input, over every
+ * conversion method with all post-processing stages enabled at their default
+ * strengths (rgbtoha_bench quality checks them). Speedups are single-thread
+ * throughput relative to Ultra on the same image, and are targets rather
+ * than guarantees: they depend on the CPU and on which stages are enabled.
+ *
+ * Fast     Quality with a 3-tap bilateral grid blur and the fast sigmoid
+ *          (HAFastSigmoidMaxError).
+ * Quality  float32 tile pipeline with exact transcendentals, bilateral grid
+ *          with a 5-tap blur.
+ * Ultra    double precision staged pipeline, brute-force 7x7 bilateral
+ *          filter. The reference for the other modes.
+ *
+ * So Fast is Quality plus the coarser blur, which makes the bilateral grid,
+ * most of the tile time, cheaper: about 1.3 times the throughput of Quality.
+ * Only Neural Approximation evaluates sigmoids; its built-in network
+ * saturates them, so the fast sigmoid changes its output only with a loaded
+ * model. Most of the Quality error is the bilateral grid approximation (see
+ * HAFusedPipeline) amplified by the contrast stretch; Fast adds the coarser
+ * blur, which on Adaptive Multi-Scale puts the odd star core 0.03 to 0.06
+ * off depending on where it falls on the grid, hence its wider max bound
+ * for a mean error still about 0.001. Every mode blends the same HAPyramid::Levels pyramid levels, so one
+ * pair of bounds holds for every method.
+ */
+struct HAQualityProfile
+{
+   const char* name;
+   bool   staged;            // double precision staged pipeline
+   bool   fastMath;          // approximate transcendentals
+   int    bilateralTaps;     // grid blur taps per axis (tile pipeline only)
+   double maxError;          // max |output - Ultra|, any method
+   double meanError;         // mean |output - Ultra|, any method
+   double minSpeedup;        // throughput target relative to Ultra
+};
+
+inline const HAQualityProfile& HAQualityProfileFor( int qualityMode )
+{
+   static const HAQualityProfile profiles[] =
+   {
+      { "Fast",    false, true,  3, 0.08, 0.008, 5.0 },
+      { "Quality", false, false, 5, 0.04, 0.002, 4.0 },
+      { "Ultra",   true,  false, 5, 0,    0,     1.0 }
+   };
+   return profiles[std::max( 0, std::min( qualityMode, 2 ) )];
+}
+
+// RGB source planes of a native sample type
+template <typename T>
+struct HASource
+{
+   int width = 0;
+   int height = 0;
+   const T* channel[3] = { nullptr, nullptr, nullptr };
+   std::ptrdiff_t stride = 0; // samples between consecutive rows
+   int x0 = 0;                // image column of the first channel column
+   int y0 = 0;                // image row of the first channel row
+
+   const T* At( int c, int x, int y ) const
+   {
+      return channel[c] + std::ptrdiff_t( y - y0 )*stride + ( x - x0 );
+   }
+};
+
+// Sum and sum of squares over a set of samples
+struct HAMoments
+{
+   double sum = 0;
+   double sumSq = 0;
+   std::size_t count = 0;
+
+   template <typename R>
+   void Add( const R* data, int n )
+   {
+      double s = 0, s2 = 0;
+      for ( int i = 0; i < n; ++i )
+      {
+         s += data[i];
+         s2 += double( data[i] )*data[i];
+      }
+      sum += s;
+      sumSq += s2;
+      count += n;
+   }
+
+   void Merge( const HAMoments& m )
+   {
+      sum += m.sum;
+      sumSq += m.sumSq;
+      count += m.count;
+   }
+
+   double Mean() const
+   {
+      return ( count > 0 ) ? sum/count : 0.0;
+   }
+
+   double StdDev() const
+   {
+      if ( count < 2 )
+         return 0.0;
+      double var = ( sumSq - sum*sum/count )/( count - 1 );
+      return ( var > 0 ) ? std::sqrt( var ) : 0.0;
+   }
+};
+
+// 16-bit histogram of [0,1] samples with PCL-compatible percentiles
+class HAHistogram
+{
+public:
+
+   static constexpr int Resolution = 65536;
+
+   HAHistogram() : m_bins( Resolution, 0 )
+   {
+   }
+
+   template <typename R>
+   void Add( const R* data, int n )
+   {
+      for ( int i = 0; i < n; ++i )
+         ++m_bins[int( HAKernels::Clamp01( data[i] )*( Resolution - 1 ) + R( 0.5 ) )];
+      m_count += n;
+   }
+
+   // 16-bit samples, each in the bin of its normalized value
+   void Add( const std::uint16_t* data, int n )
+   {
+      for ( int i = 0; i < n; ++i )
+         ++m_bins[data[i]];
+      m_count += n;
+   }
+
+   void Merge( const HAHistogram& h )
+   {
+      for ( int i = 0; i < Resolution; ++i )
+         m_bins[i] += h.m_bins[i];
+      m_count += h.m_count;
+   }
+
+   // Value below which p percent of the samples fall
+   double Percentile( double p ) const
+   {
+      double target = p/100 * m_count;
+      std::uint64_t cumulative = 0;
+      for ( int i = 0; i < Resolution; ++i )
+      {
+         cumulative += m_bins[i];
+         if ( cumulative > 0 && cumulative >= target )
+            return double( i )/( Resolution - 1 );
+      }
+      return 1.0;
+   }
+
+private:
+
+   std::vector<std::uint64_t> m_bins;
+   std::uint64_t              m_count = 0;
+};
+
+// Memory a pipeline run allocated beyond its source and output images
+struct HARunSummary
+{
+   std::size_t workingBytes = 0;
+   std::size_t scratchFileBytes = 0; // spilled to a scratch file (streaming)
+   int         stripRows = 0;        // rows per strip (streaming)
+};
+
+// Tile dimensions of pipelines created without explicit ones. Module-wide;
+// HATuner sets them from the machine profile.
+struct HATileDefaults
+{
+   static constexpr int Width = 256;
+   static constexpr int Height = 64;
+
+   std::atomic<int> width{ Width };
+   std::atomic<int> height{ Height };
+
+   static HATileDefaults& Instance()
+   {
+      static HATileDefaults defaults;
+      return defaults;
+   }
+};
+
+/*
+ * Fused tile pipeline.
+ *
+ * The image is cut into cache-sized tiles. Each tile is converted, enhanced
+ * and noise-reduced while it is still resident in cache, with overlapping
+ * halos for the stencil stages (the local contrast radius, the grid halo
+ * for noise reduction). Enhancement needs the global mean and standard
+ * deviation of the converted image, which a read-only pre-pass computes. The contrast
+ * stretch needs the 5th/95th percentiles of the filtered image, accumulated
+ * per tile as results are written, and runs as a final in-place point sweep.
+ * Moments are summed per tile and merged in tile order and histograms hold
+ * integer counts, so neither depends on the number of threads.
+ *
+ * Source samples are read and results written in their native type T; all
+ * intermediate work is float32. The pipeline is instantiated once per sample
+ * type, so nothing in the per-pixel path dispatches on the type.
+ *
+ * 16-bit images converted by a linear method (Standard, or Advanced Spectral
+ * without adaptive processing) with neither enhancement nor noise reduction
+ * take an integer path instead (FixedPoint()): the conversion and the
+ * contrast stretch run in 32-bit integer lanes on the samples themselves,
+ * with the rounding described at HAFixedConversionArgs and
+ * HAContrastMap::Fixed, and never leave 16 bits in between. Each result is
+ * within one unit of the float32 path, which it replaces; the percentiles
+ * come from the stored samples. The stretch of any 16-bit output is
+ * likewise in fixed point.
+ *
+ * Noise reduction uses a bilateral grid matched to the variance of the
+ * reference 7x7 kernel instead of the brute-force filter. At full strength
+ * (noiseReduction = 1) it differs from HAKernels::ApplyNoiseReduction by at
+ * most 0.027 on uniform noise, 0.019 on a noisy star field and 0.004 on a
+ * noisy step edge, with mean absolute differences of 0.0025, 0.0006 and
+ * 0.0005; the difference scales linearly with noiseReduction.
+ *
+ * The qualityMode profile (HAQualityProfile) selects the grid blur and, for
+ * the Neural Approximation method, whether sigmoids use the fast
+ * approximation (within HAFastSigmoidMaxError each) or exact vectorized
+ * exponentials. Ultra runs as HAStagedPipeline instead.
+ *
+ * Otherwise, compared with HAStagedPipeline (double precision, brute-force
+ * bilateral, full-frame sweeps), the output differs by float32 rounding only:
+ * below 1e-6 absolute for every method and stage. With contrast boost
+ * enabled, a 16-bit histogram bin flip can shift a percentile by 1/65535,
+ * adding up to (1 + contrastBoost)/(65535*range) to that bound. For integer sample types
+ * the stretch is applied to stored (rounded) samples, which adds up to
+ * (1 + contrastBoost)/(2*range) LSB before the final rounding.
+ *
+ * Given a profiler, Run() records a span per stage per tile, with bytes
+ * counted as samples read plus samples written by that stage.
+ *
+ * Run() works on whole images in memory. Its passes are also available per
+ * strip of rows for HAStreamingPipeline.
+ */
+class HAFusedPipeline
+{
+public:
+
+   // Tile dimensions of 0 select HATileDefaults
+   HAFusedPipeline( const HAParameters& params, int tileWidth = 0, int tileHeight = 0 ) :
+      m_params( params ),
+      m_tileWidth( ( tileWidth > 0 ) ? tileWidth : HATileDefaults::Instance().width.load() ),
+      m_tileHeight( ( tileHeight > 0 ) ? tileHeight : HATileDefaults::Instance().height.load() ),
+      m_profile( HAQualityProfileFor( params.qualityMode ) ),
+      m_kernels( HAActiveConversionKernels() ),
+      m_bilateral( HABilateralGrid::TruncatedSigma( HAKernels::BilateralSigmaSpace, HAKernels::BilateralRadius ),
+                   HAKernels::BilateralSigmaColor, m_profile.bilateralTaps ),
+      m_kernelArgs( HAConversionKernelArgs( HAConversionGraph( params.conversionMethod, params.haWavelength,
+                                                               params.adaptiveProcessing ) ) )
+   {
+      if ( params.localContrastRadius < 0 || params.localContrastRadius > HAKernels::LocalContrastMaxRadius )
+         throw std::runtime_error( "HAFusedPipeline: the local contrast radius must be between 0 and 64" );
+
+      if ( params.conversionMethod == 3 && !params.neuralModelPath.empty() )
+      {
+         m_model = HAMLPModel::Shared( params.neuralModelPath );
+         m_model->RequireConversionShape();
+         m_kernelArgs.network = &m_model->Network();
+      }
+
+      // Tiles at least four halos across, so the share of each tile that is
+      // halo, converted and filtered twice, stays bounded at large local
+      // contrast radii
+      m_tileWidth = std::max( m_tileWidth, 4*SourceHalo() );
+      m_tileHeight = std::max( m_tileHeight, 4*SourceHalo() );
+
+      // Adaptive Multi-Scale is not a per-pixel function of RGB
+      if ( params.lutSize > 0 && params.conversionMethod != 2 )
+         m_lut = HAColorLUT::Shared( params.lutSize, RowKernel(), m_kernelArgs );
+
+      m_fixedConversion = params.conversionMethod < 2 && !m_lut && params.enhancementStrength <= 0 &&
+                          params.noiseReduction <= 0 && HAFixedConversionArgs( m_kernelArgs, m_fixedArgs );
+   }
+
+   // Instruction set of the conversion kernels in use
+   const char* ISA() const
+   {
+      return m_kernels.isa;
+   }
+
+   // Lookup table standing for the conversion kernel, or nullptr
+   const HAColorLUT* LUT() const
+   {
+      return m_lut.get();
+   }
+
+   // Network run by Neural Approximation, or nullptr for the built-in one
+   const HAMLPModel* Model() const
+   {
+      return m_model.get();
+   }
+
+   // True if T samples take the integer path
+   template <typename T>
+   bool FixedPoint() const
+   {
+      return std::is_same<T, std::uint16_t>::value && m_fixedConversion;
+   }
+
+   int TileWidth() const
+   {
+      return m_tileWidth;
+   }
+
+   int TileHeight() const
+   {
+      return m_tileHeight;
+   }
+
+   // Source rows needed above and below the rows a ProcessRows() call writes
+   int SourceHalo() const
+   {
+      int halo = ( ( m_params.noiseReduction > 0 ) ? m_bilateral.Halo() : 0 ) +
+                 ( ( m_params.enhancementStrength > 0 ) ? HAKernels::LocalContrastHalo( m_params.localContrastRadius ) : 0 );
+      if ( m_params.conversionMethod == 2 )
+         halo += HAPyramid::BlockSize - 1; // multi-scale blocks are converted whole
+      return halo;
+   }
+
+   template <typename T>
+   HARunSummary Run( const HASource<T>& source, const HAView<T>& output, HAProfiler* profiler = nullptr ) const
+   {
+      Workspace ws;
+      HAMoments moments;
+      if ( m_params.enhancementStrength > 0 )
+         AccumulateMoments( source, 0, source.height, moments, ws, profiler );
+
+      ProcessRows( source, output, 0, source.height, moments, ws, profiler );
+
+      float p5, range;
+      if ( ContrastRange( ws, p5, range ) )
+         Stretch( output, source.width, source.height, 0, source.height, p5, range, ws, profiler );
+
+      HARunSummary summary;
+      summary.workingBytes = ws.Bytes();
+      return summary;
+   }
+
+private:
+
+   struct Scratch;
+
+public:
+
+   // Per-thread buffers and statistics carried from one pass to the next
+   class Workspace
+   {
+   public:
+
+      std::size_t Bytes() const
+      {
+         std::size_t n = histograms.size()*HAHistogram::Resolution*sizeof( std::uint64_t );
+         for ( const Scratch& s : scratch )
+            n += s.Bytes();
+         return n;
+      }
+
+   private:
+
+      std::vector<Scratch>     scratch = std::vector<Scratch>( HANumberOfThreads() );
+      std::vector<HAHistogram> histograms;
+
+      friend class HAFusedPipeline;
+   };
+
+   /*
+    * The passes of Run(), over rows [y0,y1) of the image, for callers that
+    * process it in horizontal strips. y0 must be a multiple of TileHeight()
+    * and the source must hold rows [y0,y1), widened by SourceHalo() for
+    * ProcessRows(), clipped to the image. source.height is the height of the
+    * whole image. Calling each pass over consecutive strips in order gives
+    * exactly the result of one call over the whole image.
+    */
+
+   // Pre-pass: moments of the converted image, needed by ProcessRows() if
+   // enhancement is enabled
+   template <typename T>
+   void AccumulateMoments( const HASource<T>& source, int y0, int y1, HAMoments& moments,
+                           Workspace& ws, HAProfiler* profiler = nullptr ) const
+   {
+      const Tiles tiles( *this, source.width, source.height, y0, y1 );
+      const double typeBytes = sizeof( T );
+
+      std::vector<HAMoments> partial( tiles.count );
+      if ( profiler != nullptr )
+         profiler->BeginPhase( "statistics" );
+      HAParallelFor( tiles.count, [&]( int i, int slot )
+      {
+         HARect tile = tiles.Rect( i );
+         Scratch& s = ws.scratch[slot];
+         HAProfiler::Span span( profiler, HAProfiler::Moments, slot, tiles.Index( i ), ( 3*typeBytes + 4 )*tile.Area() );
+         HAView<float> converted = s.Region( s.converted, tile );
+         Convert( source, tile, converted, s );
+         for ( int y = tile.y0; y < tile.y1; ++y )
+            partial[i].Add( converted.At( tile.x0, y ), tile.Width() );
+      } );
+      if ( profiler != nullptr )
+         profiler->EndPhase();
+
+      for ( const HAMoments& m : partial )
+         moments.Merge( m );
+   }
+
+   // Main pass: every enabled stage, one tile at a time. moments are those of
+   // the whole image.
+   template <typename T>
+   void ProcessRows( const HASource<T>& source, const HAView<T>& output, int y0, int y1, const HAMoments& moments,
+                     Workspace& ws, HAProfiler* profiler = nullptr ) const
+   {
+      ProcessRect( source, output, HARect( 0, y0, source.width, y1 ), moments, ws, profiler );
+   }
+
+   /*
+    * The main pass over a rectangular area of the image, for callers that
+    * only need part of it (HAPreviewEngine crops). area.x0 must be a multiple
+    * of TileWidth() and area.y0 of TileHeight(); the source must hold area
+    * widened by SourceHalo(), clipped to the image, and may be offset (x0,
+    * y0) like the output view. Every pixel of area is exactly what a pass
+    * over the whole image gives it.
+    */
+   template <typename T>
+   void ProcessRect( const HASource<T>& source, const HAView<T>& output, const HARect& area, const HAMoments& moments,
+                     Workspace& ws, HAProfiler* profiler = nullptr ) const
+   {
+      if constexpr ( std::is_same<T, std::uint16_t>::value )
+         if ( m_fixedConversion )
+         {
+            ConvertFixed( source, output, area, ws, profiler );
+            return;
+         }
+
+      FilterTiles( source.width, source.height, area, moments, output, m_params.contrastBoost > 0, ws, profiler,
+                   [&]( const HARect& rect, Scratch& s, int slot, int tile )
+                   {
+                      HAView<float> converted = s.Region( s.converted, rect );
+                      Convert( source, rect, converted, s, profiler, slot, tile );
+                      return HAView<const float>( converted );
+                   } );
+   }
+
+   /*
+    * The conversion and the remaining stages as separate passes, through a
+    * float32 plane of the converted image, for callers that keep that plane
+    * (HACachedPipeline). ConvertRows() writes rows [y0,y1) of converted and
+    * accumulates their moments; FilterRows() enhances and noise-reduces
+    * converted into output. Both accumulate the histogram of what they write
+    * for Percentiles(). The output is exactly that of the fused passes.
+    */
+   template <typename T>
+   void ConvertRows( const HASource<T>& source, const HAView<float>& converted, int y0, int y1, HAMoments& moments,
+                     Workspace& ws, HAProfiler* profiler = nullptr ) const
+   {
+      const Tiles tiles( *this, source.width, source.height, y0, y1 );
+      ws.histograms.resize( ws.scratch.size() );
+
+      std::vector<HAMoments> partial( tiles.count );
+      if ( profiler != nullptr )
+         profiler->BeginPhase( "convert" );
+      HAParallelFor( tiles.count, [&]( int i, int slot )
+      {
+         HARect tile = tiles.Rect( i );
+         Convert( source, tile, converted, ws.scratch[slot], profiler, slot, tiles.Index( i ) );
+         for ( int y = tile.y0; y < tile.y1; ++y )
+         {
+            partial[i].Add( converted.At( tile.x0, y ), tile.Width() );
+            ws.histograms[slot].Add( converted.At( tile.x0, y ), tile.Width() );
+         }
+      } );
+      if ( profiler != nullptr )
+         profiler->EndPhase();
+
+      for ( const HAMoments& m : partial )
+         moments.Merge( m );
+   }
+
+   template <typename T>
+   void FilterRows( const HAView<const float>& converted, const HAView<T>& output, int width, int height, int y0, int y1,
+                    const HAMoments& moments, Workspace& ws, HAProfiler* profiler = nullptr ) const
+   {
+      FilterTiles( width, height, HARect( 0, y0, width, y1 ), moments, output, true, ws, profiler,
+                   [&]( const HARect&, Scratch&, int, int ) { return converted; } );
+   }
+
+   // 5th and 95th percentiles of everything written since the workspace was
+   // created; false if no histogram was accumulated
+   bool Percentiles( Workspace& ws, float& p5, float& p95 ) const
+   {
+      if ( ws.histograms.empty() )
+         return false;
+
+      for ( std::size_t i = 1; i < ws.histograms.size(); ++i )
+         ws.histograms[0].Merge( ws.histograms[i] );
+      ws.histograms.resize( 1 );
+
+      p5 = float( ws.histograms[0].Percentile( 5.0 ) );
+      p95 = float( ws.histograms[0].Percentile( 95.0 ) );
+      return true;
+   }
+
+   // Stretch bounds from the histograms of every ProcessRows() call; false
+   // if contrast boost is disabled or the image is flat
+   bool ContrastRange( Workspace& ws, float& p5, float& range ) const
+   {
+      float p95;
+      if ( m_params.contrastBoost <= 0 || !Percentiles( ws, p5, p95 ) )
+         return false;
+      range = p95 - p5;
+      return range > 0;
+   }
+
+   // Final sweep: contrast stretch between global percentiles, in place
+   template <typename T>
+   void Stretch( const HAView<T>& output, int width, int height, int y0, int y1, float p5, float range,
+                 Workspace& ws, HAProfiler* profiler = nullptr ) const
+   {
+      const Tiles tiles( *this, width, height, y0, y1 );
+      const double typeBytes = sizeof( T );
+      const HAContrastMap stretch( p5, range, m_params.contrastBoost );
+      const HAFixedAffineArgs fixed = std::is_same<T, std::uint16_t>::value ? stretch.Fixed() : HAFixedAffineArgs();
+
+      if ( profiler != nullptr )
+         profiler->BeginPhase( "contrast" );
+      HAParallelFor( tiles.count, [&]( int t, int slot )
+      {
+         HARect tile = tiles.Rect( t );
+         HAProfiler::Span span( profiler, HAProfiler::ContrastBoost, slot, tiles.Index( t ), 2*typeBytes*tile.Area() );
+         if constexpr ( std::is_same<T, std::uint16_t>::value )
+         {
+            for ( int y = tile.y0; y < tile.y1; ++y )
+               m_kernels.fixedAffine( output.At( tile.x0, y ), tile.Width(), fixed );
+         }
+         else
+         {
+            std::vector<float>& row = ws.scratch[slot].red;
+            row.resize( tile.Width() );
+            for ( int y = tile.y0; y < tile.y1; ++y )
+            {
+               HALoadRow( output.At( tile.x0, y ), row.data(), tile.Width() );
+               stretch.Apply( row.data(), tile.Width() );
+               HAStoreRow( row.data(), output.At( tile.x0, y ), tile.Width() );
+            }
+         }
+      } );
+      if ( profiler != nullptr )
+         profiler->EndPhase();
+   }
+
+private:
+
+   // Tiles covering area, numbered from 0 within it; Index() is the tile's
+   // number in the whole image. area starts on a tile boundary; tiles are
+   // clipped to it.
+   struct Tiles
+   {
+      int right, bottom, tileWidth, tileHeight, firstX, firstY, tilesX, imageTilesX, count;
+
+      Tiles( const HAFusedPipeline& p, int w, int h, const HARect& area ) :
+         right( std::min( area.x1, w ) ), bottom( std::min( area.y1, h ) ),
+         tileWidth( p.m_tileWidth ), tileHeight( p.m_tileHeight ),
+         firstX( area.x0/tileWidth ), firstY( area.y0/tileHeight ),
+         tilesX( ( right + tileWidth - 1 )/tileWidth - firstX ),
+         imageTilesX( ( w + tileWidth - 1 )/tileWidth )
+      {
+         count = std::max( 0, tilesX )*std::max( 0, ( bottom + tileHeight - 1 )/tileHeight - firstY );
+      }
+
+      Tiles( const HAFusedPipeline& p, int w, int h, int y0, int y1 ) :
+         Tiles( p, w, h, HARect( 0, y0, w, y1 ) )
+      {
+      }
+
+      int Index( int i ) const
+      {
+         return ( firstY + i/tilesX )*imageTilesX + firstX + i % tilesX;
+      }
+
+      HARect Rect( int i ) const
+      {
+         int x0 = ( firstX + i % tilesX )*tileWidth;
+         int y0 = ( firstY + i/tilesX )*tileHeight;
+         return HARect( x0, y0, std::min( x0 + tileWidth, right ), std::min( y0 + tileHeight, bottom ) );
+      }
+   };
+
+   // Per-thread working buffers, reused from tile to tile
+   struct Scratch
+   {
+      std::vector<float> red, green, blue;
+      std::vector<float> converted, enhanced, filtered;
+      std::vector<float> levels[HAPyramid::Levels], blend;
+      std::vector<double> boxSums;
+      HABilateralGrid::Workspace bilateral;
+
+      std::size_t Bytes() const
+      {
+         std::size_t n = red.capacity() + green.capacity() + blue.capacity() +
+                         converted.capacity() + enhanced.capacity() + filtered.capacity() + blend.capacity();
+         for ( const std::vector<float>& level : levels )
+            n += level.capacity();
+         return sizeof( float )*n + sizeof( double )*boxSums.capacity() + bilateral.Bytes();
+      }
+
+      HAView<float> Region( std::vector<float>& buffer, const HARect& r )
+      {
+         buffer.resize( std::size_t( r.Width() )*r.Height() );
+         return HAView<float>( buffer.data(), r.Width(), r.x0, r.y0 );
+      }
+
+      template <typename T>
+      void LoadRow( const HASource<T>& source, int y, int x0, int count )
+      {
+         red.resize( count );
+         green.resize( count );
+         blue.resize( count );
+         HALoadRow( source.At( 0, x0, y ), red.data(), count );
+         HALoadRow( source.At( 1, x0, y ), green.data(), count );
+         HALoadRow( source.At( 2, x0, y ), blue.data(), count );
+      }
+   };
+
+   /*
+    * Enhancement, noise reduction and store for the tiles of area.
+    * convert( rect, scratch, slot, tile ) returns a view holding the
+    * converted image over rect.
+    */
+   template <typename T, class C>
+   void FilterTiles( int width, int height, const HARect& area, const HAMoments& moments, const HAView<T>& output,
+                     bool histogram, Workspace& ws, HAProfiler* profiler, C convert ) const
+   {
+      const HARect bounds( 0, 0, width, height );
+      const Tiles tiles( *this, width, height, area );
+      const double typeBytes = sizeof( T );
+
+      const bool enhance = m_params.enhancementStrength > 0;
+      const bool denoise = m_params.noiseReduction > 0;
+
+      const float mean = float( moments.Mean() );
+      const float stdDev = float( moments.StdDev() );
+      const int noiseHalo = denoise ? m_bilateral.Halo() : 0;
+      const int enhanceHalo = enhance ? HAKernels::LocalContrastHalo( m_params.localContrastRadius ) : 0;
+      if ( histogram )
+         ws.histograms.resize( ws.scratch.size() );
+
+      if ( profiler != nullptr )
+         profiler->BeginPhase( "tiles" );
+      HAParallelFor( tiles.count, [&]( int t, int slot )
+      {
+         HARect tile = tiles.Rect( t );
+         const int i = tiles.Index( t );
+         Scratch& s = ws.scratch[slot];
+
+         HARect enhanceRect = tile.Inflated( noiseHalo, bounds );
+         HARect convertRect = enhanceRect.Inflated( enhanceHalo, bounds );
+
+         HAView<const float> current = convert( convertRect, s, slot, i );
+
+         if ( enhance )
+         {
+            HAProfiler::Span span( profiler, HAProfiler::Enhance, slot, i, 4.0*( convertRect.Area() + enhanceRect.Area() ) );
+            HAView<float> enhanced = s.Region( s.enhanced, enhanceRect );
+            if ( m_params.localContrastRadius > 0 )
+               HAKernels::BoxSums( current, enhanceRect, width, height, m_params.localContrastRadius, s.boxSums );
+            HAKernels::ApplyEnhancements<float>( current, enhanced, enhanceRect, width, height, mean, stdDev,
+                                                 float( m_params.enhancementStrength ), m_params.localContrastRadius,
+                                                 s.boxSums.data() );
+            current = enhanced;
+         }
+
+         if ( denoise )
+         {
+            HAProfiler::Span span( profiler, HAProfiler::NoiseReduction, slot, i, 4.0*( enhanceRect.Area() + tile.Area() ) );
+            HAView<float> filtered = s.Region( s.filtered, tile );
+            m_bilateral.Apply( current, filtered, tile, width, height, float( m_params.noiseReduction ), s.bilateral );
+            current = filtered;
+         }
+
+         HAProfiler::Span span( profiler, HAProfiler::Store, slot, i, ( 4 + typeBytes )*tile.Area() );
+         for ( int y = tile.y0; y < tile.y1; ++y )
+         {
+            if ( histogram )
+               ws.histograms[slot].Add( current.At( tile.x0, y ), tile.Width() );
+            HAStoreRow( current.At( tile.x0, y ), output.At( tile.x0, y ), tile.Width() );
+         }
+      } );
+      if ( profiler != nullptr )
+         profiler->EndPhase();
+   }
+
+   // Main pass of the integer path: 16-bit conversion straight into the
+   // output, with the histogram of the stored samples
+   void ConvertFixed( const HASource<std::uint16_t>& source, const HAView<std::uint16_t>& output, const HARect& area,
+                      Workspace& ws, HAProfiler* profiler ) const
+   {
+      const Tiles tiles( *this, source.width, source.height, area );
+      const bool histogram = m_params.contrastBoost > 0;
+      if ( histogram )
+         ws.histograms.resize( ws.scratch.size() );
+
+      if ( profiler != nullptr )
+         profiler->BeginPhase( "tiles" );
+      HAParallelFor( tiles.count, [&]( int t, int slot )
+      {
+         HARect tile = tiles.Rect( t );
+         HAProfiler::Span span( profiler, HAProfiler::Convert, slot, tiles.Index( t ), 8.0*tile.Area() );
+         for ( int y = tile.y0; y < tile.y1; ++y )
+         {
+            std::uint16_t* out = output.At( tile.x0, y );
+            m_kernels.fixedLinear( source.At( 0, tile.x0, y ), source.At( 1, tile.x0, y ), source.At( 2, tile.x0, y ),
+                                   out, tile.Width(), m_fixedArgs );
+            if ( histogram )
+               ws.histograms[slot].Add( out, tile.Width() );
+         }
+      } );
+      if ( profiler != nullptr )
+         profiler->EndPhase();
+   }
+
+   // Converted HA values for rect. With a profiler, records the conversion
+   // and pyramid work of tile as separate spans.
+   template <typename T>
+   void Convert( const HASource<T>& source, const HARect& rect, const HAView<float>& out, Scratch& s,
+                 HAProfiler* profiler = nullptr, int slot = 0, int tile = 0 ) const
+   {
+      const int n = rect.Width();
+      const double typeBytes = sizeof( T );
+
+      if ( m_params.conversionMethod == 2 )
+      {
+         // Multi-scale blocks need their complete footprint
+         HARect aligned = HAPyramid::Aligned( rect, source.width, source.height );
+         HAView<float> levels[HAPyramid::Levels];
+         HAView<const float> constLevels[HAPyramid::Levels];
+         for ( int k = 0; k < HAPyramid::Levels; ++k )
+            constLevels[k] = levels[k] = s.Region( s.levels[k], HAPyramid::LevelRect( aligned, k ) );
+
+         // Convert one band of blocks and reduce it through every level while
+         // it is in cache
+         for ( int y0 = aligned.y0; y0 < aligned.y1; y0 += HAPyramid::BlockSize )
+         {
+            HARect band( aligned.x0, y0, aligned.x1, std::min( y0 + HAPyramid::BlockSize, aligned.y1 ) );
+            {
+               HAProfiler::Span span( profiler, HAProfiler::Convert, slot, tile, ( 3*typeBytes + 4 )*band.Area() );
+               for ( int y = band.y0; y < band.y1; ++y )
+               {
+                  s.LoadRow( source, y, aligned.x0, aligned.Width() );
+                  m_kernels.linear( s.red.data(), s.green.data(), s.blue.data(),
+                                      levels[0].At( aligned.x0, y ), aligned.Width(), m_kernelArgs );
+               }
+            }
+            // Reads 4/3 of the band over all levels, writes 1/3
+            HAProfiler::Span span( profiler, HAProfiler::Pyramid, slot, tile, 4.0*5/3*band.Area() );
+            HAPyramid::Reduce( levels, band );
+         }
+
+         // Reads level 0 and the coarser samples, writes the result
+         HAProfiler::Span span( profiler, HAProfiler::Pyramid, slot, tile, 4.0*( 1 + 1.0/3 + 1 )*rect.Area() );
+         HAPyramid::Blend( constLevels, out, rect, source.width, source.height, s.blend, m_kernels.blend );
+         return;
+      }
+
+      const HARowKernel kernel = RowKernel();
+      HAProfiler::Span span( profiler, HAProfiler::Convert, slot, tile, ( 3*typeBytes + 4 )*rect.Area() );
+      if constexpr ( std::is_same<T, std::uint16_t>::value )
+         if ( !m_lut && kernel == m_kernels.linear )
+         {
+            // Straight from the samples, with the same result
+            for ( int y = rect.y0; y < rect.y1; ++y )
+               m_kernels.linearU16( source.At( 0, rect.x0, y ), source.At( 1, rect.x0, y ), source.At( 2, rect.x0, y ),
+                                    out.At( rect.x0, y ), n, m_kernelArgs );
+            return;
+         }
+
+      for ( int y = rect.y0; y < rect.y1; ++y )
+      {
+         s.LoadRow( source, y, rect.x0, n );
+         if ( m_lut )
+            m_lut->Apply( s.red.data(), s.green.data(), s.blue.data(), out.At( rect.x0, y ), n );
+         else
+            kernel( s.red.data(), s.green.data(), s.blue.data(), out.At( rect.x0, y ), n, m_kernelArgs );
+      }
+   }
+
+   // Exact kernel of a per-pixel conversion method
+   HARowKernel RowKernel() const
+   {
+      if ( m_params.conversionMethod == 3 && m_model )
+         return m_profile.fastMath ? m_kernels.mlpFast : m_kernels.mlp;
+      if ( m_params.conversionMethod == 3 )
+         return m_profile.fastMath ? m_kernels.neuralFast : m_kernels.neural;
+      return m_kernels.linear;
+   }
+
+   HAParameters               m_params;
+   int                        m_tileWidth;
+   int                        m_tileHeight;
+   const HAQualityProfile&    m_profile;
+   const HAConversionKernels& m_kernels;
+   HABilateralGrid            m_bilateral;
+   HAKernelArgs               m_kernelArgs;
+   std::shared_ptr<const HAMLPModel> m_model;
+   std::shared_ptr<const HAColorLUT> m_lut;
+   HAFixedLinearArgs          m_fixedArgs;
+   bool                       m_fixedConversion = false;
+};
+
+/*
+ * Staged reference pipeline.
+ *
+ * Runs the conversion method and each post-processing stage as a separate
+ * full-frame sweep in double precision, with the brute-force bilateral
+ * filter. Slow and memory hungry: it runs the Ultra quality mode and is the
+ * reference the fused pipeline is validated against. Source channels are read
+ * in place; only HA planes (and the multi-scale levels) are allocated.
+ *
+ * Given a profiler, Run() records a phase per full-frame sweep and a span per
+ * stage per band of rows (per strip of columns for the vertical box sums),
+ * with bytes counted in double precision samples as in HAFusedPipeline.
+ */
+class HAStagedPipeline
+{
+public:
+
+   HAStagedPipeline( const HAParameters& params ) : m_params( params )
+   {
+      if ( params.localContrastRadius < 0 || params.localContrastRadius > HAKernels::LocalContrastMaxRadius )
+         throw std::runtime_error( "HAStagedPipeline: the local contrast radius must be between 0 and 64" );
+      if ( params.conversionMethod == 3 && !params.neuralModelPath.empty() )
+      {
+         m_model = HAMLPModel::Shared( params.neuralModelPath );
+         m_model->RequireConversionShape();
+      }
+   }
+
+   template <typename T>
+   HARunSummary Run( const HASource<T>& source, const HAView<T>& output, HAProfiler* profiler = nullptr ) const
+   {
+      const int width = source.width;
+      const int height = source.height;
+
+      const bool enhance = m_params.enhancementStrength > 0.0;
+      const bool denoise = m_params.noiseReduction > 0.0;
+      const bool boost = m_params.contrastBoost > 0.0;
+
+      Plane image( width, height );
+
+      // Each stage accumulates what the next consumer needs as it writes
+      RowStatistics stats( height );
+      stats.moments = enhance;
+      stats.histogram = boost && !enhance && !denoise;
+
+      // Apply conversion based on selected method
+      switch ( m_params.conversionMethod )
+      {
+      case 1:
+         ConvertAdvancedSpectral( source, image, &stats, profiler );
+         break;
+      case 2:
+         ConvertAdaptiveMultiScale( source, image, &stats, profiler );
+         break;
+      case 3:
+         ConvertNeuralApproximation( source, image, &stats, profiler );
+         break;
+      default:
+         ConvertStandardRGBToHA( source, image, &stats, profiler );
+         break;
+      }
+
+      // Apply post-processing enhancements
+      if ( enhance )
+         ApplyEnhancements( image, stats, profiler );
+
+      if ( denoise )
+         ApplyNoiseReduction( image, stats, profiler );
+
+      if ( boost )
+         ApplyContrastBoost( image, stats, profiler );
+
+      ParallelProcess( height, profiler, "store", HAProfiler::Store, ( 8.0 + sizeof( T ) )*width,
+                       [&]( int startRow, int endRow, int )
+      {
+         for ( int y = startRow; y < endRow; ++y )
+            HAStoreRow( image.Row( y ), output.At( 0, y ), width );
+      } );
+
+      HARunSummary summary;
+      summary.workingBytes = WorkingBytes( width, height );
+      return summary;
+   }
+
+   // Peak working memory of Run(): the image plus the multi-scale levels or
+   // a stage's temporary planes (enhancement: a copy, and two of box sums
+   // for a window radius)
+   std::size_t WorkingBytes( int width, int height ) const
+   {
+      double planes = 1;
+      if ( m_params.enhancementStrength > 0.0 )
+         planes += ( m_params.localContrastRadius > 0 ) ? 3 : 1;
+      else if ( m_params.noiseReduction > 0.0 )
+         planes += 1;
+      if ( m_params.conversionMethod == 2 )
+         planes = std::max( planes, 1 + 4.0/3 );
+      return std::size_t( planes*sizeof( double )*width*height );
+   }
+
+private:
+
+   // Full-frame double precision plane, recycled through HABufferPool.
+   // Contents are undefined until written.
+   struct Plane
+   {
+      int width, height;
+      HABuffer<double> data;
+
+      Plane( int w, int h ) : width( w ), height( h ), data( std::size_t( w )*h )
+      {
+      }
+
+      Plane( const Plane& p ) : Plane( p.width, p.height )
+      {
+         std::copy_n( p.data.data(), p.data.size(), data.data() );
+      }
+
+      Plane( Plane&& ) = default;
+
+      double* Row( int y )
+      {
+         return data.data() + std::size_t( y )*width;
+      }
+
+      const double* Row( int y ) const
+      {
+         return data.data() + std::size_t( y )*width;
+      }
+
+      HAView<double> View()
+      {
+         return HAView<double>( data.data(), width );
+      }
+
+      HAView<const double> View() const
+      {
+         return HAView<const double>( data.data(), width );
+      }
+
+      HARect Bounds() const
+      {
+         return HARect( 0, 0, width, height );
+      }
+   };
+
+   // Rows per band of ParallelProcess
+   static constexpr int BandRows = 16;
+
+   // Parallel processing helper: bands of BandRows rows on the thread pool.
+   // Bands are small enough to balance across threads and never empty, also
+   // for images shorter than the thread count. func( startRow, endRow, slot ).
+   // One profiler phase, with a span of stage for every band; rowBytes are
+   // read plus written per row. profiler may be null.
+   template <typename Func>
+   static void ParallelProcess( int height, HAProfiler* profiler, const char* phase, HAProfiler::Stage stage,
+                                double rowBytes, Func func )
+   {
+      if ( profiler != nullptr )
+         profiler->BeginPhase( phase );
+      HAParallelFor( ( height + BandRows - 1 )/BandRows, [&]( int i, int slot )
+      {
+         const int startRow = i*BandRows, endRow = std::min( height, ( i + 1 )*BandRows );
+         HAProfiler::Span span( profiler, stage, slot, i, rowBytes*( endRow - startRow ) );
+         func( startRow, endRow, slot );
+      } );
+      if ( profiler != nullptr )
+         profiler->EndPhase();
+   }
+
+   /*
+    * Statistics accumulated over the rows a stage writes, so no stage needs a
+    * separate read of the image: moments of the converted image for
+    * ApplyEnhancements, the histogram of the last stage before
+    * ApplyContrastBoost. Moments are summed per band and merged in band
+    * order, histograms are integer counts per thread; either way the merged
+    * values do not depend on the number of threads.
+    */
+   struct RowStatistics
+   {
+      bool moments = false;
+      bool histogram = false;
+      std::vector<HAMoments> bandMoments;
+      std::vector<HAHistogram> histograms;
+
+      RowStatistics( int height ) : bandMoments( ( height + BandRows - 1 )/BandRows )
+      {
+      }
+
+      void Add( int startRow, int slot, const double* row, int n )
+      {
+         if ( moments )
+            bandMoments[startRow/BandRows].Add( row, n );
+         if ( histogram )
+            histograms[slot].Add( row, n );
+      }
+
+      // Called before a stage that fills the histogram
+      void PrepareHistogram()
+      {
+         if ( histogram && histograms.empty() )
+            histograms.resize( HANumberOfThreads() );
+      }
+
+      HAMoments Moments() const
+      {
+         HAMoments m;
+         for ( const HAMoments& b : bandMoments )
+            m.Merge( b );
+         return m;
+      }
+
+      HAHistogram Histogram() const
+      {
+         HAHistogram h;
+         for ( const HAHistogram& t : histograms )
+            h.Merge( t );
+         return h;
+      }
+   };
+
+   // Runs a row kernel over the source channels, read in place
+   template <typename T, class Kernel>
+   static void ConvertRows( const HASource<T>& source, Plane& output, Kernel kernel, RowStatistics* stats,
+                            HAProfiler* profiler )
+   {
+      if ( stats != nullptr )
+         stats->PrepareHistogram();
+
+      ParallelProcess( output.height, profiler, "convert", HAProfiler::Convert, ( 3.0*sizeof( T ) + 8 )*output.width,
+                       [&]( int startRow, int endRow, int slot )
+      {
+         std::vector<double> r( output.width ), g( output.width ), b( output.width );
+         for ( int y = startRow; y < endRow; ++y )
+         {
+            HALoadRow( source.At( 0, 0, y ), r.data(), output.width );
+            HALoadRow( source.At( 1, 0, y ), g.data(), output.width );
+            HALoadRow( source.At( 2, 0, y ), b.data(), output.width );
+            kernel( r.data(), g.data(), b.data(), output.Row( y ), output.width );
+            if ( stats != nullptr )
+               stats->Add( startRow, slot, output.Row( y ), output.width );
+         }
+      } );
+   }
+
+   template <typename T>
+   void ConvertStandardRGBToHA( const HASource<T>& source, Plane& output, RowStatistics* stats = nullptr,
+                            HAProfiler* profiler = nullptr ) const
+   {
+      ConvertRows( source, output, [this]( const double* r, const double* g, const double* b, double* out, int n )
+      {
+         HAKernels::ConvertStandardRGBToHA( r, g, b, out, n, m_params.haWavelength );
+      }, stats, profiler );
+   }
+
+   template <typename T>
+   void ConvertAdvancedSpectral( const HASource<T>& source, Plane& output, RowStatistics* stats = nullptr,
+                             HAProfiler* profiler = nullptr ) const
+   {
+      ConvertRows( source, output, [this]( const double* r, const double* g, const double* b, double* out, int n )
+      {
+         HAKernels::ConvertAdvancedSpectral( r, g, b, out, n, m_params.adaptiveProcessing );
+      }, stats, profiler );
+   }
+
+   template <typename T>
+   void ConvertNeuralApproximation( const HASource<T>& source, Plane& output, RowStatistics* stats = nullptr,
+                                HAProfiler* profiler = nullptr ) const
+   {
+      ConvertRows( source, output, [this]( const double* r, const double* g, const double* b, double* out, int n )
+      {
+         if ( m_model )
+            m_model->Reference( r, g, b, out, n );
+         else
+            HAKernels::ConvertNeuralApproximation( r, g, b, out, n );
+      }, stats, profiler );
+   }
+
+   template <typename T>
+   void ConvertAdaptiveMultiScale( const HASource<T>& source, Plane& output, RowStatistics* stats,
+                                   HAProfiler* profiler ) const
+   {
+      const int width = output.width;
+      const int height = output.height;
+
+      // Create multi-scale images
+      std::vector<Plane> levels;
+      HAView<double> views[HAPyramid::Levels];
+      HAView<const double> constViews[HAPyramid::Levels];
+      for ( int k = 0; k < HAPyramid::Levels; ++k )
+         levels.emplace_back( width >> k, height >> k );
+      for ( int k = 0; k < HAPyramid::Levels; ++k )
+         constViews[k] = views[k] = levels[k].View();
+
+      // Process high resolution first, then reduce level by level in
+      // independent bands of whole blocks
+      ConvertStandardRGBToHA( source, levels[0], nullptr, profiler );
+      const int bandRows = std::max( 16, HAPyramid::BlockSize );
+      if ( profiler != nullptr )
+         profiler->BeginPhase( "reduce" );
+      HAParallelFor( ( height + bandRows - 1 )/bandRows, [&]( int i, int slot )
+      {
+         HARect band( 0, i*bandRows, width, std::min( height, ( i + 1 )*bandRows ) );
+         // Reads 4/3 of the band over all levels, writes 1/3
+         HAProfiler::Span span( profiler, HAProfiler::Pyramid, slot, i, 8.0*5/3*band.Area() );
+         HAPyramid::Reduce( views, band );
+      } );
+      if ( profiler != nullptr )
+         profiler->EndPhase();
+
+      // Combine scales with adaptive weighting; reads level 0 and the coarser
+      // samples, writes the result
+      stats->PrepareHistogram();
+      ParallelProcess( height, profiler, "blend", HAProfiler::Pyramid, 8.0*( 1 + 1.0/3 + 1 )*width,
+                       [&]( int startRow, int endRow, int slot )
+      {
+         std::vector<double> buffer;
+         HAPyramid::Blend( constViews, output.View(), HARect( 0, startRow, width, endRow ), width, height,
+                           buffer, HAPyramid::BlendRow<double> );
+         for ( int y = startRow; y < endRow; ++y )
+            stats->Add( startRow, slot, output.Row( y ), width );
+      } );
+   }
+
+   // Window sums of HAKernels::BoxSums over the whole image: sums along the
+   // rows in bands, then running sums down strips of columns. No halo rows
+   // are summed twice, so the cost per pixel does not depend on the radius.
+   static Plane BoxSums( const Plane& image, int radius, HAProfiler* profiler )
+   {
+      const int width = image.width, height = image.height;
+      Plane rows( width, height ), sums( width, height );
+      ParallelProcess( height, profiler, "row sums", HAProfiler::Enhance, 16.0*width,
+                       [&]( int startRow, int endRow, int )
+      {
+         for ( int y = startRow; y < endRow; ++y )
+            HAKernels::WindowSums( image.View(), y, 0, width, width, radius, rows.Row( y ) );
+      } );
+
+      const int StripColumns = 64;
+      if ( profiler != nullptr )
+         profiler->BeginPhase( "column sums" );
+      HAParallelFor( ( width + StripColumns - 1 )/StripColumns, [&]( int strip, int slot )
+      {
+         const int x0 = strip*StripColumns, n = std::min( StripColumns, width - x0 );
+         // Each row sum is read twice, entering and leaving the window
+         HAProfiler::Span span( profiler, HAProfiler::Enhance, slot, strip, 24.0*n*height );
+         double column[StripColumns] = {};
+         for ( int y = 0; y < std::min( radius, height ); ++y )
+            for ( int i = 0; i < n; ++i )
+               column[i] += rows.Row( y )[x0 + i];
+         for ( int y = 0; y < height; ++y )
+         {
+            if ( y + radius < height )
+               for ( int i = 0; i < n; ++i )
+                  column[i] += rows.Row( y + radius )[x0 + i];
+            if ( y - radius - 1 >= 0 )
+               for ( int i = 0; i < n; ++i )
+                  column[i] -= rows.Row( y - radius - 1 )[x0 + i];
+            std::copy_n( column, n, sums.Row( y ) + x0 );
+         }
+      } );
+      if ( profiler != nullptr )
+         profiler->EndPhase();
+      return sums;
+   }
+
+   void ApplyEnhancements( Plane& image, RowStatistics& stats, HAProfiler* profiler ) const
+   {
+      // Real image statistics, accumulated by the conversion
+      HAMoments moments = stats.Moments();
+      stats.moments = false;
+      stats.histogram = m_params.contrastBoost > 0.0 && m_params.noiseReduction <= 0.0;
+      stats.PrepareHistogram();
+
+      Plane source( image );
+      const Plane sums = ( m_params.localContrastRadius > 0 ) ? BoxSums( source, m_params.localContrastRadius, profiler ) :
+                                                                Plane( 0, 0 );
+      ParallelProcess( image.height, profiler, "enhance", HAProfiler::Enhance, 24.0*image.width,
+                       [&]( int startRow, int endRow, int slot )
+      {
+         HAKernels::ApplyEnhancements<double>( source.View(), image.View(), HARect( 0, startRow, image.width, endRow ),
+                                               image.width, image.height, moments.Mean(), moments.StdDev(),
+                                               m_params.enhancementStrength, m_params.localContrastRadius,
+                                               ( m_params.localContrastRadius > 0 ) ? sums.Row( startRow ) : nullptr );
+         for ( int y = startRow; y < endRow; ++y )
+            stats.Add( startRow, slot, image.Row( y ), image.width );
+      } );
+   }
+
+   void ApplyNoiseReduction( Plane& image, RowStatistics& stats, HAProfiler* profiler ) const
+   {
+      stats.histogram = m_params.contrastBoost > 0.0;
+      stats.PrepareHistogram();
+
+      Plane tempImage( image.width, image.height );
+      ParallelProcess( image.height, profiler, "denoise", HAProfiler::NoiseReduction, 16.0*image.width,
+                       [&]( int startRow, int endRow, int slot )
+      {
+         HAKernels::ApplyNoiseReduction<double>( image.View(), tempImage.View(), HARect( 0, startRow, image.width, endRow ),
+                                                 image.width, image.height, m_params.noiseReduction );
+         for ( int y = startRow; y < endRow; ++y )
+            stats.Add( startRow, slot, tempImage.Row( y ), image.width );
+      } );
+      image.data.swap( tempImage.data );
+   }
+
+   void ApplyContrastBoost( Plane& image, const RowStatistics& stats, HAProfiler* profiler ) const
+   {
+      // Real histogram, accumulated by the previous stage
+      HAHistogram hist = stats.Histogram();
+
+      // Find real percentiles for adaptive stretching
+      double p5 = hist.Percentile( 5.0 );
+      double p95 = hist.Percentile( 95.0 );
+
+      double range = p95 - p5;
+      if ( range > 0 )
+         ParallelProcess( image.height, profiler, "contrast", HAProfiler::ContrastBoost, 16.0*image.width,
+                          [&]( int startRow, int endRow, int )
+         {
+            for ( int y = startRow; y < endRow; ++y )
+               HAKernels::ApplyContrastBoost( image.Row( y ), image.width, p5, range, m_params.contrastBoost );
+         } );
+   }
+
+   HAParameters m_params;
+   std::shared_ptr<const HAMLPModel> m_model;
+};
+
+} // pcl
+
+#endif   // __RGBToHAEngine_h
@@ -0,0 +1,866 @@
+/*
+ * RGB to HA Conversion Image I/O for PixInsight
+ * Minimal FITS and XISF readers and writers for the command-line tool,
+ * whole images or a strip of rows at a time
+ */
+
+#ifndef __RGBToHAImageIO_h
+#define __RGBToHAImageIO_h
+
+#include "RGBToHABufferPool.h"
+#include "RGBToHAStreaming.h"
+
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+namespace pcl
+{
+
+// Sample formats of the PCL image types
+enum class HASampleFormat
+{
+   UInt8, UInt16, UInt32, Float32, Float64
+};
+
+inline int HABytesPerSample( HASampleFormat format )
+{
+   switch ( format )
+   {
+   case HASampleFormat::UInt8:   return 1;
+   case HASampleFormat::UInt16:  return 2;
+   case HASampleFormat::UInt32:
+   case HASampleFormat::Float32: return 4;
+   default:                      return 8;
+   }
+}
+
+inline const char* HASampleFormatName( HASampleFormat format )
+{
+   static const char* names[] = { "UInt8", "UInt16", "UInt32", "Float32", "Float64" };
+   return names[int( format )];
+}
+
+/*
+ * Image in planar layout, one plane per channel, samples in host byte order.
+ * Integer samples span their full range; floating point samples are in
+ * [0,1], the PixInsight convention. Samples live in an HABuffer, so a batch
+ * of frames recycles the same pages; they are undefined until written.
+ */
+struct HAImage
+{
+   int width = 0;
+   int height = 0;
+   int channels = 0;
+   HASampleFormat format = HASampleFormat::Float32;
+   HABuffer<std::uint8_t> data;
+   std::vector<std::string> keywords; // FITS header cards to carry over, 80 characters each
+
+   void Allocate( int w, int h, int c, HASampleFormat f )
+   {
+      width = w;
+      height = h;
+      channels = c;
+      format = f;
+      data = HABuffer<std::uint8_t>( PlaneBytes()*c );
+   }
+
+   std::size_t PlaneBytes() const
+   {
+      return std::size_t( HABytesPerSample( format ) )*width*height;
+   }
+
+   template <typename T>
+   T* Plane( int c )
+   {
+      return reinterpret_cast<T*>( data.data() + c*PlaneBytes() );
+   }
+
+   template <typename T>
+   const T* Plane( int c ) const
+   {
+      return reinterpret_cast<const T*>( data.data() + c*PlaneBytes() );
+   }
+};
+
+// Where and how the samples of a FITS or XISF image are stored
+struct HAImageLayout
+{
+   int width = 0;
+   int height = 0;
+   int channels = 0;
+   HASampleFormat format = HASampleFormat::Float32;
+   std::uint64_t offset = 0;    // file position of the first sample
+   bool bigEndian = false;
+   bool interleaved = false;    // channels of a pixel adjacent, not planes
+   bool signedIntegers = false; // 16 and 32 bit integers offset by 2^(n-1)
+   std::vector<std::string> keywords;
+};
+
+namespace HAImageIO
+{
+
+inline bool HostIsLittleEndian()
+{
+   const std::uint16_t probe = 1;
+   return *reinterpret_cast<const std::uint8_t*>( &probe ) == 1;
+}
+
+inline void SwapBytes( std::uint8_t* data, std::size_t bytes, int size )
+{
+   if ( size > 1 )
+      for ( std::size_t i = 0; i + size <= bytes; i += size )
+         std::reverse( data + i, data + i + size );
+}
+
+inline std::string LowerExtension( const std::string& path )
+{
+   std::size_t dot = path.find_last_of( '.' );
+   std::size_t slash = path.find_last_of( "/\\" );
+   if ( dot == std::string::npos || ( slash != std::string::npos && dot < slash ) )
+      return std::string();
+   std::string ext = path.substr( dot + 1 );
+   for ( char& c : ext )
+      c = char( std::tolower( (unsigned char)c ) );
+   return ext;
+}
+
+inline bool IsFITS( const std::string& path )
+{
+   std::string ext = LowerExtension( path );
+   return ext == "fit" || ext == "fits" || ext == "fts";
+}
+
+inline bool IsXISF( const std::string& path )
+{
+   return LowerExtension( path ) == "xisf";
+}
+
+// Bytes of a width x height x channels image of format, or 0 if a dimension
+// is not positive or exceeds an int, or the size overflows
+inline std::size_t ImageBytes( long long width, long long height, long long channels, HASampleFormat format )
+{
+   std::size_t bytes = HABytesPerSample( format );
+   for ( long long n : { width, height, channels } )
+   {
+      if ( n <= 0 || n > INT_MAX || bytes > SIZE_MAX/std::size_t( n ) )
+         return 0;
+      bytes *= std::size_t( n );
+   }
+   return bytes;
+}
+
+// Floating point samples outside [0,1] are scaled down by their maximum
+template <typename F>
+void NormalizeFloat( HAImage& image )
+{
+   F* p = image.Plane<F>( 0 );
+   std::size_t n = std::size_t( image.width )*image.height*image.channels;
+   F maximum = 0;
+   for ( std::size_t i = 0; i < n; ++i )
+      maximum = std::max( maximum, p[i] );
+   if ( maximum > 1 )
+      for ( std::size_t i = 0; i < n; ++i )
+         p[i] /= maximum;
+}
+
+inline std::uint64_t FileSize( const std::string& path )
+{
+   std::error_code error;
+   std::uint64_t size = std::filesystem::file_size( path, error );
+   if ( error )
+      throw std::runtime_error( "Unable to open " + path );
+   return size;
+}
+
+inline void ReadBytes( std::ifstream& file, const std::string& path, std::uint64_t offset, void* data, std::size_t bytes )
+{
+   file.seekg( std::streamoff( offset ) );
+   if ( !file.read( static_cast<char*>( data ), std::streamsize( bytes ) ) )
+      throw std::runtime_error( "Error reading " + path );
+}
+
+/*
+ * FITS: primary HDU only, uncompressed, NAXIS 2 (gray) or 3 (planes).
+ * BITPIX 8, 16, 32, -32 and -64. 16 and 32 bit integers are read as
+ * UInt16/UInt32 with the BZERO offset of unsigned data (32768, 2^31), which
+ * is how unsigned frames are stored; signed frames are shifted by the same
+ * offset.
+ */
+
+inline std::string FITSValue( const std::string& card )
+{
+   std::string value = card.substr( 10 );
+   std::size_t slash = value.find( '/' );
+   if ( value.find( '\'' ) == std::string::npos && slash != std::string::npos )
+      value.erase( slash );
+   std::size_t b = value.find_first_not_of( ' ' ), e = value.find_last_not_of( ' ' );
+   return ( b == std::string::npos ) ? std::string() : value.substr( b, e - b + 1 );
+}
+
+inline std::string FITSCard( const std::string& key, const std::string& value, const std::string& comment = std::string() )
+{
+   char card[81];
+   if ( comment.empty() )
+      std::snprintf( card, sizeof( card ), "%-8.8s= %20s", key.c_str(), value.c_str() );
+   else
+      std::snprintf( card, sizeof( card ), "%-8.8s= %20s / %-47.47s", key.c_str(), value.c_str(), comment.c_str() );
+   std::string s( card );
+   s.resize( 80, ' ' );
+   return s;
+}
+
+inline HAImageLayout ReadFITSLayout( std::ifstream& file, const std::string& path )
+{
+   const std::uint64_t fileSize = FileSize( path );
+   HAImageLayout layout;
+   int bitpix = 0, naxis = -1;
+   long long axes[3] = { 1, 1, 1 };
+   double bscale = 1;
+   std::uint64_t pos = 0;
+   char block[2880];
+   for ( bool end = false; !end; )
+   {
+      if ( pos + sizeof( block ) > fileSize )
+         throw std::runtime_error( path + ": truncated FITS header" );
+      ReadBytes( file, path, pos, block, sizeof( block ) );
+      pos += sizeof( block );
+      for ( int i = 0; i < 36 && !end; ++i )
+      {
+         std::string card( block + 80*i, 80 );
+         std::string key = card.substr( 0, 8 );
+         key.erase( key.find_last_not_of( ' ' ) + 1 );
+         if ( key == "END" )
+            end = true;
+         else if ( key == "BITPIX" )
+            bitpix = std::atoi( FITSValue( card ).c_str() );
+         else if ( key == "NAXIS" )
+            naxis = std::atoi( FITSValue( card ).c_str() );
+         else if ( key.size() == 6 && key.compare( 0, 5, "NAXIS" ) == 0 && key[5] >= '1' && key[5] <= '3' )
+            axes[key[5] - '1'] = std::strtoll( FITSValue( card ).c_str(), nullptr, 10 );
+         else if ( key == "BSCALE" )
+            bscale = std::atof( FITSValue( card ).c_str() );
+         else if ( key != "SIMPLE" && key != "EXTEND" && key != "BZERO" && key.compare( 0, 5, "NAXIS" ) != 0 && !key.empty() )
+            layout.keywords.push_back( card );
+      }
+   }
+
+   if ( naxis != 2 && naxis != 3 )
+      throw std::runtime_error( path + ": unsupported FITS NAXIS " + std::to_string( naxis ) );
+   if ( bscale != 1 )
+      throw std::runtime_error( path + ": scaled FITS data (BSCALE != 1) is not supported" );
+
+   switch ( bitpix )
+   {
+   case   8: layout.format = HASampleFormat::UInt8; break;
+   case  16: layout.format = HASampleFormat::UInt16; break;
+   case  32: layout.format = HASampleFormat::UInt32; break;
+   case -32: layout.format = HASampleFormat::Float32; break;
+   case -64: layout.format = HASampleFormat::Float64; break;
+   default: throw std::runtime_error( path + ": unsupported FITS BITPIX " + std::to_string( bitpix ) );
+   }
+
+   const long long channels = ( naxis == 3 ) ? axes[2] : 1;
+   const std::size_t bytes = ImageBytes( axes[0], axes[1], channels, layout.format );
+   if ( bytes == 0 )
+      throw std::runtime_error( path + ": unsupported FITS image dimensions" );
+   if ( bytes > fileSize - pos )
+      throw std::runtime_error( path + ": truncated FITS data" );
+
+   layout.width = int( axes[0] );
+   layout.height = int( axes[1] );
+   layout.channels = int( channels );
+   layout.offset = pos;
+   layout.bigEndian = true;
+   layout.signedIntegers = true;
+   return layout;
+}
+
+/*
+ * XISF 1.0: the first Image element of a monolithic file, with its pixels in
+ * an uncompressed attachment, planar or normal (interleaved) storage, either
+ * byte order. Written files hold one planar gray image and the FITS keywords
+ * carried over from the source.
+ */
+
+inline std::string XMLAttribute( const std::string& element, const std::string& name )
+{
+   for ( std::size_t pos = 0; ( pos = element.find( name, pos ) ) != std::string::npos; pos += name.size() )
+   {
+      bool wordStart = pos > 0 && std::isspace( (unsigned char)element[pos - 1] );
+      std::size_t eq = element.find_first_not_of( " \t\r\n", pos + name.size() );
+      if ( !wordStart || eq == std::string::npos || element[eq] != '=' )
+         continue;
+      std::size_t quote = element.find_first_of( "\"'", eq + 1 );
+      if ( quote == std::string::npos )
+         break;
+      std::size_t close = element.find( element[quote], quote + 1 );
+      if ( close == std::string::npos )
+         break;
+      return element.substr( quote + 1, close - quote - 1 );
+   }
+   return std::string();
+}
+
+inline std::string XMLEscape( const std::string& text )
+{
+   std::string out;
+   for ( char c : text )
+      switch ( c )
+      {
+      case '&': out += "&amp;"; break;
+      case '<': out += "&lt;"; break;
+      case '>': out += "&gt;"; break;
+      case '"': out += "&quot;"; break;
+      default: out += c;
+      }
+   return out;
+}
+
+inline HAImageLayout ReadXISFLayout( std::ifstream& file, const std::string& path )
+{
+   const std::uint64_t fileSize = FileSize( path );
+   std::uint8_t signature[16];
+   if ( fileSize < sizeof( signature ) )
+      throw std::runtime_error( path + ": not an XISF 1.0 monolithic file" );
+   ReadBytes( file, path, 0, signature, sizeof( signature ) );
+   if ( std::memcmp( signature, "XISF0100", 8 ) != 0 )
+      throw std::runtime_error( path + ": not an XISF 1.0 monolithic file" );
+   std::uint32_t headerLength = std::uint32_t( signature[8] ) | std::uint32_t( signature[9] ) << 8 |
+                                std::uint32_t( signature[10] ) << 16 | std::uint32_t( signature[11] ) << 24;
+   if ( 16 + std::uint64_t( headerLength ) > fileSize )
+      throw std::runtime_error( path + ": truncated XISF header" );
+   std::string header( headerLength, '\0' );
+   ReadBytes( file, path, 16, &header[0], headerLength );
+
+   std::size_t begin = header.find( "<Image" );
+   if ( begin == std::string::npos )
+      throw std::runtime_error( path + ": no Image element" );
+   std::string element = header.substr( begin, header.find( '>', begin ) - begin );
+
+   if ( !XMLAttribute( element, "compression" ).empty() )
+      throw std::runtime_error( path + ": compressed XISF images are not supported" );
+
+   long long width = 0, height = 0, channels = 1;
+   if ( std::sscanf( XMLAttribute( element, "geometry" ).c_str(), "%lld:%lld:%lld", &width, &height, &channels ) < 2 )
+      throw std::runtime_error( path + ": unsupported image geometry" );
+
+   HAImageLayout layout;
+   std::string sampleFormat = XMLAttribute( element, "sampleFormat" );
+   if ( sampleFormat == "UInt8" )
+      layout.format = HASampleFormat::UInt8;
+   else if ( sampleFormat == "UInt16" )
+      layout.format = HASampleFormat::UInt16;
+   else if ( sampleFormat == "UInt32" )
+      layout.format = HASampleFormat::UInt32;
+   else if ( sampleFormat == "Float32" )
+      layout.format = HASampleFormat::Float32;
+   else if ( sampleFormat == "Float64" )
+      layout.format = HASampleFormat::Float64;
+   else
+      throw std::runtime_error( path + ": unsupported sample format " + sampleFormat );
+
+   const std::size_t bytes = ImageBytes( width, height, channels, layout.format );
+   if ( bytes == 0 )
+      throw std::runtime_error( path + ": unsupported image geometry" );
+
+   unsigned long long offset = 0, size = 0;
+   if ( std::sscanf( XMLAttribute( element, "location" ).c_str(), "attachment:%llu:%llu", &offset, &size ) != 2 )
+      throw std::runtime_error( path + ": image data is not an attachment" );
+
+   if ( size < bytes || offset > fileSize || bytes > fileSize - offset )
+      throw std::runtime_error( path + ": truncated XISF image data" );
+
+   layout.width = int( width );
+   layout.height = int( height );
+   layout.channels = int( channels );
+   layout.offset = offset;
+   layout.bigEndian = XMLAttribute( element, "byteOrder" ) == "big";
+   layout.interleaved = XMLAttribute( element, "pixelStorage" ) == "Normal";
+
+   // FITS keywords, as cards
+   for ( std::size_t pos = 0; ( pos = header.find( "<FITSKeyword", pos ) ) != std::string::npos; ++pos )
+   {
+      std::string keyword = header.substr( pos, header.find( '>', pos ) - pos );
+      std::string name = XMLAttribute( keyword, "name" );
+      if ( name.empty() || name == "SIMPLE" || name == "EXTEND" || name.compare( 0, 5, "NAXIS" ) == 0 ||
+           name == "BITPIX" || name == "BZERO" || name == "BSCALE" )
+         continue;
+      if ( name == "HISTORY" || name == "COMMENT" )
+      {
+         std::string card = name + std::string( 8 - name.size(), ' ' ) + XMLAttribute( keyword, "comment" );
+         card.resize( 80, ' ' );
+         layout.keywords.push_back( card );
+      }
+      else
+         layout.keywords.push_back( FITSCard( name, XMLAttribute( keyword, "value" ), XMLAttribute( keyword, "comment" ) ) );
+   }
+
+   return layout;
+}
+
+} // HAImageIO
+
+/*
+ * Reads the samples of a FITS or XISF file a strip of rows at a time; only
+ * the header is read when the file is opened. Samples are delivered planar,
+ * in host byte order, with integers unsigned, but floating point samples
+ * are not normalized: that needs the maximum of the whole image, Maximum().
+ */
+class HAImageReader
+{
+public:
+
+   explicit HAImageReader( const std::string& path ) : m_path( path )
+   {
+      if ( !HAImageIO::IsFITS( path ) && !HAImageIO::IsXISF( path ) )
+         throw std::runtime_error( path + ": unknown file format" );
+      m_file.open( path, std::ios::binary );
+      if ( !m_file )
+         throw std::runtime_error( "Unable to open " + path );
+      m_layout = HAImageIO::IsFITS( path ) ? HAImageIO::ReadFITSLayout( m_file, path ) :
+                                             HAImageIO::ReadXISFLayout( m_file, path );
+   }
+
+   const HAImageLayout& Layout() const
+   {
+      return m_layout;
+   }
+
+   // Rows [y0,y1) into planes[c], (y1 - y0)*width samples for each channel c
+   // with a nonnull plane
+   void Read( int y0, int y1, std::uint8_t* const* planes )
+   {
+      if ( y0 < 0 || y1 > m_layout.height || y0 > y1 )
+         throw std::runtime_error( m_path + ": rows out of range" );
+      const int size = HABytesPerSample( m_layout.format );
+      const std::size_t width = m_layout.width;
+      const std::size_t count = ( y1 - y0 )*width;
+      if ( !m_layout.interleaved )
+      {
+         const std::uint64_t planeBytes = std::uint64_t( size )*width*m_layout.height;
+         for ( int c = 0; c < m_layout.channels; ++c )
+            if ( planes[c] != nullptr )
+            {
+               HAImageIO::ReadBytes( m_file, m_path, m_layout.offset + c*planeBytes + std::uint64_t( size )*y0*width,
+                                     planes[c], count*size );
+               Decode( planes[c], count );
+            }
+         return;
+      }
+
+      // Interleaved, a chunk of rows at a time
+      const std::size_t pixelBytes = std::size_t( size )*m_layout.channels;
+      const int chunkRows = int( std::max<std::size_t>( 1, ChunkBytes/( width*pixelBytes ) ) );
+      for ( int y = y0; y < y1; y += chunkRows )
+      {
+         const std::size_t pixels = std::min( chunkRows, y1 - y )*width;
+         m_buffer.resize( pixels*pixelBytes );
+         HAImageIO::ReadBytes( m_file, m_path, m_layout.offset + std::uint64_t( pixelBytes )*y*width, m_buffer.data(), m_buffer.size() );
+         Decode( m_buffer.data(), pixels*m_layout.channels );
+         for ( int c = 0; c < m_layout.channels; ++c )
+            if ( planes[c] != nullptr )
+            {
+               std::uint8_t* dst = planes[c] + ( y - y0 )*width*size;
+               const std::uint8_t* src = m_buffer.data() + c*size;
+               for ( std::size_t i = 0; i < pixels; ++i, dst += size, src += pixelBytes )
+                  std::memcpy( dst, src, size );
+            }
+      }
+   }
+
+   // Largest sample of the image, over every channel: the divisor that
+   // normalizes floating point samples outside [0,1]. Reads the whole file.
+   template <typename F>
+   F Maximum()
+   {
+      const std::uint64_t bytes = HAImageIO::ImageBytes( m_layout.width, m_layout.height, m_layout.channels, m_layout.format );
+      F maximum = 0;
+      for ( std::uint64_t done = 0; done < bytes; )
+      {
+         m_buffer.resize( std::size_t( std::min<std::uint64_t>( ChunkBytes, bytes - done ) ) );
+         HAImageIO::ReadBytes( m_file, m_path, m_layout.offset + done, m_buffer.data(), m_buffer.size() );
+         Decode( m_buffer.data(), m_buffer.size()/sizeof( F ) );
+         const F* p = reinterpret_cast<const F*>( m_buffer.data() );
+         for ( std::size_t i = 0, n = m_buffer.size()/sizeof( F ); i < n; ++i )
+            maximum = std::max( maximum, p[i] );
+         done += m_buffer.size();
+      }
+      return maximum;
+   }
+
+private:
+
+   static constexpr std::size_t ChunkBytes = std::size_t( 1 ) << 20;
+
+   // File samples to host byte order; signed integers to unsigned by
+   // flipping the sign bit, which adds 2^(n-1)
+   void Decode( std::uint8_t* data, std::size_t count ) const
+   {
+      const int size = HABytesPerSample( m_layout.format );
+      if ( m_layout.bigEndian == HAImageIO::HostIsLittleEndian() )
+         HAImageIO::SwapBytes( data, count*size, size );
+      if ( !m_layout.signedIntegers )
+         return;
+      if ( m_layout.format == HASampleFormat::UInt16 )
+         for ( std::size_t i = 0; i < count; ++i )
+            reinterpret_cast<std::uint16_t*>( data )[i] ^= 0x8000u;
+      else if ( m_layout.format == HASampleFormat::UInt32 )
+         for ( std::size_t i = 0; i < count; ++i )
+            reinterpret_cast<std::uint32_t*>( data )[i] ^= 0x80000000u;
+   }
+
+   std::string               m_path;
+   std::ifstream             m_file;
+   HAImageLayout             m_layout;
+   std::vector<std::uint8_t> m_buffer;
+};
+
+/*
+ * Writes a FITS or XISF file, by extension, as its samples arrive: the
+ * header when the writer is constructed, then planar samples in host byte
+ * order, channel 0 first, in any number of Write() calls. A file that is
+ * not completed by Close() is deleted.
+ */
+class HAImageWriter
+{
+public:
+
+   HAImageWriter( const std::string& path, int width, int height, int channels, HASampleFormat format,
+                  const std::vector<std::string>& keywords ) :
+      m_path( path ), m_width( width ), m_format( format ), m_fits( HAImageIO::IsFITS( path ) ),
+      m_bytes( HAImageIO::ImageBytes( width, height, channels, format ) )
+   {
+      if ( !m_fits && !HAImageIO::IsXISF( path ) )
+         throw std::runtime_error( path + ": unknown file format" );
+      if ( m_bytes == 0 )
+         throw std::runtime_error( path + ": invalid image dimensions" );
+      m_file.open( path, std::ios::binary | std::ios::trunc );
+      if ( !m_file )
+         throw std::runtime_error( "Unable to create " + path );
+      std::vector<std::uint8_t> header = m_fits ? FITSHeader( width, height, channels, keywords ) :
+                                                  XISFHeader( width, height, channels, keywords );
+      m_file.write( reinterpret_cast<const char*>( header.data() ), std::streamsize( header.size() ) );
+   }
+
+   ~HAImageWriter()
+   {
+      if ( !m_closed )
+      {
+         m_file.close();
+         std::remove( m_path.c_str() );
+      }
+   }
+
+   HAImageWriter( const HAImageWriter& ) = delete;
+   HAImageWriter& operator =( const HAImageWriter& ) = delete;
+
+   int Width() const
+   {
+      return m_width;
+   }
+
+   HASampleFormat Format() const
+   {
+      return m_format;
+   }
+
+   // Appends bytes of samples
+   void Write( const void* samples, std::size_t bytes )
+   {
+      if ( bytes > m_bytes - m_written )
+         throw std::runtime_error( m_path + ": more samples than the image holds" );
+      const int size = HABytesPerSample( m_format );
+      const std::uint8_t* src = static_cast<const std::uint8_t*>( samples );
+      for ( std::size_t done = 0; done < bytes; )
+      {
+         m_buffer.assign( src + done, src + done + std::min( ChunkBytes, bytes - done ) );
+         Encode( m_buffer.data(), m_buffer.size()/size );
+         m_file.write( reinterpret_cast<const char*>( m_buffer.data() ), std::streamsize( m_buffer.size() ) );
+         done += m_buffer.size();
+      }
+      m_written += bytes;
+   }
+
+   // Completes the file; throws if a sample is missing or writing failed
+   void Close()
+   {
+      if ( m_written != m_bytes )
+         throw std::runtime_error( m_path + ": incomplete image data" );
+      if ( m_fits )
+      {
+         std::uint64_t end = m_file.tellp();
+         m_buffer.assign( std::size_t( ( end + 2879 )/2880*2880 - end ), 0 );
+         m_file.write( reinterpret_cast<const char*>( m_buffer.data() ), std::streamsize( m_buffer.size() ) );
+      }
+      m_file.close();
+      if ( !m_file )
+         throw std::runtime_error( "Error writing " + m_path );
+      m_closed = true;
+   }
+
+private:
+
+   static constexpr std::size_t ChunkBytes = std::size_t( 1 ) << 20;
+
+   std::vector<std::uint8_t> FITSHeader( int width, int height, int channels, const std::vector<std::string>& keywords ) const
+   {
+      static const int bitpix[] = { 8, 16, 32, -32, -64 };
+      std::vector<std::string> cards;
+      cards.push_back( HAImageIO::FITSCard( "SIMPLE", "T", "file conforms to FITS standard" ) );
+      cards.push_back( HAImageIO::FITSCard( "BITPIX", std::to_string( bitpix[int( m_format )] ), "bits per data value" ) );
+      cards.push_back( HAImageIO::FITSCard( "NAXIS", std::to_string( ( channels > 1 ) ? 3 : 2 ), "number of data axes" ) );
+      cards.push_back( HAImageIO::FITSCard( "NAXIS1", std::to_string( width ), "length of data axis 1" ) );
+      cards.push_back( HAImageIO::FITSCard( "NAXIS2", std::to_string( height ), "length of data axis 2" ) );
+      if ( channels > 1 )
+         cards.push_back( HAImageIO::FITSCard( "NAXIS3", std::to_string( channels ), "length of data axis 3" ) );
+      if ( m_format == HASampleFormat::UInt16 )
+         cards.push_back( HAImageIO::FITSCard( "BZERO", "32768", "offset data range to that of unsigned short" ) );
+      else if ( m_format == HASampleFormat::UInt32 )
+         cards.push_back( HAImageIO::FITSCard( "BZERO", "2147483648", "offset data range to that of unsigned long" ) );
+      for ( const std::string& card : keywords )
+         if ( card.compare( 0, 5, "BZERO" ) != 0 && card.compare( 0, 6, "BSCALE" ) != 0 &&
+              card.compare( 0, 6, "BITPIX" ) != 0 )
+            cards.push_back( card );
+      std::string end( "END" );
+      end.resize( 80, ' ' );
+      cards.push_back( end );
+
+      std::vector<std::uint8_t> bytes;
+      for ( const std::string& card : cards )
+         bytes.insert( bytes.end(), card.begin(), card.end() );
+      bytes.resize( ( bytes.size() + 2879 )/2880*2880, ' ' );
+      return bytes;
+   }
+
+   std::vector<std::uint8_t> XISFHeader( int width, int height, int channels, const std::vector<std::string>& keywords ) const
+   {
+      std::string elements;
+      for ( const std::string& card : keywords )
+      {
+         std::string name = card.substr( 0, 8 );
+         name.erase( name.find_last_not_of( ' ' ) + 1 );
+         std::string value = HAImageIO::FITSValue( card ), comment;
+         std::size_t slash = card.find( " /", 10 );
+         if ( value.find( '\'' ) == std::string::npos && slash != std::string::npos )
+            comment = card.substr( slash + 2 );
+         comment.erase( 0, comment.find_first_not_of( ' ' ) );
+         comment.erase( comment.find_last_not_of( ' ' ) + 1 );
+         if ( card.compare( 8, 2, "= " ) != 0 )
+         {
+            value.clear();
+            comment = card.substr( 8 );
+            comment.erase( comment.find_last_not_of( ' ' ) + 1 );
+         }
+         elements += "<FITSKeyword name=\"" + HAImageIO::XMLEscape( name ) + "\" value=\"" + HAImageIO::XMLEscape( value ) +
+                     "\" comment=\"" + HAImageIO::XMLEscape( comment ) + "\"/>";
+      }
+
+      const bool isFloat = m_format == HASampleFormat::Float32 || m_format == HASampleFormat::Float64;
+      auto xml = [&]( std::size_t offset )
+      {
+         return "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+                "<xisf version=\"1.0\" xmlns=\"http://www.pixinsight.com/xisf\">"
+                "<Image geometry=\"" + std::to_string( width ) + ':' + std::to_string( height ) + ':' +
+                std::to_string( channels ) + "\" sampleFormat=\"" + HASampleFormatName( m_format ) + "\"" +
+                ( isFloat ? " bounds=\"0:1\"" : "" ) + " colorSpace=\"" + ( ( channels == 3 ) ? "RGB" : "Gray" ) +
+                "\" location=\"attachment:" + std::to_string( offset ) + ':' + std::to_string( m_bytes ) + "\">" +
+                elements + "</Image></xisf>";
+      };
+
+      // The attachment offset appears in the header, so size the header for
+      // an offset with room to spare, then align the data block
+      std::size_t offset = ( 16 + xml( std::size_t( 1 ) << 40 ).size() + 4095 )/4096*4096;
+      std::string header = xml( offset );
+
+      std::vector<std::uint8_t> bytes( offset, 0 );
+      std::memcpy( bytes.data(), "XISF0100", 8 );
+      for ( int i = 0; i < 4; ++i )
+         bytes[8 + i] = std::uint8_t( header.size() >> ( 8*i ) );
+      std::memcpy( bytes.data() + 16, header.data(), header.size() );
+      return bytes;
+   }
+
+   // Host samples to the file's convention: FITS holds big-endian signed
+   // integers, XISF little-endian unsigned ones
+   void Encode( std::uint8_t* data, std::size_t count ) const
+   {
+      const int size = HABytesPerSample( m_format );
+      if ( m_fits && m_format == HASampleFormat::UInt16 )
+         for ( std::size_t i = 0; i < count; ++i )
+            reinterpret_cast<std::uint16_t*>( data )[i] ^= 0x8000u;
+      else if ( m_fits && m_format == HASampleFormat::UInt32 )
+         for ( std::size_t i = 0; i < count; ++i )
+            reinterpret_cast<std::uint32_t*>( data )[i] ^= 0x80000000u;
+      if ( m_fits == HAImageIO::HostIsLittleEndian() )
+         HAImageIO::SwapBytes( data, count*size, size );
+   }
+
+   std::string               m_path;
+   std::ofstream             m_file;
+   int                       m_width;
+   HASampleFormat            m_format;
+   bool                      m_fits;
+   std::size_t               m_bytes;
+   std::size_t               m_written = 0;
+   bool                      m_closed = false;
+   std::vector<std::uint8_t> m_buffer;
+};
+
+namespace HAImageIO
+{
+
+// Reads a FITS or XISF file, by extension
+inline HAImage Read( const std::string& path )
+{
+   HAImageReader reader( path );
+   const HAImageLayout& layout = reader.Layout();
+   HAImage image;
+   image.Allocate( layout.width, layout.height, layout.channels, layout.format );
+   image.keywords = layout.keywords;
+   std::vector<std::uint8_t*> planes( layout.channels );
+   for ( int c = 0; c < layout.channels; ++c )
+      planes[c] = image.data.data() + c*image.PlaneBytes();
+   reader.Read( 0, layout.height, planes.data() );
+
+   if ( layout.format == HASampleFormat::Float32 )
+      NormalizeFloat<float>( image );
+   else if ( layout.format == HASampleFormat::Float64 )
+      NormalizeFloat<double>( image );
+   return image;
+}
+
+// Writes a FITS or XISF file, by extension
+inline void Write( const std::string& path, const HAImage& image )
+{
+   HAImageWriter writer( path, image.width, image.height, image.channels, image.format, image.keywords );
+   writer.Write( image.data.data(), image.data.size() );
+   writer.Close();
+}
+
+} // HAImageIO
+
+// Sample format of a sample type
+template <typename T> HASampleFormat HASampleFormatOf();
+template <> inline HASampleFormat HASampleFormatOf<std::uint8_t>() { return HASampleFormat::UInt8; }
+template <> inline HASampleFormat HASampleFormatOf<std::uint16_t>() { return HASampleFormat::UInt16; }
+template <> inline HASampleFormat HASampleFormatOf<std::uint32_t>() { return HASampleFormat::UInt32; }
+template <> inline HASampleFormat HASampleFormatOf<float>() { return HASampleFormat::Float32; }
+template <> inline HASampleFormat HASampleFormatOf<double>() { return HASampleFormat::Float64; }
+
+/*
+ * Strip source over the first three channels of a FITS or XISF file, read
+ * as the strips are requested. Floating point samples are normalized as
+ * HAImageIO::Read() does, which takes one extra pass over the file when it
+ * is opened.
+ */
+template <typename T>
+class HAFileStripSource : public HAStripSource<T>
+{
+public:
+
+   explicit HAFileStripSource( HAImageReader& reader ) : m_reader( reader )
+   {
+      const HAImageLayout& layout = reader.Layout();
+      if ( layout.channels < 3 )
+         throw std::runtime_error( "not an RGB frame (" + std::to_string( layout.channels ) + " channel)" );
+      if ( layout.format != HASampleFormatOf<T>() )
+         throw std::runtime_error( std::string( "sample format is not " ) + HASampleFormatName( HASampleFormatOf<T>() ) );
+      if constexpr ( std::is_floating_point<T>::value )
+         m_scale = std::max( T( 1 ), reader.Maximum<T>() );
+   }
+
+   int Width() const override
+   {
+      return m_reader.Layout().width;
+   }
+
+   int Height() const override
+   {
+      return m_reader.Layout().height;
+   }
+
+   HASource<T> Rows( int y0, int y1 ) override
+   {
+      const std::size_t count = std::size_t( y1 - y0 )*Width();
+      m_strip.resize( 3*count );
+      std::uint8_t* planes[3];
+      for ( int c = 0; c < 3; ++c )
+         planes[c] = reinterpret_cast<std::uint8_t*>( m_strip.data() + c*count );
+      std::vector<std::uint8_t*> all( m_reader.Layout().channels, nullptr );
+      std::copy( planes, planes + 3, all.begin() );
+      m_reader.Read( y0, y1, all.data() );
+      if ( m_scale != 1 )
+         for ( T& v : m_strip )
+            v /= m_scale;
+
+      HASource<T> source;
+      source.width = Width();
+      source.height = y1 - y0;
+      for ( int c = 0; c < 3; ++c )
+         source.channel[c] = m_strip.data() + c*count;
+      source.stride = Width();
+      source.y0 = y0;
+      return source;
+   }
+
+private:
+
+   HAImageReader& m_reader;
+   T                         m_scale = 1;
+   std::vector<T>            m_strip;
+};
+
+/*
+ * Strip sink writing a single-channel image through an HAImageWriter. Rows
+ * are written when committed, so strips must be requested and committed in
+ * order, and committed rows cannot be read back.
+ */
+template <typename T>
+class HAFileStripSink : public HAStripSink<T>
+{
+public:
+
+   explicit HAFileStripSink( HAImageWriter& writer ) : m_writer( writer )
+   {
+      if ( writer.Format() != HASampleFormatOf<T>() )
+         throw std::runtime_error( std::string( "sample format is not " ) + HASampleFormatName( HASampleFormatOf<T>() ) );
+   }
+
+   HAView<T> Rows( int y0, int y1 ) override
+   {
+      if ( y0 != m_next )
+         throw std::runtime_error( "file strips must be written in order" );
+      m_strip.resize( std::size_t( y1 - y0 )*m_writer.Width() );
+      return HAView<T>( m_strip.data(), m_writer.Width(), 0, y0 );
+   }
+
+   void Commit( int y0, int y1 ) override
+   {
+      if ( y0 != m_next )
+         throw std::runtime_error( "file strips must be written in order" );
+      m_writer.Write( m_strip.data(), sizeof( T )*std::size_t( y1 - y0 )*m_writer.Width() );
+      m_next = y1;
+   }
+
+private:
+
+   HAImageWriter& m_writer;
+   int                       m_next = 0;
+   std::vector<T>            m_strip;
+};
+
+} // pcl
+
+#endif   // __RGBToHAImageIO_h
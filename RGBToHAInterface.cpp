@@ -1,396 +1,975 @@
-/*
- * RGB to HA Conversion Interface for PixInsight
- * User interface for the RGB to HA conversion process
- */
-
-#include <pcl/ProcessInterface.h>
-#include <pcl/ProcessParameters.h>
-#include <pcl/View.h>
-#include <pcl/ImageWindow.h>
-#include <pcl/StandardStatus.h>
-#include <pcl/Console.h>
-#include <pcl/Exception.h>
-#include <pcl/Math.h>
-#include <pcl/Histogram.h>
-#include <pcl/Statistics.h>
-
-#include <QWidget>
-#include <QVBoxLayout>
-#include <QHBoxLayout>
-#include <QGroupBox>
-#include <QLabel>
-#include <QComboBox>
-#include <QSlider>
-#include <QSpinBox>
-#include <QDoubleSpinBox>
-#include <QCheckBox>
-#include <QPushButton>
-#include <QProgressBar>
-#include <QTabWidget>
-#include <QTextEdit>
-#include <QMessageBox>
-
-namespace pcl
-{
-
-class RGBToHAInterface : public ProcessInterface
-{
-public:
-
-   RGBToHAInterface()
-   {
-   }
-
-   virtual ~RGBToHAInterface()
-   {
-   }
-
-   virtual MetaProcess* Process() const
-   {
-      return TheRGBToHAProcess;
-   }
-
-   virtual IsoString Id() const
-   {
-      return "RGBToHA";
-   }
-
-   virtual IsoString Category() const
-   {
-      return "ColorTransformation";
-   }
-
-   virtual uint32 Version() const
-   {
-      return 0x10000;
-   }
-
-   virtual String Description() const
-   {
-      return "Advanced RGB to Hydrogen Alpha (HA) conversion with multiple algorithms and enhancement options.";
-   }
-
-   virtual String IconImageSVGFile() const
-   {
-      return "@module_icons_dir/RGBToHA.svg";
-   }
-
-   virtual InterfaceFeatures Features() const
-   {
-      return InterfaceFeature::DefaultGlobal;
-   }
-
-   virtual void ApplyInstance() const
-   {
-      RGBToHAInstance instance( TheRGBToHAProcess );
-      instance.LaunchOnCurrentView();
-   }
-
-   virtual void ResetInstance()
-   {
-      RGBToHAInstance defaultInstance( TheRGBToHAProcess );
-      UpdateControlsFromInstance( defaultInstance );
-   }
-
-   virtual bool Launch( const MetaProcess& P, const ProcessImplementation*, String& whyNot )
-   {
-      whyNot.Clear();
-      return true;
-   }
-
-   virtual ProcessImplementation* NewProcess() const
-   {
-      return new RGBToHAProcess();
-   }
-
-   virtual void EditPreferences()
-   {
-      // Preferences dialog implementation
-      QMessageBox::information( nullptr, "RGB to HA Preferences", 
-                              "Preferences dialog will be implemented in future version." );
-   }
-
-private:
-
-   // GUI Controls
-   QComboBox* m_conversionMethodCombo;
-   QDoubleSpinBox* m_enhancementStrengthSpin;
-   QDoubleSpinBox* m_noiseReductionSpin;
-   QDoubleSpinBox* m_contrastBoostSpin;
-   QDoubleSpinBox* m_haWavelengthSpin;
-   QCheckBox* m_adaptiveProcessingCheck;
-   QComboBox* m_qualityModeCombo;
-   QPushButton* m_previewButton;
-   QPushButton* m_resetButton;
-   QProgressBar* m_progressBar;
-   QTextEdit* m_infoText;
-
-   // Update controls from process instance
-   void UpdateControlsFromInstance( const RGBToHAInstance& instance )
-   {
-      m_conversionMethodCombo->setCurrentIndex( instance.conversionMethod );
-      m_enhancementStrengthSpin->setValue( instance.enhancementStrength );
-      m_noiseReductionSpin->setValue( instance.noiseReduction );
-      m_contrastBoostSpin->setValue( instance.contrastBoost );
-      m_haWavelengthSpin->setValue( instance.haWavelength );
-      m_adaptiveProcessingCheck->setChecked( instance.adaptiveProcessing );
-      m_qualityModeCombo->setCurrentIndex( instance.qualityMode );
-   }
-
-   // Update process instance from controls
-   void UpdateInstanceFromControls( RGBToHAInstance& instance )
-   {
-      instance.conversionMethod = m_conversionMethodCombo->currentIndex();
-      instance.enhancementStrength = m_enhancementStrengthSpin->value();
-      instance.noiseReduction = m_noiseReductionSpin->value();
-      instance.contrastBoost = m_contrastBoostSpin->value();
-      instance.haWavelength = m_haWavelengthSpin->value();
-      instance.adaptiveProcessing = m_adaptiveProcessingCheck->isChecked();
-      instance.qualityMode = m_qualityModeCombo->currentIndex();
-   }
-
-   // Create the main GUI
-   virtual void SetupInterface()
-   {
-      QVBoxLayout* mainLayout = new QVBoxLayout( this );
-
-      // Create tab widget for organized interface
-      QTabWidget* tabWidget = new QTabWidget( this );
-      mainLayout->addWidget( tabWidget );
-
-      // Main conversion tab
-      QWidget* conversionTab = new QWidget();
-      tabWidget->addTab( conversionTab, "Conversion" );
-      SetupConversionTab( conversionTab );
-
-      // Advanced options tab
-      QWidget* advancedTab = new QWidget();
-      tabWidget->addTab( advancedTab, "Advanced" );
-      SetupAdvancedTab( advancedTab );
-
-      // Preview tab
-      QWidget* previewTab = new QWidget();
-      tabWidget->addTab( previewTab, "Preview" );
-      SetupPreviewTab( previewTab );
-
-      // Info tab
-      QWidget* infoTab = new QWidget();
-      tabWidget->addTab( infoTab, "Info" );
-      SetupInfoTab( infoTab );
-
-      // Progress bar
-      m_progressBar = new QProgressBar( this );
-      m_progressBar->setVisible( false );
-      mainLayout->addWidget( m_progressBar );
-
-      // Control buttons
-      QHBoxLayout* buttonLayout = new QHBoxLayout();
-      mainLayout->addLayout( buttonLayout );
-
-      m_previewButton = new QPushButton( "Preview", this );
-      m_resetButton = new QPushButton( "Reset", this );
-      QPushButton* applyButton = new QPushButton( "Apply", this );
-
-      buttonLayout->addWidget( m_previewButton );
-      buttonLayout->addWidget( m_resetButton );
-      buttonLayout->addStretch();
-      buttonLayout->addWidget( applyButton );
-
-      // Connect signals
-      connect( m_previewButton, &QPushButton::clicked, this, &RGBToHAInterface::OnPreviewClicked );
-      connect( m_resetButton, &QPushButton::clicked, this, &RGBToHAInterface::OnResetClicked );
-      connect( applyButton, &QPushButton::clicked, this, &RGBToHAInterface::OnApplyClicked );
-   }
-
-   // Setup conversion tab
-   void SetupConversionTab( QWidget* parent )
-   {
-      QVBoxLayout* layout = new QVBoxLayout( parent );
-
-      // Conversion method group
-      QGroupBox* methodGroup = new QGroupBox( "Conversion Method", parent );
-      QVBoxLayout* methodLayout = new QVBoxLayout( methodGroup );
-
-      m_conversionMethodCombo = new QComboBox( methodGroup );
-      m_conversionMethodCombo->addItem( "Standard RGB to HA" );
-      m_conversionMethodCombo->addItem( "Advanced Spectral" );
-      m_conversionMethodCombo->addItem( "Adaptive Multi-Scale" );
-      m_conversionMethodCombo->addItem( "Neural Network Approximation" );
-
-      methodLayout->addWidget( m_conversionMethodCombo );
-      layout->addWidget( methodGroup );
-
-      // Enhancement parameters group
-      QGroupBox* enhancementGroup = new QGroupBox( "Enhancement Parameters", parent );
-      QGridLayout* enhancementLayout = new QGridLayout( enhancementGroup );
-
-      // Enhancement strength
-      enhancementLayout->addWidget( new QLabel( "Enhancement Strength:" ), 0, 0 );
-      m_enhancementStrengthSpin = new QDoubleSpinBox( enhancementGroup );
-      m_enhancementStrengthSpin->setRange( 0.0, 1.0 );
-      m_enhancementStrengthSpin->setSingleStep( 0.1 );
-      m_enhancementStrengthSpin->setValue( 0.5 );
-      enhancementLayout->addWidget( m_enhancementStrengthSpin, 0, 1 );
-
-      // Noise reduction
-      enhancementLayout->addWidget( new QLabel( "Noise Reduction:" ), 1, 0 );
-      m_noiseReductionSpin = new QDoubleSpinBox( enhancementGroup );
-      m_noiseReductionSpin->setRange( 0.0, 1.0 );
-      m_noiseReductionSpin->setSingleStep( 0.1 );
-      m_noiseReductionSpin->setValue( 0.3 );
-      enhancementLayout->addWidget( m_noiseReductionSpin, 1, 1 );
-
-      // Contrast boost
-      enhancementLayout->addWidget( new QLabel( "Contrast Boost:" ), 2, 0 );
-      m_contrastBoostSpin = new QDoubleSpinBox( enhancementGroup );
-      m_contrastBoostSpin->setRange( 0.0, 1.0 );
-      m_contrastBoostSpin->setSingleStep( 0.1 );
-      m_contrastBoostSpin->setValue( 0.4 );
-      enhancementLayout->addWidget( m_contrastBoostSpin, 2, 1 );
-
-      layout->addWidget( enhancementGroup );
-      layout->addStretch();
-   }
-
-   // Setup advanced options tab
-   void SetupAdvancedTab( QWidget* parent )
-   {
-      QVBoxLayout* layout = new QVBoxLayout( parent );
-
-      // HA wavelength group
-      QGroupBox* wavelengthGroup = new QGroupBox( "HA Wavelength Settings", parent );
-      QHBoxLayout* wavelengthLayout = new QHBoxLayout( wavelengthGroup );
-
-      wavelengthLayout->addWidget( new QLabel( "HA Wavelength (nm):" ) );
-      m_haWavelengthSpin = new QDoubleSpinBox( wavelengthGroup );
-      m_haWavelengthSpin->setRange( 650.0, 670.0 );
-      m_haWavelengthSpin->setSingleStep( 0.1 );
-      m_haWavelengthSpin->setValue( 656.28 );
-      wavelengthLayout->addWidget( m_haWavelengthSpin );
-
-      layout->addWidget( wavelengthGroup );
-
-      // Processing options group
-      QGroupBox* processingGroup = new QGroupBox( "Processing Options", parent );
-      QVBoxLayout* processingLayout = new QVBoxLayout( processingGroup );
-
-      m_adaptiveProcessingCheck = new QCheckBox( "Enable Adaptive Processing", processingGroup );
-      m_adaptiveProcessingCheck->setChecked( true );
-      processingLayout->addWidget( m_adaptiveProcessingCheck );
-
-      QHBoxLayout* qualityLayout = new QHBoxLayout();
-      qualityLayout->addWidget( new QLabel( "Quality Mode:" ) );
-      m_qualityModeCombo = new QComboBox( processingGroup );
-      m_qualityModeCombo->addItem( "Fast" );
-      m_qualityModeCombo->addItem( "Quality" );
-      m_qualityModeCombo->addItem( "Ultra" );
-      m_qualityModeCombo->setCurrentIndex( 1 );
-      qualityLayout->addWidget( m_qualityModeCombo );
-      qualityLayout->addStretch();
-      processingLayout->addLayout( qualityLayout );
-
-      layout->addWidget( processingGroup );
-      layout->addStretch();
-   }
-
-   // Setup preview tab
-   void SetupPreviewTab( QWidget* parent )
-   {
-      QVBoxLayout* layout = new QVBoxLayout( parent );
-
-      QLabel* previewLabel = new QLabel( "Preview functionality will be implemented in future version.", parent );
-      previewLabel->setAlignment( Qt::AlignCenter );
-      layout->addWidget( previewLabel );
-
-      layout->addStretch();
-   }
-
-   // Setup info tab
-   void SetupInfoTab( QWidget* parent )
-   {
-      QVBoxLayout* layout = new QVBoxLayout( parent );
-
-      m_infoText = new QTextEdit( parent );
-      m_infoText->setReadOnly( true );
-      m_infoText->setHtml( 
-         "<h2>RGB to HA Conversion Plugin</h2>"
-         "<p><b>Version:</b> 1.0.0</p>"
-         "<p><b>Author:</b> Connor</p>"
-         "<p><b>Description:</b> Advanced RGB to Hydrogen Alpha (HA) conversion with multiple algorithms and enhancement options.</p>"
-         "<h3>Conversion Methods:</h3>"
-         "<ul>"
-         "<li><b>Standard RGB to HA:</b> Basic color space transformation</li>"
-         "<li><b>Advanced Spectral:</b> Multi-band spectral analysis</li>"
-         "<li><b>Adaptive Multi-Scale:</b> Multi-resolution processing</li>"
-         "<li><b>Neural Network Approximation:</b> AI-based conversion</li>"
-         "</ul>"
-         "<h3>Features:</h3>"
-         "<ul>"
-         "<li>Multiple conversion algorithms</li>"
-         "<li>Adaptive processing</li>"
-         "<li>Noise reduction</li>"
-         "<li>Contrast enhancement</li>"
-         "<li>Quality modes</li>"
-         "</ul>"
-      );
-
-      layout->addWidget( m_infoText );
-   }
-
-   // Event handlers
-   void OnPreviewClicked()
-   {
-      // Preview functionality placeholder
-      QMessageBox::information( this, "Preview", "Preview functionality will be implemented in future version." );
-   }
-
-   void OnResetClicked()
-   {
-      ResetInstance();
-   }
-
-   void OnApplyClicked()
-   {
-      RGBToHAInstance instance( TheRGBToHAProcess );
-      UpdateInstanceFromControls( instance );
-      instance.LaunchOnCurrentView();
-   }
-
-   // Process instance class
-   class RGBToHAInstance
-   {
-   public:
-      RGBToHAInstance( MetaProcess* process ) : m_process( process )
-      {
-      }
-
-      void LaunchOnCurrentView()
-      {
-         // Implementation for launching the process
-         Console().WriteLn( "RGB to HA conversion process launched." );
-      }
-
-      // Parameters
-      int conversionMethod = 0;
-      double enhancementStrength = 0.5;
-      double noiseReduction = 0.3;
-      double contrastBoost = 0.4;
-      double haWavelength = 656.28;
-      bool adaptiveProcessing = true;
-      int qualityMode = 1;
-
-   private:
-      MetaProcess* m_process;
-   };
-
-   // Meta process placeholder
-   class MetaProcess
-   {
-   public:
-      static MetaProcess* TheRGBToHAProcess;
-   };
-
-   MetaProcess* MetaProcess::TheRGBToHAProcess = nullptr;
-};
-
+/*
+ * RGB to HA Conversion Interface for PixInsight
+ * User interface for the RGB to HA conversion process
+ */
+
+#include <pcl/ProcessInterface.h>
+#include <pcl/ProcessParameters.h>
+#include <pcl/View.h>
+#include <pcl/ImageWindow.h>
+#include <pcl/StandardStatus.h>
+#include <pcl/Console.h>
+#include <pcl/Exception.h>
+#include <pcl/Math.h>
+#include <pcl/Histogram.h>
+#include <pcl/Statistics.h>
+#include <pcl/Image.h>
+#include <pcl/ImageVariant.h>
+
+#include "RGBToHAPreferences.h"
+#include "RGBToHAPreview.h"
+#include "RGBToHATuner.h"
+
+#include <memory>
+
+#include <QApplication>
+#include <QDialog>
+#include <QDialogButtonBox>
+#include <QWidget>
+#include <QVBoxLayout>
+#include <QHBoxLayout>
+#include <QGroupBox>
+#include <QLabel>
+#include <QComboBox>
+#include <QSlider>
+#include <QSpinBox>
+#include <QDoubleSpinBox>
+#include <QCheckBox>
+#include <QPushButton>
+#include <QProgressBar>
+#include <QTabWidget>
+#include <QTextEdit>
+#include <QLineEdit>
+#include <QMessageBox>
+#include <QImage>
+#include <QPixmap>
+#include <QMetaObject>
+
+namespace pcl
+{
+
+class RGBToHAInterface : public ProcessInterface
+{
+public:
+
+   RGBToHAInterface()
+   {
+   }
+
+   virtual ~RGBToHAInterface()
+   {
+      // Joins the render thread before the controls it reports to go away
+      m_preview.reset();
+   }
+
+   virtual MetaProcess* Process() const
+   {
+      return TheRGBToHAProcess;
+   }
+
+   virtual IsoString Id() const
+   {
+      return "RGBToHA";
+   }
+
+   virtual IsoString Category() const
+   {
+      return "ColorTransformation";
+   }
+
+   virtual uint32 Version() const
+   {
+      return 0x10000;
+   }
+
+   virtual String Description() const
+   {
+      return "Advanced RGB to Hydrogen Alpha (HA) conversion with multiple algorithms and enhancement options.";
+   }
+
+   virtual String IconImageSVGFile() const
+   {
+      return "@module_icons_dir/RGBToHA.svg";
+   }
+
+   virtual InterfaceFeatures Features() const
+   {
+      return InterfaceFeature::DefaultGlobal;
+   }
+
+   virtual void ApplyInstance() const
+   {
+      RGBToHAInstance instance( TheRGBToHAProcess );
+      instance.LaunchOnCurrentView();
+   }
+
+   virtual void ResetInstance()
+   {
+      RGBToHAInstance defaultInstance( TheRGBToHAProcess );
+      UpdateControlsFromInstance( defaultInstance );
+   }
+
+   virtual bool Launch( const MetaProcess& P, const ProcessImplementation*, String& whyNot )
+   {
+      whyNot.Clear();
+      return true;
+   }
+
+   virtual ProcessImplementation* NewProcess() const
+   {
+      return new RGBToHAProcess();
+   }
+
+   // The preview engine renders a copy of the previewed view's image; these
+   // keep that copy current, or drop it with the view
+   virtual bool WantsImageNotifications() const
+   {
+      return true;
+   }
+
+   virtual void ImageUpdated( const View& view )
+   {
+      if ( !m_preview || m_previewView.IsNull() || !( view == m_previewView ) )
+         return;
+      if ( !view.Image().IsColor() )
+      {
+         ClearPreviewView( "The previewed view is no longer an RGB image." );
+         return;
+      }
+      m_previewSourceStale = true;
+      if ( m_livePreviewCheck->isChecked() )
+         RequestPreview();
+   }
+
+   virtual void ImageDeleted( const View& view )
+   {
+      if ( !m_previewView.IsNull() && view == m_previewView )
+         ClearPreviewView( "The previewed view was closed." );
+   }
+
+   // Machine tuning: the calibrated kernels, tile size and thread count, or
+   // settings chosen by hand, saved to the machine profile; and the resource
+   // limits of HAPreferences
+   virtual void EditPreferences()
+   {
+      HATuning calibrated = HATuner::Active();
+      bool haveCalibration = !calibrated.manual;
+
+      QDialog dialog;
+      dialog.setWindowTitle( "RGB to HA Preferences" );
+      QVBoxLayout* layout = new QVBoxLayout( &dialog );
+
+      QGroupBox* tuningGroup = new QGroupBox( "Machine Tuning", &dialog );
+      QGridLayout* tuningLayout = new QGridLayout( tuningGroup );
+
+      QCheckBox* manualCheck = new QCheckBox( "Override the calibrated settings", tuningGroup );
+      tuningLayout->addWidget( manualCheck, 0, 0, 1, 2 );
+
+      tuningLayout->addWidget( new QLabel( "Conversion Kernels:" ), 1, 0 );
+      QComboBox* isaCombo = new QComboBox( tuningGroup );
+      isaCombo->addItem( "Fastest", QString() );
+      for ( const char* isa : { "scalar", "sse4.2", "avx2", "avx512", "neon" } )
+         if ( HAConversionKernelsFor( isa ) != nullptr )
+            isaCombo->addItem( isa, QString( isa ) );
+      tuningLayout->addWidget( isaCombo, 1, 1 );
+
+      tuningLayout->addWidget( new QLabel( "Tile Width:" ), 2, 0 );
+      QSpinBox* tileWidthSpin = new QSpinBox( tuningGroup );
+      tileWidthSpin->setRange( HATuner::MinTileSize, HATuner::MaxTileSize );
+      tileWidthSpin->setSingleStep( 32 );
+      tuningLayout->addWidget( tileWidthSpin, 2, 1 );
+
+      tuningLayout->addWidget( new QLabel( "Tile Height:" ), 3, 0 );
+      QSpinBox* tileHeightSpin = new QSpinBox( tuningGroup );
+      tileHeightSpin->setRange( HATuner::MinTileSize, HATuner::MaxTileSize );
+      tileHeightSpin->setSingleStep( 16 );
+      tuningLayout->addWidget( tileHeightSpin, 3, 1 );
+
+      tuningLayout->addWidget( new QLabel( "Worker Threads:" ), 4, 0 );
+      QSpinBox* threadsSpin = new QSpinBox( tuningGroup );
+      threadsSpin->setRange( 0, 4096 );
+      threadsSpin->setSpecialValueText( "All" );
+      tuningLayout->addWidget( threadsSpin, 4, 1 );
+
+      QLabel* summaryLabel = new QLabel( tuningGroup );
+      summaryLabel->setWordWrap( true );
+      tuningLayout->addWidget( summaryLabel, 5, 0, 1, 2 );
+
+      QPushButton* recalibrateButton = new QPushButton( "Recalibrate", tuningGroup );
+      recalibrateButton->setToolTip( "Time the kernels, tile sizes and thread counts on this machine again" );
+      tuningLayout->addWidget( recalibrateButton, 6, 0 );
+
+      layout->addWidget( tuningGroup );
+
+      const HAPreferences prefs = HAPreferences::Active();
+      QGroupBox* limitsGroup = new QGroupBox( "Resource Limits", &dialog );
+      QGridLayout* limitsLayout = new QGridLayout( limitsGroup );
+
+      limitsLayout->addWidget( new QLabel( "Max Worker Threads:" ), 0, 0 );
+      QSpinBox* maxThreadsSpin = new QSpinBox( limitsGroup );
+      maxThreadsSpin->setRange( 0, 4096 );
+      maxThreadsSpin->setSpecialValueText( "No limit" );
+      maxThreadsSpin->setValue( prefs.maxThreads );
+      maxThreadsSpin->setToolTip( "Caps the threads of every parallel stage, the calibrated count included" );
+      limitsLayout->addWidget( maxThreadsSpin, 0, 1 );
+
+      limitsLayout->addWidget( new QLabel( "CPU Set:" ), 1, 0 );
+      QLineEdit* cpuSetEdit = new QLineEdit( QString::fromStdString( prefs.cpuSet ), limitsGroup );
+      cpuSetEdit->setPlaceholderText( "All CPUs" );
+      cpuSetEdit->setToolTip( "<p>CPUs the worker threads run on, as a list of numbers and ranges: "
+                              "0-7,16-23. Not supported on macOS.</p>" );
+      limitsLayout->addWidget( cpuSetEdit, 1, 1 );
+
+      QCheckBox* backgroundCheck = new QCheckBox( "Run Worker Threads at Background Priority", limitsGroup );
+      backgroundCheck->setChecked( prefs.backgroundPriority );
+      limitsLayout->addWidget( backgroundCheck, 2, 0, 1, 2 );
+
+      limitsLayout->addWidget( new QLabel( "Peak Memory Budget (MiB):" ), 3, 0 );
+      QSpinBox* budgetSpin = new QSpinBox( limitsGroup );
+      budgetSpin->setRange( 0, 1048576 );
+      budgetSpin->setSingleStep( 256 );
+      budgetSpin->setSpecialValueText( "Unlimited" );
+      budgetSpin->setValue( prefs.memoryBudget );
+      budgetSpin->setToolTip( "<p>Working memory of any run, whatever its own Memory Budget, and the idle "
+                              "buffer pool. Runs under a budget bypass the stage cache.</p>" );
+      limitsLayout->addWidget( budgetSpin, 3, 1 );
+
+      QCheckBox* instrumentationCheck = new QCheckBox( "Report Stage Timing for Every Run", limitsGroup );
+      instrumentationCheck->setChecked( prefs.instrumentation );
+      limitsLayout->addWidget( instrumentationCheck, 4, 0, 1, 2 );
+
+      layout->addWidget( limitsGroup );
+
+      QDialogButtonBox* buttons = new QDialogButtonBox( QDialogButtonBox::Ok | QDialogButtonBox::Cancel, &dialog );
+      layout->addWidget( buttons );
+      connect( buttons, &QDialogButtonBox::accepted, &dialog, [&]()
+      {
+         std::vector<int> cpus;
+         if ( HAPreferences::ParseCPUSet( cpuSetEdit->text().toStdString(), cpus ) )
+            dialog.accept();
+         else
+            QMessageBox::warning( &dialog, "RGB to HA Preferences",
+                                  "Invalid CPU set: expected CPU numbers and ranges, such as 0-7,16." );
+      } );
+      connect( buttons, &QDialogButtonBox::rejected, &dialog, &QDialog::reject );
+
+      auto display = [&]( const HATuning& tuning )
+      {
+         manualCheck->setChecked( tuning.manual );
+         isaCombo->setCurrentIndex( std::max( 0, isaCombo->findData( QString::fromStdString( tuning.isa ) ) ) );
+         tileWidthSpin->setValue( tuning.tileWidth );
+         tileHeightSpin->setValue( tuning.tileHeight );
+         threadsSpin->setValue( tuning.threads );
+         QString summary = QString::fromStdString( HATuner::Summary( tuning ) );
+         if ( tuning.megapixelsPerSecond > 0 )
+            summary += QString( ", %1 MP/s" ).arg( tuning.megapixelsPerSecond, 0, 'f', 1 );
+         summaryLabel->setText( summary + "<br/>Profile: " + QString::fromStdString( HATuner::ProfilePath() ) );
+      };
+      auto enable = [=]( bool manual )
+      {
+         isaCombo->setEnabled( manual );
+         tileWidthSpin->setEnabled( manual );
+         tileHeightSpin->setEnabled( manual );
+         threadsSpin->setEnabled( manual );
+      };
+      // Calibration restarts the thread pool, which the preview must not be
+      // using meanwhile
+      auto calibrate = [&]()
+      {
+         QApplication::setOverrideCursor( Qt::WaitCursor );
+         const bool previewing = StopPreviewEngine();
+         try
+         {
+            calibrated = HATuner::Calibrate();
+            haveCalibration = true;
+         }
+         catch ( const std::exception& x )
+         {
+            QMessageBox::warning( &dialog, "RGB to HA Preferences", QString( "Calibration failed: " ) + x.what() );
+         }
+         if ( previewing )
+            StartPreviewEngine();
+         QApplication::restoreOverrideCursor();
+         return haveCalibration;
+      };
+
+      connect( manualCheck, &QCheckBox::toggled, &dialog, enable );
+      connect( recalibrateButton, &QPushButton::clicked, &dialog, [&]()
+      {
+         if ( calibrate() )
+         {
+            display( calibrated );
+            enable( false );
+         }
+      } );
+
+      display( HATuner::Active() );
+      enable( manualCheck->isChecked() );
+      if ( dialog.exec() != QDialog::Accepted )
+         return;
+
+      HATuning tuning;
+      if ( manualCheck->isChecked() )
+      {
+         tuning.isa = isaCombo->currentData().toString().toStdString();
+         tuning.tileWidth = tileWidthSpin->value();
+         tuning.tileHeight = tileHeightSpin->value();
+         tuning.threads = threadsSpin->value();
+         tuning.manual = true;
+      }
+      else
+      {
+         // Back from settings chosen by hand: calibrate afresh
+         if ( !haveCalibration && !calibrate() )
+            return;
+         tuning = calibrated;
+      }
+
+      HAPreferences limits;
+      limits.maxThreads = maxThreadsSpin->value();
+      limits.cpuSet = cpuSetEdit->text().trimmed().toStdString();
+      limits.backgroundPriority = backgroundCheck->isChecked();
+      limits.memoryBudget = budgetSpin->value();
+      limits.instrumentation = instrumentationCheck->isChecked();
+
+      // Both restart the thread pool
+      const bool previewing = StopPreviewEngine();
+      HAPreferences::Apply( limits );
+      const bool available = HATuner::Apply( tuning );
+      if ( previewing )
+         StartPreviewEngine();
+      if ( !available )
+         QMessageBox::warning( nullptr, "RGB to HA Preferences",
+                               QString( "The %1 kernels are not available; using the fastest supported." )
+                               .arg( QString::fromStdString( tuning.isa ) ) );
+      try
+      {
+         HATuner::Save( tuning );
+         limits.Save();
+      }
+      catch ( const std::exception& x )
+      {
+         QMessageBox::warning( nullptr, "RGB to HA Preferences", QString( "Unable to save the preferences: " ) + x.what() );
+      }
+   }
+
+private:
+
+   // GUI Controls
+   QComboBox* m_conversionMethodCombo;
+   QLineEdit* m_neuralModelEdit;
+   QDoubleSpinBox* m_enhancementStrengthSpin;
+   QSpinBox* m_localContrastRadiusSpin;
+   QDoubleSpinBox* m_noiseReductionSpin;
+   QDoubleSpinBox* m_contrastBoostSpin;
+   QDoubleSpinBox* m_haWavelengthSpin;
+   QCheckBox* m_adaptiveProcessingCheck;
+   QComboBox* m_qualityModeCombo;
+   QComboBox* m_lutSizeCombo;
+   QCheckBox* m_instrumentationCheck;
+   QLineEdit* m_traceFileEdit;
+   QSpinBox* m_memoryBudgetSpin;
+   QSpinBox* m_stageCacheSpin;
+   QSpinBox* m_bufferPoolSpin;
+   QComboBox* m_previewModeCombo;
+   QCheckBox* m_livePreviewCheck;
+   QLabel* m_previewImage;
+   QLabel* m_previewStatus;
+   QPushButton* m_previewButton;
+   QPushButton* m_resetButton;
+   QProgressBar* m_progressBar;
+   QTextEdit* m_infoText;
+
+   // Live preview of the bound view, from a copy of its image taken by the
+   // first render request after it is bound or changes (ImageUpdated)
+   std::unique_ptr<HAPreviewEngine> m_preview;
+   View m_previewView;
+   bool m_previewSourceStale = false;
+
+   // Update controls from process instance
+   void UpdateControlsFromInstance( const RGBToHAInstance& instance )
+   {
+      m_conversionMethodCombo->setCurrentIndex( instance.conversionMethod );
+      m_neuralModelEdit->setText( instance.neuralModelPath );
+      m_neuralModelEdit->setEnabled( instance.conversionMethod == 3 );
+      m_enhancementStrengthSpin->setValue( instance.enhancementStrength );
+      m_localContrastRadiusSpin->setValue( instance.localContrastRadius );
+      m_noiseReductionSpin->setValue( instance.noiseReduction );
+      m_contrastBoostSpin->setValue( instance.contrastBoost );
+      m_haWavelengthSpin->setValue( instance.haWavelength );
+      m_adaptiveProcessingCheck->setChecked( instance.adaptiveProcessing );
+      m_qualityModeCombo->setCurrentIndex( instance.qualityMode );
+      m_instrumentationCheck->setChecked( instance.instrumentation );
+      m_traceFileEdit->setText( instance.traceFile );
+      m_traceFileEdit->setEnabled( instance.instrumentation );
+      m_memoryBudgetSpin->setValue( instance.memoryBudget );
+      m_stageCacheSpin->setValue( instance.stageCacheSize );
+      m_bufferPoolSpin->setValue( instance.bufferPoolSize );
+      int lutIndex = m_lutSizeCombo->findData( instance.lutSize );
+      if ( lutIndex < 0 )
+      {
+         m_lutSizeCombo->addItem( QString( "%1\u00b3" ).arg( instance.lutSize ), instance.lutSize );
+         lutIndex = m_lutSizeCombo->count() - 1;
+      }
+      m_lutSizeCombo->setCurrentIndex( lutIndex );
+   }
+
+   // Update process instance from controls
+   void UpdateInstanceFromControls( RGBToHAInstance& instance )
+   {
+      instance.conversionMethod = m_conversionMethodCombo->currentIndex();
+      instance.neuralModelPath = m_neuralModelEdit->text();
+      instance.enhancementStrength = m_enhancementStrengthSpin->value();
+      instance.localContrastRadius = m_localContrastRadiusSpin->value();
+      instance.noiseReduction = m_noiseReductionSpin->value();
+      instance.contrastBoost = m_contrastBoostSpin->value();
+      instance.haWavelength = m_haWavelengthSpin->value();
+      instance.adaptiveProcessing = m_adaptiveProcessingCheck->isChecked();
+      instance.qualityMode = m_qualityModeCombo->currentIndex();
+      instance.instrumentation = m_instrumentationCheck->isChecked();
+      instance.traceFile = m_traceFileEdit->text();
+      instance.memoryBudget = m_memoryBudgetSpin->value();
+      instance.stageCacheSize = m_stageCacheSpin->value();
+      instance.bufferPoolSize = m_bufferPoolSpin->value();
+      instance.lutSize = m_lutSizeCombo->currentData().toInt();
+   }
+
+   // Create the main GUI
+   virtual void SetupInterface()
+   {
+      QVBoxLayout* mainLayout = new QVBoxLayout( this );
+
+      // Create tab widget for organized interface
+      QTabWidget* tabWidget = new QTabWidget( this );
+      mainLayout->addWidget( tabWidget );
+
+      // Main conversion tab
+      QWidget* conversionTab = new QWidget();
+      tabWidget->addTab( conversionTab, "Conversion" );
+      SetupConversionTab( conversionTab );
+
+      // Advanced options tab
+      QWidget* advancedTab = new QWidget();
+      tabWidget->addTab( advancedTab, "Advanced" );
+      SetupAdvancedTab( advancedTab );
+
+      // Preview tab
+      QWidget* previewTab = new QWidget();
+      tabWidget->addTab( previewTab, "Preview" );
+      SetupPreviewTab( previewTab );
+
+      // Info tab
+      QWidget* infoTab = new QWidget();
+      tabWidget->addTab( infoTab, "Info" );
+      SetupInfoTab( infoTab );
+
+      // Progress bar
+      m_progressBar = new QProgressBar( this );
+      m_progressBar->setVisible( false );
+      mainLayout->addWidget( m_progressBar );
+
+      // Control buttons
+      QHBoxLayout* buttonLayout = new QHBoxLayout();
+      mainLayout->addLayout( buttonLayout );
+
+      m_previewButton = new QPushButton( "Preview", this );
+      m_resetButton = new QPushButton( "Reset", this );
+      QPushButton* applyButton = new QPushButton( "Apply", this );
+
+      buttonLayout->addWidget( m_previewButton );
+      buttonLayout->addWidget( m_resetButton );
+      buttonLayout->addStretch();
+      buttonLayout->addWidget( applyButton );
+
+      // Connect signals
+      connect( m_previewButton, &QPushButton::clicked, this, &RGBToHAInterface::OnPreviewClicked );
+      connect( m_resetButton, &QPushButton::clicked, this, &RGBToHAInterface::OnResetClicked );
+      connect( applyButton, &QPushButton::clicked, this, &RGBToHAInterface::OnApplyClicked );
+   }
+
+   // Setup conversion tab
+   void SetupConversionTab( QWidget* parent )
+   {
+      QVBoxLayout* layout = new QVBoxLayout( parent );
+
+      // Conversion method group
+      QGroupBox* methodGroup = new QGroupBox( "Conversion Method", parent );
+      QVBoxLayout* methodLayout = new QVBoxLayout( methodGroup );
+
+      m_conversionMethodCombo = new QComboBox( methodGroup );
+      m_conversionMethodCombo->addItem( "Standard RGB to HA" );
+      m_conversionMethodCombo->addItem( "Advanced Spectral" );
+      m_conversionMethodCombo->addItem( "Adaptive Multi-Scale" );
+      m_conversionMethodCombo->addItem( "Neural Network Approximation" );
+
+      methodLayout->addWidget( m_conversionMethodCombo );
+
+      QHBoxLayout* modelLayout = new QHBoxLayout();
+      modelLayout->addWidget( new QLabel( "Model File:" ) );
+      m_neuralModelEdit = new QLineEdit( methodGroup );
+      m_neuralModelEdit->setPlaceholderText( "Built-in weights" );
+      m_neuralModelEdit->setToolTip( "<p>Weight file of a trained network (rgbtoha-mlp format) for Neural Network "
+                                     "Approximation: 3 inputs (RGB), 1 output (HA). Leave empty for the built-in "
+                                     "weights.</p>" );
+      m_neuralModelEdit->setEnabled( false );
+      modelLayout->addWidget( m_neuralModelEdit );
+      methodLayout->addLayout( modelLayout );
+      connect( m_conversionMethodCombo, QOverload<int>::of( &QComboBox::currentIndexChanged ), this,
+               [this]( int method ) { m_neuralModelEdit->setEnabled( method == 3 ); } );
+
+      layout->addWidget( methodGroup );
+
+      // Enhancement parameters group
+      QGroupBox* enhancementGroup = new QGroupBox( "Enhancement Parameters", parent );
+      QGridLayout* enhancementLayout = new QGridLayout( enhancementGroup );
+
+      // Enhancement strength
+      enhancementLayout->addWidget( new QLabel( "Enhancement Strength:" ), 0, 0 );
+      m_enhancementStrengthSpin = new QDoubleSpinBox( enhancementGroup );
+      m_enhancementStrengthSpin->setRange( 0.0, 1.0 );
+      m_enhancementStrengthSpin->setSingleStep( 0.1 );
+      m_enhancementStrengthSpin->setValue( 0.5 );
+      enhancementLayout->addWidget( m_enhancementStrengthSpin, 0, 1 );
+
+      // Noise reduction
+      enhancementLayout->addWidget( new QLabel( "Noise Reduction:" ), 1, 0 );
+      m_noiseReductionSpin = new QDoubleSpinBox( enhancementGroup );
+      m_noiseReductionSpin->setRange( 0.0, 1.0 );
+      m_noiseReductionSpin->setSingleStep( 0.1 );
+      m_noiseReductionSpin->setValue( 0.3 );
+      enhancementLayout->addWidget( m_noiseReductionSpin, 1, 1 );
+
+      // Contrast boost
+      enhancementLayout->addWidget( new QLabel( "Contrast Boost:" ), 2, 0 );
+      m_contrastBoostSpin = new QDoubleSpinBox( enhancementGroup );
+      m_contrastBoostSpin->setRange( 0.0, 1.0 );
+      m_contrastBoostSpin->setSingleStep( 0.1 );
+      m_contrastBoostSpin->setValue( 0.4 );
+      enhancementLayout->addWidget( m_contrastBoostSpin, 2, 1 );
+
+      // Local contrast neighbourhood
+      enhancementLayout->addWidget( new QLabel( "Local Contrast Radius:" ), 3, 0 );
+      m_localContrastRadiusSpin = new QSpinBox( enhancementGroup );
+      m_localContrastRadiusSpin->setRange( 0, HAKernels::LocalContrastMaxRadius );
+      m_localContrastRadiusSpin->setValue( 0 );
+      m_localContrastRadiusSpin->setSpecialValueText( "4 Neighbours" );
+      m_localContrastRadiusSpin->setToolTip( "<p>Local contrast compares each pixel with the mean of the "
+                                             "(2r+1)\u00d7(2r+1) pixels around it. The cost per pixel does "
+                                             "not depend on the radius.</p>"
+                                             "<p>0 (the default) uses the four direct neighbours and leaves "
+                                             "the image edges without local contrast, as in earlier "
+                                             "versions.</p>" );
+      enhancementLayout->addWidget( m_localContrastRadiusSpin, 3, 1 );
+
+      layout->addWidget( enhancementGroup );
+      layout->addStretch();
+   }
+
+   // Setup advanced options tab
+   void SetupAdvancedTab( QWidget* parent )
+   {
+      QVBoxLayout* layout = new QVBoxLayout( parent );
+
+      // HA wavelength group
+      QGroupBox* wavelengthGroup = new QGroupBox( "HA Wavelength Settings", parent );
+      QHBoxLayout* wavelengthLayout = new QHBoxLayout( wavelengthGroup );
+
+      wavelengthLayout->addWidget( new QLabel( "HA Wavelength (nm):" ) );
+      m_haWavelengthSpin = new QDoubleSpinBox( wavelengthGroup );
+      m_haWavelengthSpin->setRange( 650.0, 670.0 );
+      m_haWavelengthSpin->setSingleStep( 0.1 );
+      m_haWavelengthSpin->setValue( 656.28 );
+      wavelengthLayout->addWidget( m_haWavelengthSpin );
+
+      layout->addWidget( wavelengthGroup );
+
+      // Processing options group
+      QGroupBox* processingGroup = new QGroupBox( "Processing Options", parent );
+      QVBoxLayout* processingLayout = new QVBoxLayout( processingGroup );
+
+      m_adaptiveProcessingCheck = new QCheckBox( "Enable Adaptive Processing", processingGroup );
+      m_adaptiveProcessingCheck->setChecked( true );
+      processingLayout->addWidget( m_adaptiveProcessingCheck );
+
+      QHBoxLayout* qualityLayout = new QHBoxLayout();
+      qualityLayout->addWidget( new QLabel( "Quality Mode:" ) );
+      m_qualityModeCombo = new QComboBox( processingGroup );
+      m_qualityModeCombo->addItem( "Fast" );
+      m_qualityModeCombo->addItem( "Quality" );
+      m_qualityModeCombo->addItem( "Ultra" );
+      m_qualityModeCombo->setCurrentIndex( 1 );
+      m_qualityModeCombo->setToolTip( "<p><b>Fast:</b> float32 with approximations, about 5x Ultra.</p>"
+                                      "<p><b>Quality:</b> float32 with exact math, about 4x Ultra.</p>"
+                                      "<p><b>Ultra:</b> double precision reference with full kernels.</p>" );
+      qualityLayout->addWidget( m_qualityModeCombo );
+      qualityLayout->addStretch();
+      processingLayout->addLayout( qualityLayout );
+
+      QHBoxLayout* lutLayout = new QHBoxLayout();
+      lutLayout->addWidget( new QLabel( "Conversion LUT:" ) );
+      m_lutSizeCombo = new QComboBox( processingGroup );
+      m_lutSizeCombo->addItem( "Exact", 0 );
+      m_lutSizeCombo->addItem( "33\u00b3", 33 );
+      m_lutSizeCombo->addItem( "65\u00b3", 65 );
+      m_lutSizeCombo->setToolTip( "<p>Evaluates a Neural Approximation model file through a 3D lookup table "
+                                  "built once per parameter set, about twice as fast as the network. The "
+                                  "interpolation error against the exact model is reported in the console.</p>"
+                                  "<p>Ignored for the other methods and the built-in network, which convert "
+                                  "at least as fast without it, and in Ultra mode.</p>" );
+      lutLayout->addWidget( m_lutSizeCombo );
+      lutLayout->addStretch();
+      processingLayout->addLayout( lutLayout );
+
+      QHBoxLayout* budgetLayout = new QHBoxLayout();
+      budgetLayout->addWidget( new QLabel( "Memory Budget (MiB):" ) );
+      m_memoryBudgetSpin = new QSpinBox( processingGroup );
+      m_memoryBudgetSpin->setRange( 0, 1048576 );
+      m_memoryBudgetSpin->setSingleStep( 256 );
+      m_memoryBudgetSpin->setSpecialValueText( "Unlimited" );
+      m_memoryBudgetSpin->setToolTip( "Working memory limit; the image is processed in strips sized to fit" );
+      budgetLayout->addWidget( m_memoryBudgetSpin );
+      budgetLayout->addStretch();
+      processingLayout->addLayout( budgetLayout );
+
+      QHBoxLayout* cacheLayout = new QHBoxLayout();
+      cacheLayout->addWidget( new QLabel( "Stage Cache (MiB):" ) );
+      m_stageCacheSpin = new QSpinBox( processingGroup );
+      m_stageCacheSpin->setRange( 0, 1048576 );
+      m_stageCacheSpin->setSingleStep( 256 );
+      m_stageCacheSpin->setValue( 1024 );
+      m_stageCacheSpin->setSpecialValueText( "Disabled" );
+      m_stageCacheSpin->setToolTip( "Keeps converted and filtered images so that changing only contrast, "
+                                    "enhancement or noise reduction reruns just the affected stages" );
+      cacheLayout->addWidget( m_stageCacheSpin );
+      cacheLayout->addStretch();
+      processingLayout->addLayout( cacheLayout );
+
+      QHBoxLayout* poolLayout = new QHBoxLayout();
+      poolLayout->addWidget( new QLabel( "Buffer Pool (MiB):" ) );
+      m_bufferPoolSpin = new QSpinBox( processingGroup );
+      m_bufferPoolSpin->setRange( 0, 1048576 );
+      m_bufferPoolSpin->setSingleStep( 256 );
+      m_bufferPoolSpin->setValue( 1024 );
+      m_bufferPoolSpin->setSpecialValueText( "Disabled" );
+      m_bufferPoolSpin->setToolTip( "Keeps released image planes mapped for reuse by later stages and runs, "
+                                    "instead of allocating and zeroing fresh memory each time" );
+      poolLayout->addWidget( m_bufferPoolSpin );
+      poolLayout->addStretch();
+      processingLayout->addLayout( poolLayout );
+
+      layout->addWidget( processingGroup );
+
+      // Diagnostics group
+      QGroupBox* diagnosticsGroup = new QGroupBox( "Diagnostics", parent );
+      QVBoxLayout* diagnosticsLayout = new QVBoxLayout( diagnosticsGroup );
+
+      m_instrumentationCheck = new QCheckBox( "Report Stage Timing", diagnosticsGroup );
+      m_instrumentationCheck->setToolTip( "Print per-stage time, bytes and per-thread load to the console" );
+      diagnosticsLayout->addWidget( m_instrumentationCheck );
+
+      QHBoxLayout* traceLayout = new QHBoxLayout();
+      traceLayout->addWidget( new QLabel( "Chrome Trace File:" ) );
+      m_traceFileEdit = new QLineEdit( diagnosticsGroup );
+      m_traceFileEdit->setPlaceholderText( "None" );
+      m_traceFileEdit->setToolTip( "Optional trace_event JSON for chrome://tracing or Perfetto" );
+      m_traceFileEdit->setEnabled( false );
+      traceLayout->addWidget( m_traceFileEdit );
+      diagnosticsLayout->addLayout( traceLayout );
+
+      QObject::connect( m_instrumentationCheck, &QCheckBox::toggled, m_traceFileEdit, &QLineEdit::setEnabled );
+
+      layout->addWidget( diagnosticsGroup );
+      layout->addStretch();
+   }
+
+   // Setup preview tab
+   void SetupPreviewTab( QWidget* parent )
+   {
+      QVBoxLayout* layout = new QVBoxLayout( parent );
+
+      QHBoxLayout* optionsLayout = new QHBoxLayout();
+      m_previewModeCombo = new QComboBox( parent );
+      m_previewModeCombo->addItem( "Whole Image (Proxy)" );
+      m_previewModeCombo->addItem( "Visible Region (1:1)" );
+      m_previewModeCombo->setToolTip( "<p><b>Proxy:</b> the whole image, downsampled.</p>"
+                                      "<p><b>Visible Region:</b> the part of the view shown in its window, "
+                                      "at full resolution, if it is at most about one megapixel; "
+                                      "otherwise the proxy.</p>" );
+      optionsLayout->addWidget( m_previewModeCombo );
+
+      m_livePreviewCheck = new QCheckBox( "Live", parent );
+      m_livePreviewCheck->setChecked( true );
+      m_livePreviewCheck->setToolTip( "Re-render whenever a parameter changes" );
+      optionsLayout->addWidget( m_livePreviewCheck );
+      optionsLayout->addStretch();
+      layout->addLayout( optionsLayout );
+
+      m_previewImage = new QLabel( "Press Preview to render the active view.", parent );
+      m_previewImage->setAlignment( Qt::AlignCenter );
+      m_previewImage->setMinimumSize( 320, 240 );
+      layout->addWidget( m_previewImage, 1 );
+
+      m_previewStatus = new QLabel( parent );
+      layout->addWidget( m_previewStatus );
+
+      StartPreviewEngine();
+
+      // Every parameter that changes the result re-renders
+      auto changed = [this]() { if ( m_livePreviewCheck->isChecked() ) RequestPreview(); };
+      connect( m_conversionMethodCombo, QOverload<int>::of( &QComboBox::currentIndexChanged ), this, changed );
+      connect( m_enhancementStrengthSpin, QOverload<double>::of( &QDoubleSpinBox::valueChanged ), this, changed );
+      connect( m_localContrastRadiusSpin, QOverload<int>::of( &QSpinBox::valueChanged ), this, changed );
+      connect( m_noiseReductionSpin, QOverload<double>::of( &QDoubleSpinBox::valueChanged ), this, changed );
+      connect( m_contrastBoostSpin, QOverload<double>::of( &QDoubleSpinBox::valueChanged ), this, changed );
+      connect( m_haWavelengthSpin, QOverload<double>::of( &QDoubleSpinBox::valueChanged ), this, changed );
+      connect( m_adaptiveProcessingCheck, &QCheckBox::toggled, this, changed );
+      connect( m_qualityModeCombo, QOverload<int>::of( &QComboBox::currentIndexChanged ), this, changed );
+      connect( m_lutSizeCombo, QOverload<int>::of( &QComboBox::currentIndexChanged ), this, changed );
+      connect( m_neuralModelEdit, &QLineEdit::editingFinished, this, changed );
+      connect( m_previewModeCombo, QOverload<int>::of( &QComboBox::currentIndexChanged ), this, [this]() { RequestPreview(); } );
+   }
+
+   // Starts the render thread, binding the view previewed before it stopped
+   void StartPreviewEngine()
+   {
+      if ( m_preview )
+         return;
+      m_preview.reset( new HAPreviewEngine( [this]( const HAPreviewFrame& frame )
+      {
+         // Render thread to GUI thread
+         std::shared_ptr<HAPreviewFrame> shown = std::make_shared<HAPreviewFrame>( frame );
+         QMetaObject::invokeMethod( m_previewImage, [this, shown]() { ShowPreview( *shown ); }, Qt::QueuedConnection );
+      } ) );
+      m_previewSourceStale = !m_previewView.IsNull();
+   }
+
+   // Joins the render thread; returns false if it was not running
+   bool StopPreviewEngine()
+   {
+      if ( !m_preview )
+         return false;
+      m_preview.reset();
+      return true;
+   }
+
+   // Binds the active view to the preview engine
+   bool BindPreviewView()
+   {
+      View view = ImageWindow::ActiveWindow().CurrentView();
+      if ( view.IsNull() || !view.Image().IsColor() )
+      {
+         ClearPreviewView( "The active view is not an RGB image." );
+         return false;
+      }
+
+      m_previewView = view;
+      m_previewSourceStale = true;
+      return true;
+   }
+
+   // Unbinds the previewed view, dropping the engine's copy of its image
+   void ClearPreviewView( const QString& status )
+   {
+      if ( m_preview )
+         m_preview->ClearSource();
+      m_previewView = View::Null();
+      m_previewStatus->setText( status );
+   }
+
+   // Makes the image of the previewed view the render source
+   void BindPreviewSource()
+   {
+      ImageVariant image = m_previewView.Image();
+      if ( image.IsFloatSample() )
+         switch ( image.BitsPerSample() )
+         {
+         case 32: BindPreviewImage<FloatPixelTraits>( image ); break;
+         case 64: BindPreviewImage<DoublePixelTraits>( image ); break;
+         }
+      else
+         switch ( image.BitsPerSample() )
+         {
+         case  8: BindPreviewImage<UInt8PixelTraits>( image ); break;
+         case 16: BindPreviewImage<UInt16PixelTraits>( image ); break;
+         case 32: BindPreviewImage<UInt32PixelTraits>( image ); break;
+         }
+   }
+
+   template <class P>
+   void BindPreviewImage( const ImageVariant& image )
+   {
+      const GenericImage<P>& typed = static_cast<const GenericImage<P>&>( *image );
+      HASource<typename P::sample> source;
+      source.width = typed.Width();
+      source.height = typed.Height();
+      for ( int c = 0; c < 3; ++c )
+         source.channel[c] = typed.PixelData( c );
+      source.stride = typed.Width();
+      m_preview->SetSource( source );
+   }
+
+   // Queues a render of the bound view with the current controls
+   void RequestPreview()
+   {
+      if ( m_previewView.IsNull() )
+         return;
+
+      // The engine copies the image only when it is about to render it
+      if ( m_previewSourceStale )
+      {
+         BindPreviewSource();
+         m_previewSourceStale = false;
+      }
+
+      RGBToHAInstance instance( TheRGBToHAProcess );
+      UpdateInstanceFromControls( instance );
+
+      HAPreviewRequest request;
+      request.params.conversionMethod = instance.conversionMethod;
+      request.params.neuralModelPath = instance.neuralModelPath.toStdString();
+      request.params.enhancementStrength = instance.enhancementStrength;
+      request.params.localContrastRadius = instance.localContrastRadius;
+      request.params.noiseReduction = instance.noiseReduction;
+      request.params.contrastBoost = instance.contrastBoost;
+      request.params.haWavelength = instance.haWavelength;
+      request.params.adaptiveProcessing = instance.adaptiveProcessing;
+      // Ultra runs the staged pipeline, too slow to preview; Quality shares
+      // its exact kernels
+      request.params.qualityMode = std::min( instance.qualityMode, 1 );
+      request.params.lutSize = ( instance.qualityMode < 2 && HALUTPays( request.params ) ) ? instance.lutSize : 0;
+
+      if ( m_previewModeCombo->currentIndex() == 1 )
+      {
+         ImageWindow window = m_previewView.Window();
+         Rect visible = window.ViewportToImage( window.VisibleViewportRect() );
+         request.mode = HAPreviewRequest::Crop;
+         request.region = HARect( visible.x0, visible.y0, visible.x1, visible.y1 );
+      }
+
+      m_preview->Request( request );
+      m_previewStatus->setText( "Rendering..." );
+   }
+
+   void ShowPreview( const HAPreviewFrame& frame )
+   {
+      if ( !frame.error.empty() )
+      {
+         m_previewStatus->setText( QString::fromStdString( frame.error ) );
+         return;
+      }
+
+      QImage image( frame.width, frame.height, QImage::Format_Grayscale8 );
+      for ( int y = 0; y < frame.height; ++y )
+      {
+         uchar* line = image.scanLine( y );
+         const float* row = frame.pixels.data() + std::size_t( y )*frame.width;
+         for ( int x = 0; x < frame.width; ++x )
+            line[x] = uchar( HAKernels::Clamp01( row[x] )*255 + 0.5f );
+      }
+      m_previewImage->setPixmap( QPixmap::fromImage( image ).scaled( m_previewImage->size(), Qt::KeepAspectRatio,
+                                                                      Qt::SmoothTransformation ) );
+      m_previewStatus->setText( QString( "%1 x %2 %3, %4 ms%5" ).arg( frame.width ).arg( frame.height )
+                                .arg( ( frame.mode == HAPreviewRequest::Crop ) ? "at 1:1" :
+                                      QString( "at 1:%1" ).arg( frame.scale ) )
+                                .arg( frame.milliseconds, 0, 'f', 1 )
+                                .arg( ( frame.mode == HAPreviewRequest::Proxy && m_previewModeCombo->currentIndex() == 1 ) ?
+                                      " (zoom in for a 1:1 crop)" : "" ) );
+   }
+
+   // Setup info tab
+   void SetupInfoTab( QWidget* parent )
+   {
+      QVBoxLayout* layout = new QVBoxLayout( parent );
+
+      m_infoText = new QTextEdit( parent );
+      m_infoText->setReadOnly( true );
+      m_infoText->setHtml( 
+         "<h2>RGB to HA Conversion Plugin</h2>"
+         "<p><b>Version:</b> 1.0.0</p>"
+         "<p><b>Author:</b> Connor</p>"
+         "<p><b>Description:</b> Advanced RGB to Hydrogen Alpha (HA) conversion with multiple algorithms and enhancement options.</p>"
+         "<h3>Conversion Methods:</h3>"
+         "<ul>"
+         "<li><b>Standard RGB to HA:</b> Basic color space transformation</li>"
+         "<li><b>Advanced Spectral:</b> Multi-band spectral analysis</li>"
+         "<li><b>Adaptive Multi-Scale:</b> Multi-resolution processing</li>"
+         "<li><b>Neural Network Approximation:</b> Per-pixel network, built-in or loaded from a model file</li>"
+         "</ul>"
+         "<h3>Features:</h3>"
+         "<ul>"
+         "<li>Multiple conversion algorithms</li>"
+         "<li>Adaptive processing</li>"
+         "<li>Noise reduction</li>"
+         "<li>Contrast enhancement</li>"
+         "<li>Quality modes</li>"
+         "</ul>"
+      );
+
+      layout->addWidget( m_infoText );
+   }
+
+   // Event handlers
+   void OnPreviewClicked()
+   {
+      if ( BindPreviewView() )
+         RequestPreview();
+   }
+
+   void OnResetClicked()
+   {
+      ResetInstance();
+   }
+
+   void OnApplyClicked()
+   {
+      RGBToHAInstance instance( TheRGBToHAProcess );
+      UpdateInstanceFromControls( instance );
+      instance.LaunchOnCurrentView();
+   }
+
+   // Process instance class
+   class RGBToHAInstance
+   {
+   public:
+      RGBToHAInstance( MetaProcess* process ) : m_process( process )
+      {
+      }
+
+      void LaunchOnCurrentView()
+      {
+         // Implementation for launching the process
+         Console().WriteLn( "RGB to HA conversion process launched." );
+      }
+
+      // Parameters
+      int conversionMethod = 0;
+      QString neuralModelPath;
+      double enhancementStrength = 0.5;
+      int localContrastRadius = 0;
+      double noiseReduction = 0.3;
+      double contrastBoost = 0.4;
+      double haWavelength = 656.28;
+      bool adaptiveProcessing = true;
+      int qualityMode = 1;
+      bool instrumentation = false;
+      QString traceFile;
+      int memoryBudget = 0;
+      int stageCacheSize = 1024;
+      int bufferPoolSize = 1024;
+      int lutSize = 0;
+
+   private:
+      MetaProcess* m_process;
+   };
+
+   // Meta process placeholder
+   class MetaProcess
+   {
+   public:
+      static MetaProcess* TheRGBToHAProcess;
+   };
+
+   MetaProcess* MetaProcess::TheRGBToHAProcess = nullptr;
+};
+
 } // pcl 
\ No newline at end of file
@@ -0,0 +1,194 @@
+/*
+ * RGB to HA Conversion LUT for PixInsight
+ * Per-pixel conversion methods baked into a 3D lookup table
+ */
+
+#ifndef __RGBToHALUT_h
+#define __RGBToHALUT_h
+
+#include "RGBToHASIMD.h"
+#include "RGBToHAThreadPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace pcl
+{
+
+/*
+ * A per-pixel conversion kernel sampled on a size^3 lattice over the RGB
+ * cube and evaluated by tetrahedral interpolation (HAConversionKernels::lut).
+ * The interpolated value is exact at lattice points and continuous
+ * everywhere; between them its error depends on the curvature of the
+ * method, so it is measured when the table is built: the exact kernel and
+ * the table are compared at the centre of every lattice cell, where
+ * interpolation is least accurate.
+ *
+ * Building a 65^3 table runs the exact kernel over 0.27 million samples, plus
+ * 0.26 million for the error, so Shared() keeps recent tables for reuse by
+ * later runs with the same conversion.
+ */
+class HAColorLUT
+{
+public:
+
+   static constexpr int MinSize = 2;
+   static constexpr int MaxSize = 129;
+
+   HAColorLUT( int size, HARowKernel kernel, const HAKernelArgs& args,
+               const HAConversionKernels& kernels = HAActiveConversionKernels() ) :
+      m_size( size ), m_kernel( kernel ), m_args( args ), m_interpolate( kernels.lut )
+   {
+      if ( size < MinSize || size > MaxSize )
+         throw std::runtime_error( "HAColorLUT: the table size must be between 2 and 129 points per axis" );
+
+      const auto start = std::chrono::steady_clock::now();
+      m_table.resize( std::size_t( size )*size*size );
+      Build();
+      Measure();
+      m_buildMilliseconds = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+   }
+
+   // Interpolated conversion of n pixels
+   void Apply( const float* r, const float* g, const float* b, float* out, int n ) const
+   {
+      m_interpolate( r, g, b, out, n, m_table.data(), m_size );
+   }
+
+   int Size() const
+   {
+      return m_size;
+   }
+
+   // Largest and mean absolute error against the exact kernel
+   double MaxError() const
+   {
+      return m_maxError;
+   }
+
+   double MeanError() const
+   {
+      return m_meanError;
+   }
+
+   // Time to sample the kernel and measure the error
+   double BuildMilliseconds() const
+   {
+      return m_buildMilliseconds;
+   }
+
+   std::size_t Bytes() const
+   {
+      return m_table.size()*sizeof( float );
+   }
+
+   // Table for kernel and args, built on first use. The most recently used
+   // tables are kept, so a batch of runs with one parameter set builds one.
+   static std::shared_ptr<const HAColorLUT> Shared( int size, HARowKernel kernel, const HAKernelArgs& args )
+   {
+      static std::mutex mutex;
+      static std::vector<std::shared_ptr<const HAColorLUT>> recent;
+      const std::size_t MaxRecent = 4;
+
+      std::lock_guard<std::mutex> lock( mutex );
+      for ( std::size_t i = 0; i < recent.size(); ++i )
+         if ( recent[i]->Matches( size, kernel, args ) )
+         {
+            std::rotate( recent.begin(), recent.begin() + i, recent.begin() + i + 1 );
+            return recent.front();
+         }
+
+      recent.insert( recent.begin(), std::make_shared<const HAColorLUT>( size, kernel, args ) );
+      if ( recent.size() > MaxRecent )
+         recent.pop_back();
+      return recent.front();
+   }
+
+private:
+
+   int                m_size;
+   HARowKernel        m_kernel;
+   HAKernelArgs       m_args;      // network only valid while building
+   HALUTKernel        m_interpolate;
+   std::vector<float> m_table;
+   double             m_maxError = 0;
+   double             m_meanError = 0;
+   double             m_buildMilliseconds = 0;
+
+   bool Matches( int size, HARowKernel kernel, const HAKernelArgs& args ) const
+   {
+      if ( size != m_size || kernel != m_kernel || args.product != m_args.product )
+         return false;
+      if ( ( args.network ? args.network->id : 0 ) != ( m_args.network ? m_args.network->id : 0 ) )
+         return false;
+      for ( int i = 0; i < 2; ++i )
+      {
+         if ( args.offsets[i] != m_args.offsets[i] )
+            return false;
+         for ( int j = 0; j < 3; ++j )
+            if ( args.weights[i][j] != m_args.weights[i][j] )
+               return false;
+      }
+      return true;
+   }
+
+   // One lattice row per (red, green) pair, blue varying along it
+   void Build()
+   {
+      const int n = m_size;
+      const float step = 1.0f/( n - 1 );
+      HAParallelFor( n, [&]( int ir, int )
+      {
+         std::vector<float> r( n, ir*step ), g( n ), b( n );
+         for ( int k = 0; k < n; ++k )
+            b[k] = k*step;
+         for ( int ig = 0; ig < n; ++ig )
+         {
+            std::fill( g.begin(), g.end(), ig*step );
+            m_kernel( r.data(), g.data(), b.data(), m_table.data() + ( std::size_t( ir )*n + ig )*n, n, m_args );
+         }
+      } );
+   }
+
+   // Exact and interpolated values at every cell centre
+   void Measure()
+   {
+      const int cells = m_size - 1;
+      const float step = 1.0f/cells;
+      std::vector<double> maxError( cells ), sumError( cells );
+      HAParallelFor( cells, [&]( int ir, int )
+      {
+         std::vector<float> r( cells, ( ir + 0.5f )*step ), g( cells ), b( cells ), exact( cells ), table( cells );
+         for ( int k = 0; k < cells; ++k )
+            b[k] = ( k + 0.5f )*step;
+         for ( int ig = 0; ig < cells; ++ig )
+         {
+            std::fill( g.begin(), g.end(), ( ig + 0.5f )*step );
+            m_kernel( r.data(), g.data(), b.data(), exact.data(), cells, m_args );
+            Apply( r.data(), g.data(), b.data(), table.data(), cells );
+            for ( int k = 0; k < cells; ++k )
+            {
+               double error = std::fabs( double( table[k] ) - exact[k] );
+               maxError[ir] = std::max( maxError[ir], error );
+               sumError[ir] += error;
+            }
+         }
+      } );
+
+      for ( int i = 0; i < cells; ++i )
+      {
+         m_maxError = std::max( m_maxError, maxError[i] );
+         m_meanError += sumError[i];
+      }
+      m_meanError /= double( cells )*cells*cells;
+   }
+};
+
+} // pcl
+
+#endif   // __RGBToHALUT_h
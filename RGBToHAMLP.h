@@ -0,0 +1,388 @@
+/*
+ * RGB to HA Conversion MLP for PixInsight
+ * Trained per-pixel networks loaded from weight files
+ */
+
+#ifndef __RGBToHAMLP_h
+#define __RGBToHAMLP_h
+
+#include "RGBToHASIMD.h"
+#include "RGBToHAThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace pcl
+{
+
+/*
+ * A multilayer perceptron of dense layers, evaluated per pixel by the
+ * HAConversionKernels::mlp kernels: blocks of pixels go through the whole
+ * network as a chain of small GEMMs, with vectorized activations, while
+ * their activations stay in L1. Neural Approximation runs a model instead of
+ * its built-in weights when HAParameters::neuralModelPath names one; the
+ * network then takes normalized RGB and returns HA, clamped to [0,1].
+ *
+ * Weight files are text, whitespace separated, with # comments:
+ *
+ *    rgbtoha-mlp 1
+ *    inputs 3
+ *    dense 16 relu        outputs and activation (linear, relu, sigmoid, tanh)
+ *    w w w ...            outputs x inputs weights, one row per output
+ *    b b ...              outputs biases
+ *    dense 16 relu
+ *    ...
+ *    dense 1 sigmoid
+ *    ...
+ *
+ * with at most HAMLPNetwork::MaxLayers layers of HAMLPNetwork::MaxWidth
+ * units. A 3-16-16-1 network takes 320 multiply-adds per pixel.
+ */
+class HAMLPModel
+{
+public:
+
+   struct Layer
+   {
+      int                outputs = 0;
+      HAActivation       activation = HAActivation::Linear;
+      std::vector<float> weights;  // outputs x inputs, row-major
+      std::vector<float> bias;     // outputs
+   };
+
+   HAMLPModel( int inputs, std::vector<Layer> layers ) : m_inputs( inputs ), m_layers( std::move( layers ) )
+   {
+      if ( inputs < 1 || inputs > HAMLPNetwork::MaxWidth )
+         throw std::runtime_error( "HAMLPModel: invalid number of inputs" );
+      if ( m_layers.empty() || m_layers.size() > std::size_t( HAMLPNetwork::MaxLayers ) )
+         throw std::runtime_error( "HAMLPModel: a model has 1 to 8 layers" );
+
+      // FNV-1a over the shape and the weights
+      std::uint64_t id = 0xcbf29ce484222325ull;
+      auto hash = [&id]( const void* data, std::size_t bytes )
+      {
+         for ( std::size_t i = 0; i < bytes; ++i )
+            id = ( id ^ static_cast<const unsigned char*>( data )[i] )*0x100000001b3ull;
+      };
+      hash( &inputs, sizeof( inputs ) );
+
+      int width = inputs;
+      m_network.layerCount = int( m_layers.size() );
+      for ( std::size_t l = 0; l < m_layers.size(); ++l )
+      {
+         const Layer& layer = m_layers[l];
+         if ( layer.outputs < 1 || layer.outputs > HAMLPNetwork::MaxWidth )
+            throw std::runtime_error( "HAMLPModel: a layer has 1 to 64 units" );
+         if ( layer.weights.size() != std::size_t( layer.outputs )*width || layer.bias.size() != std::size_t( layer.outputs ) )
+            throw std::runtime_error( "HAMLPModel: layer weights do not match its shape" );
+
+         HAMLPLayer& view = m_network.layers[l];
+         view.inputs = width;
+         view.outputs = layer.outputs;
+         view.weights = layer.weights.data();
+         view.bias = layer.bias.data();
+         view.activation = layer.activation;
+
+         hash( &layer.outputs, sizeof( layer.outputs ) );
+         hash( &layer.activation, sizeof( layer.activation ) );
+         hash( layer.weights.data(), layer.weights.size()*sizeof( float ) );
+         hash( layer.bias.data(), layer.bias.size()*sizeof( float ) );
+         m_parameters += layer.weights.size() + layer.bias.size();
+         width = layer.outputs;
+      }
+      m_network.id = id;
+   }
+
+   // The network views point into this model
+   HAMLPModel( const HAMLPModel& ) = delete;
+   HAMLPModel& operator =( const HAMLPModel& ) = delete;
+
+   // Reads a weight file; throws std::runtime_error naming the file and line
+   // of the first problem
+   static std::unique_ptr<HAMLPModel> Load( const std::string& path )
+   {
+      std::ifstream file( path );
+      if ( !file )
+         throw std::runtime_error( "HAMLPModel: cannot open '" + path + "'" );
+
+      Reader reader( file, path );
+      if ( reader.Word() != "rgbtoha-mlp" )
+         reader.Fail( "not an rgbtoha-mlp weight file" );
+      if ( reader.Integer() != 1 )
+         reader.Fail( "unsupported weight file version" );
+      if ( reader.Word() != "inputs" )
+         reader.Fail( "expected 'inputs'" );
+      const int inputs = reader.Integer();
+      if ( inputs < 1 || inputs > HAMLPNetwork::MaxWidth )
+         reader.Fail( "invalid number of inputs" );
+
+      std::vector<Layer> layers;
+      int width = inputs;
+      for ( std::string word = reader.Word(); !word.empty(); word = reader.Word() )
+      {
+         if ( word != "dense" )
+            reader.Fail( "expected 'dense'" );
+         if ( layers.size() == std::size_t( HAMLPNetwork::MaxLayers ) )
+            reader.Fail( "too many layers" );
+         Layer layer;
+         layer.outputs = reader.Integer();
+         if ( layer.outputs < 1 || layer.outputs > HAMLPNetwork::MaxWidth )
+            reader.Fail( "invalid number of units" );
+         layer.activation = ActivationNamed( reader.Word(), reader );
+         layer.weights.resize( std::size_t( layer.outputs )*width );
+         for ( float& w : layer.weights )
+            w = reader.Number();
+         layer.bias.resize( layer.outputs );
+         for ( float& b : layer.bias )
+            b = reader.Number();
+         width = layer.outputs;
+         layers.push_back( std::move( layer ) );
+      }
+      if ( layers.empty() )
+         reader.Fail( "no layers" );
+
+      return std::unique_ptr<HAMLPModel>( new HAMLPModel( inputs, std::move( layers ) ) );
+   }
+
+   // Model in the file at path, loaded on first use and reloaded when the
+   // file changes. The most recently used models are kept.
+   static std::shared_ptr<const HAMLPModel> Shared( const std::string& path )
+   {
+      struct Entry
+      {
+         std::string                       path;
+         std::filesystem::file_time_type   modified;
+         std::uintmax_t                    size;
+         std::shared_ptr<const HAMLPModel> model;
+      };
+      static std::mutex mutex;
+      static std::vector<Entry> recent;
+      const std::size_t MaxRecent = 4;
+
+      std::error_code error;
+      const std::filesystem::file_time_type modified = std::filesystem::last_write_time( path, error );
+      const std::uintmax_t size = error ? 0 : std::filesystem::file_size( path, error );
+
+      std::lock_guard<std::mutex> lock( mutex );
+      for ( std::size_t i = 0; i < recent.size(); ++i )
+         if ( !error && recent[i].path == path && recent[i].modified == modified && recent[i].size == size )
+         {
+            std::rotate( recent.begin(), recent.begin() + i, recent.begin() + i + 1 );
+            return recent.front().model;
+         }
+
+      Entry entry{ path, modified, size, std::shared_ptr<const HAMLPModel>( Load( path ) ) };
+      recent.erase( std::remove_if( recent.begin(), recent.end(), [&]( const Entry& e ) { return e.path == path; } ),
+                    recent.end() );
+      recent.insert( recent.begin(), std::move( entry ) );
+      if ( recent.size() > MaxRecent )
+         recent.pop_back();
+      return recent.front().model;
+   }
+
+   // The layers, as HAKernelArgs::network
+   const HAMLPNetwork& Network() const
+   {
+      return m_network;
+   }
+
+   int Inputs() const
+   {
+      return m_inputs;
+   }
+
+   int Outputs() const
+   {
+      return m_layers.back().outputs;
+   }
+
+   // Weights and biases
+   std::size_t Parameters() const
+   {
+      return m_parameters;
+   }
+
+   // Multiply-adds per pixel
+   std::size_t MultiplyAdds() const
+   {
+      return m_parameters - std::size_t( Units() );
+   }
+
+   // Layer widths, e.g. "3-16-16-1"
+   std::string Shape() const
+   {
+      std::string shape = std::to_string( m_inputs );
+      for ( const Layer& layer : m_layers )
+         shape += "-" + std::to_string( layer.outputs );
+      return shape;
+   }
+
+   // Checks that the model maps RGB to a single value, as a conversion
+   void RequireConversionShape() const
+   {
+      if ( m_inputs != 3 || Outputs() != 1 )
+         throw std::runtime_error( "HAMLPModel: a conversion model needs 3 inputs and 1 output, not " + Shape() );
+   }
+
+   // Converts n pixels on the thread pool, in chunks of ChunkPixels, with
+   // the given kernels (fast: with the fast sigmoid)
+   void Convert( const float* r, const float* g, const float* b, float* out, std::size_t n, bool fast = false,
+                 const HAConversionKernels& kernels = HAActiveConversionKernels() ) const
+   {
+      const int ChunkPixels = 16384;
+      RequireConversionShape();
+      HAKernelArgs args;
+      args.network = &m_network;
+      const HARowKernel kernel = fast ? kernels.mlpFast : kernels.mlp;
+      HAParallelFor( int( ( n + ChunkPixels - 1 )/ChunkPixels ), [&]( int chunk, int )
+      {
+         const std::size_t i = std::size_t( chunk )*ChunkPixels;
+         kernel( r + i, g + i, b + i, out + i, int( std::min<std::size_t>( ChunkPixels, n - i ) ), args );
+      } );
+   }
+
+   // The same conversion in double precision, one pixel at a time, with
+   // exact activations: the reference for Ultra and for the kernels
+   template <typename R>
+   void Reference( const R* r, const R* g, const R* b, R* out, int n ) const
+   {
+      RequireConversionShape();
+      double x[HAMLPNetwork::MaxWidth], y[HAMLPNetwork::MaxWidth];
+      for ( int i = 0; i < n; ++i )
+      {
+         x[0] = r[i];
+         x[1] = g[i];
+         x[2] = b[i];
+         int width = 3;
+         for ( const Layer& layer : m_layers )
+         {
+            for ( int o = 0; o < layer.outputs; ++o )
+            {
+               double s = layer.bias[o];
+               for ( int k = 0; k < width; ++k )
+                  s += double( layer.weights[std::size_t( o )*width + k] )*x[k];
+               y[o] = Activate( s, layer.activation );
+            }
+            width = layer.outputs;
+            std::copy_n( y, width, x );
+         }
+         out[i] = R( std::min( 1.0, std::max( 0.0, x[0] ) ) );
+      }
+   }
+
+private:
+
+   int                m_inputs;
+   std::vector<Layer> m_layers;
+   HAMLPNetwork       m_network;
+   std::size_t        m_parameters = 0;
+
+   int Units() const
+   {
+      int units = 0;
+      for ( const Layer& layer : m_layers )
+         units += layer.outputs;
+      return units;
+   }
+
+   static double Activate( double x, HAActivation activation )
+   {
+      switch ( activation )
+      {
+      case HAActivation::ReLU:
+         return std::max( x, 0.0 );
+      case HAActivation::Sigmoid:
+         return 1/( 1 + std::exp( -x ) );
+      case HAActivation::Tanh:
+         return std::tanh( x );
+      default:
+         return x;
+      }
+   }
+
+   // Tokens of a weight file, with the line they are on
+   class Reader
+   {
+   public:
+
+      Reader( std::istream& in, const std::string& path ) : m_in( in ), m_path( path )
+      {
+      }
+
+      // Next token, or an empty string at the end of the file
+      std::string Word()
+      {
+         std::string word;
+         while ( !( m_tokens >> word ) )
+         {
+            std::string line;
+            if ( !std::getline( m_in, line ) )
+               return std::string();
+            ++m_line;
+            line = line.substr( 0, line.find( '#' ) );
+            m_tokens.clear();
+            m_tokens.str( line );
+         }
+         return word;
+      }
+
+      int Integer()
+      {
+         const std::string word = Word();
+         char* end = nullptr;
+         const long value = std::strtol( word.c_str(), &end, 10 );
+         if ( word.empty() || *end != '\0' )
+            Fail( word.empty() ? "unexpected end of file" : "expected an integer, found '" + word + "'" );
+         return int( std::max( -1L, std::min( value, 1L << 20 ) ) );
+      }
+
+      float Number()
+      {
+         const std::string word = Word();
+         char* end = nullptr;
+         const float value = std::strtof( word.c_str(), &end );
+         if ( word.empty() || *end != '\0' || !std::isfinite( value ) )
+            Fail( word.empty() ? "unexpected end of file" : "expected a number, found '" + word + "'" );
+         return value;
+      }
+
+      [[noreturn]] void Fail( const std::string& message ) const
+      {
+         throw std::runtime_error( "HAMLPModel: " + m_path + ", line " + std::to_string( m_line ) + ": " + message );
+      }
+
+   private:
+
+      std::istream&      m_in;
+      const std::string& m_path;
+      std::istringstream m_tokens;
+      int                m_line = 0;
+   };
+
+   static HAActivation ActivationNamed( const std::string& name, const Reader& reader )
+   {
+      if ( name == "linear" )
+         return HAActivation::Linear;
+      if ( name == "relu" )
+         return HAActivation::ReLU;
+      if ( name == "sigmoid" )
+         return HAActivation::Sigmoid;
+      if ( name == "tanh" )
+         return HAActivation::Tanh;
+      reader.Fail( "unknown activation '" + name + "'" );
+   }
+};
+
+} // pcl
+
+#endif   // __RGBToHAMLP_h
@@ -0,0 +1,304 @@
+/*
+ * RGB to HA Conversion Preferences for PixInsight
+ * Per-user settings files and module-wide resource limits
+ */
+
+#ifndef __RGBToHAPreferences_h
+#define __RGBToHAPreferences_h
+
+#include "RGBToHAEngine.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace pcl
+{
+
+/*
+ * Settings file of one host: key=value lines, # comments, under the user's
+ * configuration directory (~/.config/rgbtoha, ~/Library/Application
+ * Support/RGBToHA or %APPDATA%\RGBToHA) and named after the host, so that a
+ * home directory shared by several machines keeps one file per machine.
+ */
+class HASettingsFile
+{
+public:
+
+   typedef std::vector<std::pair<std::string, std::string>> Entries;
+
+   // <directory>/<name>-<host>.conf, or the value of environment variable
+   // override if it is set
+   static std::string PathFor( const char* name, const char* override )
+   {
+      const char* path = std::getenv( override );
+      if ( path != nullptr && *path != '\0' )
+         return path;
+      return ( Directory()/( std::string( name ) + '-' + HostName() + ".conf" ) ).string();
+   }
+
+   // Entries of a file, later ones overriding earlier; false if unreadable
+   static bool Read( const std::string& path, std::map<std::string, std::string>& values )
+   {
+      std::ifstream file( path );
+      if ( !file )
+         return false;
+      std::string line;
+      while ( std::getline( file, line ) )
+      {
+         if ( !line.empty() && line.back() == '\r' )
+            line.pop_back();
+         const std::size_t equals = line.find( '=' );
+         if ( line.empty() || line[0] == '#' || equals == std::string::npos )
+            continue;
+         values[line.substr( 0, equals )] = line.substr( equals + 1 );
+      }
+      return true;
+   }
+
+   // Replaces a file, creating its directory. The file is written aside and
+   // renamed, so a concurrent Read() never sees half of it. Throws
+   // std::runtime_error.
+   static void Write( const std::string& path, const char* title, const Entries& entries )
+   {
+      namespace fs = std::filesystem;
+      std::error_code error;
+      const fs::path dir = fs::path( path ).parent_path();
+      if ( !dir.empty() )
+         fs::create_directories( dir, error );
+
+      const std::string temporary = path + ".tmp";
+      {
+         std::ofstream file( temporary, std::ios::trunc );
+         file << "# " << title << '\n';
+         for ( const auto& entry : entries )
+         {
+            if ( entry.second.find_first_of( "\r\n" ) != std::string::npos )
+               throw std::runtime_error( "HASettingsFile: invalid value of " + entry.first );
+            file << entry.first << '=' << entry.second << '\n';
+         }
+         file.flush();
+         if ( !file )
+            throw std::runtime_error( "HASettingsFile: unable to write " + temporary );
+      }
+      fs::rename( temporary, path, error );
+      if ( error )
+      {
+         fs::remove( temporary, error );
+         throw std::runtime_error( "HASettingsFile: unable to write " + path );
+      }
+   }
+
+private:
+
+   static std::filesystem::path Directory()
+   {
+      namespace fs = std::filesystem;
+#ifdef _WIN32
+      if ( const char* appData = std::getenv( "APPDATA" ) )
+         return fs::path( appData )/"RGBToHA";
+#elif defined( __APPLE__ )
+      if ( const char* home = std::getenv( "HOME" ) )
+         return fs::path( home )/"Library"/"Application Support"/"RGBToHA";
+#else
+      const char* config = std::getenv( "XDG_CONFIG_HOME" );
+      if ( config != nullptr && *config != '\0' )
+         return fs::path( config )/"rgbtoha";
+      if ( const char* home = std::getenv( "HOME" ) )
+         return fs::path( home )/".config"/"rgbtoha";
+#endif
+      std::error_code error;
+      return fs::temp_directory_path( error )/"rgbtoha";
+   }
+
+   // First label of the host name, reduced to characters safe in a file name
+   static std::string HostName()
+   {
+      char name[256] = {};
+#ifdef _WIN32
+      DWORD size = sizeof( name );
+      if ( !GetComputerNameA( name, &size ) )
+         name[0] = '\0';
+#else
+      if ( gethostname( name, sizeof( name ) - 1 ) != 0 )
+         name[0] = '\0';
+#endif
+      std::string host;
+      for ( const char* c = name; *c != '\0' && *c != '.'; ++c )
+         host += ( ( *c >= 'a' && *c <= 'z' ) || ( *c >= 'A' && *c <= 'Z' ) || ( *c >= '0' && *c <= '9' ) ||
+                   *c == '-' || *c == '_' ) ? *c : '_';
+      return host.empty() ? "localhost" : host;
+   }
+};
+
+/*
+ * Resource limits of the module on this machine, for shared workstations.
+ * They bound every run whatever the process instance asks for:
+ *
+ * maxThreads          caps the thread pool (HAWorkerPolicy), over the
+ *                     calibrated or hand-set thread count;
+ * cpuSet              pins the pool's workers to those CPUs, "0-7,16" say,
+ *                     and sizes the pool to them;
+ * backgroundPriority  runs the workers below normal priority;
+ * memoryBudget        caps the working memory of a run, as the instance's
+ *                     Memory Budget does (the tighter of the two applies),
+ *                     and the idle planes the buffer pool keeps; runs under
+ *                     a budget do not use the stage cache, which is emptied;
+ * instrumentation     reports stage timing for every tile pipeline run.
+ *
+ * The tile size is set with the machine tuning (HATuner), whose profile
+ * holds it. Preferences are kept in preferences-<host>.conf
+ * (HASettingsFile; RGBTOHA_PREFERENCES overrides the path).
+ */
+struct HAPreferences
+{
+   int         maxThreads = 0;             // 0 for no cap
+   std::string cpuSet;                     // empty for any CPU
+   bool        backgroundPriority = false;
+   int         memoryBudget = 0;           // MiB, 0 for unlimited
+   bool        instrumentation = false;
+
+   static std::string Path()
+   {
+      return HASettingsFile::PathFor( "preferences", "RGBTOHA_PREFERENCES" );
+   }
+
+   // Reads preferences; false, leaving prefs unchanged, if there are none or
+   // they are invalid
+   static bool Load( HAPreferences& prefs, const std::string& path = Path() )
+   {
+      std::map<std::string, std::string> values;
+      if ( !HASettingsFile::Read( path, values ) )
+         return false;
+      HAPreferences loaded;
+      loaded.maxThreads = std::atoi( values["maxThreads"].c_str() );
+      loaded.cpuSet = values["cpuSet"];
+      loaded.backgroundPriority = values["backgroundPriority"] == "true";
+      loaded.memoryBudget = std::atoi( values["memoryBudget"].c_str() );
+      loaded.instrumentation = values["instrumentation"] == "true";
+      if ( !loaded.Valid() )
+         return false;
+      prefs = loaded;
+      return true;
+   }
+
+   // Throws std::runtime_error
+   void Save( const std::string& path = Path() ) const
+   {
+      if ( !Valid() )
+         throw std::runtime_error( "HAPreferences: invalid CPU set or limits" );
+      HASettingsFile::Write( path, "RGB to HA preferences",
+                             { { "maxThreads", std::to_string( maxThreads ) },
+                               { "cpuSet", cpuSet },
+                               { "backgroundPriority", backgroundPriority ? "true" : "false" },
+                               { "memoryBudget", std::to_string( memoryBudget ) },
+                               { "instrumentation", instrumentation ? "true" : "false" } } );
+   }
+
+   bool Valid() const
+   {
+      std::vector<int> cpus;
+      return maxThreads >= 0 && memoryBudget >= 0 && ParseCPUSet( cpuSet, cpus );
+   }
+
+   // Makes prefs the module-wide limits. Restarts the thread pool, so no
+   // parallel loop may be running.
+   static void Apply( const HAPreferences& prefs )
+   {
+      HAWorkerPolicy policy;
+      policy.maxThreads = prefs.maxThreads;
+      ParseCPUSet( prefs.cpuSet, policy.cpus );
+      policy.background = prefs.backgroundPriority;
+      HAThreadPool::SetPolicy( policy );
+
+      std::lock_guard<std::mutex> lock( Mutex() );
+      ActivePreferences() = prefs;
+   }
+
+   // Limits last applied, or none
+   static HAPreferences Active()
+   {
+      std::lock_guard<std::mutex> lock( Mutex() );
+      return ActivePreferences();
+   }
+
+   // Working memory of a run asking for bytes (0 for no limit), within the
+   // budget
+   std::size_t BudgetBytes( std::size_t bytes ) const
+   {
+      const std::size_t limit = std::size_t( memoryBudget ) << 20;
+      if ( limit == 0 )
+         return bytes;
+      return ( bytes == 0 ) ? limit : std::min( bytes, limit );
+   }
+
+   // CPU numbers of a list of CPUs and inclusive ranges, "0-3,8,10-11";
+   // false if it is malformed. An empty list is valid.
+   static bool ParseCPUSet( const std::string& text, std::vector<int>& cpus )
+   {
+      cpus.clear();
+      std::istringstream items( text );
+      std::string item;
+      while ( std::getline( items, item, ',' ) )
+      {
+         item.erase( std::remove( item.begin(), item.end(), ' ' ), item.end() );
+         if ( item.empty() )
+            continue;
+         int first, last;
+         char dash, extra;
+         std::istringstream range( item );
+         if ( item.find( '-' ) == std::string::npos )
+         {
+            if ( !( range >> first ) || range >> extra )
+               return false;
+            last = first;
+         }
+         else if ( !( range >> first >> dash >> last ) || dash != '-' || range >> extra )
+            return false;
+         if ( first < 0 || last < first || last >= 4096 )
+            return false;
+         for ( int cpu = first; cpu <= last; ++cpu )
+            cpus.push_back( cpu );
+      }
+      std::sort( cpus.begin(), cpus.end() );
+      cpus.erase( std::unique( cpus.begin(), cpus.end() ), cpus.end() );
+      return true;
+   }
+
+private:
+
+   static std::mutex& Mutex()
+   {
+      static std::mutex mutex;
+      return mutex;
+   }
+
+   static HAPreferences& ActivePreferences()
+   {
+      static HAPreferences prefs;
+      return prefs;
+   }
+};
+
+} // pcl
+
+#endif   // __RGBToHAPreferences_h
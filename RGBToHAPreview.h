@@ -0,0 +1,425 @@
+/*
+ * RGB to HA Conversion Preview Engine for PixInsight
+ * Debounced, cancellable background rendering of proxies and crops
+ */
+
+#ifndef __RGBToHAPreview_h
+#define __RGBToHAPreview_h
+
+#include "RGBToHABufferPool.h"
+#include "RGBToHAEngine.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace pcl
+{
+
+// What to render
+struct HAPreviewRequest
+{
+   enum Mode
+   {
+      Proxy, // the whole image, downsampled
+      Crop   // a region at full resolution
+   };
+
+   HAParameters params;
+   Mode         mode = Proxy;
+   HARect       region;     // Crop: full resolution image rect to show
+};
+
+// A rendered preview: single-channel float32 samples in [0,1]
+struct HAPreviewFrame
+{
+   HAPreviewRequest::Mode mode = HAPreviewRequest::Proxy;
+   int                    width = 0;
+   int                    height = 0;
+   int                    scale = 1;     // source pixels per frame pixel along each axis
+   HARect                 region;        // image rect covered by the frame
+   std::vector<float>     pixels;
+   double                 milliseconds = 0;
+   std::string            error;         // why nothing was rendered (e.g. a bad model file), else empty
+};
+
+/*
+ * Renders previews on a background thread with HAFusedPipeline, the tile
+ * pipeline Execute runs for Fast and Quality, so the kernels, tile layout
+ * and statistics code are those of the final result.
+ *
+ * Proxy renders run the pipeline on a box-filtered copy of the source no
+ * larger than maxProxySide pixels on its long side (built once per source,
+ * on the render thread). Crop renders run it at full resolution over the
+ * requested region only (HAFusedPipeline::ProcessRect), in image
+ * coordinates, so every pixel shown is computed exactly as in a full run
+ * given the same global statistics. Those (moments for enhancement,
+ * percentiles for the contrast stretch) come from a proxy pass with the
+ * same parameters, so a crop differs from the final result only by the
+ * difference between proxy and full image statistics. A crop region larger
+ * than maxProxySide^2 pixels would cost as much as a full run of a large
+ * image, so it is rendered as the proxy instead (the frame says which).
+ *
+ * Requests are debounced: rendering starts once no new request has arrived
+ * for debounceMs. A new request cancels a render in progress at its next
+ * strip boundary (a few tile rows), and only the latest request is ever
+ * rendered. Frames are passed to the callback on the render thread; a render
+ * that throws (for instance on a neural model file that fails to load)
+ * passes a frame with just the error message.
+ *
+ * SetSource() copies the source samples, in their own type, on the calling
+ * thread (in parallel, into pooled buffers), and the render thread reads only
+ * that copy: the caller's image may be modified, reallocated or freed as soon
+ * as SetSource() returns. A render in progress keeps the copy it started with
+ * alive until it finishes. Copying a large image takes a noticeable time, so
+ * callers should bind a changed image only when they request a render.
+ */
+class HAPreviewEngine
+{
+public:
+
+   typedef std::function<void( const HAPreviewFrame& )> Callback;
+
+   HAPreviewEngine( Callback callback, int maxProxySide = 1024, int debounceMs = 40 ) :
+      m_callback( std::move( callback ) ), m_maxProxySide( std::max( 64, maxProxySide ) ),
+      m_debounce( std::chrono::milliseconds( std::max( 0, debounceMs ) ) )
+   {
+      m_thread = std::thread( [this]() { RenderLoop(); } );
+   }
+
+   ~HAPreviewEngine()
+   {
+      {
+         std::lock_guard<std::mutex> lock( m_mutex );
+         m_stop = true;
+         ++m_generation;
+      }
+      m_wake.notify_all();
+      m_thread.join();
+   }
+
+   HAPreviewEngine( const HAPreviewEngine& ) = delete;
+   HAPreviewEngine& operator =( const HAPreviewEngine& ) = delete;
+
+   // Binds a copy of a new source, which must cover the whole image,
+   // cancelling any render of the previous one
+   template <typename T>
+   void SetSource( const HASource<T>& image )
+   {
+      // Copied before taking the lock, so renders of the previous source are
+      // not held up
+      const std::size_t plane = std::size_t( image.width )*image.height;
+      std::shared_ptr<HABuffer<T>> samples = std::make_shared<HABuffer<T>>( 3*plane );
+      HASource<T> source;
+      source.width = image.width;
+      source.height = image.height;
+      source.stride = image.width;
+      for ( int c = 0; c < 3; ++c )
+         source.channel[c] = samples->data() + c*plane;
+      HAParallelFor( 3*image.height, [&]( int i, int )
+      {
+         const int c = i/image.height, y = i % image.height;
+         std::copy_n( image.At( c, 0, y ), image.width, samples->data() + c*plane + std::size_t( y )*image.width );
+      } );
+
+      std::lock_guard<std::mutex> lock( m_mutex );
+      ++m_generation;
+      m_pending = false;
+      m_width = source.width;
+      m_height = source.height;
+      ++m_source;
+      m_extract = [source, samples]( const HARect& rect, int scale, std::vector<float>* planes )
+      {
+         const int w = ( rect.Width() + scale - 1 )/scale;
+         const int h = ( rect.Height() + scale - 1 )/scale;
+         for ( int c = 0; c < 3; ++c )
+            planes[c].assign( std::size_t( w )*h, 0.0f );
+         HAParallelFor( h, [&]( int y, int )
+         {
+            // Box average of scale x scale blocks, clipped to rect
+            std::vector<float> row( rect.Width() );
+            const int sy0 = rect.y0 + y*scale, sy1 = std::min( sy0 + scale, rect.y1 );
+            for ( int c = 0; c < 3; ++c )
+            {
+               float* out = planes[c].data() + std::size_t( y )*w;
+               for ( int sy = sy0; sy < sy1; ++sy )
+               {
+                  HALoadRow( source.At( c, rect.x0, sy ), row.data(), rect.Width() );
+                  for ( int x = 0; x < rect.Width(); ++x )
+                     out[x/scale] += row[x];
+               }
+               for ( int x = 0; x < w; ++x )
+                  out[x] /= float( sy1 - sy0 )*( std::min( ( x + 1 )*scale, rect.Width() ) - x*scale );
+            }
+         } );
+      };
+   }
+
+   // Detaches the source; pending and running renders are dropped
+   void ClearSource()
+   {
+      std::lock_guard<std::mutex> lock( m_mutex );
+      ++m_generation;
+      m_pending = false;
+      m_extract = nullptr;
+      m_width = m_height = 0;
+      ++m_source;
+   }
+
+   // Queues a render, replacing any queued one and cancelling one in progress
+   void Request( const HAPreviewRequest& request )
+   {
+      {
+         std::lock_guard<std::mutex> lock( m_mutex );
+         m_request = request;
+         m_pending = true;
+         m_requested = Clock::now();
+         ++m_generation;
+      }
+      m_wake.notify_all();
+   }
+
+private:
+
+   typedef std::chrono::steady_clock Clock;
+
+   // Copies a rect of the source to three float planes, box-averaging
+   // scale x scale blocks
+   typedef std::function<void( const HARect&, int, std::vector<float>* )> Extractor;
+
+   // Source planes of one render, as a pipeline source
+   struct Planes
+   {
+      int width = 0, height = 0;
+      std::vector<float> channel[3];
+
+      HASource<float> Source() const
+      {
+         HASource<float> s;
+         s.width = width;
+         s.height = height;
+         for ( int c = 0; c < 3; ++c )
+            s.channel[c] = channel[c].data();
+         s.stride = width;
+         return s;
+      }
+   };
+
+   // Statistics of a proxy pass, reused by crops
+   struct Statistics
+   {
+      HAMoments moments;
+      bool      stretch = false;
+      float     p5 = 0, range = 0;
+   };
+
+   void RenderLoop()
+   {
+      for ( ;; )
+      {
+         HAPreviewRequest request;
+         Extractor extract;
+         int width, height;
+         unsigned source, generation;
+         {
+            std::unique_lock<std::mutex> lock( m_mutex );
+            for ( ;; )
+            {
+               if ( m_stop )
+                  return;
+               if ( !m_pending || !m_extract )
+                  m_wake.wait( lock );
+               else if ( Clock::now() < m_requested + m_debounce )
+                  m_wake.wait_until( lock, m_requested + m_debounce );
+               else
+                  break;
+            }
+            m_pending = false;
+            request = m_request;
+            extract = m_extract;
+            width = m_width;
+            height = m_height;
+            source = m_source;
+            generation = m_generation;
+         }
+
+         const Clock::time_point start = Clock::now();
+         HAPreviewFrame frame;
+         try
+         {
+            if ( !Render( request, extract, width, height, source, generation, frame ) )
+               continue;
+         }
+         catch ( const std::exception& x )
+         {
+            frame = HAPreviewFrame();
+            frame.error = x.what();
+         }
+         frame.milliseconds = std::chrono::duration<double, std::milli>( Clock::now() - start ).count();
+         m_callback( frame );
+      }
+   }
+
+   bool Cancelled( unsigned generation ) const
+   {
+      return m_generation.load() != generation;
+   }
+
+   // Returns false if cancelled
+   bool Render( const HAPreviewRequest& request, const Extractor& extract, int width, int height,
+                unsigned source, unsigned generation, HAPreviewFrame& frame )
+   {
+      const HAFusedPipeline pipeline( request.params );
+
+      // The proxy of the source, kept across renders
+      if ( m_proxySource != source )
+      {
+         m_proxyScale = std::max( 1, ( std::max( width, height ) + m_maxProxySide - 1 )/m_maxProxySide );
+         m_proxy.width = ( width + m_proxyScale - 1 )/m_proxyScale;
+         m_proxy.height = ( height + m_proxyScale - 1 )/m_proxyScale;
+         extract( HARect( 0, 0, width, height ), m_proxyScale, m_proxy.channel );
+         if ( Cancelled( generation ) )
+            return false;
+         m_proxySource = source;
+      }
+
+      std::vector<float> proxyOutput( std::size_t( m_proxy.width )*m_proxy.height );
+      Statistics stats;
+      if ( !RunProxy( pipeline, request.params, proxyOutput, stats, generation ) )
+         return false;
+
+      const HARect bounds( 0, 0, width, height );
+      const HARect region( std::max( request.region.x0, 0 ), std::max( request.region.y0, 0 ),
+                           std::min( request.region.x1, width ), std::min( request.region.y1, height ) );
+      if ( request.mode == HAPreviewRequest::Proxy || region.Area() > double( m_maxProxySide )*m_maxProxySide )
+      {
+         frame.mode = HAPreviewRequest::Proxy;
+         frame.width = m_proxy.width;
+         frame.height = m_proxy.height;
+         frame.scale = m_proxyScale;
+         frame.region = bounds;
+         frame.pixels.swap( proxyOutput );
+         return true;
+      }
+
+      // Full resolution crop, in image coordinates: tiles, grid lattices and
+      // multi-scale blocks fall where they do in a full run
+      if ( region.IsEmpty() )
+         return false;
+      const HARect area( region.x0 - region.x0 % pipeline.TileWidth(), region.y0 - region.y0 % pipeline.TileHeight(),
+                         region.x1, region.y1 );
+      const HARect padded = area.Inflated( pipeline.SourceHalo(), bounds );
+
+      Planes crop;
+      crop.width = padded.Width();
+      crop.height = padded.Height();
+      extract( padded, 1, crop.channel );
+      if ( Cancelled( generation ) )
+         return false;
+      HASource<float> cropSource = crop.Source();
+      cropSource.width = width;
+      cropSource.height = height;
+      cropSource.x0 = padded.x0;
+      cropSource.y0 = padded.y0;
+
+      HABuffer<float> output( std::size_t( area.Width() )*area.Height() );
+      const HAView<float> out( output.data(), area.Width(), area.x0, area.y0 );
+      HAFusedPipeline::Workspace ws;
+      const int stripRows = 4*pipeline.TileHeight();
+      for ( int y0 = area.y0; y0 < area.y1; y0 += stripRows )
+      {
+         pipeline.ProcessRect( cropSource, out, HARect( area.x0, y0, area.x1, std::min( y0 + stripRows, area.y1 ) ),
+                               stats.moments, ws );
+         if ( Cancelled( generation ) )
+            return false;
+      }
+
+      frame.mode = HAPreviewRequest::Crop;
+      frame.width = region.Width();
+      frame.height = region.Height();
+      frame.scale = 1;
+      frame.region = region;
+      frame.pixels.resize( std::size_t( frame.width )*frame.height );
+      const HAContrastMap stretch = stats.stretch ? HAContrastMap( stats.p5, stats.range, request.params.contrastBoost ) :
+                                                    HAContrastMap();
+      for ( int y = 0; y < frame.height; ++y )
+      {
+         float* row = frame.pixels.data() + std::size_t( y )*frame.width;
+         std::copy_n( out.At( region.x0, region.y0 + y ), frame.width, row );
+         if ( stats.stretch )
+            stretch.Apply( row, frame.width );
+      }
+      return true;
+   }
+
+   // The passes of HAFusedPipeline::Run() over the proxy in strips, checking
+   // for cancellation between strips; returns the statistics in stats
+   bool RunProxy( const HAFusedPipeline& pipeline, const HAParameters& params, std::vector<float>& output,
+                  Statistics& stats, unsigned generation ) const
+   {
+      const HASource<float> source = m_proxy.Source();
+      const HAView<float> out( output.data(), source.width );
+      const int stripRows = 4*pipeline.TileHeight();
+      HAFusedPipeline::Workspace ws;
+
+      if ( params.enhancementStrength > 0 )
+         for ( int y0 = 0; y0 < source.height; y0 += stripRows )
+         {
+            pipeline.AccumulateMoments( source, y0, std::min( source.height, y0 + stripRows ), stats.moments, ws );
+            if ( Cancelled( generation ) )
+               return false;
+         }
+
+      for ( int y0 = 0; y0 < source.height; y0 += stripRows )
+      {
+         pipeline.ProcessRows( source, out, y0, std::min( source.height, y0 + stripRows ), stats.moments, ws );
+         if ( Cancelled( generation ) )
+            return false;
+      }
+
+      stats.stretch = pipeline.ContrastRange( ws, stats.p5, stats.range );
+      if ( stats.stretch )
+         for ( int y0 = 0; y0 < source.height; y0 += stripRows )
+         {
+            pipeline.Stretch( out, source.width, source.height, y0, std::min( source.height, y0 + stripRows ),
+                              stats.p5, stats.range, ws );
+            if ( Cancelled( generation ) )
+               return false;
+         }
+      return true;
+   }
+
+   Callback                  m_callback;
+   const int                 m_maxProxySide;
+   const Clock::duration     m_debounce;
+
+   // Shared with the render thread, under m_mutex
+   std::mutex                m_mutex;
+   std::condition_variable   m_wake;
+   std::atomic<unsigned>     m_generation{ 0 };
+   bool                      m_stop = false;
+   bool                      m_pending = false;
+   HAPreviewRequest          m_request;
+   Clock::time_point         m_requested;
+   Extractor                 m_extract;
+   int                       m_width = 0, m_height = 0;
+   unsigned                  m_source = 0;  // serial number of the bound source
+
+   // Render thread only
+   Planes                    m_proxy;
+   int                       m_proxyScale = 1;
+   unsigned                  m_proxySource = 0;
+
+   std::thread               m_thread;
+};
+
+} // pcl
+
+#endif   // __RGBToHAPreview_h
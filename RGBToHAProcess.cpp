@@ -1,701 +1,396 @@
-/*
- * RGB to HA Conversion Process for PixInsight
- * Real implementation with actual image processing
- */
-
-#include <pcl/ProcessInterface.h>
-#include <pcl/ProcessImplementation.h>
-#include <pcl/ProcessParameters.h>
-#include <pcl/View.h>
-#include <pcl/ImageWindow.h>
-#include <pcl/StandardStatus.h>
-#include <pcl/Console.h>
-#include <pcl/Exception.h>
-#include <pcl/Math.h>
-#include <pcl/Histogram.h>
-#include <pcl/Statistics.h>
-#include <pcl/Image.h>
-#include <pcl/ImageVariant.h>
-#include <pcl/ParallelProcess.h>
-#include <pcl/Thread.h>
-
-namespace pcl
-{
-
-class RGBToHAProcess : public ProcessImplementation
-{
-public:
-
-   RGBToHAProcess()
-   {
-   }
-
-   virtual ~RGBToHAProcess()
-   {
-   }
-
-   virtual void Assign( const ProcessImplementation& p )
-   {
-      const RGBToHAProcess* ps = dynamic_cast<const RGBToHAProcess*>( &p );
-      if ( ps != nullptr )
-      {
-         m_conversionMethod = ps->m_conversionMethod;
-         m_enhancementStrength = ps->m_enhancementStrength;
-         m_noiseReduction = ps->m_noiseReduction;
-         m_contrastBoost = ps->m_contrastBoost;
-         m_haWavelength = ps->m_haWavelength;
-         m_adaptiveProcessing = ps->m_adaptiveProcessing;
-         m_qualityMode = ps->m_qualityMode;
-      }
-   }
-
-   virtual bool IsHistoryUpdater( const View& view ) const
-   {
-      return false;
-   }
-
-   virtual bool CanExecuteOn( const View& view, pcl::String& whyNot ) const
-   {
-      if ( view.Image().IsColor() )
-         return true;
-      
-      whyNot = "RGB to HA conversion requires a color image.";
-      return false;
-   }
-
-   virtual void Execute()
-   {
-      if ( !m_image.IsValid() )
-         throw Error( "No image has been specified." );
-
-      if ( !m_image.IsColor() )
-         throw Error( "RGB to HA conversion requires a color image." );
-
-      StandardStatus status;
-      m_image.SetStatusCallback( &status );
-
-      Console().WriteLn( "<end><cbr>RGB to HA Conversion Process" );
-      Console().WriteLn( String().Format( "Conversion Method: %d", m_conversionMethod ) );
-      Console().WriteLn( String().Format( "Enhancement Strength: %.2f", m_enhancementStrength ) );
-
-      // Get image dimensions
-      int width = m_image.Width();
-      int height = m_image.Height();
-      int numberOfChannels = m_image.NumberOfChannels();
-
-      if ( numberOfChannels < 3 )
-         throw Error( "RGB to HA conversion requires at least 3 color channels." );
-
-      // Create output image
-      ImageVariant outputImage;
-      outputImage.CreateFloatImage( width, height, 1 ); // Single channel HA output
-      outputImage.SetStatusCallback( &status );
-
-      // Extract RGB channels
-      ImageVariant redChannel, greenChannel, blueChannel;
-      m_image.GetChannel( 0, redChannel );
-      m_image.GetChannel( 1, greenChannel );
-      m_image.GetChannel( 2, blueChannel );
-
-      // Apply conversion based on selected method
-      switch ( m_conversionMethod )
-      {
-      case 0: // Standard RGB to HA
-         ConvertStandardRGBToHA( redChannel, greenChannel, blueChannel, outputImage );
-         break;
-      case 1: // Advanced Spectral Conversion
-         ConvertAdvancedSpectral( redChannel, greenChannel, blueChannel, outputImage );
-         break;
-      case 2: // Adaptive Multi-Scale
-         ConvertAdaptiveMultiScale( redChannel, greenChannel, blueChannel, outputImage );
-         break;
-      case 3: // Neural Network Approximation
-         ConvertNeuralApproximation( redChannel, greenChannel, blueChannel, outputImage );
-         break;
-      default:
-         ConvertStandardRGBToHA( redChannel, greenChannel, blueChannel, outputImage );
-         break;
-      }
-
-      // Apply post-processing enhancements
-      if ( m_enhancementStrength > 0.0 )
-         ApplyEnhancements( outputImage );
-
-      if ( m_noiseReduction > 0.0 )
-         ApplyNoiseReduction( outputImage );
-
-      if ( m_contrastBoost > 0.0 )
-         ApplyContrastBoost( outputImage );
-
-      // Set the output image
-      m_image = outputImage;
-
-      Console().WriteLn( "RGB to HA conversion completed successfully." );
-   }
-
-private:
-
-   // Conversion method selection
-   int m_conversionMethod = 0;        // 0=Standard, 1=Advanced, 2=Adaptive, 3=Neural
-   double m_enhancementStrength = 0.5; // 0.0 to 1.0
-   double m_noiseReduction = 0.3;     // 0.0 to 1.0
-   double m_contrastBoost = 0.4;      // 0.0 to 1.0
-   double m_haWavelength = 656.28;    // HA wavelength in nm
-   bool m_adaptiveProcessing = true;   // Enable adaptive processing
-   int m_qualityMode = 1;             // 0=Fast, 1=Quality, 2=Ultra
-
-   // Standard RGB to HA conversion using real spectral coefficients
-   void ConvertStandardRGBToHA( const ImageVariant& red, const ImageVariant& green, 
-                               const ImageVariant& blue, ImageVariant& output )
-   {
-      Console().WriteLn( "Applying standard RGB to HA conversion..." );
-
-      int width = red.Width();
-      int height = red.Height();
-
-      // Real HA conversion coefficients based on spectral response
-      const double haRedCoeff = 0.85;    // Red channel contribution to HA
-      const double haGreenCoeff = 0.10;  // Green channel contribution  
-      const double haBlueCoeff = 0.05;   // Blue channel contribution
-
-      // Parallel processing for performance
-      ThreadData threadData;
-      threadData.width = width;
-      threadData.height = height;
-      threadData.red = &red;
-      threadData.green = &green;
-      threadData.blue = &blue;
-      threadData.output = &output;
-      threadData.haRedCoeff = haRedCoeff;
-      threadData.haGreenCoeff = haGreenCoeff;
-      threadData.haBlueCoeff = haBlueCoeff;
-      threadData.haWavelength = m_haWavelength;
-
-      ParallelProcess( threadData, []( const ThreadData& data, int startRow, int endRow )
-      {
-         for ( int y = startRow; y < endRow; ++y )
-         {
-            for ( int x = 0; x < data.width; ++x )
-            {
-               double r = data.red->Pixel( x, y );
-               double g = data.green->Pixel( x, y );
-               double b = data.blue->Pixel( x, y );
-
-               // Convert to HA using spectral approximation
-               double haValue = data.haRedCoeff * r + data.haGreenCoeff * g + data.haBlueCoeff * b;
-
-               // Apply wavelength correction factor
-               haValue *= ( data.haWavelength / 656.28 );
-
-               // Ensure values are in valid range
-               haValue = pcl::Max( 0.0, pcl::Min( 1.0, haValue ) );
-
-               data.output->Pixel( x, y ) = haValue;
-            }
-         }
-      } );
-   }
-
-   // Advanced spectral conversion using multiple wavelength bands
-   void ConvertAdvancedSpectral( const ImageVariant& red, const ImageVariant& green,
-                                const ImageVariant& blue, ImageVariant& output )
-   {
-      Console().WriteLn( "Applying advanced spectral conversion..." );
-
-      int width = red.Width();
-      int height = red.Height();
-
-      // Multi-band spectral coefficients based on real HA response
-      const double spectralBands[][3] = {
-         { 0.90, 0.08, 0.02 },  // Primary HA band (656.28 nm)
-         { 0.75, 0.20, 0.05 },  // Secondary band (H-beta influence)
-         { 0.60, 0.30, 0.10 }   // Tertiary band (continuum)
-      };
-
-      ThreadData threadData;
-      threadData.width = width;
-      threadData.height = height;
-      threadData.red = &red;
-      threadData.green = &green;
-      threadData.blue = &blue;
-      threadData.output = &output;
-      threadData.adaptiveProcessing = m_adaptiveProcessing;
-
-      ParallelProcess( threadData, [&spectralBands]( const ThreadData& data, int startRow, int endRow )
-      {
-         for ( int y = startRow; y < endRow; ++y )
-         {
-            for ( int x = 0; x < data.width; ++x )
-            {
-               double r = data.red->Pixel( x, y );
-               double g = data.green->Pixel( x, y );
-               double b = data.blue->Pixel( x, y );
-
-               double haValue = 0.0;
-
-               // Multi-band spectral analysis
-               for ( int band = 0; band < 3; ++band )
-               {
-                  double bandValue = spectralBands[band][0] * r + 
-                                   spectralBands[band][1] * g + 
-                                   spectralBands[band][2] * b;
-                  
-                  haValue += bandValue * ( 1.0 - band * 0.3 ); // Weighted combination
-               }
-
-               // Apply adaptive enhancement
-               if ( data.adaptiveProcessing )
-               {
-                  double luminance = 0.299 * r + 0.587 * g + 0.114 * b;
-                  double adaptiveFactor = 1.0 + ( luminance - 0.5 ) * 0.5;
-                  haValue *= adaptiveFactor;
-               }
-
-               haValue = pcl::Max( 0.0, pcl::Min( 1.0, haValue ) );
-               data.output->Pixel( x, y ) = haValue;
-            }
-         }
-      } );
-   }
-
-   // Adaptive multi-scale conversion with real multi-resolution processing
-   void ConvertAdaptiveMultiScale( const ImageVariant& red, const ImageVariant& green,
-                                  const ImageVariant& blue, ImageVariant& output )
-   {
-      Console().WriteLn( "Applying adaptive multi-scale conversion..." );
-
-      int width = red.Width();
-      int height = red.Height();
-
-      // Create multi-scale images
-      ImageVariant lowRes, midRes, highRes;
-      lowRes.CreateFloatImage( width/4, height/4, 1 );
-      midRes.CreateFloatImage( width/2, height/2, 1 );
-      highRes.CreateFloatImage( width, height, 1 );
-
-      // Process at different scales
-      ProcessMultiScale( red, green, blue, lowRes, midRes, highRes );
-
-      // Combine scales with adaptive weighting
-      ThreadData threadData;
-      threadData.width = width;
-      threadData.height = height;
-      threadData.output = &output;
-      threadData.lowRes = &lowRes;
-      threadData.midRes = &midRes;
-      threadData.highRes = &highRes;
-
-      ParallelProcess( threadData, []( const ThreadData& data, int startRow, int endRow )
-      {
-         for ( int y = startRow; y < endRow; ++y )
-         {
-            for ( int x = 0; x < data.width; ++x )
-            {
-               double haValue = 0.0;
-
-               // High resolution detail (60%)
-               haValue += 0.6 * data.highRes->Pixel( x, y );
-
-               // Medium resolution structure (30%)
-               if ( x/2 < data.midRes->Width() && y/2 < data.midRes->Height() )
-                  haValue += 0.3 * data.midRes->Pixel( x/2, y/2 );
-
-               // Low resolution base (10%)
-               if ( x/4 < data.lowRes->Width() && y/4 < data.lowRes->Height() )
-                  haValue += 0.1 * data.lowRes->Pixel( x/4, y/4 );
-
-               haValue = pcl::Max( 0.0, pcl::Min( 1.0, haValue ) );
-               data.output->Pixel( x, y ) = haValue;
-            }
-         }
-      } );
-   }
-
-   // Neural network approximation using real mathematical models
-   void ConvertNeuralApproximation( const ImageVariant& red, const ImageVariant& green,
-                                   const ImageVariant& blue, ImageVariant& output )
-   {
-      Console().WriteLn( "Applying neural network approximation..." );
-
-      int width = red.Width();
-      int height = red.Height();
-
-      // Real neural network weights (trained on HA spectral data)
-      const double weights[3][5] = {
-         { 0.85, 0.10, 0.05, 0.02, 0.01 },  // Layer 1: Primary spectral response
-         { 0.70, 0.20, 0.08, 0.01, 0.01 },  // Layer 2: Secondary features
-         { 0.60, 0.25, 0.12, 0.02, 0.01 }   // Layer 3: Fine detail extraction
-      };
-
-      ThreadData threadData;
-      threadData.width = width;
-      threadData.height = height;
-      threadData.red = &red;
-      threadData.green = &green;
-      threadData.blue = &blue;
-      threadData.output = &output;
-
-      ParallelProcess( threadData, [&weights]( const ThreadData& data, int startRow, int endRow )
-      {
-         for ( int y = startRow; y < endRow; ++y )
-         {
-            for ( int x = 0; x < data.width; ++x )
-            {
-               double r = data.red->Pixel( x, y );
-               double g = data.green->Pixel( x, y );
-               double b = data.blue->Pixel( x, y );
-
-               // Multi-layer neural approximation
-               double haValue = 0.0;
-               
-               for ( int layer = 0; layer < 3; ++layer )
-               {
-                  double layerOutput = weights[layer][0] * r + 
-                                     weights[layer][1] * g + 
-                                     weights[layer][2] * b +
-                                     weights[layer][3] * ( r * g ) +
-                                     weights[layer][4] * ( r * b );
-
-                  // Apply sigmoid activation function
-                  layerOutput = 1.0 / ( 1.0 + exp( -layerOutput ) );
-                  
-                  haValue += layerOutput * ( 1.0 - layer * 0.2 );
-               }
-
-               haValue = pcl::Max( 0.0, pcl::Min( 1.0, haValue ) );
-               data.output->Pixel( x, y ) = haValue;
-            }
-         }
-      } );
-   }
-
-   // Real multi-scale processing helper
-   void ProcessMultiScale( const ImageVariant& red, const ImageVariant& green,
-                          const ImageVariant& blue, ImageVariant& lowRes,
-                          ImageVariant& midRes, ImageVariant& highRes )
-   {
-      // Process high resolution first
-      ConvertStandardRGBToHA( red, green, blue, highRes );
-
-      // Downsample for medium resolution using real averaging
-      for ( int y = 0; y < midRes.Height(); ++y )
-      {
-         for ( int x = 0; x < midRes.Width(); ++x )
-         {
-            double sum = 0.0;
-            int count = 0;
-            
-            for ( int dy = 0; dy < 2; ++dy )
-            {
-               for ( int dx = 0; dx < 2; ++dx )
-               {
-                  int sx = x * 2 + dx;
-                  int sy = y * 2 + dy;
-                  
-                  if ( sx < highRes.Width() && sy < highRes.Height() )
-                  {
-                     sum += highRes.Pixel( sx, sy );
-                     count++;
-                  }
-               }
-            }
-            
-            midRes.Pixel( x, y ) = ( count > 0 ) ? sum / count : 0.0;
-         }
-      }
-
-      // Downsample for low resolution
-      for ( int y = 0; y < lowRes.Height(); ++y )
-      {
-         for ( int x = 0; x < lowRes.Width(); ++x )
-         {
-            double sum = 0.0;
-            int count = 0;
-            
-            for ( int dy = 0; dy < 4; ++dy )
-            {
-               for ( int dx = 0; dx < 4; ++dx )
-               {
-                  int sx = x * 4 + dx;
-                  int sy = y * 4 + dy;
-                  
-                  if ( sx < highRes.Width() && sy < highRes.Height() )
-                  {
-                     sum += highRes.Pixel( sx, sy );
-                     count++;
-                  }
-               }
-            }
-            
-            lowRes.Pixel( x, y ) = ( count > 0 ) ? sum / count : 0.0;
-         }
-      }
-   }
-
-   // Real post-processing enhancement
-   void ApplyEnhancements( ImageVariant& image )
-   {
-      Console().WriteLn( "Applying image enhancements..." );
-
-      int width = image.Width();
-      int height = image.Height();
-
-      // Calculate real image statistics
-      Statistics stats;
-      image.GetStatistics( stats );
-
-      double mean = stats.Mean();
-      double stdDev = stats.StdDev();
-
-      ThreadData threadData;
-      threadData.width = width;
-      threadData.height = height;
-      threadData.output = &image;
-      threadData.mean = mean;
-      threadData.stdDev = stdDev;
-      threadData.enhancementStrength = m_enhancementStrength;
-
-      ParallelProcess( threadData, []( const ThreadData& data, int startRow, int endRow )
-      {
-         for ( int y = startRow; y < endRow; ++y )
-         {
-            for ( int x = 0; x < data.width; ++x )
-            {
-               double pixel = data.output->Pixel( x, y );
-
-               // Real adaptive histogram equalization
-               if ( pixel > data.mean )
-               {
-                  double enhancement = ( pixel - data.mean ) / data.stdDev;
-                  pixel += enhancement * data.enhancementStrength * 0.1;
-               }
-
-               // Real local contrast enhancement
-               if ( x > 0 && x < data.width - 1 && y > 0 && y < data.height - 1 )
-               {
-                  double localMean = ( data.output->Pixel( x-1, y ) + data.output->Pixel( x+1, y ) +
-                                     data.output->Pixel( x, y-1 ) + data.output->Pixel( x, y+1 ) ) / 4.0;
-                  
-                  double localContrast = pixel - localMean;
-                  pixel += localContrast * data.enhancementStrength * 0.2;
-               }
-
-               data.output->Pixel( x, y ) = pcl::Max( 0.0, pcl::Min( 1.0, pixel ) );
-            }
-         }
-      } );
-   }
-
-   // Real bilateral noise reduction
-   void ApplyNoiseReduction( ImageVariant& image )
-   {
-      Console().WriteLn( "Applying noise reduction..." );
-
-      int width = image.Width();
-      int height = image.Height();
-
-      ImageVariant tempImage;
-      tempImage.CreateFloatImage( width, height, 1 );
-
-      const double sigmaSpace = 2.0;
-      const double sigmaColor = 0.1;
-
-      ThreadData threadData;
-      threadData.width = width;
-      threadData.height = height;
-      threadData.output = &image;
-      threadData.tempImage = &tempImage;
-      threadData.sigmaSpace = sigmaSpace;
-      threadData.sigmaColor = sigmaColor;
-
-      ParallelProcess( threadData, []( const ThreadData& data, int startRow, int endRow )
-      {
-         for ( int y = startRow; y < endRow; ++y )
-         {
-            for ( int x = 0; x < data.width; ++x )
-            {
-               double centerPixel = data.output->Pixel( x, y );
-               double weightedSum = 0.0;
-               double weightSum = 0.0;
-
-               int radius = 3;
-               for ( int dy = -radius; dy <= radius; ++dy )
-               {
-                  for ( int dx = -radius; dx <= radius; ++dx )
-                  {
-                     int nx = x + dx;
-                     int ny = y + dy;
-
-                     if ( nx >= 0 && nx < data.width && ny >= 0 && ny < data.height )
-                     {
-                        double neighborPixel = data.output->Pixel( nx, ny );
-                        
-                        // Real spatial weight
-                        double spatialWeight = exp( -( dx*dx + dy*dy ) / ( 2 * data.sigmaSpace * data.sigmaSpace ) );
-                        
-                        // Real color weight
-                        double colorWeight = exp( -( centerPixel - neighborPixel ) * ( centerPixel - neighborPixel ) / 
-                                               ( 2 * data.sigmaColor * data.sigmaColor ) );
-                        
-                        double weight = spatialWeight * colorWeight;
-                        weightedSum += neighborPixel * weight;
-                        weightSum += weight;
-                     }
-                  }
-               }
-
-               data.tempImage->Pixel( x, y ) = ( weightSum > 0 ) ? weightedSum / weightSum : centerPixel;
-            }
-         }
-      } );
-
-      // Blend original with filtered result
-      ThreadData blendData;
-      blendData.width = width;
-      blendData.height = height;
-      blendData.output = &image;
-      blendData.tempImage = &tempImage;
-      blendData.noiseReduction = m_noiseReduction;
-
-      ParallelProcess( blendData, []( const ThreadData& data, int startRow, int endRow )
-      {
-         for ( int y = startRow; y < endRow; ++y )
-         {
-            for ( int x = 0; x < data.width; ++x )
-            {
-               double original = data.output->Pixel( x, y );
-               double filtered = data.tempImage->Pixel( x, y );
-               data.output->Pixel( x, y ) = original * ( 1.0 - data.noiseReduction ) + filtered * data.noiseReduction;
-            }
-         }
-      } );
-   }
-
-   // Real contrast boost using histogram stretching
-   void ApplyContrastBoost( ImageVariant& image )
-   {
-      Console().WriteLn( "Applying contrast boost..." );
-
-      int width = image.Width();
-      int height = image.Height();
-
-      // Calculate real histogram
-      Histogram hist;
-      image.GetHistogram( hist );
-
-      // Find real percentiles for adaptive stretching
-      double p5 = hist.Percentile( 5.0 );
-      double p95 = hist.Percentile( 95.0 );
-
-      double range = p95 - p5;
-      if ( range > 0 )
-      {
-         ThreadData threadData;
-         threadData.width = width;
-         threadData.height = height;
-         threadData.output = &image;
-         threadData.p5 = p5;
-         threadData.range = range;
-         threadData.contrastBoost = m_contrastBoost;
-
-         ParallelProcess( threadData, []( const ThreadData& data, int startRow, int endRow )
-         {
-            for ( int y = startRow; y < endRow; ++y )
-            {
-               for ( int x = 0; x < data.width; ++x )
-               {
-                  double pixel = data.output->Pixel( x, y );
-                  
-                  // Real adaptive contrast stretching
-                  double stretched = ( pixel - data.p5 ) / data.range;
-                  stretched = pcl::Max( 0.0, pcl::Min( 1.0, stretched ) );
-                  
-                  // Real boost factor
-                  double boosted = stretched * ( 1.0 + data.contrastBoost );
-                  boosted = pcl::Max( 0.0, pcl::Min( 1.0, boosted ) );
-                  
-                  data.output->Pixel( x, y ) = boosted;
-               }
-            }
-         } );
-      }
-   }
-
-   // Thread data structure for parallel processing
-   struct ThreadData
-   {
-      int width, height;
-      const ImageVariant *red, *green, *blue;
-      ImageVariant *output, *tempImage;
-      const ImageVariant *lowRes, *midRes, *highRes;
-      double haRedCoeff, haGreenCoeff, haBlueCoeff, haWavelength;
-      bool adaptiveProcessing;
-      double mean, stdDev, enhancementStrength;
-      double sigmaSpace, sigmaColor, noiseReduction;
-      double p5, range, contrastBoost;
-   };
-
-   // Parallel processing helper
-   template<typename Func>
-   void ParallelProcess( const ThreadData& data, Func func )
-   {
-      int numThreads = Thread::NumberOfThreads();
-      int rowsPerThread = data.height / numThreads;
-      
-      Array<Thread> threads;
-      for ( int i = 0; i < numThreads; ++i )
-      {
-         int startRow = i * rowsPerThread;
-         int endRow = ( i == numThreads - 1 ) ? data.height : ( i + 1 ) * rowsPerThread;
-         
-         threads.Add( Thread( [&data, &func, startRow, endRow]() {
-            func( data, startRow, endRow );
-         } ) );
-      }
-      
-      for ( auto& thread : threads )
-         thread.Start();
-      
-      for ( auto& thread : threads )
-         thread.Wait();
-   }
-
-   // Process parameters
-   virtual void GetParameters( ProcessParameters& p ) const
-   {
-      p.conversionMethod = m_conversionMethod;
-      p.enhancementStrength = m_enhancementStrength;
-      p.noiseReduction = m_noiseReduction;
-      p.contrastBoost = m_contrastBoost;
-      p.haWavelength = m_haWavelength;
-      p.adaptiveProcessing = m_adaptiveProcessing;
-      p.qualityMode = m_qualityMode;
-   }
-
-   virtual void SetParameters( const ProcessParameters& p )
-   {
-      m_conversionMethod = p.conversionMethod;
-      m_enhancementStrength = p.enhancementStrength;
-      m_noiseReduction = p.noiseReduction;
-      m_contrastBoost = p.contrastBoost;
-      m_haWavelength = p.haWavelength;
-      m_adaptiveProcessing = p.adaptiveProcessing;
-      m_qualityMode = p.qualityMode;
-   }
-
-   ImageVariant m_image;
-};
-
-// Process parameters structure
-struct ProcessParameters
-{
-   int conversionMethod = 0;
-   double enhancementStrength = 0.5;
-   double noiseReduction = 0.3;
-   double contrastBoost = 0.4;
-   double haWavelength = 656.28;
-   bool adaptiveProcessing = true;
-   int qualityMode = 1;
-};
-
+/*
+ * RGB to HA Conversion Process for PixInsight
+ * Real implementation with actual image processing
+ */
+
+#include <pcl/ProcessInterface.h>
+#include <pcl/ProcessImplementation.h>
+#include <pcl/ProcessParameters.h>
+#include <pcl/View.h>
+#include <pcl/ImageWindow.h>
+#include <pcl/StandardStatus.h>
+#include <pcl/Console.h>
+#include <pcl/Exception.h>
+#include <pcl/Math.h>
+#include <pcl/Histogram.h>
+#include <pcl/Statistics.h>
+#include <pcl/Image.h>
+#include <pcl/ImageVariant.h>
+#include <pcl/Thread.h>
+#include <pcl/ElapsedTime.h>
+
+#include "RGBToHABufferPool.h"
+#include "RGBToHAEngine.h"
+#include "RGBToHAPreferences.h"
+#include "RGBToHAStageCache.h"
+#include "RGBToHAStreaming.h"
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+namespace pcl
+{
+
+class RGBToHAProcess : public ProcessImplementation
+{
+public:
+
+   RGBToHAProcess()
+   {
+   }
+
+   virtual ~RGBToHAProcess()
+   {
+   }
+
+   virtual void Assign( const ProcessImplementation& p )
+   {
+      const RGBToHAProcess* ps = dynamic_cast<const RGBToHAProcess*>( &p );
+      if ( ps != nullptr )
+      {
+         m_conversionMethod = ps->m_conversionMethod;
+         m_enhancementStrength = ps->m_enhancementStrength;
+         m_localContrastRadius = ps->m_localContrastRadius;
+         m_noiseReduction = ps->m_noiseReduction;
+         m_contrastBoost = ps->m_contrastBoost;
+         m_haWavelength = ps->m_haWavelength;
+         m_adaptiveProcessing = ps->m_adaptiveProcessing;
+         m_qualityMode = ps->m_qualityMode;
+         m_instrumentation = ps->m_instrumentation;
+         m_traceFile = ps->m_traceFile;
+         m_memoryBudget = ps->m_memoryBudget;
+         m_stageCacheSize = ps->m_stageCacheSize;
+         m_bufferPoolSize = ps->m_bufferPoolSize;
+         m_lutSize = ps->m_lutSize;
+         m_neuralModelPath = ps->m_neuralModelPath;
+      }
+   }
+
+   virtual bool IsHistoryUpdater( const View& view ) const
+   {
+      return false;
+   }
+
+   virtual bool CanExecuteOn( const View& view, pcl::String& whyNot ) const
+   {
+      if ( view.Image().IsColor() )
+         return true;
+      
+      whyNot = "RGB to HA conversion requires a color image.";
+      return false;
+   }
+
+   virtual void Execute()
+   {
+      if ( !m_image.IsValid() )
+         throw Error( "No image has been specified." );
+
+      if ( !m_image.IsColor() )
+         throw Error( "RGB to HA conversion requires a color image." );
+
+      StandardStatus status;
+      m_image.SetStatusCallback( &status );
+
+      Console().WriteLn( "<end><cbr>RGB to HA Conversion Process" );
+      Console().WriteLn( String().Format( "Conversion Method: %d", m_conversionMethod ) );
+      Console().WriteLn( String().Format( "Enhancement Strength: %.2f", m_enhancementStrength ) );
+
+      // Get image dimensions
+      int width = m_image.Width();
+      int height = m_image.Height();
+      int numberOfChannels = m_image.NumberOfChannels();
+
+      if ( numberOfChannels < 3 )
+         throw Error( "RGB to HA conversion requires at least 3 color channels." );
+
+      if ( m_localContrastRadius < 0 || m_localContrastRadius > HAKernels::LocalContrastMaxRadius )
+         throw Error( String().Format( "Invalid local contrast radius %d: must be between 0 and %d.",
+                                       m_localContrastRadius, HAKernels::LocalContrastMaxRadius ) );
+
+      if ( m_lutSize != 0 && ( m_lutSize < HAColorLUT::MinSize || m_lutSize > HAColorLUT::MaxSize ) )
+         throw Error( String().Format( "Invalid conversion LUT size %d: must be 0 (exact) or between %d and %d.",
+                                       m_lutSize, HAColorLUT::MinSize, HAColorLUT::MaxSize ) );
+
+      // Load the neural model up front, so a bad file fails before any work;
+      // the pipelines reuse the loaded copy
+      if ( m_conversionMethod == 3 && !m_neuralModelPath.IsEmpty() )
+      {
+         std::shared_ptr<const HAMLPModel> model;
+         try
+         {
+            model = HAMLPModel::Shared( NeuralModelPath() );
+            model->RequireConversionShape();
+         }
+         catch ( const std::runtime_error& x )
+         {
+            throw Error( String( "Unable to load the neural model: " ) + x.what() );
+         }
+         Console().WriteLn( String( "Neural model: " ) + m_neuralModelPath +
+                            String().Format( " (%s, %u parameters)", model->Shape().c_str(), unsigned( model->Parameters() ) ) );
+      }
+
+      // Create output image in the source sample format
+      ImageVariant outputImage;
+      outputImage.CreateImage( m_image.IsFloatSample(), false, m_image.BitsPerSample() );
+      outputImage.AllocateData( width, height, 1 ); // Single channel HA output
+      outputImage.SetStatusCallback( &status );
+
+      // Dispatch once on the sample type; everything below is typed
+      if ( m_image.IsFloatSample() )
+         switch ( m_image.BitsPerSample() )
+         {
+         case 32: Execute<FloatPixelTraits>( outputImage ); break;
+         case 64: Execute<DoublePixelTraits>( outputImage ); break;
+         default: throw Error( "Unsupported floating point sample format." );
+         }
+      else
+         switch ( m_image.BitsPerSample() )
+         {
+         case  8: Execute<UInt8PixelTraits>( outputImage ); break;
+         case 16: Execute<UInt16PixelTraits>( outputImage ); break;
+         case 32: Execute<UInt32PixelTraits>( outputImage ); break;
+         default: throw Error( "Unsupported integer sample format." );
+         }
+
+      // Set the output image
+      m_image = outputImage;
+
+      Console().WriteLn( "RGB to HA conversion completed successfully." );
+   }
+
+private:
+
+   // Conversion method selection
+   int m_conversionMethod = 0;        // 0=Standard, 1=Advanced, 2=Adaptive, 3=Neural
+   double m_enhancementStrength = 0.5; // 0.0 to 1.0
+   int m_localContrastRadius = 0;     // Local contrast window (2r+1)^2, 0 = 4 neighbours
+   double m_noiseReduction = 0.3;     // 0.0 to 1.0
+   double m_contrastBoost = 0.4;      // 0.0 to 1.0
+   double m_haWavelength = 656.28;    // HA wavelength in nm
+   bool m_adaptiveProcessing = true;   // Enable adaptive processing
+   int m_qualityMode = 1;             // 0=Fast, 1=Quality, 2=Ultra
+   bool m_instrumentation = false;    // Per-stage timing summary
+   String m_traceFile;                // Chrome trace output, if instrumented
+   int m_memoryBudget = 0;            // Working memory in MiB, 0 = unlimited
+   int m_stageCacheSize = 1024;       // Stage cache in MiB, 0 = disabled
+   int m_bufferPoolSize = 1024;       // Idle recycled planes in MiB, 0 = disabled
+   int m_lutSize = 0;                 // Conversion LUT points per axis, 0 = exact
+   String m_neuralModelPath;          // Neural Approximation weight file, empty = built-in weights
+
+   // Fused pipeline over the typed sample planes of one PCL image type.
+   // The RGB planes are read in place; no channel copies are made.
+   template <class P>
+   void Execute( ImageVariant& outputImage ) const
+   {
+      typedef typename P::sample sample;
+
+      const GenericImage<P>& image = static_cast<const GenericImage<P>&>( *m_image );
+      GenericImage<P>& output = static_cast<GenericImage<P>&>( *outputImage );
+
+      HASource<sample> source;
+      source.width = image.Width();
+      source.height = image.Height();
+      source.channel[0] = image.PixelData( 0 );
+      source.channel[1] = image.PixelData( 1 );
+      source.channel[2] = image.PixelData( 2 );
+      source.stride = image.Width();
+
+      const HAParameters params = Parameters();
+      const HAQualityProfile& profile = HAQualityProfileFor( params.qualityMode );
+      const HAView<sample> outputView( output.PixelData( 0 ), output.Width() );
+
+      // The module preferences bound what the instance asks for
+      const HAPreferences prefs = HAPreferences::Active();
+      std::unique_ptr<HAProfiler> profiler;
+      if ( m_instrumentation || prefs.instrumentation )
+         profiler.reset( new HAProfiler( HANumberOfThreads() ) );
+
+      const double MiB = 1024.0*1024.0;
+      const std::size_t budget = prefs.BudgetBytes( std::size_t( m_memoryBudget )*1024*1024 );
+      HABufferPool& pool = HABufferPool::Instance();
+      pool.SetCapacity( ( m_bufferPoolSize > 0 ) ? prefs.BudgetBytes( std::size_t( m_bufferPoolSize )*1024*1024 ) : 0 );
+      const HABufferPool::Statistics poolBefore = pool.Stats();
+
+      ElapsedTime T;
+      HARunSummary summary;
+      if ( profile.staged )
+      {
+         HAStagedPipeline pipeline( params );
+         std::size_t required = pipeline.WorkingBytes( source.width, source.height );
+         if ( budget > 0 && required > budget )
+            throw Error( String().Format( "Ultra quality needs %.1f MiB of working memory, over the %.0f MiB budget. "
+                                          "Use Quality mode or raise the memory budget.", required/MiB, budget/MiB ) );
+
+         Console().WriteLn( String().Format( "Quality mode: %s, double precision staged pipeline, %d-bit %s samples",
+                                             profile.name, int( 8*sizeof( sample ) ), P::IsFloatSample() ? "float" : "integer" ) );
+         if ( m_lutSize > 0 )
+            Console().WriteLn( "The conversion LUT is not used in Ultra quality mode." );
+         summary = pipeline.Run( source, outputView, profiler.get() );
+      }
+      else if ( budget > 0 )
+      {
+         // Strips sized to the budget; the image itself is already in memory,
+         // so nothing is spilled. Cached stages would not count against it.
+         HAStageCache::Instance().SetCapacity( 0 );
+         HAStreamingPipeline pipeline( params, budget );
+         HAImageStripSource<sample> stripSource( source );
+         HAImageStripSink<sample> stripSink( outputView );
+         Console().WriteLn( String().Format( "Quality mode: %s, conversion kernels: %s, %d-bit %s samples, %d-row strips",
+                                             profile.name, pipeline.ISA(), int( 8*sizeof( sample ) ),
+                                             P::IsFloatSample() ? "float" : "integer",
+                                             pipeline.StripRows<sample>( source.width, source.height ) ) );
+         ReportLUT( pipeline.LUT() );
+         summary = pipeline.Run( stripSource, stripSink, profiler.get() );
+      }
+      else if ( m_stageCacheSize > 0 )
+      {
+         // Reuse the stages whose inputs have not changed since the last run
+         // on this image. The image buffer stands for the view: new contents
+         // in it drop what was cached for the old.
+         HAStageCache& cache = HAStageCache::Instance();
+         cache.SetCapacity( std::size_t( m_stageCacheSize )*1024*1024 );
+         const std::uint64_t sourceId = HASourceFingerprint( source );
+         cache.Bind( std::uint64_t( reinterpret_cast<std::uintptr_t>( source.channel[0] ) ), sourceId );
+
+         HACachedPipeline pipeline( params, cache );
+         Console().WriteLn( String().Format( "Quality mode: %s, conversion kernels: %s, %d-bit %s samples", profile.name,
+                                             pipeline.ISA(), int( 8*sizeof( sample ) ), P::IsFloatSample() ? "float" : "integer" ) );
+         ReportLUT( pipeline.LUT() );
+         summary = pipeline.Run( source, sourceId, outputView, profiler.get() );
+         Console().WriteLn( String().Format( "Stage cache: %d stage(s) reused, %.1f of %d MiB in use",
+                                             pipeline.ReusedStages(), cache.Bytes()/MiB, m_stageCacheSize ) );
+      }
+      else
+      {
+         HAStageCache::Instance().SetCapacity( 0 );
+         HAFusedPipeline pipeline( params );
+         Console().WriteLn( String().Format( "Quality mode: %s, conversion kernels: %s, %d-bit %s samples", profile.name,
+                                             pipeline.ISA(), int( 8*sizeof( sample ) ), P::IsFloatSample() ? "float" : "integer" ) );
+         ReportLUT( pipeline.LUT() );
+         summary = pipeline.Run( source, outputView, profiler.get() );
+      }
+
+      double planeBytes = double( sizeof( sample ) )*source.width*source.height;
+      Console().WriteLn( String().Format( "Processing time: %.3f s", T() ) );
+      Console().WriteLn( String().Format( "Working memory: %.1f MiB, output: %.1f MiB, channel copies avoided: %.1f MiB",
+                                          summary.workingBytes/MiB, planeBytes/MiB, 3*planeBytes/MiB ) );
+      const HABufferPool::Statistics poolAfter = pool.Stats();
+      if ( poolAfter.requests > poolBefore.requests )
+         Console().WriteLn( String().Format( "Buffer pool: %u of %u plane(s) recycled, %.1f MiB not mapped afresh; "
+                                             "since startup %.0f%% recycled, %.1f MiB saved; %.1f MiB idle",
+                                             unsigned( poolAfter.hits - poolBefore.hits ),
+                                             unsigned( poolAfter.requests - poolBefore.requests ),
+                                             ( poolAfter.bytesReused - poolBefore.bytesReused )/MiB,
+                                             100*poolAfter.HitRate(), poolAfter.bytesReused/MiB, poolAfter.idleBytes/MiB ) );
+
+      if ( profiler )
+      {
+         Console().WriteLn( "<end><cbr>" + String( profiler->Summary().c_str() ) );
+         if ( !m_traceFile.IsEmpty() )
+         {
+            if ( profiler->WriteChromeTrace( IsoString( m_traceFile ).c_str() ) )
+               Console().WriteLn( "Chrome trace written: " + m_traceFile );
+            else
+               Console().WarningLn( "** Unable to write Chrome trace: " + m_traceFile );
+         }
+      }
+   }
+
+   // Interpolation error of the conversion LUT in use, if any
+   void ReportLUT( const HAColorLUT* lut ) const
+   {
+      if ( lut != nullptr )
+         Console().WriteLn( String().Format( "Conversion LUT: %d^3 points, built in %.1f ms, "
+                                             "error against the exact method: max %.2e, mean %.2e",
+                                             lut->Size(), lut->BuildMilliseconds(), lut->MaxError(), lut->MeanError() ) );
+      else if ( m_lutSize > 0 )
+         Console().WarningLn( "** The conversion LUT is ignored: it is only faster than exact conversion for "
+                              "Neural Approximation with a model file." );
+   }
+
+   std::string NeuralModelPath() const
+   {
+      return m_neuralModelPath.ToUTF8().c_str();
+   }
+
+   // Engine parameters from the current instance
+   HAParameters Parameters() const
+   {
+      HAParameters p;
+      p.conversionMethod = m_conversionMethod;
+      p.enhancementStrength = m_enhancementStrength;
+      p.localContrastRadius = m_localContrastRadius;
+      p.noiseReduction = m_noiseReduction;
+      p.contrastBoost = m_contrastBoost;
+      p.haWavelength = m_haWavelength;
+      p.adaptiveProcessing = m_adaptiveProcessing;
+      p.qualityMode = m_qualityMode;
+      p.neuralModelPath = NeuralModelPath();
+      p.lutSize = HALUTPays( p ) ? m_lutSize : 0;
+      return p;
+   }
+
+   // Process parameters
+   virtual void GetParameters( ProcessParameters& p ) const
+   {
+      p.conversionMethod = m_conversionMethod;
+      p.enhancementStrength = m_enhancementStrength;
+      p.localContrastRadius = m_localContrastRadius;
+      p.noiseReduction = m_noiseReduction;
+      p.contrastBoost = m_contrastBoost;
+      p.haWavelength = m_haWavelength;
+      p.adaptiveProcessing = m_adaptiveProcessing;
+      p.qualityMode = m_qualityMode;
+      p.instrumentation = m_instrumentation;
+      p.traceFile = m_traceFile;
+      p.memoryBudget = m_memoryBudget;
+      p.stageCacheSize = m_stageCacheSize;
+      p.bufferPoolSize = m_bufferPoolSize;
+      p.lutSize = m_lutSize;
+      p.neuralModelPath = m_neuralModelPath;
+   }
+
+   virtual void SetParameters( const ProcessParameters& p )
+   {
+      m_conversionMethod = p.conversionMethod;
+      m_enhancementStrength = p.enhancementStrength;
+      m_localContrastRadius = p.localContrastRadius;
+      m_noiseReduction = p.noiseReduction;
+      m_contrastBoost = p.contrastBoost;
+      m_haWavelength = p.haWavelength;
+      m_adaptiveProcessing = p.adaptiveProcessing;
+      m_qualityMode = p.qualityMode;
+      m_instrumentation = p.instrumentation;
+      m_traceFile = p.traceFile;
+      m_memoryBudget = p.memoryBudget;
+      m_stageCacheSize = p.stageCacheSize;
+      m_bufferPoolSize = p.bufferPoolSize;
+      m_lutSize = p.lutSize;
+      m_neuralModelPath = p.neuralModelPath;
+   }
+
+   ImageVariant m_image;
+};
+
+// Process parameters structure
+struct ProcessParameters
+{
+   int conversionMethod = 0;
+   double enhancementStrength = 0.5;
+   int localContrastRadius = 0;
+   double noiseReduction = 0.3;
+   double contrastBoost = 0.4;
+   double haWavelength = 656.28;
+   bool adaptiveProcessing = true;
+   int qualityMode = 1;
+   bool instrumentation = false;
+   String traceFile;
+   int memoryBudget = 0;
+   int stageCacheSize = 1024;
+   int bufferPoolSize = 1024;
+   int lutSize = 0;
+   String neuralModelPath;
+};
+
 } // pcl 
\ No newline at end of file
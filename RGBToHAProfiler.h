@@ -0,0 +1,241 @@
+/*
+ * RGB to HA Conversion Profiler for PixInsight
+ * Per-stage and per-tile timing with summary table and Chrome trace export
+ */
+
+#ifndef __RGBToHAProfiler_h
+#define __RGBToHAProfiler_h
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace pcl
+{
+
+/*
+ * Records a span for every stage of every tile (every band of rows in the
+ * staged pipeline): which thread ran it, when, for how long and how many
+ * bytes it read and wrote. Spans are grouped in
+ * phases, one per parallel loop; a thread's idle time in a phase is the
+ * phase's wall time minus the time it spent in spans.
+ *
+ * Each thread-pool participant slot appends to its own event list, so
+ * recording takes no locks. A slot is used by one thread at a time, which
+ * is all that requires; the thread itself is identified separately, since
+ * work stealing may run a slot on different threads in different loops.
+ *
+ * Pipelines take a null profiler by default and then record nothing.
+ */
+class HAProfiler
+{
+public:
+
+   enum Stage
+   {
+      Moments,        // pre-pass conversion for the enhancement statistics
+      Convert,        // RGB to HA conversion
+      Pyramid,        // multi-scale reduction and blending
+      Enhance,        // local contrast enhancement
+      NoiseReduction, // bilateral noise reduction
+      Store,          // histogram accumulation and typed output
+      ContrastBoost,  // percentile stretch
+      StageCount
+   };
+
+   static const char* StageName( int stage )
+   {
+      static const char* names[] = { "moments", "convert", "pyramid", "enhance", "denoise", "store", "contrast" };
+      return names[stage];
+   }
+
+   // slots is the number of thread-pool participants, HANumberOfThreads()
+   explicit HAProfiler( int slots ) :
+      m_events( std::max( 1, slots ) ), m_origin( Clock::now() )
+   {
+   }
+
+   // Times one stage of one tile from construction to destruction
+   class Span
+   {
+   public:
+
+      // profiler may be null
+      Span( HAProfiler* profiler, Stage stage, int slot, int tile, double bytes ) :
+         m_profiler( profiler ), m_stage( stage ), m_slot( slot ), m_tile( tile ), m_bytes( bytes )
+      {
+         if ( m_profiler != nullptr )
+            m_start = m_profiler->Now();
+      }
+
+      ~Span()
+      {
+         if ( m_profiler != nullptr )
+            m_profiler->Record( m_stage, m_slot, m_tile, m_start, m_profiler->Now() - m_start, m_bytes );
+      }
+
+      Span( const Span& ) = delete;
+      Span& operator =( const Span& ) = delete;
+
+   private:
+
+      HAProfiler* m_profiler;
+      Stage       m_stage;
+      int         m_slot;
+      int         m_tile;
+      double      m_bytes;
+      double      m_start = 0;
+   };
+
+   // Brackets a parallel loop; called by the thread issuing it
+   void BeginPhase( const char* name )
+   {
+      Phase phase;
+      phase.name = name;
+      phase.start = Now();
+      m_phases.push_back( phase );
+   }
+
+   void EndPhase()
+   {
+      m_phases.back().duration = Now() - m_phases.back().start;
+   }
+
+   // Stage totals and per-thread busy/idle time as a fixed-width table
+   std::string Summary() const
+   {
+      struct Total { double seconds = 0, bytes = 0; std::size_t spans = 0; };
+      Total stages[StageCount];
+      std::vector<std::thread::id> threads = Threads();
+      std::vector<double> busy( threads.size(), 0 );
+
+      for ( const std::vector<Event>& slotEvents : m_events )
+         for ( const Event& e : slotEvents )
+         {
+            stages[e.stage].seconds += e.duration;
+            stages[e.stage].bytes += e.bytes;
+            ++stages[e.stage].spans;
+            busy[ThreadIndex( threads, e.thread )] += e.duration;
+         }
+
+      double wall = 0;
+      for ( const Phase& p : m_phases )
+         wall += p.duration;
+
+      std::string text;
+      char line[160];
+      std::snprintf( line, sizeof( line ), "%-10s %10s %8s %10s %10s\n", "Stage", "Time (ms)", "Spans", "MiB", "GiB/s" );
+      text += line;
+      for ( int s = 0; s < StageCount; ++s )
+         if ( stages[s].spans > 0 )
+         {
+            std::snprintf( line, sizeof( line ), "%-10s %10.2f %8zu %10.1f %10.2f\n", StageName( s ),
+                           1000*stages[s].seconds, stages[s].spans, stages[s].bytes/1048576,
+                           ( stages[s].seconds > 0 ) ? stages[s].bytes/stages[s].seconds/1073741824 : 0.0 );
+            text += line;
+         }
+
+      std::snprintf( line, sizeof( line ), "\n%-10s %10s %10s %8s\n", "Thread", "Busy (ms)", "Idle (ms)", "Busy %" );
+      text += line;
+      for ( std::size_t t = 0; t < threads.size(); ++t )
+      {
+         std::snprintf( line, sizeof( line ), "%-10zu %10.2f %10.2f %7.1f%%\n", t,
+                        1000*busy[t], 1000*std::max( 0.0, wall - busy[t] ), ( wall > 0 ) ? 100*busy[t]/wall : 0.0 );
+         text += line;
+      }
+
+      for ( const Phase& p : m_phases )
+      {
+         std::snprintf( line, sizeof( line ), "%s%s %.2f ms", ( &p == &m_phases.front() ) ? "\nPhases: " : ", ",
+                        p.name, 1000*p.duration );
+         text += line;
+      }
+      return text + '\n';
+   }
+
+   // Writes every span and phase in the Chrome trace_event format, viewable
+   // in chrome://tracing or Perfetto. Returns false if the file cannot be
+   // written.
+   bool WriteChromeTrace( const std::string& path ) const
+   {
+      FILE* f = std::fopen( path.c_str(), "w" );
+      if ( f == nullptr )
+         return false;
+
+      std::vector<std::thread::id> threads = Threads();
+      std::fprintf( f, "{\"traceEvents\":[\n" );
+      for ( std::size_t t = 0; t < threads.size(); ++t )
+         std::fprintf( f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":\"thread %zu\"}},\n",
+                       t + 1, t );
+      for ( const Phase& p : m_phases )
+         std::fprintf( f, "{\"name\":\"%s\",\"cat\":\"phase\",\"ph\":\"X\",\"pid\":1,\"tid\":0,\"ts\":%.3f,\"dur\":%.3f},\n",
+                       p.name, 1e6*p.start, 1e6*p.duration );
+      for ( const std::vector<Event>& slotEvents : m_events )
+         for ( const Event& e : slotEvents )
+            std::fprintf( f, "{\"name\":\"%s\",\"cat\":\"stage\",\"ph\":\"X\",\"pid\":1,\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f,"
+                          "\"args\":{\"tile\":%d,\"bytes\":%.0f}},\n",
+                          StageName( e.stage ), ThreadIndex( threads, e.thread ) + 1, 1e6*e.start, 1e6*e.duration,
+                          e.tile, e.bytes );
+      std::fprintf( f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"RGBToHA\"}}\n]}\n" );
+      return std::fclose( f ) == 0;
+   }
+
+private:
+
+   typedef std::chrono::steady_clock Clock;
+
+   struct Event
+   {
+      std::thread::id thread;
+      Stage           stage;
+      int             tile;
+      double          start;    // seconds since the profiler was created
+      double          duration; // seconds
+      double          bytes;
+   };
+
+   struct Phase
+   {
+      const char* name = "";
+      double      start = 0;
+      double      duration = 0;
+   };
+
+   double Now() const
+   {
+      return std::chrono::duration<double>( Clock::now() - m_origin ).count();
+   }
+
+   void Record( Stage stage, int slot, int tile, double start, double duration, double bytes )
+   {
+      m_events[slot].push_back( Event{ std::this_thread::get_id(), stage, tile, start, duration, bytes } );
+   }
+
+   // Distinct threads in order of first appearance, the issuing thread first
+   std::vector<std::thread::id> Threads() const
+   {
+      std::vector<std::thread::id> threads;
+      for ( const std::vector<Event>& slotEvents : m_events )
+         for ( const Event& e : slotEvents )
+            if ( std::find( threads.begin(), threads.end(), e.thread ) == threads.end() )
+               threads.push_back( e.thread );
+      return threads;
+   }
+
+   static std::size_t ThreadIndex( const std::vector<std::thread::id>& threads, std::thread::id id )
+   {
+      return std::find( threads.begin(), threads.end(), id ) - threads.begin();
+   }
+
+   std::vector<std::vector<Event>> m_events; // per participant slot
+   std::vector<Phase>              m_phases;
+   Clock::time_point               m_origin;
+};
+
+} // pcl
+
+#endif   // __RGBToHAProfiler_h
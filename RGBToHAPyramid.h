@@ -0,0 +1,155 @@
+/*
+ * RGB to HA Conversion Pyramid for PixInsight
+ * Multi-scale levels for the Adaptive Multi-Scale method
+ */
+
+#ifndef __RGBToHAPyramid_h
+#define __RGBToHAPyramid_h
+
+#include "RGBToHAKernels.h"
+
+#include <vector>
+
+namespace pcl
+{
+
+/*
+ * Box pyramid of a converted HA image. Level 0 is full resolution; level k
+ * has (width >> k) x (height >> k) samples, each the mean of a 2x2 block of
+ * level k-1 (so the mean of a complete 2^k x 2^k block of level 0). Samples
+ * of incomplete blocks at the right and bottom edges do not exist.
+ *
+ * The three levels are recombined by nearest-neighbour upsampling with
+ * weights 0.6/0.3/0.1. A level without a sample at some position contributes
+ * nothing there. The depth is fixed: with fewer levels the coarse detail is
+ * weighted differently, which on star cores, stretched by the contrast
+ * boost, reaches full scale.
+ *
+ * Work is organized in bands of BlockSize level-0 rows: converting a band
+ * and reducing it through every level touches each sample once while the
+ * band is still in cache, and bands are independent of one another.
+ */
+class HAPyramid
+{
+public:
+
+   // Levels blended by Adaptive Multi-Scale, in every quality mode
+   static constexpr int Levels = 3;
+
+   // Level-0 pixels per coarsest sample along each axis
+   static constexpr int BlockSize = 1 << ( Levels - 1 );
+
+   // Column block for upsample-and-blend, in level-0 pixels
+   static constexpr int BlendBlock = 256;
+
+   // Blend weight of each level
+   static const double* Weights()
+   {
+      static const double weights[Levels] = { 0.6, 0.3, 0.1 };
+      return weights;
+   }
+
+   // Smallest rect containing r made of whole blocks, clipped to the image
+   static HARect Aligned( const HARect& r, int width, int height )
+   {
+      const int mask = BlockSize - 1;
+      return HARect( r.x0 & ~mask, r.y0 & ~mask,
+                     std::min( ( r.x1 + mask ) & ~mask, width ), std::min( ( r.y1 + mask ) & ~mask, height ) );
+   }
+
+   // Samples of level k covered by a block-aligned level-0 rect
+   static HARect LevelRect( const HARect& r, int k )
+   {
+      return HARect( r.x0 >> k, r.y0 >> k, r.x1 >> k, r.y1 >> k );
+   }
+
+   // Computes levels 1.. for the block-aligned level-0 band, each level from
+   // the one above it. levels[k] must cover LevelRect( band, k ). Blocks are
+   // complete, so there are no bounds checks for HAStencil to remove, and
+   // the stencil would evaluate the mean at every sample of the finer level:
+   // about ten times slower (rgbtoha_bench stencil).
+   template <typename R>
+   static void Reduce( const HAView<R>* levels, const HARect& band )
+   {
+      for ( int k = 1; k < Levels; ++k )
+      {
+         HARect r = LevelRect( band, k );
+         const HAView<R>& fine = levels[k-1];
+         const HAView<R>& coarse = levels[k];
+         for ( int y = r.y0; y < r.y1; ++y )
+         {
+            const R* a = fine.At( 2*r.x0, 2*y );
+            const R* b = fine.At( 2*r.x0, 2*y + 1 );
+            R* out = coarse.At( r.x0, y );
+            for ( int x = 0, n = r.Width(); x < n; ++x )
+               out[x] = ( a[2*x] + a[2*x+1] + b[2*x] + b[2*x+1] )/4;
+         }
+      }
+   }
+
+   // Weighted sum of count rows, clamped to [0,1]
+   template <typename R>
+   static void BlendRow( const R* const* rows, const R* weights, int count, R* out, int n )
+   {
+      for ( int i = 0; i < n; ++i )
+      {
+         R v = weights[0]*rows[0][i];
+         for ( int k = 1; k < count; ++k )
+            v += weights[k]*rows[k][i];
+         out[i] = HAKernels::Clamp01( v );
+      }
+   }
+
+   // Upsamples every level over rect and blends into out. levels[k] must
+   // cover LevelRect( aligned, k ) of a block-aligned rect containing rect.
+   // blendRow has the signature of BlendRow; buffer is per-thread scratch.
+   template <typename R, class BlendRowFunc>
+   static void Blend( const HAView<const R>* levels, const HAView<R>& out, const HARect& rect, int width, int height,
+                      std::vector<R>& buffer, BlendRowFunc blendRow )
+   {
+      R weights[Levels];
+      for ( int k = 0; k < Levels; ++k )
+         weights[k] = R( Weights()[k] );
+
+      buffer.resize( std::size_t( Levels )*BlendBlock );
+
+      for ( int y = rect.y0; y < rect.y1; ++y )
+         for ( int bx = rect.x0; bx < rect.x1; bx += BlendBlock )
+         {
+            const int n = std::min( BlendBlock, rect.x1 - bx );
+            const R* rows[Levels];
+            rows[0] = levels[0].At( bx, y );
+
+            for ( int k = 1; k < Levels; ++k )
+            {
+               R* up = buffer.data() + std::size_t( k )*BlendBlock;
+               rows[k] = up;
+               const int levelWidth = width >> k;
+               if ( ( y >> k ) >= ( height >> k ) )
+               {
+                  for ( int i = 0; i < n; ++i )
+                     up[i] = 0;
+                  continue;
+               }
+
+               // Runs of 2^k equal samples, zero past the last complete block
+               const int end = std::min( bx + n, levelWidth << k );
+               int x = bx;
+               if ( x < end )
+               {
+                  const R* src = levels[k].At( bx >> k, y >> k );
+                  for ( ; x < end; ++x )
+                     up[x - bx] = src[( x >> k ) - ( bx >> k )];
+               }
+               for ( ; x < bx + n; ++x )
+                  up[x - bx] = 0;
+            }
+
+            blendRow( rows, weights, Levels, out.At( bx, y ), n );
+         }
+   }
+};
+
+} // pcl
+
+#endif   // __RGBToHAPyramid_h
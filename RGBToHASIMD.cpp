@@ -0,0 +1,261 @@
+/*
+ * RGB to HA Conversion SIMD Dispatch for PixInsight
+ * CPU feature detection and scalar fallback kernels
+ */
+
+#include "RGBToHASIMD.h"
+#include "RGBToHAKernels.h"
+#include "RGBToHAPyramid.h"
+#include "RGBToHASIMDKernels.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#if defined( _MSC_VER ) && ( defined( _M_X64 ) || defined( _M_IX86 ) )
+#include <intrin.h>
+#elif defined( __x86_64__ ) || defined( __i386__ )
+#include <cpuid.h>
+#endif
+
+namespace pcl
+{
+
+namespace
+{
+
+void NeuralScalar( const float* r, const float* g, const float* b, float* out, int n, const HAKernelArgs& )
+{
+   HAKernels::ConvertNeuralApproximation( r, g, b, out, n );
+}
+
+// One-lane vector type: the folded linear kernel, the fast sigmoid, the LUT
+// interpolation and the MLP have no HAKernels equivalent, so the scalar
+// table runs the vector code one pixel at a time
+struct VecScalar
+{
+   typedef float type;
+   static constexpr int Width = 1;
+
+   static type Load( const float* p ) { return *p; }
+   static void Store( float* p, type v ) { *p = v; }
+   static type Set( float x ) { return x; }
+   static type Add( type a, type b ) { return a + b; }
+   static type Sub( type a, type b ) { return a - b; }
+   static type Mul( type a, type b ) { return a*b; }
+   static type Div( type a, type b ) { return a/b; }
+   static type Min( type a, type b ) { return ( b < a ) ? b : a; }
+   static type Max( type a, type b ) { return ( a < b ) ? b : a; }
+   static type MulAdd( type a, type b, type c ) { return a*b + c; }
+   static type Round( type x ) { return float( int( x + ( ( x < 0 ) ? -0.5f : 0.5f ) ) ); }
+   static type IfLess( type a, type b, type x, type y ) { return ( a < b ) ? x : y; }
+   static type Gather( const float* table, type index ) { return table[int( index )]; }
+
+   typedef std::int32_t itype;
+
+   static itype LoadU16( const std::uint16_t* p ) { return *p; }
+   static void StoreU16( std::uint16_t* p, itype v ) { *p = std::uint16_t( v ); }
+   static itype ISet( std::int32_t x ) { return x; }
+   static itype IAdd( itype a, itype b ) { return a + b; }
+   static itype ISub( itype a, itype b ) { return a - b; }
+   static itype IMul( itype a, itype b ) { return a*b; }
+   static itype IMin( itype a, itype b ) { return ( b < a ) ? b : a; }
+   static itype IMax( itype a, itype b ) { return ( a < b ) ? b : a; }
+   static itype IShiftRight( itype x, int n ) { return x >> n; }
+   static type ToFloat( itype x ) { return float( x ); }
+
+   static type Pow2( type n )
+   {
+      std::uint32_t bits = std::uint32_t( int( n ) + 127 ) << 23;
+      float x;
+      std::memcpy( &x, &bits, sizeof( x ) );
+      return x;
+   }
+};
+
+void SigmoidScalar( const float* x, float* out, int n )
+{
+   for ( int i = 0; i < n; ++i )
+      out[i] = 1/( 1 + std::exp( -x[i] ) );
+}
+
+void BlendScalar( const float* const* rows, const float* weights, int count, float* out, int n )
+{
+   HAPyramid::BlendRow( rows, weights, count, out, n );
+}
+
+#if defined( __x86_64__ ) || defined( _M_X64 )
+
+void CPUID( unsigned leaf, unsigned subleaf, unsigned regs[4] )
+{
+#ifdef _MSC_VER
+   int r[4];
+   __cpuidex( r, int( leaf ), int( subleaf ) );
+   for ( int i = 0; i < 4; ++i )
+      regs[i] = unsigned( r[i] );
+#else
+   __cpuid_count( leaf, subleaf, regs[0], regs[1], regs[2], regs[3] );
+#endif
+}
+
+unsigned long long XCR0()
+{
+#ifdef _MSC_VER
+   return _xgetbv( 0 );
+#else
+   unsigned lo, hi;
+   __asm__ __volatile__ ( "xgetbv" : "=a"( lo ), "=d"( hi ) : "c"( 0 ) );
+   return ( ( unsigned long long )hi << 32 ) | lo;
+#endif
+}
+
+struct X86Features
+{
+   bool sse42 = false;
+   bool avx2 = false;
+   bool avx512 = false;
+
+   X86Features()
+   {
+      unsigned r[4];
+      CPUID( 0, 0, r );
+      unsigned maxLeaf = r[0];
+
+      CPUID( 1, 0, r );
+      sse42 = ( r[2] & ( 1u << 20 ) ) != 0;
+      bool fma = ( r[2] & ( 1u << 12 ) ) != 0;
+      bool osxsave = ( r[2] & ( 1u << 27 ) ) != 0;
+      bool avx = ( r[2] & ( 1u << 28 ) ) != 0;
+      if ( !osxsave || !avx || maxLeaf < 7 )
+         return;
+
+      // The OS must save the YMM (and for AVX-512, opmask/ZMM) state
+      unsigned long long xcr0 = XCR0();
+      bool ymmState = ( xcr0 & 0x06 ) == 0x06;
+      bool zmmState = ( xcr0 & 0xe6 ) == 0xe6;
+
+      CPUID( 7, 0, r );
+      avx2 = ymmState && fma && ( r[1] & ( 1u << 5 ) ) != 0;
+      avx512 = zmmState && avx2 && ( r[1] & ( 1u << 16 ) ) != 0;
+   }
+};
+
+#endif
+
+bool Allowed( const char* isa )
+{
+   const char* only = std::getenv( "RGBTOHA_ISA" );
+   return only == nullptr || *only == '\0' || std::strcmp( only, isa ) == 0;
+}
+
+const HAConversionKernels& SelectKernels()
+{
+   const HAConversionKernels* candidates[] = {
+      HAConversionKernelsAVX512(), HAConversionKernelsAVX2(), HAConversionKernelsSSE42(), HAConversionKernelsNEON()
+   };
+   for ( const HAConversionKernels* kernels : candidates )
+      if ( kernels != nullptr && HACPUSupports( kernels->isa ) && Allowed( kernels->isa ) )
+         return *kernels;
+   return *HAConversionKernelsScalar();
+}
+
+std::atomic<const HAConversionKernels*>& ActiveKernels()
+{
+   static std::atomic<const HAConversionKernels*> active( &SelectKernels() );
+   return active;
+}
+
+} // namespace
+
+const HAConversionKernels* HAConversionKernelsScalar()
+{
+   static const HAConversionKernels kernels = {
+      "scalar", HAVectorKernels<VecScalar>::Linear<float>, NeuralScalar, HAVectorKernels<VecScalar>::NeuralLayers<true>,
+      BlendScalar, SigmoidScalar, HAVectorKernels<VecScalar>::Map<HAVectorKernels<VecScalar>::FastSigmoid>,
+      HAVectorKernels<VecScalar>::Tetrahedral, HAVectorKernels<VecScalar>::MLP<false>,
+      HAVectorKernels<VecScalar>::MLP<true>, HAVectorKernels<VecScalar>::Linear<std::uint16_t>,
+      HAVectorKernels<VecScalar>::FixedLinear, HAVectorKernels<VecScalar>::FixedAffine
+   };
+   return &kernels;
+}
+
+bool HACPUSupports( const char* isa )
+{
+   if ( std::strcmp( isa, "scalar" ) == 0 )
+      return true;
+#if defined( __x86_64__ ) || defined( _M_X64 )
+   static const X86Features cpu;
+   return ( std::strcmp( isa, "sse4.2" ) == 0 && cpu.sse42 ) ||
+          ( std::strcmp( isa, "avx2" ) == 0 && cpu.avx2 ) ||
+          ( std::strcmp( isa, "avx512" ) == 0 && cpu.avx512 );
+#elif defined( __aarch64__ ) || defined( _M_ARM64 )
+   // Advanced SIMD is mandatory on arm64
+   return std::strcmp( isa, "neon" ) == 0;
+#else
+   return false;
+#endif
+}
+
+const HAConversionKernels* HAConversionKernelsFor( const char* isa )
+{
+   for ( const HAConversionKernels* kernels : { HAConversionKernelsScalar(), HAConversionKernelsSSE42(),
+                                                HAConversionKernelsAVX2(), HAConversionKernelsAVX512(),
+                                                HAConversionKernelsNEON() } )
+      if ( kernels != nullptr && std::strcmp( kernels->isa, isa ) == 0 )
+         return HACPUSupports( isa ) ? kernels : nullptr;
+   return nullptr;
+}
+
+const char* HACPUName()
+{
+#if defined( __x86_64__ ) || defined( _M_X64 )
+   static const struct BrandString
+   {
+      char text[49] = {};
+
+      BrandString()
+      {
+         unsigned r[4];
+         CPUID( 0x80000000u, 0, r );
+         if ( r[0] < 0x80000004u )
+            return;
+         for ( unsigned leaf = 0; leaf < 3; ++leaf )
+         {
+            CPUID( 0x80000002u + leaf, 0, r );
+            std::memcpy( text + 16*leaf, r, 16 );
+         }
+      }
+   } brand;
+
+   // Leading spaces pad the string on some CPUs
+   const char* name = brand.text;
+   while ( *name == ' ' )
+      ++name;
+   return name;
+#else
+   return "";
+#endif
+}
+
+const HAConversionKernels& HAActiveConversionKernels()
+{
+   return *ActiveKernels().load( std::memory_order_acquire );
+}
+
+bool HASelectConversionKernels( const char* isa )
+{
+   if ( isa == nullptr || *isa == '\0' )
+   {
+      ActiveKernels().store( &SelectKernels(), std::memory_order_release );
+      return true;
+   }
+   const HAConversionKernels* kernels = HAConversionKernelsFor( isa );
+   if ( kernels == nullptr || !Allowed( isa ) )
+      return false;
+   ActiveKernels().store( kernels, std::memory_order_release );
+   return true;
+}
+
+} // pcl
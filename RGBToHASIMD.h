@@ -0,0 +1,172 @@
+/*
+ * RGB to HA Conversion SIMD Dispatch for PixInsight
+ * Runtime selection of vectorized conversion kernels
+ */
+
+#ifndef __RGBToHASIMD_h
+#define __RGBToHASIMD_h
+
+#include <cstdint>
+
+namespace pcl
+{
+
+// Activation of a dense layer; Tanh is evaluated as 2*sigmoid(2x) - 1
+enum class HAActivation
+{
+   Linear,
+   ReLU,
+   Sigmoid,
+   Tanh
+};
+
+// Dense layer: out = activation( weights*in + bias ), weights row-major,
+// outputs x inputs
+struct HAMLPLayer
+{
+   int          inputs = 0;
+   int          outputs = 0;
+   const float* weights = nullptr;
+   const float* bias = nullptr;
+   HAActivation activation = HAActivation::Linear;
+};
+
+// Layers of a loaded multilayer perceptron (HAMLPModel), as the kernels see
+// them; the weights stay owned by the model. id identifies the weights.
+struct HAMLPNetwork
+{
+   static constexpr int MaxLayers = 8;
+   static constexpr int MaxWidth = 64;
+
+   int                layerCount = 0;
+   HAMLPLayer         layers[MaxLayers];
+   unsigned long long id = 0;
+};
+
+// Per-run constants passed to every row kernel: the folded conversion
+// (HAConversionKernelArgs), Clamp01( (w0·rgb + o0)*(w1·rgb + o1) ) with the
+// second factor only if product is set
+struct HAKernelArgs
+{
+   float weights[2][3] = { { 0.85f, 0.10f, 0.05f }, { 0, 0, 0 } };
+   float offsets[2] = { 0, 1 };
+   bool  product = false;
+
+   // Neural Approximation with a loaded model: a network of 3 inputs
+   // (normalized RGB) and 1 output
+   const HAMLPNetwork* network = nullptr;
+};
+
+// Coefficient of a 16-bit fixed-point kernel, c*2^-shift with c = whole +
+// fraction/2^15. x*c is evaluated as x*whole + (x*fraction >> 15), so both
+// products of a 16-bit sample fit 32-bit lanes.
+struct HAFixedCoefficient
+{
+   std::int32_t whole = 0;
+   std::int32_t fraction = 0; // [0,2^15)
+};
+
+// Integer form of a linear conversion of 16-bit samples (HAFixedConversionArgs):
+// out = min( max( ( coeffs·rgb + offset ) >> shift, 0 ), 65535 ), with the
+// rounding term 2^(shift - 1) included in offset
+struct HAFixedLinearArgs
+{
+   HAFixedCoefficient coeffs[3];
+   std::int32_t       offset = 0;
+   int                shift = 0;
+};
+
+// Integer form of an affine map of 16-bit samples (HAContrastMap::Fixed):
+// t = min( max( x - origin, 0 ), limit ),
+// out = min( max( ( t*scale + offset ) >> shift, 0 ), 65535 )
+struct HAFixedAffineArgs
+{
+   std::int32_t       origin = 0;
+   std::int32_t       limit = 0;
+   HAFixedCoefficient scale;
+   std::int32_t       offset = 0;
+   int                shift = 0;
+};
+
+// Converts n pixels of contiguous, normalized float RGB rows into HA values
+typedef void (*HARowKernel)( const float* r, const float* g, const float* b, float* out, int n,
+                             const HAKernelArgs& args );
+
+// The same from 16-bit RGB rows, normalized as HALoadRow does
+typedef void (*HAU16RowKernel)( const std::uint16_t* r, const std::uint16_t* g, const std::uint16_t* b, float* out,
+                                int n, const HAKernelArgs& args );
+
+// Converts n pixels of 16-bit RGB rows into 16-bit HA in integer arithmetic
+typedef void (*HAFixedRowKernel)( const std::uint16_t* r, const std::uint16_t* g, const std::uint16_t* b,
+                                  std::uint16_t* out, int n, const HAFixedLinearArgs& args );
+
+// Applies args to n 16-bit samples in place
+typedef void (*HAFixedMapKernel)( std::uint16_t* data, int n, const HAFixedAffineArgs& args );
+
+// Clamped weighted sum of count rows: out[i] = Clamp01( sum of weights[k]*rows[k][i] )
+typedef void (*HABlendKernel)( const float* const* rows, const float* weights, int count, float* out, int n );
+
+// out[i] = f( x[i] )
+typedef void (*HAMapKernel)( const float* x, float* out, int n );
+
+// Interpolates n pixels of normalized float RGB rows in a size^3 lattice of
+// samples, blue varying fastest
+typedef void (*HALUTKernel)( const float* r, const float* g, const float* b, float* out, int n,
+                             const float* table, int size );
+
+// Bound on the absolute error of the fast sigmoid, over all finite inputs
+const float HAFastSigmoidMaxError = 1.0e-6f;
+
+// One instruction set's implementation of the per-pixel conversion methods
+// and of the multi-scale blend
+struct HAConversionKernels
+{
+   const char* isa;
+   HARowKernel linear;      // ConvertStandardRGBToHA and ConvertAdvancedSpectral, folded
+   HARowKernel neural;      // ConvertNeuralApproximation
+   HARowKernel neuralFast;  // ConvertNeuralApproximation with the fast sigmoid
+   HABlendKernel blend;     // HAPyramid::BlendRow
+   HAMapKernel sigmoid;     // 1/(1 + exp(-x))
+   HAMapKernel fastSigmoid; // 1/(1 + exp(-x)) within HAFastSigmoidMaxError
+   HALUTKernel lut;         // HAColorLUT::Apply, tetrahedral interpolation
+   HARowKernel mlp;         // HAKernelArgs::network, clamped to [0,1]
+   HARowKernel mlpFast;     // the same with the fast sigmoid
+   HAU16RowKernel linearU16;      // linear, from 16-bit rows
+   HAFixedRowKernel fixedLinear;  // HAFixedLinearArgs, 16-bit to 16-bit
+   HAFixedMapKernel fixedAffine;  // HAFixedAffineArgs, in place
+};
+
+// Implementations compiled into this binary; each returns nullptr when the
+// target architecture does not match. Availability on the running CPU is
+// checked by HAActiveConversionKernels().
+const HAConversionKernels* HAConversionKernelsScalar();
+const HAConversionKernels* HAConversionKernelsSSE42();
+const HAConversionKernels* HAConversionKernelsAVX2();
+const HAConversionKernels* HAConversionKernelsAVX512();
+const HAConversionKernels* HAConversionKernelsNEON();
+
+// True if the running CPU (and OS) supports isa: "scalar", "sse4.2", "avx2",
+// "avx512" or "neon"
+bool HACPUSupports( const char* isa );
+
+// Kernels for isa if they are compiled in and supported by the running CPU,
+// else nullptr
+const HAConversionKernels* HAConversionKernelsFor( const char* isa );
+
+// Brand string of the running CPU, or an empty string if it is not known
+const char* HACPUName();
+
+// Kernels used by pipelines created from now on: the fastest supported by the
+// running CPU, unless HASelectConversionKernels() chose others. The
+// RGBTOHA_ISA environment variable (scalar, sse4.2, avx2, avx512, neon)
+// restricts the choice.
+const HAConversionKernels& HAActiveConversionKernels();
+
+// Makes the kernels of isa active, or the fastest if isa is null or empty.
+// Returns false, leaving the selection unchanged, if they are unavailable or
+// excluded by RGBTOHA_ISA. Pipelines already created keep their kernels.
+bool HASelectConversionKernels( const char* isa );
+
+} // pcl
+
+#endif   // __RGBToHASIMD_h
@@ -0,0 +1,507 @@
+/*
+ * RGB to HA Conversion SIMD Kernels for PixInsight
+ * Conversion kernels written once against a small vector interface
+ *
+ * Included by the per-ISA translation units (RGBToHASIMD_*.cpp), each
+ * compiled with its own target flags, and by RGBToHASIMD.cpp for the one-lane
+ * scalar fallback. Every instantiation takes a vector type declared in an
+ * anonymous namespace, so no code built for one ISA can be merged by the
+ * linker into another. For the same reason nothing here calls into the
+ * standard library.
+ *
+ * A vector type V provides:
+ *    type, Width
+ *    Load, Store, Set, Add, Sub, Mul, Div, Min, Max
+ *    MulAdd( a, b, c ) = a*b + c
+ *    Round( x )        nearest integer, as float
+ *    Pow2( n )         2^n for integral n in [-126,127]
+ *    IfLess( a, b, x, y )  a < b ? x : y, per lane
+ *    Gather( t, i )    t[i] per lane, for integral i in [0,2^24)
+ *
+ * and Width lanes of 32-bit signed integers for the 16-bit fixed-point
+ * kernels:
+ *    itype
+ *    LoadU16, StoreU16 16-bit samples, zero-extended; stored lanes must hold
+ *                      values in [0,65535]
+ *    ISet, IAdd, ISub, IMul, IMin, IMax
+ *    IShiftRight( x, n )  arithmetic shift
+ *    ToFloat( x )
+ */
+
+#ifndef __RGBToHASIMDKernels_h
+#define __RGBToHASIMDKernels_h
+
+#include "RGBToHASIMD.h"
+
+namespace pcl
+{
+
+template <class V>
+struct HAVectorKernels
+{
+   typedef typename V::type vec;
+   typedef typename V::itype ivec;
+
+   static vec Clamp01( vec x )
+   {
+      return V::Min( V::Max( x, V::Set( 0.0f ) ), V::Set( 1.0f ) );
+   }
+
+   // Cephes single precision exp(), within 2 ulp over the clamped domain
+   static vec Exp( vec x )
+   {
+      x = V::Min( V::Max( x, V::Set( -87.3f ) ), V::Set( 88.3f ) );
+      vec n = V::Round( V::Mul( x, V::Set( 1.44269504088896341f ) ) );
+      vec r = V::Sub( x, V::Mul( n, V::Set( 0.693359375f ) ) );
+      r = V::Sub( r, V::Mul( n, V::Set( -2.12194440e-4f ) ) );
+      vec p = V::Set( 1.9875691500e-4f );
+      p = V::MulAdd( p, r, V::Set( 1.3981999507e-3f ) );
+      p = V::MulAdd( p, r, V::Set( 8.3334519073e-3f ) );
+      p = V::MulAdd( p, r, V::Set( 4.1665795894e-2f ) );
+      p = V::MulAdd( p, r, V::Set( 1.6666665459e-1f ) );
+      p = V::MulAdd( p, r, V::Set( 5.0000001201e-1f ) );
+      p = V::MulAdd( p, V::Mul( r, r ), V::Add( r, V::Set( 1.0f ) ) );
+      return V::Mul( p, V::Pow2( n ) );
+   }
+
+   // Runs step over full vectors, then once over a zero-padded tail
+   template <class Step>
+   static void ForEach( const float* r, const float* g, const float* b, float* out, int n, const Step& step )
+   {
+      int i = 0;
+      for ( ; i + V::Width <= n; i += V::Width )
+         V::Store( out + i, step( V::Load( r + i ), V::Load( g + i ), V::Load( b + i ) ) );
+
+      if ( i < n )
+      {
+         float tr[V::Width], tg[V::Width], tb[V::Width], to[V::Width];
+         for ( int j = 0; j < V::Width; ++j )
+         {
+            bool inside = i + j < n;
+            tr[j] = inside ? r[i+j] : 0.0f;
+            tg[j] = inside ? g[i+j] : 0.0f;
+            tb[j] = inside ? b[i+j] : 0.0f;
+         }
+         V::Store( to, step( V::Load( tr ), V::Load( tg ), V::Load( tb ) ) );
+         for ( int j = 0; i + j < n; ++j )
+            out[i+j] = to[j];
+      }
+   }
+
+   static void Put( float* p, vec v )
+   {
+      V::Store( p, v );
+   }
+
+   static void Put( std::uint16_t* p, ivec v )
+   {
+      V::StoreU16( p, v );
+   }
+
+   // ForEach over 16-bit samples in integer lanes; step returns a vec for
+   // float output or an ivec for 16-bit output
+   template <typename O, class Step>
+   static void ForEachU16( const std::uint16_t* r, const std::uint16_t* g, const std::uint16_t* b, O* out, int n,
+                           const Step& step )
+   {
+      int i = 0;
+      for ( ; i + V::Width <= n; i += V::Width )
+         Put( out + i, step( V::LoadU16( r + i ), V::LoadU16( g + i ), V::LoadU16( b + i ) ) );
+
+      if ( i < n )
+      {
+         std::uint16_t tr[V::Width], tg[V::Width], tb[V::Width];
+         O to[V::Width];
+         for ( int j = 0; j < V::Width; ++j )
+         {
+            bool inside = i + j < n;
+            tr[j] = inside ? r[i+j] : 0;
+            tg[j] = inside ? g[i+j] : 0;
+            tb[j] = inside ? b[i+j] : 0;
+         }
+         Put( to, step( V::LoadU16( tr ), V::LoadU16( tg ), V::LoadU16( tb ) ) );
+         for ( int j = 0; i + j < n; ++j )
+            out[i+j] = to[j];
+      }
+   }
+
+   // ForEach over 16-bit samples, normalized to [0,1] as HALoadRow does
+   template <class Step>
+   static void ForEach( const std::uint16_t* r, const std::uint16_t* g, const std::uint16_t* b, float* out, int n,
+                        const Step& step )
+   {
+      const vec scale = V::Set( float( 1/65535.0 ) );
+      ForEachU16( r, g, b, out, n, [&]( ivec vr, ivec vg, ivec vb )
+      {
+         return step( V::Mul( V::ToFloat( vr ), scale ), V::Mul( V::ToFloat( vg ), scale ),
+                      V::Mul( V::ToFloat( vb ), scale ) );
+      } );
+   }
+
+   // Standard and Advanced Spectral, folded into one or two affine forms of
+   // RGB by HAStageGraph: three or seven multiply-adds per pixel. S is float
+   // for normalized rows or std::uint16_t for 16-bit samples.
+   template <typename S>
+   static void Linear( const S* r, const S* g, const S* b, float* out, int n, const HAKernelArgs& args )
+   {
+      const vec w0r = V::Set( args.weights[0][0] ), w0g = V::Set( args.weights[0][1] ),
+                w0b = V::Set( args.weights[0][2] ), o0 = V::Set( args.offsets[0] );
+
+      if ( !args.product )
+      {
+         ForEach( r, g, b, out, n, [&]( vec vr, vec vg, vec vb )
+         {
+            return Clamp01( V::MulAdd( w0b, vb, V::MulAdd( w0g, vg, V::MulAdd( w0r, vr, o0 ) ) ) );
+         } );
+         return;
+      }
+
+      const vec w1r = V::Set( args.weights[1][0] ), w1g = V::Set( args.weights[1][1] ),
+                w1b = V::Set( args.weights[1][2] ), o1 = V::Set( args.offsets[1] );
+      ForEach( r, g, b, out, n, [&]( vec vr, vec vg, vec vb )
+      {
+         vec ha = V::MulAdd( w0b, vb, V::MulAdd( w0g, vg, V::MulAdd( w0r, vr, o0 ) ) );
+         vec factor = V::MulAdd( w1b, vb, V::MulAdd( w1g, vg, V::MulAdd( w1r, vr, o1 ) ) );
+         return Clamp01( V::Mul( ha, factor ) );
+      } );
+   }
+
+   // 1/(1 + exp(-x)) with exp(-x) = 2^n*p(f), n = round(-x*log2(e)) and p the
+   // degree 4 minimax polynomial of 2^f on [-1/2,1/2] (relative error 2.6e-6).
+   // Absolute error within HAFastSigmoidMaxError for every x.
+   static vec FastSigmoid( vec x )
+   {
+      vec t = V::Mul( x, V::Set( -1.44269504088896341f ) );
+      t = V::Min( V::Max( t, V::Set( -126.0f ) ), V::Set( 126.0f ) );
+      vec n = V::Round( t );
+      vec f = V::Sub( t, n );
+      vec p = V::Set( 9.5701019081e-3f );
+      p = V::MulAdd( p, f, V::Set( 5.5917860319e-2f ) );
+      p = V::MulAdd( p, f, V::Set( 2.4024744828e-1f ) );
+      p = V::MulAdd( p, f, V::Set( 6.9312181474e-1f ) );
+      p = V::MulAdd( p, f, V::Set( 9.9999926145e-1f ) );
+      return V::Div( V::Set( 1.0f ), V::Add( V::Set( 1.0f ), V::Mul( p, V::Pow2( n ) ) ) );
+   }
+
+   static vec Sigmoid( vec x )
+   {
+      return V::Div( V::Set( 1.0f ), V::Add( V::Set( 1.0f ), Exp( V::Sub( V::Set( 0.0f ), x ) ) ) );
+   }
+
+   template <bool Fast>
+   static void NeuralLayers( const float* r, const float* g, const float* b, float* out, int n, const HAKernelArgs& )
+   {
+      static const float weights[3][5] = {
+         { 0.85f, 0.10f, 0.05f, 0.02f, 0.01f },
+         { 0.70f, 0.20f, 0.08f, 0.01f, 0.01f },
+         { 0.60f, 0.25f, 0.12f, 0.02f, 0.01f }
+      };
+
+      ForEach( r, g, b, out, n, [&]( vec vr, vec vg, vec vb )
+      {
+         vec rg = V::Mul( vr, vg );
+         vec rb = V::Mul( vr, vb );
+         vec ha = V::Set( 0.0f );
+         for ( int layer = 0; layer < 3; ++layer )
+         {
+            vec x = V::Mul( V::Set( weights[layer][0] ), vr );
+            x = V::MulAdd( V::Set( weights[layer][1] ), vg, x );
+            x = V::MulAdd( V::Set( weights[layer][2] ), vb, x );
+            x = V::MulAdd( V::Set( weights[layer][3] ), rg, x );
+            x = V::MulAdd( V::Set( weights[layer][4] ), rb, x );
+
+            vec sigmoid = Fast ? FastSigmoid( x ) : Sigmoid( x );
+            ha = V::MulAdd( sigmoid, V::Set( 1.0f - layer*0.2f ), ha );
+         }
+         return Clamp01( ha );
+      } );
+   }
+
+   template <vec (*F)( vec )>
+   static void Map( const float* x, float* out, int n )
+   {
+      int i = 0;
+      for ( ; i + V::Width <= n; i += V::Width )
+         V::Store( out + i, F( V::Load( x + i ) ) );
+
+      if ( i < n )
+      {
+         float tx[V::Width], to[V::Width];
+         for ( int j = 0; j < V::Width; ++j )
+            tx[j] = ( i + j < n ) ? x[i+j] : 0.0f;
+         V::Store( to, F( V::Load( tx ) ) );
+         for ( int j = 0; i + j < n; ++j )
+            out[i+j] = to[j];
+      }
+   }
+
+   static void Blend( const float* const* rows, const float* weights, int count, float* out, int n )
+   {
+      int i = 0;
+      for ( ; i + V::Width <= n; i += V::Width )
+      {
+         vec v = V::Mul( V::Set( weights[0] ), V::Load( rows[0] + i ) );
+         for ( int k = 1; k < count; ++k )
+            v = V::MulAdd( V::Set( weights[k] ), V::Load( rows[k] + i ), v );
+         V::Store( out + i, Clamp01( v ) );
+      }
+
+      for ( ; i < n; ++i )
+      {
+         float v = weights[0]*rows[0][i];
+         for ( int k = 1; k < count; ++k )
+            v += weights[k]*rows[k][i];
+         out[i] = ( v < 0 ) ? 0.0f : ( ( v > 1 ) ? 1.0f : v );
+      }
+   }
+
+   // Tetrahedral interpolation in a size^3 lattice (HAColorLUT). The lattice
+   // cell holding a pixel is split into six tetrahedra along its main
+   // diagonal; the one holding the pixel is found by sorting the fractional
+   // coordinates, which then weight its four vertices.
+   static void Tetrahedral( const float* r, const float* g, const float* b, float* out, int n,
+                            const float* table, int size )
+   {
+      const vec scale = V::Set( float( size - 1 ) ), half = V::Set( 0.5f );
+      const vec zero = V::Set( 0.0f ), last = V::Set( float( size - 2 ) );
+      const vec sr = V::Set( float( size*size ) ), sg = V::Set( float( size ) ), sb = V::Set( 1.0f );
+      const vec diagonal = V::Set( float( size*size + size + 1 ) );
+
+      ForEach( r, g, b, out, n, [&]( vec vr, vec vg, vec vb )
+      {
+         // Cell origin and position within it; at a lattice point between
+         // two cells either one gives the same value
+         vec xr = V::Mul( Clamp01( vr ), scale ), xg = V::Mul( Clamp01( vg ), scale ), xb = V::Mul( Clamp01( vb ), scale );
+         vec ir = V::Min( V::Max( V::Round( V::Sub( xr, half ) ), zero ), last );
+         vec ig = V::Min( V::Max( V::Round( V::Sub( xg, half ) ), zero ), last );
+         vec ib = V::Min( V::Max( V::Round( V::Sub( xb, half ) ), zero ), last );
+         vec fr = V::Sub( xr, ir ), fg = V::Sub( xg, ig ), fb = V::Sub( xb, ib );
+
+         vec hi = V::Max( fr, V::Max( fg, fb ) );
+         vec lo = V::Min( fr, V::Min( fg, fb ) );
+         vec mid = V::Sub( V::Add( fr, V::Add( fg, fb ) ), V::Add( hi, lo ) );
+
+         // Steps along the axes of the largest and smallest fractions
+         vec maxStep = V::IfLess( fr, fg, V::IfLess( fg, fb, sb, sg ), V::IfLess( fr, fb, sb, sr ) );
+         vec minStep = V::IfLess( fg, fr, V::IfLess( fb, fg, sb, sg ), V::IfLess( fb, fr, sb, sr ) );
+
+         vec base = V::MulAdd( ir, sr, V::MulAdd( ig, sg, ib ) );
+         vec c0 = V::Gather( table, base );
+         vec c1 = V::Gather( table, V::Add( base, maxStep ) );
+         vec c2 = V::Gather( table, V::Sub( V::Add( base, diagonal ), minStep ) );
+         vec c3 = V::Gather( table, V::Add( base, diagonal ) );
+
+         vec v = V::MulAdd( V::Sub( c1, c0 ), hi, c0 );
+         v = V::MulAdd( V::Sub( c2, c1 ), mid, v );
+         return V::MulAdd( V::Sub( c3, c2 ), lo, v );
+      } );
+   }
+
+   // Pixels per block of the MLP kernel. Activations are held feature-major,
+   // MLPBlock floats per feature, so the two buffers of a block of the widest
+   // layers take 32 KiB and stay in L1.
+   static constexpr int MLPBlock = 64;
+
+   template <bool Fast>
+   static vec Activate( vec x, HAActivation activation )
+   {
+      switch ( activation )
+      {
+      case HAActivation::ReLU:
+         return V::Max( x, V::Set( 0.0f ) );
+      case HAActivation::Sigmoid:
+         return Fast ? FastSigmoid( x ) : Sigmoid( x );
+      case HAActivation::Tanh:
+      {
+         vec s = Fast ? FastSigmoid( V::Add( x, x ) ) : Sigmoid( V::Add( x, x ) );
+         return V::Sub( V::Add( s, s ), V::Set( 1.0f ) );
+      }
+      default:
+         return x;
+      }
+   }
+
+   // One dense layer over count pixels of a block (a multiple of 2*Width) as
+   // a small GEMM, out = activation( W*in + bias ). Four outputs by two pixel
+   // vectors per step: each input load and weight broadcast feeds several
+   // multiply-adds, and the eight accumulators stay in registers.
+   template <bool Fast>
+   static void Dense( const HAMLPLayer& layer, const float* in, float* out, int count )
+   {
+      const int m = layer.inputs;
+      const HAActivation f = layer.activation;
+      int o = 0;
+      for ( ; o + 4 <= layer.outputs; o += 4 )
+      {
+         const float* w0 = layer.weights + o*m;
+         const float* w1 = w0 + m;
+         const float* w2 = w1 + m;
+         const float* w3 = w2 + m;
+         for ( int p = 0; p < count; p += 2*V::Width )
+         {
+            vec a0 = V::Set( layer.bias[o] ), a1 = V::Set( layer.bias[o+1] ),
+                a2 = V::Set( layer.bias[o+2] ), a3 = V::Set( layer.bias[o+3] );
+            vec b0 = a0, b1 = a1, b2 = a2, b3 = a3;
+            for ( int k = 0; k < m; ++k )
+            {
+               const vec x = V::Load( in + k*MLPBlock + p ), y = V::Load( in + k*MLPBlock + p + V::Width );
+               vec w = V::Set( w0[k] );
+               a0 = V::MulAdd( w, x, a0 );
+               b0 = V::MulAdd( w, y, b0 );
+               w = V::Set( w1[k] );
+               a1 = V::MulAdd( w, x, a1 );
+               b1 = V::MulAdd( w, y, b1 );
+               w = V::Set( w2[k] );
+               a2 = V::MulAdd( w, x, a2 );
+               b2 = V::MulAdd( w, y, b2 );
+               w = V::Set( w3[k] );
+               a3 = V::MulAdd( w, x, a3 );
+               b3 = V::MulAdd( w, y, b3 );
+            }
+            float* q = out + o*MLPBlock + p;
+            V::Store( q, Activate<Fast>( a0, f ) );
+            V::Store( q + V::Width, Activate<Fast>( b0, f ) );
+            V::Store( q + MLPBlock, Activate<Fast>( a1, f ) );
+            V::Store( q + MLPBlock + V::Width, Activate<Fast>( b1, f ) );
+            V::Store( q + 2*MLPBlock, Activate<Fast>( a2, f ) );
+            V::Store( q + 2*MLPBlock + V::Width, Activate<Fast>( b2, f ) );
+            V::Store( q + 3*MLPBlock, Activate<Fast>( a3, f ) );
+            V::Store( q + 3*MLPBlock + V::Width, Activate<Fast>( b3, f ) );
+         }
+      }
+
+      for ( ; o < layer.outputs; ++o )
+      {
+         const float* w0 = layer.weights + o*m;
+         for ( int p = 0; p < count; p += 2*V::Width )
+         {
+            vec a0 = V::Set( layer.bias[o] ), b0 = a0;
+            for ( int k = 0; k < m; ++k )
+            {
+               const vec w = V::Set( w0[k] );
+               a0 = V::MulAdd( w, V::Load( in + k*MLPBlock + p ), a0 );
+               b0 = V::MulAdd( w, V::Load( in + k*MLPBlock + p + V::Width ), b0 );
+            }
+            V::Store( out + o*MLPBlock + p, Activate<Fast>( a0, f ) );
+            V::Store( out + o*MLPBlock + p + V::Width, Activate<Fast>( b0, f ) );
+         }
+      }
+   }
+
+   // Neural Approximation with a loaded network (HAMLPModel): blocks of
+   // MLPBlock pixels go through every layer before the next block is read,
+   // so the intermediate activations never leave L1
+   template <bool Fast>
+   static void MLP( const float* r, const float* g, const float* b, float* out, int n, const HAKernelArgs& args )
+   {
+      const HAMLPNetwork& network = *args.network;
+      float buffer[2][HAMLPNetwork::MaxWidth*MLPBlock];
+
+      for ( int p0 = 0; p0 < n; p0 += MLPBlock )
+      {
+         const int count = ( n - p0 < MLPBlock ) ? n - p0 : MLPBlock;
+         const int padded = ( count + 2*V::Width - 1 )/( 2*V::Width )*( 2*V::Width );
+
+         float* x = buffer[0];
+         for ( int i = 0; i < padded; ++i )
+         {
+            bool inside = i < count;
+            x[i] = inside ? r[p0+i] : 0.0f;
+            x[MLPBlock+i] = inside ? g[p0+i] : 0.0f;
+            x[2*MLPBlock+i] = inside ? b[p0+i] : 0.0f;
+         }
+
+         int current = 0;
+         for ( int l = 0; l < network.layerCount; ++l, current ^= 1 )
+            Dense<Fast>( network.layers[l], buffer[current], buffer[current^1], padded );
+
+         const float* y = buffer[current];
+         int i = 0;
+         for ( ; i + V::Width <= count; i += V::Width )
+            V::Store( out + p0 + i, Clamp01( V::Load( y + i ) ) );
+         for ( ; i < count; ++i )
+            out[p0+i] = ( y[i] < 0 ) ? 0.0f : ( ( y[i] > 1 ) ? 1.0f : y[i] );
+      }
+   }
+
+   // x*c for a 16-bit sample x and an HAFixedCoefficient c
+   struct FixedProduct
+   {
+      ivec whole, fraction;
+
+      FixedProduct( const HAFixedCoefficient& c ) : whole( V::ISet( c.whole ) ), fraction( V::ISet( c.fraction ) )
+      {
+      }
+
+      ivec operator ()( ivec x ) const
+      {
+         return V::IAdd( V::IMul( x, whole ), V::IShiftRight( V::IMul( x, fraction ), 15 ) );
+      }
+   };
+
+   // HAFixedLinearArgs: 16-bit RGB to 16-bit HA in integer lanes, six
+   // multiplies per pixel and no floating point
+   static void FixedLinear( const std::uint16_t* r, const std::uint16_t* g, const std::uint16_t* b, std::uint16_t* out,
+                            int n, const HAFixedLinearArgs& args )
+   {
+      const FixedProduct cr( args.coeffs[0] ), cg( args.coeffs[1] ), cb( args.coeffs[2] );
+      const ivec offset = V::ISet( args.offset ), zero = V::ISet( 0 ), top = V::ISet( 65535 );
+      const int shift = args.shift;
+      ForEachU16( r, g, b, out, n, [&]( ivec vr, ivec vg, ivec vb )
+      {
+         ivec sum = V::IAdd( V::IAdd( cr( vr ), cg( vg ) ), V::IAdd( cb( vb ), offset ) );
+         return V::IMin( V::IMax( V::IShiftRight( sum, shift ), zero ), top );
+      } );
+   }
+
+   // HAFixedAffineArgs on 16-bit samples, in place
+   static void FixedAffine( std::uint16_t* data, int n, const HAFixedAffineArgs& args )
+   {
+      const FixedProduct scale( args.scale );
+      const ivec origin = V::ISet( args.origin ), limit = V::ISet( args.limit ), offset = V::ISet( args.offset ),
+                 zero = V::ISet( 0 ), top = V::ISet( 65535 );
+      const int shift = args.shift;
+      auto map = [&]( ivec x )
+      {
+         ivec t = V::IMin( V::IMax( V::ISub( x, origin ), zero ), limit );
+         return V::IMin( V::IMax( V::IShiftRight( V::IAdd( scale( t ), offset ), shift ), zero ), top );
+      };
+
+      int i = 0;
+      for ( ; i + V::Width <= n; i += V::Width )
+         V::StoreU16( data + i, map( V::LoadU16( data + i ) ) );
+
+      if ( i < n )
+      {
+         std::uint16_t t[V::Width];
+         for ( int j = 0; j < V::Width; ++j )
+            t[j] = ( i + j < n ) ? data[i+j] : 0;
+         V::StoreU16( t, map( V::LoadU16( t ) ) );
+         for ( int j = 0; i + j < n; ++j )
+            data[i+j] = t[j];
+      }
+   }
+
+   static HAConversionKernels Table( const char* isa )
+   {
+      HAConversionKernels k;
+      k.isa = isa;
+      k.linear = Linear<float>;
+      k.neural = NeuralLayers<false>;
+      k.neuralFast = NeuralLayers<true>;
+      k.blend = Blend;
+      k.sigmoid = Map<Sigmoid>;
+      k.fastSigmoid = Map<FastSigmoid>;
+      k.lut = Tetrahedral;
+      k.mlp = MLP<false>;
+      k.mlpFast = MLP<true>;
+      k.linearU16 = Linear<std::uint16_t>;
+      k.fixedLinear = FixedLinear;
+      k.fixedAffine = FixedAffine;
+      return k;
+   }
+};
+
+} // pcl
+
+#endif   // __RGBToHASIMDKernels_h
@@ -0,0 +1,87 @@
+/*
+ * RGB to HA Conversion SIMD Kernels for PixInsight
+ * AVX2 + FMA implementation (x86-64)
+ */
+
+#include "RGBToHASIMD.h"
+
+#if defined( __x86_64__ ) || defined( _M_X64 )
+
+#include <immintrin.h>
+
+#include "RGBToHASIMDKernels.h"
+
+namespace pcl
+{
+
+namespace
+{
+
+struct VecAVX2
+{
+   typedef __m256 type;
+   static constexpr int Width = 8;
+
+   static type Load( const float* p ) { return _mm256_loadu_ps( p ); }
+   static void Store( float* p, type v ) { _mm256_storeu_ps( p, v ); }
+   static type Set( float x ) { return _mm256_set1_ps( x ); }
+   static type Add( type a, type b ) { return _mm256_add_ps( a, b ); }
+   static type Sub( type a, type b ) { return _mm256_sub_ps( a, b ); }
+   static type Mul( type a, type b ) { return _mm256_mul_ps( a, b ); }
+   static type Div( type a, type b ) { return _mm256_div_ps( a, b ); }
+   static type Min( type a, type b ) { return _mm256_min_ps( a, b ); }
+   static type Max( type a, type b ) { return _mm256_max_ps( a, b ); }
+   static type MulAdd( type a, type b, type c ) { return _mm256_fmadd_ps( a, b, c ); }
+   static type Round( type x ) { return _mm256_round_ps( x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC ); }
+   static type IfLess( type a, type b, type x, type y ) { return _mm256_blendv_ps( y, x, _mm256_cmp_ps( a, b, _CMP_LT_OQ ) ); }
+   static type Gather( const float* table, type index ) { return _mm256_i32gather_ps( table, _mm256_cvtps_epi32( index ), 4 ); }
+
+   typedef __m256i itype;
+
+   static itype LoadU16( const std::uint16_t* p ) { return _mm256_cvtepu16_epi32( _mm_loadu_si128( reinterpret_cast<const __m128i*>( p ) ) ); }
+   static itype ISet( std::int32_t x ) { return _mm256_set1_epi32( x ); }
+   static itype IAdd( itype a, itype b ) { return _mm256_add_epi32( a, b ); }
+   static itype ISub( itype a, itype b ) { return _mm256_sub_epi32( a, b ); }
+   static itype IMul( itype a, itype b ) { return _mm256_mullo_epi32( a, b ); }
+   static itype IMin( itype a, itype b ) { return _mm256_min_epi32( a, b ); }
+   static itype IMax( itype a, itype b ) { return _mm256_max_epi32( a, b ); }
+   static itype IShiftRight( itype x, int n ) { return _mm256_sra_epi32( x, _mm_cvtsi32_si128( n ) ); }
+   static type ToFloat( itype x ) { return _mm256_cvtepi32_ps( x ); }
+
+   // Packing works within 128-bit lanes: gather the two low quadwords
+   static void StoreU16( std::uint16_t* p, itype v )
+   {
+      __m256i packed = _mm256_permute4x64_epi64( _mm256_packus_epi32( v, v ), 0x08 );
+      _mm_storeu_si128( reinterpret_cast<__m128i*>( p ), _mm256_castsi256_si128( packed ) );
+   }
+
+   static type Pow2( type n )
+   {
+      __m256i e = _mm256_add_epi32( _mm256_cvtps_epi32( n ), _mm256_set1_epi32( 127 ) );
+      return _mm256_castsi256_ps( _mm256_slli_epi32( e, 23 ) );
+   }
+};
+
+} // namespace
+
+const HAConversionKernels* HAConversionKernelsAVX2()
+{
+   static const HAConversionKernels kernels = HAVectorKernels<VecAVX2>::Table( "avx2" );
+   return &kernels;
+}
+
+} // pcl
+
+#else
+
+namespace pcl
+{
+
+const HAConversionKernels* HAConversionKernelsAVX2()
+{
+   return nullptr;
+}
+
+} // pcl
+
+#endif
@@ -0,0 +1,81 @@
+/*
+ * RGB to HA Conversion SIMD Kernels for PixInsight
+ * AVX-512F implementation (x86-64)
+ */
+
+#include "RGBToHASIMD.h"
+
+#if defined( __x86_64__ ) || defined( _M_X64 )
+
+#include <immintrin.h>
+
+#include "RGBToHASIMDKernels.h"
+
+namespace pcl
+{
+
+namespace
+{
+
+struct VecAVX512
+{
+   typedef __m512 type;
+   static constexpr int Width = 16;
+
+   static type Load( const float* p ) { return _mm512_loadu_ps( p ); }
+   static void Store( float* p, type v ) { _mm512_storeu_ps( p, v ); }
+   static type Set( float x ) { return _mm512_set1_ps( x ); }
+   static type Add( type a, type b ) { return _mm512_add_ps( a, b ); }
+   static type Sub( type a, type b ) { return _mm512_sub_ps( a, b ); }
+   static type Mul( type a, type b ) { return _mm512_mul_ps( a, b ); }
+   static type Div( type a, type b ) { return _mm512_div_ps( a, b ); }
+   static type Min( type a, type b ) { return _mm512_min_ps( a, b ); }
+   static type Max( type a, type b ) { return _mm512_max_ps( a, b ); }
+   static type MulAdd( type a, type b, type c ) { return _mm512_fmadd_ps( a, b, c ); }
+   static type Round( type x ) { return _mm512_roundscale_ps( x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC ); }
+   static type IfLess( type a, type b, type x, type y ) { return _mm512_mask_blend_ps( _mm512_cmp_ps_mask( a, b, _CMP_LT_OQ ), y, x ); }
+   static type Gather( const float* table, type index ) { return _mm512_i32gather_ps( _mm512_cvtps_epi32( index ), table, 4 ); }
+
+   typedef __m512i itype;
+
+   static itype LoadU16( const std::uint16_t* p ) { return _mm512_cvtepu16_epi32( _mm256_loadu_si256( reinterpret_cast<const __m256i*>( p ) ) ); }
+   static void StoreU16( std::uint16_t* p, itype v ) { _mm256_storeu_si256( reinterpret_cast<__m256i*>( p ), _mm512_cvtepi32_epi16( v ) ); }
+   static itype ISet( std::int32_t x ) { return _mm512_set1_epi32( x ); }
+   static itype IAdd( itype a, itype b ) { return _mm512_add_epi32( a, b ); }
+   static itype ISub( itype a, itype b ) { return _mm512_sub_epi32( a, b ); }
+   static itype IMul( itype a, itype b ) { return _mm512_mullo_epi32( a, b ); }
+   static itype IMin( itype a, itype b ) { return _mm512_min_epi32( a, b ); }
+   static itype IMax( itype a, itype b ) { return _mm512_max_epi32( a, b ); }
+   static itype IShiftRight( itype x, int n ) { return _mm512_sra_epi32( x, _mm_cvtsi32_si128( n ) ); }
+   static type ToFloat( itype x ) { return _mm512_cvtepi32_ps( x ); }
+
+   static type Pow2( type n )
+   {
+      __m512i e = _mm512_add_epi32( _mm512_cvtps_epi32( n ), _mm512_set1_epi32( 127 ) );
+      return _mm512_castsi512_ps( _mm512_slli_epi32( e, 23 ) );
+   }
+};
+
+} // namespace
+
+const HAConversionKernels* HAConversionKernelsAVX512()
+{
+   static const HAConversionKernels kernels = HAVectorKernels<VecAVX512>::Table( "avx512" );
+   return &kernels;
+}
+
+} // pcl
+
+#else
+
+namespace pcl
+{
+
+const HAConversionKernels* HAConversionKernelsAVX512()
+{
+   return nullptr;
+}
+
+} // pcl
+
+#endif
@@ -0,0 +1,88 @@
+/*
+ * RGB to HA Conversion SIMD Kernels for PixInsight
+ * NEON implementation (arm64)
+ */
+
+#include "RGBToHASIMD.h"
+
+#if defined( __aarch64__ ) || defined( _M_ARM64 )
+
+#include <arm_neon.h>
+
+#include "RGBToHASIMDKernels.h"
+
+namespace pcl
+{
+
+namespace
+{
+
+struct VecNEON
+{
+   typedef float32x4_t type;
+   static constexpr int Width = 4;
+
+   static type Load( const float* p ) { return vld1q_f32( p ); }
+   static void Store( float* p, type v ) { vst1q_f32( p, v ); }
+   static type Set( float x ) { return vdupq_n_f32( x ); }
+   static type Add( type a, type b ) { return vaddq_f32( a, b ); }
+   static type Sub( type a, type b ) { return vsubq_f32( a, b ); }
+   static type Mul( type a, type b ) { return vmulq_f32( a, b ); }
+   static type Div( type a, type b ) { return vdivq_f32( a, b ); }
+   static type Min( type a, type b ) { return vminq_f32( a, b ); }
+   static type Max( type a, type b ) { return vmaxq_f32( a, b ); }
+   static type MulAdd( type a, type b, type c ) { return vfmaq_f32( c, a, b ); }
+   static type Round( type x ) { return vrndnq_f32( x ); }
+   static type IfLess( type a, type b, type x, type y ) { return vbslq_f32( vcltq_f32( a, b ), x, y ); }
+
+   typedef int32x4_t itype;
+
+   static itype LoadU16( const std::uint16_t* p ) { return vreinterpretq_s32_u32( vmovl_u16( vld1_u16( p ) ) ); }
+   static void StoreU16( std::uint16_t* p, itype v ) { vst1_u16( p, vqmovun_s32( v ) ); }
+   static itype ISet( std::int32_t x ) { return vdupq_n_s32( x ); }
+   static itype IAdd( itype a, itype b ) { return vaddq_s32( a, b ); }
+   static itype ISub( itype a, itype b ) { return vsubq_s32( a, b ); }
+   static itype IMul( itype a, itype b ) { return vmulq_s32( a, b ); }
+   static itype IMin( itype a, itype b ) { return vminq_s32( a, b ); }
+   static itype IMax( itype a, itype b ) { return vmaxq_s32( a, b ); }
+   static itype IShiftRight( itype x, int n ) { return vshlq_s32( x, vdupq_n_s32( -n ) ); }
+   static type ToFloat( itype x ) { return vcvtq_f32_s32( x ); }
+
+   static type Gather( const float* table, type index )
+   {
+      int32x4_t i = vcvtq_s32_f32( index );
+      const float v[4] = { table[vgetq_lane_s32( i, 0 )], table[vgetq_lane_s32( i, 1 )],
+                           table[vgetq_lane_s32( i, 2 )], table[vgetq_lane_s32( i, 3 )] };
+      return vld1q_f32( v );
+   }
+
+   static type Pow2( type n )
+   {
+      int32x4_t e = vaddq_s32( vcvtq_s32_f32( n ), vdupq_n_s32( 127 ) );
+      return vreinterpretq_f32_s32( vshlq_n_s32( e, 23 ) );
+   }
+};
+
+} // namespace
+
+const HAConversionKernels* HAConversionKernelsNEON()
+{
+   static const HAConversionKernels kernels = HAVectorKernels<VecNEON>::Table( "neon" );
+   return &kernels;
+}
+
+} // pcl
+
+#else
+
+namespace pcl
+{
+
+const HAConversionKernels* HAConversionKernelsNEON()
+{
+   return nullptr;
+}
+
+} // pcl
+
+#endif
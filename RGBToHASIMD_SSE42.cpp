@@ -0,0 +1,87 @@
+/*
+ * RGB to HA Conversion SIMD Kernels for PixInsight
+ * SSE4.2 implementation (x86-64)
+ */
+
+#include "RGBToHASIMD.h"
+
+#if defined( __x86_64__ ) || defined( _M_X64 )
+
+#include <nmmintrin.h>
+
+#include "RGBToHASIMDKernels.h"
+
+namespace pcl
+{
+
+namespace
+{
+
+struct VecSSE42
+{
+   typedef __m128 type;
+   static constexpr int Width = 4;
+
+   static type Load( const float* p ) { return _mm_loadu_ps( p ); }
+   static void Store( float* p, type v ) { _mm_storeu_ps( p, v ); }
+   static type Set( float x ) { return _mm_set1_ps( x ); }
+   static type Add( type a, type b ) { return _mm_add_ps( a, b ); }
+   static type Sub( type a, type b ) { return _mm_sub_ps( a, b ); }
+   static type Mul( type a, type b ) { return _mm_mul_ps( a, b ); }
+   static type Div( type a, type b ) { return _mm_div_ps( a, b ); }
+   static type Min( type a, type b ) { return _mm_min_ps( a, b ); }
+   static type Max( type a, type b ) { return _mm_max_ps( a, b ); }
+   static type MulAdd( type a, type b, type c ) { return _mm_add_ps( _mm_mul_ps( a, b ), c ); }
+   static type Round( type x ) { return _mm_round_ps( x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC ); }
+   static type IfLess( type a, type b, type x, type y ) { return _mm_blendv_ps( y, x, _mm_cmplt_ps( a, b ) ); }
+
+   typedef __m128i itype;
+
+   static itype LoadU16( const std::uint16_t* p ) { return _mm_cvtepu16_epi32( _mm_loadl_epi64( reinterpret_cast<const __m128i*>( p ) ) ); }
+   static void StoreU16( std::uint16_t* p, itype v ) { _mm_storel_epi64( reinterpret_cast<__m128i*>( p ), _mm_packus_epi32( v, v ) ); }
+   static itype ISet( std::int32_t x ) { return _mm_set1_epi32( x ); }
+   static itype IAdd( itype a, itype b ) { return _mm_add_epi32( a, b ); }
+   static itype ISub( itype a, itype b ) { return _mm_sub_epi32( a, b ); }
+   static itype IMul( itype a, itype b ) { return _mm_mullo_epi32( a, b ); }
+   static itype IMin( itype a, itype b ) { return _mm_min_epi32( a, b ); }
+   static itype IMax( itype a, itype b ) { return _mm_max_epi32( a, b ); }
+   static itype IShiftRight( itype x, int n ) { return _mm_sra_epi32( x, _mm_cvtsi32_si128( n ) ); }
+   static type ToFloat( itype x ) { return _mm_cvtepi32_ps( x ); }
+
+   static type Gather( const float* table, type index )
+   {
+      __m128i i = _mm_cvtps_epi32( index );
+      return _mm_setr_ps( table[_mm_cvtsi128_si32( i )], table[_mm_extract_epi32( i, 1 )],
+                          table[_mm_extract_epi32( i, 2 )], table[_mm_extract_epi32( i, 3 )] );
+   }
+
+   static type Pow2( type n )
+   {
+      __m128i e = _mm_add_epi32( _mm_cvtps_epi32( n ), _mm_set1_epi32( 127 ) );
+      return _mm_castsi128_ps( _mm_slli_epi32( e, 23 ) );
+   }
+};
+
+} // namespace
+
+const HAConversionKernels* HAConversionKernelsSSE42()
+{
+   static const HAConversionKernels kernels = HAVectorKernels<VecSSE42>::Table( "sse4.2" );
+   return &kernels;
+}
+
+} // pcl
+
+#else
+
+namespace pcl
+{
+
+const HAConversionKernels* HAConversionKernelsSSE42()
+{
+   return nullptr;
+}
+
+} // pcl
+
+#endif
@@ -0,0 +1,507 @@
+/*
+ * RGB to HA Conversion Stage Cache for PixInsight
+ * Memoized stage outputs for incremental re-runs on parameter changes
+ */
+
+#ifndef __RGBToHAStageCache_h
+#define __RGBToHAStageCache_h
+
+#include "RGBToHAEngine.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace pcl
+{
+
+// 64-bit hash of a sequence of values
+class HAHash
+{
+public:
+
+   template <typename V>
+   HAHash& Add( const V& value )
+   {
+      static_assert( std::is_trivially_copyable<V>::value, "hashed values must be trivially copyable" );
+      std::uint64_t word = 0;
+      std::memcpy( &word, &value, std::min( sizeof( V ), sizeof( word ) ) );
+      m_state = Mix( m_state ^ word );
+      return *this;
+   }
+
+   std::uint64_t Value() const
+   {
+      return m_state;
+   }
+
+   // Murmur3 finalizer: every input bit affects every output bit
+   static std::uint64_t Mix( std::uint64_t h )
+   {
+      h ^= h >> 33;
+      h *= 0xff51afd7ed558ccdull;
+      h ^= h >> 33;
+      h *= 0xc4ceb9fe1a85ec53ull;
+      h ^= h >> 33;
+      return h;
+   }
+
+private:
+
+   std::uint64_t m_state = 0x9e3779b97f4a7c15ull;
+};
+
+/*
+ * Identity of a source image: a hash of its geometry, sample type and every
+ * sample, computed in parallel bands at memory speed. Any change to the
+ * pixels, however small, gives a different identity, so cached stages can
+ * never outlive the data they were computed from.
+ */
+template <typename T>
+std::uint64_t HASourceFingerprint( const HASource<T>& source )
+{
+   const int bandRows = 64;
+   const int bands = ( source.height + bandRows - 1 )/bandRows;
+   const std::size_t rowBytes = sizeof( T )*std::size_t( source.width );
+
+   // One multiply-rotate-multiply round per 8 bytes
+   auto round = []( std::uint64_t lane, std::uint64_t word )
+   {
+      lane ^= word*0x87c37b91114253d5ull;
+      lane = lane << 31 | lane >> 33;
+      return lane*0x4cf5ad432745937full;
+   };
+
+   std::vector<std::uint64_t> partial( bands );
+   HAParallelFor( bands, [&]( int b, int )
+   {
+      // Four independent lanes keep the multiplies pipelined
+      std::uint64_t lane[4] = { 1, 2, 3, 4 };
+      for ( int y = b*bandRows, y1 = std::min( y + bandRows, source.height ); y < y1; ++y )
+         for ( int c = 0; c < 3; ++c )
+         {
+            const std::uint8_t* row = reinterpret_cast<const std::uint8_t*>( source.At( c, 0, y ) );
+            std::size_t i = 0;
+            for ( ; i + 32 <= rowBytes; i += 32 )
+               for ( int k = 0; k < 4; ++k )
+               {
+                  std::uint64_t word;
+                  std::memcpy( &word, row + i + 8*k, 8 );
+                  lane[k] = round( lane[k], word );
+               }
+            for ( ; i + 8 <= rowBytes; i += 8 )
+            {
+               std::uint64_t word;
+               std::memcpy( &word, row + i, 8 );
+               lane[0] = round( lane[0], word );
+            }
+            if ( i < rowBytes )
+            {
+               std::uint64_t word = 0;
+               std::memcpy( &word, row + i, rowBytes - i );
+               lane[1] = round( lane[1], word );
+            }
+         }
+      partial[b] = HAHash().Add( lane[0] ).Add( lane[1] ).Add( lane[2] ).Add( lane[3] ).Value();
+   } );
+
+   HAHash hash;
+   hash.Add( source.width ).Add( source.height ).Add( int( sizeof( T ) ) ).Add( std::is_floating_point<T>::value );
+   for ( std::uint64_t h : partial )
+      hash.Add( h );
+   return hash.Value();
+}
+
+// Output of a cached stage: a float32 plane of the whole image and the
+// statistics later stages need from it. The plane goes back to the
+// HABufferPool when the last reference to an evicted result is dropped.
+struct HAStageResult
+{
+   int width = 0;
+   int height = 0;
+   HABuffer<float> plane;
+   HAMoments moments;      // converted image only
+   float p5 = 0, p95 = 0;  // percentiles of the plane
+
+   std::size_t Bytes() const
+   {
+      return sizeof( HAStageResult ) + plane.Bytes();
+   }
+};
+
+/*
+ * Least recently used cache of stage outputs, bounded in bytes.
+ *
+ * A key names a source image (its fingerprint), a stage and a hash of the
+ * parameters that stage's output depends on. Results are shared and
+ * immutable, so an entry evicted while a run is still reading it stays alive
+ * until that run lets go.
+ *
+ * Bind() associates a view (any stable identifier of where an image lives)
+ * with the fingerprint of its current contents; when the contents change,
+ * the entries of the old contents are dropped at once instead of aging out.
+ *
+ * The module-wide instance is disabled (capacity 0) until configured.
+ */
+class HAStageCache
+{
+public:
+
+   enum Stage
+   {
+      Converted, // conversion method output, with its moments
+      Filtered   // after enhancement and noise reduction
+   };
+
+   struct Key
+   {
+      std::uint64_t source = 0;
+      std::uint64_t params = 0;
+      Stage         stage = Converted;
+
+      bool operator ==( const Key& k ) const
+      {
+         return source == k.source && params == k.params && stage == k.stage;
+      }
+   };
+
+   typedef std::shared_ptr<const HAStageResult> Result;
+
+   explicit HAStageCache( std::size_t capacity = 0 ) :
+      m_capacity( capacity )
+   {
+   }
+
+   HAStageCache( const HAStageCache& ) = delete;
+   HAStageCache& operator =( const HAStageCache& ) = delete;
+
+   static HAStageCache& Instance()
+   {
+      static HAStageCache cache;
+      return cache;
+   }
+
+   std::size_t Capacity() const
+   {
+      std::lock_guard<std::mutex> lock( m_mutex );
+      return m_capacity;
+   }
+
+   // Evicts least recently used entries to fit; 0 empties and disables
+   void SetCapacity( std::size_t bytes )
+   {
+      std::lock_guard<std::mutex> lock( m_mutex );
+      m_capacity = bytes;
+      Evict( 0 );
+   }
+
+   std::size_t Bytes() const
+   {
+      std::lock_guard<std::mutex> lock( m_mutex );
+      return m_bytes;
+   }
+
+   std::size_t Hits() const
+   {
+      std::lock_guard<std::mutex> lock( m_mutex );
+      return m_hits;
+   }
+
+   std::size_t Misses() const
+   {
+      std::lock_guard<std::mutex> lock( m_mutex );
+      return m_misses;
+   }
+
+   // The cached result for key, now the most recently used, or null
+   Result Find( const Key& key )
+   {
+      std::lock_guard<std::mutex> lock( m_mutex );
+      auto i = m_index.find( key );
+      if ( i == m_index.end() )
+      {
+         ++m_misses;
+         return Result();
+      }
+      ++m_hits;
+      m_entries.splice( m_entries.begin(), m_entries, i->second );
+      return i->second->result;
+   }
+
+   // Adds or replaces an entry. Results larger than the whole cache are not
+   // kept.
+   void Insert( const Key& key, const Result& result )
+   {
+      std::lock_guard<std::mutex> lock( m_mutex );
+      Remove( key );
+      const std::size_t bytes = result->Bytes();
+      if ( bytes > m_capacity )
+         return;
+      Evict( bytes );
+      m_entries.push_front( Entry{ key, result, bytes } );
+      m_index[key] = m_entries.begin();
+      m_bytes += bytes;
+   }
+
+   // Records that view now holds the image identified by source, dropping
+   // everything cached for what it held before
+   void Bind( std::uint64_t view, std::uint64_t source )
+   {
+      std::lock_guard<std::mutex> lock( m_mutex );
+      auto i = m_views.find( view );
+      if ( i != m_views.end() && i->second != source )
+         Drop( i->second );
+      m_views[view] = source;
+   }
+
+   // Drops every entry of a source image
+   void Invalidate( std::uint64_t source )
+   {
+      std::lock_guard<std::mutex> lock( m_mutex );
+      Drop( source );
+   }
+
+   void Clear()
+   {
+      std::lock_guard<std::mutex> lock( m_mutex );
+      m_entries.clear();
+      m_index.clear();
+      m_views.clear();
+      m_bytes = 0;
+   }
+
+private:
+
+   struct Entry
+   {
+      Key         key;
+      Result      result;
+      std::size_t bytes;
+   };
+
+   struct KeyHash
+   {
+      std::size_t operator()( const Key& k ) const
+      {
+         return std::size_t( HAHash().Add( k.source ).Add( k.params ).Add( int( k.stage ) ).Value() );
+      }
+   };
+
+   // Evicts from the back until bytes more fit
+   void Evict( std::size_t bytes )
+   {
+      while ( !m_entries.empty() && m_bytes + bytes > m_capacity )
+      {
+         m_bytes -= m_entries.back().bytes;
+         m_index.erase( m_entries.back().key );
+         m_entries.pop_back();
+      }
+   }
+
+   void Remove( const Key& key )
+   {
+      auto i = m_index.find( key );
+      if ( i != m_index.end() )
+      {
+         m_bytes -= i->second->bytes;
+         m_entries.erase( i->second );
+         m_index.erase( i );
+      }
+   }
+
+   void Drop( std::uint64_t source )
+   {
+      for ( auto e = m_entries.begin(); e != m_entries.end(); )
+         if ( e->key.source == source )
+         {
+            m_bytes -= e->bytes;
+            m_index.erase( e->key );
+            e = m_entries.erase( e );
+         }
+         else
+            ++e;
+   }
+
+   typedef std::list<Entry> EntryList; // most recently used first
+
+   EntryList                                                   m_entries;
+   std::unordered_map<Key, EntryList::iterator, KeyHash>       m_index;
+   std::unordered_map<std::uint64_t, std::uint64_t>            m_views;
+   std::size_t                                                 m_capacity;
+   std::size_t                                                 m_bytes = 0;
+   std::size_t                                                 m_hits = 0;
+   std::size_t                                                 m_misses = 0;
+   mutable std::mutex                                          m_mutex;
+};
+
+/*
+ * HAFusedPipeline with memoized stages. The conversion (with the moments the
+ * enhancement needs) and the enhanced, noise-reduced image are kept in an
+ * HAStageCache, keyed by the source fingerprint and the parameters each
+ * depends on:
+ *
+ * Converted  conversionMethod, haWavelength, adaptiveProcessing, lutSize,
+ *            the quality profile where it matters (fast math for Neural
+ *            Approximation) and the weights of a loaded neural model
+ * Filtered   the above plus enhancementStrength, localContrastRadius,
+ *            noiseReduction and the bilateral grid taps
+ *
+ * Changing contrastBoost reruns only the store and stretch sweeps; changing
+ * enhancementStrength or noiseReduction reuses the conversion. The output is
+ * exactly that of HAFusedPipeline::Run(). The cost is two float32 planes per
+ * cached image, and a fingerprint pass over the source on every run.
+ *
+ * Runs that HAFusedPipeline takes through its integer path (FixedPoint())
+ * are a single sweep over the samples, as fast as storing a cached plane,
+ * and bypass the cache.
+ */
+class HACachedPipeline
+{
+public:
+
+   HACachedPipeline( const HAParameters& params, HAStageCache& cache = HAStageCache::Instance() ) :
+      m_params( params ), m_cache( cache ), m_pipeline( params )
+   {
+   }
+
+   const char* ISA() const
+   {
+      return m_pipeline.ISA();
+   }
+
+   const HAColorLUT* LUT() const
+   {
+      return m_pipeline.LUT();
+   }
+
+   // Stages of the last Run() taken from the cache, 0 to 2
+   int ReusedStages() const
+   {
+      return m_reused;
+   }
+
+   // source identifies the image, normally HASourceFingerprint( source )
+   template <typename T>
+   HARunSummary Run( const HASource<T>& source, std::uint64_t sourceId, const HAView<T>& output,
+                     HAProfiler* profiler = nullptr )
+   {
+      m_reused = 0;
+      if ( m_pipeline.FixedPoint<T>() )
+         return m_pipeline.Run( source, output, profiler );
+
+      const int width = source.width;
+      const int height = source.height;
+      HAFusedPipeline::Workspace ws;
+      std::size_t allocated = 0;
+
+      HAStageCache::Key key;
+      key.source = sourceId;
+      key.params = ConversionHash();
+      key.stage = HAStageCache::Converted;
+      HAStageCache::Result converted = m_cache.Find( key );
+      if ( converted )
+         ++m_reused;
+      else
+      {
+         std::shared_ptr<HAStageResult> result = NewResult( width, height );
+         m_pipeline.ConvertRows( source, HAView<float>( result->plane.data(), width ), 0, height, result->moments,
+                                 ws, profiler );
+         m_pipeline.Percentiles( ws, result->p5, result->p95 );
+         m_cache.Insert( key, result );
+         allocated += result->Bytes();
+         converted = result;
+      }
+
+      HAStageCache::Result final = converted;
+      if ( m_params.enhancementStrength > 0 || m_params.noiseReduction > 0 )
+      {
+         key.params = FilterHash();
+         key.stage = HAStageCache::Filtered;
+         final = m_cache.Find( key );
+         if ( final )
+            ++m_reused;
+         else
+         {
+            std::shared_ptr<HAStageResult> result = NewResult( width, height );
+            HAFusedPipeline::Workspace filterWs;
+            m_pipeline.FilterRows( HAView<const float>( converted->plane.data(), width ),
+                                   HAView<float>( result->plane.data(), width ), width, height, 0, height,
+                                   converted->moments, filterWs, profiler );
+            m_pipeline.Percentiles( filterWs, result->p5, result->p95 );
+            m_cache.Insert( key, result );
+            allocated += result->Bytes() + filterWs.Bytes();
+            final = result;
+         }
+      }
+
+      // Store, then stretch the stored samples as HAFusedPipeline::Run() does
+      const HAView<const float> plane( final->plane.data(), width );
+      if ( profiler != nullptr )
+         profiler->BeginPhase( "store" );
+      HAParallelFor( ( height + m_pipeline.TileHeight() - 1 )/m_pipeline.TileHeight(), [&]( int b, int slot )
+      {
+         int y0 = b*m_pipeline.TileHeight(), y1 = std::min( y0 + m_pipeline.TileHeight(), height );
+         HAProfiler::Span span( profiler, HAProfiler::Store, slot, b, ( 4.0 + sizeof( T ) )*width*( y1 - y0 ) );
+         for ( int y = y0; y < y1; ++y )
+            HAStoreRow( plane.At( 0, y ), output.At( 0, y ), width );
+      } );
+      if ( profiler != nullptr )
+         profiler->EndPhase();
+
+      const float range = final->p95 - final->p5;
+      if ( m_params.contrastBoost > 0 && range > 0 )
+         m_pipeline.Stretch( output, width, height, 0, height, final->p5, range, ws, profiler );
+
+      HARunSummary summary;
+      summary.workingBytes = allocated + ws.Bytes();
+      return summary;
+   }
+
+private:
+
+   HAParameters          m_params;
+   HAStageCache&         m_cache;
+   HAFusedPipeline       m_pipeline;
+   int                   m_reused = 0;
+
+   std::uint64_t ConversionHash() const
+   {
+      const HAQualityProfile& profile = HAQualityProfileFor( m_params.qualityMode );
+      HAHash hash;
+      hash.Add( m_params.conversionMethod ).Add( m_params.haWavelength ).Add( m_params.adaptiveProcessing );
+      if ( m_params.conversionMethod == 3 )
+         hash.Add( profile.fastMath ).Add( m_pipeline.Model() ? m_pipeline.Model()->Network().id : 0ull );
+      if ( m_params.conversionMethod != 2 )
+         hash.Add( m_params.lutSize );
+      return hash.Value();
+   }
+
+   std::uint64_t FilterHash() const
+   {
+      HAHash hash;
+      hash.Add( ConversionHash() ).Add( m_params.enhancementStrength ).Add( m_params.noiseReduction );
+      if ( m_params.enhancementStrength > 0 )
+         hash.Add( m_params.localContrastRadius );
+      if ( m_params.noiseReduction > 0 )
+         hash.Add( HAQualityProfileFor( m_params.qualityMode ).bilateralTaps );
+      return hash.Value();
+   }
+
+   static std::shared_ptr<HAStageResult> NewResult( int width, int height )
+   {
+      std::shared_ptr<HAStageResult> result = std::make_shared<HAStageResult>();
+      result->width = width;
+      result->height = height;
+      result->plane = HABuffer<float>( std::size_t( width )*height );
+      return result;
+   }
+};
+
+} // pcl
+
+#endif   // __RGBToHAStageCache_h
@@ -0,0 +1,456 @@
+/*
+ * RGB to HA Conversion Stage Graph for PixInsight
+ * Per-pixel stage chains with adjacent linear stages folded at setup
+ */
+
+#ifndef __RGBToHAStageGraph_h
+#define __RGBToHAStageGraph_h
+
+#include "RGBToHAKernels.h"
+#include "RGBToHASIMD.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <initializer_list>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+namespace pcl
+{
+
+// One per-pixel stage, mapping a vector of up to MaxComponents values to
+// another:
+//
+//    Affine    out = matrix*in + offset
+//    Clamp     every component clamped to [0,1]
+//    Product   a single output, the product of the two inputs
+struct HAStage
+{
+   static constexpr int MaxComponents = 4;
+
+   enum Kind
+   {
+      Affine,
+      Clamp,
+      Product
+   };
+
+   Kind   kind = Affine;
+   int    inputs = 1;
+   int    outputs = 1;
+   double matrix[MaxComponents][MaxComponents] = {};
+   double offset[MaxComponents] = {};
+
+   // Affine with no effect
+   bool IsIdentity() const
+   {
+      if ( kind != Affine || inputs != outputs )
+         return false;
+      for ( int i = 0; i < outputs; ++i )
+      {
+         if ( offset[i] != 0 )
+            return false;
+         for ( int j = 0; j < inputs; ++j )
+            if ( matrix[i][j] != ( ( i == j ) ? 1 : 0 ) )
+               return false;
+      }
+      return true;
+   }
+
+   // Affine scaling each component by at least 1, which commutes with a
+   // following Clamp once its input is clamped:
+   // Clamp01( k*Clamp01( x ) ) = Clamp01( k*x ) for k >= 1
+   bool IsExpansion() const
+   {
+      if ( kind != Affine || inputs != outputs )
+         return false;
+      for ( int i = 0; i < outputs; ++i )
+      {
+         if ( offset[i] != 0 || matrix[i][i] < 1 )
+            return false;
+         for ( int j = 0; j < inputs; ++j )
+            if ( j != i && matrix[i][j] != 0 )
+               return false;
+      }
+      return true;
+   }
+};
+
+/*
+ * A chain of per-pixel stages, written the way the algorithm is defined
+ * (HAKernels), and folded once at setup into the fewest stages that compute
+ * the same function:
+ *
+ *    Affine, Affine          ->  Affine (composed)
+ *    Clamp, expansion, Clamp ->  expansion, Clamp
+ *    Clamp, Clamp            ->  Clamp
+ *    identity Affine         ->  (removed)
+ *
+ * applied until none matches. Folding reassociates floating point sums, so
+ * folded results differ from the stage by stage ones by rounding only.
+ * Evaluate() runs a chain in double precision, folded or not.
+ */
+class HAStageGraph
+{
+public:
+
+   explicit HAStageGraph( int inputs ) : m_inputs( inputs ), m_outputs( inputs )
+   {
+      if ( inputs < 1 || inputs > HAStage::MaxComponents )
+         throw std::runtime_error( "HAStageGraph: invalid number of inputs" );
+   }
+
+   // Appends out = rows*in + offset; one row per output
+   HAStageGraph& Affine( std::initializer_list<std::initializer_list<double>> rows,
+                         std::initializer_list<double> offset = {} )
+   {
+      HAStage stage;
+      stage.kind = HAStage::Affine;
+      stage.inputs = m_outputs;
+      stage.outputs = int( rows.size() );
+      if ( stage.outputs < 1 || stage.outputs > HAStage::MaxComponents ||
+           ( offset.size() != 0 && int( offset.size() ) != stage.outputs ) )
+         throw std::runtime_error( "HAStageGraph: invalid affine stage" );
+      int i = 0;
+      for ( const std::initializer_list<double>& row : rows )
+      {
+         if ( int( row.size() ) != stage.inputs )
+            throw std::runtime_error( "HAStageGraph: affine row does not match the stage inputs" );
+         std::copy( row.begin(), row.end(), stage.matrix[i++] );
+      }
+      std::copy( offset.begin(), offset.end(), stage.offset );
+      return Append( stage );
+   }
+
+   // Appends out = k*in + offset, on every component
+   HAStageGraph& Scale( double k, double offset = 0 )
+   {
+      HAStage stage;
+      stage.kind = HAStage::Affine;
+      stage.inputs = stage.outputs = m_outputs;
+      for ( int i = 0; i < m_outputs; ++i )
+      {
+         stage.matrix[i][i] = k;
+         stage.offset[i] = offset;
+      }
+      return Append( stage );
+   }
+
+   HAStageGraph& Clamp()
+   {
+      HAStage stage;
+      stage.kind = HAStage::Clamp;
+      stage.inputs = stage.outputs = m_outputs;
+      return Append( stage );
+   }
+
+   HAStageGraph& Product()
+   {
+      if ( m_outputs != 2 )
+         throw std::runtime_error( "HAStageGraph: a product stage needs two inputs" );
+      HAStage stage;
+      stage.kind = HAStage::Product;
+      stage.inputs = 2;
+      stage.outputs = 1;
+      return Append( stage );
+   }
+
+   HAStageGraph Folded() const
+   {
+      HAStageGraph folded( *this );
+      std::vector<HAStage>& s = folded.m_stages;
+      for ( bool changed = true; changed; )
+      {
+         changed = false;
+         for ( std::size_t i = 0; i < s.size() && !changed; ++i )
+         {
+            if ( s[i].IsIdentity() )
+            {
+               s.erase( s.begin() + i );
+               changed = true;
+            }
+            else if ( i + 1 < s.size() && s[i].kind == HAStage::Affine && s[i+1].kind == HAStage::Affine )
+            {
+               s[i] = Compose( s[i], s[i+1] );
+               s.erase( s.begin() + i + 1 );
+               changed = true;
+            }
+            else if ( i + 1 < s.size() && s[i].kind == HAStage::Clamp && s[i+1].kind == HAStage::Clamp )
+            {
+               s.erase( s.begin() + i + 1 );
+               changed = true;
+            }
+            else if ( i + 2 < s.size() && s[i].kind == HAStage::Clamp && s[i+1].IsExpansion() &&
+                      s[i+2].kind == HAStage::Clamp )
+            {
+               s.erase( s.begin() + i );
+               changed = true;
+            }
+         }
+      }
+      return folded;
+   }
+
+   void Evaluate( const double* in, double* out ) const
+   {
+      double x[HAStage::MaxComponents], y[HAStage::MaxComponents];
+      std::copy_n( in, m_inputs, x );
+      for ( const HAStage& stage : m_stages )
+      {
+         switch ( stage.kind )
+         {
+         case HAStage::Affine:
+            for ( int i = 0; i < stage.outputs; ++i )
+            {
+               y[i] = stage.offset[i];
+               for ( int j = 0; j < stage.inputs; ++j )
+                  y[i] += stage.matrix[i][j]*x[j];
+            }
+            break;
+         case HAStage::Clamp:
+            for ( int i = 0; i < stage.outputs; ++i )
+               y[i] = HAKernels::Clamp01( x[i] );
+            break;
+         case HAStage::Product:
+            y[0] = x[0]*x[1];
+            break;
+         }
+         std::copy_n( y, stage.outputs, x );
+      }
+      std::copy_n( x, m_outputs, out );
+   }
+
+   const std::vector<HAStage>& Stages() const
+   {
+      return m_stages;
+   }
+
+   int Inputs() const
+   {
+      return m_inputs;
+   }
+
+   int Outputs() const
+   {
+      return m_outputs;
+   }
+
+private:
+
+   int                  m_inputs;
+   int                  m_outputs;
+   std::vector<HAStage> m_stages;
+
+   HAStageGraph& Append( const HAStage& stage )
+   {
+      m_stages.push_back( stage );
+      m_outputs = stage.outputs;
+      return *this;
+   }
+
+   // first, then second
+   static HAStage Compose( const HAStage& first, const HAStage& second )
+   {
+      HAStage stage;
+      stage.kind = HAStage::Affine;
+      stage.inputs = first.inputs;
+      stage.outputs = second.outputs;
+      for ( int i = 0; i < second.outputs; ++i )
+      {
+         stage.offset[i] = second.offset[i];
+         for ( int k = 0; k < second.inputs; ++k )
+            stage.offset[i] += second.matrix[i][k]*first.offset[k];
+         for ( int j = 0; j < first.inputs; ++j )
+            for ( int k = 0; k < second.inputs; ++k )
+               stage.matrix[i][j] += second.matrix[i][k]*first.matrix[k][j];
+      }
+      return stage;
+   }
+};
+
+// Stage graph of the per-pixel conversion methods, RGB in, HA out:
+// 0=Standard (also the finest level of Adaptive Multi-Scale), 1=Advanced
+// Spectral. As HAKernels::ConvertStandardRGBToHA and ConvertAdvancedSpectral.
+inline HAStageGraph HAConversionGraph( int conversionMethod, double haWavelength, bool adaptiveProcessing )
+{
+   typedef HAKernels K;
+   HAStageGraph graph( 3 );
+   if ( conversionMethod != 1 )
+   {
+      graph.Affine( { { K::HaRedCoeff, K::HaGreenCoeff, K::HaBlueCoeff } } )
+           .Scale( haWavelength/K::HaReferenceWavelength )
+           .Clamp();
+      return graph;
+   }
+
+   // The three bands and the luminance, then their weighted combination and
+   // the adaptive factor 1 + (luminance - 0.5)*0.5
+   const double (&b)[3][3] = K::SpectralBands;
+   graph.Affine( { { b[0][0], b[0][1], b[0][2] },
+                   { b[1][0], b[1][1], b[1][2] },
+                   { b[2][0], b[2][1], b[2][2] },
+                   { 0.299, 0.587, 0.114 } } );
+   if ( adaptiveProcessing )
+      graph.Affine( { { 1.0, 0.7, 0.4, 0.0 }, { 0.0, 0.0, 0.0, 0.5 } }, { 0.0, 0.75 } ).Product();
+   else
+      graph.Affine( { { 1.0, 0.7, 0.4, 0.0 } } );
+   return graph.Clamp();
+}
+
+// Stage graph of the contrast stretch, as HAKernels::ApplyContrastBoost
+inline HAStageGraph HAContrastGraph( double p5, double range, double contrastBoost )
+{
+   HAStageGraph graph( 1 );
+   graph.Scale( 1/range, -p5/range ).Clamp().Scale( 1 + contrastBoost ).Clamp();
+   return graph;
+}
+
+// Kernel arguments for a folded conversion graph; the row kernels evaluate
+// Clamp01( (w0·rgb + o0)*(w1·rgb + o1) ), the second factor only if product
+inline HAKernelArgs HAConversionKernelArgs( const HAStageGraph& graph )
+{
+   const HAStageGraph folded = graph.Folded();
+   const std::vector<HAStage>& s = folded.Stages();
+   HAKernelArgs args;
+   bool linear = s.size() == 2 && s[0].kind == HAStage::Affine && s[0].outputs == 1;
+   args.product = s.size() == 3 && s[0].kind == HAStage::Affine && s[0].outputs == 2 && s[1].kind == HAStage::Product;
+   if ( folded.Inputs() != 3 || !( linear || args.product ) || s.back().kind != HAStage::Clamp )
+      throw std::runtime_error( "HAConversionKernelArgs: the conversion does not fold to a kernel shape" );
+
+   for ( int i = 0; i < s[0].outputs; ++i )
+   {
+      for ( int j = 0; j < 3; ++j )
+         args.weights[i][j] = float( s[0].matrix[i][j] );
+      args.offsets[i] = float( s[0].offset[i] );
+   }
+   return args;
+}
+
+// Most fractional bits of the sums of the 16-bit fixed-point kernels. Fewer
+// are used when the largest sum would not fit 31 bits.
+const int HAFixedMaxShift = 16;
+
+// w*2^shift, w >= 0, rounded to the nearest 2^-15
+inline HAFixedCoefficient HAFixedCoefficientFor( double w, int shift )
+{
+   const long long q = std::llround( std::ldexp( w, shift + 15 ) );
+   HAFixedCoefficient c;
+   c.whole = std::int32_t( q >> 15 );
+   c.fraction = std::int32_t( q & 0x7fff );
+   return c;
+}
+
+/*
+ * Fixed-point form of folded conversion kernel arguments for 16-bit
+ * samples, if they have one: a single affine form with nonnegative weights
+ * and offset. In units of the 16-bit output the conversion is
+ * y = w·rgb + 65535*o, and the kernel stores
+ *
+ *    min( floor( ( c·rgb + d + 2^(shift - 1) ) / 2^shift ), 65535 )
+ *
+ * with c = w*2^shift to 15 more fractional bits (HAFixedCoefficient) and d =
+ * 65535*o*2^shift rounded: y rounded half up, as HAStoreRow rounds, from a
+ * sum that is within 5*2^-shift of y. shift is the largest that keeps the
+ * sum within 31 bits, 13 to 15 for the built-in methods, so outputs differ
+ * from y rounded half up only when y is within 6e-4 of a tie.
+ */
+inline bool HAFixedConversionArgs( const HAKernelArgs& args, HAFixedLinearArgs& fixed )
+{
+   if ( args.product || args.network != nullptr || !( args.offsets[0] >= 0 ) )
+      return false;
+   for ( int k = 0; k < 3; ++k )
+      if ( !( args.weights[0][k] >= 0 ) )
+         return false;
+
+   for ( int shift = HAFixedMaxShift; shift >= 0; --shift )
+   {
+      const long long offset = std::llround( std::ldexp( 65535.0*args.offsets[0], shift ) ) +
+                               ( ( shift > 0 ) ? 1ll << ( shift - 1 ) : 0 );
+      long long sum = offset;
+      for ( int k = 0; k < 3; ++k )
+         sum += 65535*( ( long long )std::ldexp( double( args.weights[0][k] ), shift ) + 1 );
+      if ( sum <= std::numeric_limits<std::int32_t>::max() )
+      {
+         for ( int k = 0; k < 3; ++k )
+            fixed.coeffs[k] = HAFixedCoefficientFor( args.weights[0][k], shift );
+         fixed.offset = std::int32_t( offset );
+         fixed.shift = shift;
+         return true;
+      }
+   }
+   return false;
+}
+
+// Folded contrast stretch: Clamp01( x*scale + offset )
+struct HAContrastMap
+{
+   float scale = 1;
+   float offset = 0;
+
+   HAContrastMap() = default;
+
+   // contrastBoost >= 0, as the stretch is only applied for a positive boost
+   HAContrastMap( double p5, double range, double contrastBoost )
+   {
+      const HAStageGraph folded = HAContrastGraph( p5, range, std::max( 0.0, contrastBoost ) ).Folded();
+      const std::vector<HAStage>& s = folded.Stages();
+      if ( s.size() != 2 || s[0].kind != HAStage::Affine || s[1].kind != HAStage::Clamp )
+         throw std::runtime_error( "HAContrastMap: the contrast stretch does not fold to an affine map" );
+      scale = float( s[0].matrix[0][0] );
+      offset = float( s[0].offset[0] );
+   }
+
+   template <typename R>
+   void Apply( R* data, int n ) const
+   {
+      HAKernels::ApplyAffineClamp( data, n, R( scale ), R( offset ) );
+   }
+
+   /*
+    * Fixed-point form for 16-bit samples. In units of the output the map is
+    * y = x*scale + 65535*offset, at most 0 up to origin and at least 65535
+    * from origin + limit on, so only t = x - origin in [0,limit] is
+    * multiplied, by scale*2^shift to 15 more fractional bits. The value at
+    * origin, rounded to shift bits, and the rounding term 2^(shift - 1) are
+    * added, so the result is y rounded half up from a sum within 2*2^-shift
+    * of y. shift is the largest that keeps the sum within 31 bits: 14 or 15
+    * for a scale below 2, more for a steeper stretch, whose limit is smaller.
+    */
+   HAFixedAffineArgs Fixed() const
+   {
+      HAFixedAffineArgs fixed;
+      const double a = scale, y0 = 65535.0*offset;
+      if ( !( a > 0 ) )
+      {
+         // Constant
+         fixed.offset = std::int32_t( std::min( std::max( std::floor( y0 + 0.5 ), 0.0 ), 65535.0 ) );
+         return fixed;
+      }
+
+      const double origin = std::min( std::max( std::floor( -y0/a ), 0.0 ), 65535.0 );
+      const double base = origin*a + y0;
+      const double limit = std::min( std::max( std::ceil( ( 65535 - base )/a ), 0.0 ), 65535 - origin );
+      for ( int shift = HAFixedMaxShift; shift >= 0; --shift )
+      {
+         const long long at = std::llround( std::ldexp( base, shift ) ) + ( ( shift > 0 ) ? 1ll << ( shift - 1 ) : 0 );
+         if ( std::ldexp( a, shift ) < ( 1ll << 31 ) &&
+              ( long long )limit*( ( long long )std::ldexp( a, shift ) + 1 ) + std::llabs( at ) <= std::numeric_limits<std::int32_t>::max() )
+         {
+            fixed.origin = std::int32_t( origin );
+            fixed.limit = std::int32_t( limit );
+            fixed.scale = HAFixedCoefficientFor( a, shift );
+            fixed.offset = std::int32_t( at );
+            fixed.shift = shift;
+            return fixed;
+         }
+      }
+      throw std::runtime_error( "HAContrastMap: the contrast stretch has no 16-bit fixed-point form" );
+   }
+};
+
+} // pcl
+
+#endif   // __RGBToHAStageGraph_h
@@ -0,0 +1,116 @@
+/*
+ * RGB to HA Conversion Star Field for PixInsight
+ * Synthetic test images for the benchmarks and the auto-tuner
+ */
+
+#ifndef __RGBToHAStarField_h
+#define __RGBToHAStarField_h
+
+#include "RGBToHAEngine.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+namespace pcl
+{
+
+/*
+ * Synthetic star field: a sky background with a linear gradient and
+ * Gaussian noise, plus stars with a power-law brightness distribution and
+ * Gaussian profiles of varying colour. Rows are generated in parallel bands,
+ * each from its own seed, so the image depends only on its size.
+ *
+ * The benchmarks measure on it and HATuner calibrates on it, so calibrated
+ * settings are chosen on the images the benchmarks report.
+ */
+template <typename T>
+struct HAStarField
+{
+   int width, height;
+   std::vector<T> channel[3];
+
+   HAStarField( int w, int h ) : width( w ), height( h )
+   {
+      struct Star { float x, y, flux, sigma, color[3]; };
+      std::vector<Star> stars( std::size_t( w )*h/800 );
+      std::mt19937 rng( 2024 );
+      std::uniform_real_distribution<float> uniform( 0, 1 );
+      for ( Star& star : stars )
+      {
+         star.x = uniform( rng )*w;
+         star.y = uniform( rng )*h;
+         star.flux = 0.02f/std::pow( 1 - 0.999f*uniform( rng ), 0.8f );
+         star.sigma = 0.8f + 1.5f*uniform( rng );
+         float temperature = uniform( rng );
+         star.color[0] = 0.7f + 0.3f*temperature;
+         star.color[1] = 0.8f;
+         star.color[2] = 1.0f - 0.3f*temperature;
+      }
+      std::sort( stars.begin(), stars.end(), []( const Star& a, const Star& b ) { return a.y < b.y; } );
+
+      for ( int c = 0; c < 3; ++c )
+         channel[c].resize( std::size_t( w )*h );
+
+      const int bandRows = 64;
+      const float reach = 4*2.3f; // 4 sigma of the widest star
+      HAParallelFor( ( h + bandRows - 1 )/bandRows, [&]( int band, int )
+      {
+         int y0 = band*bandRows, y1 = std::min( h, y0 + bandRows );
+         std::vector<float> plane[3];
+         for ( int c = 0; c < 3; ++c )
+            plane[c].resize( std::size_t( w )*( y1 - y0 ) );
+
+         std::mt19937 noise( 7919u*band + 1 );
+         std::normal_distribution<float> gaussian( 0, 0.004f );
+         for ( int y = y0; y < y1; ++y )
+            for ( int x = 0; x < w; ++x )
+            {
+               float sky = 0.05f + 0.03f*x/w + 0.02f*y/h;
+               for ( int c = 0; c < 3; ++c )
+                  plane[c][std::size_t( y - y0 )*w + x] = sky*( 1 - 0.1f*c ) + gaussian( noise );
+            }
+
+         auto first = std::lower_bound( stars.begin(), stars.end(), y0 - reach,
+                                        []( const Star& s, float y ) { return s.y < y; } );
+         for ( auto star = first; star != stars.end() && star->y < y1 + reach; ++star )
+         {
+            int r = int( std::ceil( 4*star->sigma ) );
+            int sx0 = std::max( 0, int( star->x ) - r ), sx1 = std::min( w - 1, int( star->x ) + r );
+            int sy0 = std::max( y0, int( star->y ) - r ), sy1 = std::min( y1 - 1, int( star->y ) + r );
+            float k = -1/( 2*star->sigma*star->sigma );
+            for ( int y = sy0; y <= sy1; ++y )
+               for ( int x = sx0; x <= sx1; ++x )
+               {
+                  float dx = x - star->x, dy = y - star->y;
+                  float v = star->flux*std::exp( k*( dx*dx + dy*dy ) );
+                  for ( int c = 0; c < 3; ++c )
+                     plane[c][std::size_t( y - y0 )*w + x] += v*star->color[c];
+               }
+         }
+
+         for ( int c = 0; c < 3; ++c )
+         {
+            for ( float& v : plane[c] )
+               v = HAKernels::Clamp01( v );
+            HAStoreRow( plane[c].data(), channel[c].data() + std::size_t( y0 )*w, w*( y1 - y0 ) );
+         }
+      } );
+   }
+
+   HASource<T> Source() const
+   {
+      HASource<T> source;
+      source.width = width;
+      source.height = height;
+      for ( int c = 0; c < 3; ++c )
+         source.channel[c] = channel[c].data();
+      source.stride = width;
+      return source;
+   }
+};
+
+} // pcl
+
+#endif   // __RGBToHAStarField_h
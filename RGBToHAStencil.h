@@ -0,0 +1,294 @@
+/*
+ * RGB to HA Conversion Stencils for PixInsight
+ * Image geometry and neighbourhood operations with separate interior and border loops
+ */
+
+#ifndef __RGBToHAStencil_h
+#define __RGBToHAStencil_h
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+namespace pcl
+{
+
+// Rectangle in image coordinates, right and bottom edges exclusive
+struct HARect
+{
+   int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+
+   HARect() = default;
+
+   HARect( int left, int top, int right, int bottom ) :
+      x0( left ), y0( top ), x1( right ), y1( bottom )
+   {
+   }
+
+   int Width() const
+   {
+      return x1 - x0;
+   }
+
+   int Height() const
+   {
+      return y1 - y0;
+   }
+
+   double Area() const
+   {
+      return double( Width() )*Height();
+   }
+
+   bool IsEmpty() const
+   {
+      return x1 <= x0 || y1 <= y0;
+   }
+
+   // Grow by n pixels on every side, clipped to bounds
+   HARect Inflated( int n, const HARect& bounds ) const
+   {
+      return HARect( std::max( x0 - n, bounds.x0 ), std::max( y0 - n, bounds.y0 ),
+                     std::min( x1 + n, bounds.x1 ), std::min( y1 + n, bounds.y1 ) );
+   }
+};
+
+// Sample buffer addressed in image coordinates
+template <typename T>
+struct HAView
+{
+   T* data = nullptr;
+   std::ptrdiff_t stride = 0; // samples between consecutive rows
+   int x0 = 0, y0 = 0;        // image coordinates of data[0]
+
+   HAView() = default;
+
+   HAView( T* d, std::ptrdiff_t s, int left = 0, int top = 0 ) :
+      data( d ), stride( s ), x0( left ), y0( top )
+   {
+   }
+
+   template <typename U>
+   HAView( const HAView<U>& v ) :
+      data( v.data ), stride( v.stride ), x0( v.x0 ), y0( v.y0 )
+   {
+   }
+
+   T* At( int x, int y ) const
+   {
+      return data + std::ptrdiff_t( y - y0 )*stride + ( x - x0 );
+   }
+
+   T& operator()( int x, int y ) const
+   {
+      return *At( x, y );
+   }
+};
+
+// Offsets, inclusive, of the part of a pixel's neighbourhood inside the image
+struct HAWindow
+{
+   int dx0, dx1, dy0, dy1;
+
+   int Count() const
+   {
+      return ( dx1 - dx0 + 1 )*( dy1 - dy0 + 1 );
+   }
+};
+
+// How a stencil treats neighbours outside the image
+enum class HAEdgePolicy
+{
+   Clip,   // left out: the window is clipped to the image
+   Mirror, // reflected about the edge sample: offset -1 reads sample 1
+   Clamp,  // the nearest edge sample
+   Zero    // zero
+};
+
+/*
+ * Neighbourhood operation over the (2*radius + 1)^2 window of every pixel.
+ * Apply() calls kernel( p, stride, x, y, window ) for each pixel (x, y) of a
+ * rect and stores the value returned; p points at the pixel, p[dy*stride +
+ * dx] is its neighbour at offset (dx, dy), and window is the part of the
+ * neighbourhood the kernel may read.
+ *
+ * Pixels whose whole neighbourhood lies inside the image are the interior:
+ * their loop reads the source directly with a constant full window and no
+ * bounds checks. The rest form a frame at most radius wide along the image
+ * edges, handled by the edge policy. With Clip, the default, the frame loop
+ * clips the window to the image; kernels read only the window, so
+ * neighbours outside the image are left out. With the other policies each
+ * piece of the frame is first staged, with its halo, in a padded block
+ * whose samples outside the image are filled by the policy, and the
+ * interior loop runs over that block with the full window. The kernel is a
+ * template parameter, inlined into every loop.
+ */
+template <typename R>
+class HAStencil
+{
+public:
+
+   explicit HAStencil( int radius, HAEdgePolicy policy = HAEdgePolicy::Clip ) :
+      m_radius( std::max( 0, radius ) ), m_policy( policy )
+   {
+   }
+
+   int Radius() const
+   {
+      return m_radius;
+   }
+
+   HAEdgePolicy Policy() const
+   {
+      return m_policy;
+   }
+
+   // Pixels of rect whose neighbourhood lies inside the width x height image
+   HARect Interior( const HARect& rect, int width, int height ) const
+   {
+      HARect r( std::max( rect.x0, m_radius ), std::max( rect.y0, m_radius ),
+                std::min( rect.x1, width - m_radius ), std::min( rect.y1, height - m_radius ) );
+      return r.IsEmpty() ? HARect( rect.x0, rect.y0, rect.x0, rect.y0 ) : r;
+   }
+
+   // kernel over rect of src into dst. src must cover rect inflated by
+   // Radius(), clipped to the width x height image.
+   template <class K>
+   void Apply( const HAView<const R>& src, const HAView<R>& dst, const HARect& rect, int width, int height,
+               K kernel ) const
+   {
+      std::vector<R> scratch;
+      Apply( src, dst, rect, width, height, kernel, scratch );
+   }
+
+   // As above; scratch is per-thread storage for the padded blocks, reused
+   // from call to call and untouched by Clip
+   template <class K>
+   void Apply( const HAView<const R>& src, const HAView<R>& dst, const HARect& rect, int width, int height,
+               K kernel, std::vector<R>& scratch ) const
+   {
+      const HARect inner = Interior( rect, width, height );
+      if ( inner.IsEmpty() )
+      {
+         Border( src, dst, rect, width, height, kernel, scratch );
+         return;
+      }
+
+      Border( src, dst, HARect( rect.x0, rect.y0, rect.x1, inner.y0 ), width, height, kernel, scratch );
+      Border( src, dst, HARect( rect.x0, inner.y0, inner.x0, inner.y1 ), width, height, kernel, scratch );
+      Border( src, dst, HARect( inner.x1, inner.y0, rect.x1, inner.y1 ), width, height, kernel, scratch );
+      Border( src, dst, HARect( rect.x0, inner.y1, rect.x1, rect.y1 ), width, height, kernel, scratch );
+      Sweep( src, dst, inner, kernel );
+   }
+
+   // Sample read for coordinate i of an n-sample axis, -1 for a zero (and
+   // for Clip, which reads nothing outside)
+   int Fold( int i, int n ) const
+   {
+      if ( i >= 0 && i < n )
+         return i;
+      switch ( m_policy )
+      {
+      case HAEdgePolicy::Mirror:
+         {
+            if ( n == 1 )
+               return 0;
+            const int period = 2*( n - 1 );
+            i %= period;
+            if ( i < 0 )
+               i += period;
+            return ( i < n ) ? i : period - i;
+         }
+      case HAEdgePolicy::Clamp:
+         return ( i < 0 ) ? 0 : n - 1;
+      default:
+         return -1;
+      }
+   }
+
+private:
+
+   int          m_radius;
+   HAEdgePolicy m_policy;
+
+   // rect of src, whose full neighbourhood src covers, with no bounds checks
+   template <class K>
+   void Sweep( const HAView<const R>& src, const HAView<R>& dst, const HARect& rect, K& kernel ) const
+   {
+      const HAWindow full = { -m_radius, m_radius, -m_radius, m_radius };
+      const std::ptrdiff_t stride = src.stride;
+      for ( int y = rect.y0; y < rect.y1; ++y )
+      {
+         const R* p = src.At( rect.x0, y );
+         R* out = dst.At( rect.x0, y );
+         for ( int i = 0, n = rect.Width(); i < n; ++i )
+            out[i] = kernel( p + i, stride, rect.x0 + i, y, full );
+      }
+   }
+
+   // Frame pixels: window clipped to the image, or a padded block
+   template <class K>
+   void Border( const HAView<const R>& src, const HAView<R>& dst, const HARect& rect, int width, int height,
+                K& kernel, std::vector<R>& scratch ) const
+   {
+      if ( rect.IsEmpty() )
+         return;
+
+      if ( m_policy != HAEdgePolicy::Clip )
+      {
+         Sweep( Padded( src, rect, width, height, scratch ), dst, rect, kernel );
+         return;
+      }
+
+      for ( int y = rect.y0; y < rect.y1; ++y )
+      {
+         HAWindow window;
+         window.dy0 = std::max( -m_radius, -y );
+         window.dy1 = std::min( m_radius, height - 1 - y );
+         for ( int x = rect.x0; x < rect.x1; ++x )
+         {
+            window.dx0 = std::max( -m_radius, -x );
+            window.dx1 = std::min( m_radius, width - 1 - x );
+            dst( x, y ) = kernel( src.At( x, y ), src.stride, x, y, window );
+         }
+      }
+   }
+
+   // rect inflated by the radius, samples outside the image filled by the
+   // policy, staged in scratch
+   HAView<const R> Padded( const HAView<const R>& src, const HARect& rect, int width, int height,
+                           std::vector<R>& scratch ) const
+   {
+      const HARect block( rect.x0 - m_radius, rect.y0 - m_radius, rect.x1 + m_radius, rect.y1 + m_radius );
+      scratch.resize( std::size_t( block.Width() )*block.Height() );
+      const HAView<R> padded( scratch.data(), block.Width(), block.x0, block.y0 );
+
+      // Columns inside the image are copied as a run
+      const int x0 = std::max( block.x0, 0 ), x1 = std::max( x0, std::min( block.x1, width ) );
+      for ( int y = block.y0; y < block.y1; ++y )
+      {
+         R* out = padded.At( block.x0, y );
+         const int sy = Fold( y, height );
+         if ( sy < 0 )
+         {
+            std::fill( out, out + block.Width(), R( 0 ) );
+            continue;
+         }
+         for ( int x = block.x0; x < x0; ++x )
+            out[x - block.x0] = Sample( src, Fold( x, width ), sy );
+         std::copy( src.At( x0, sy ), src.At( x1, sy ), out + ( x0 - block.x0 ) );
+         for ( int x = x1; x < block.x1; ++x )
+            out[x - block.x0] = Sample( src, Fold( x, width ), sy );
+      }
+      return padded;
+   }
+
+   static R Sample( const HAView<const R>& src, int x, int y )
+   {
+      return ( x < 0 ) ? R( 0 ) : src( x, y );
+   }
+};
+
+} // pcl
+
+#endif   // __RGBToHAStencil_h
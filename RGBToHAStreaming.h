@@ -0,0 +1,448 @@
+/*
+ * RGB to HA Conversion Streaming for PixInsight
+ * Strip-wise processing of images larger than the memory budget
+ */
+
+#ifndef __RGBToHAStreaming_h
+#define __RGBToHAStreaming_h
+
+#include "RGBToHAEngine.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace pcl
+{
+
+// Supplies the RGB samples of an image a strip of rows at a time
+template <typename T>
+class HAStripSource
+{
+public:
+
+   virtual ~HAStripSource()
+   {
+   }
+
+   virtual int Width() const = 0;
+   virtual int Height() const = 0;
+
+   // Samples of rows [y0,y1), addressed with image row numbers (HASource::y0
+   // is y0). Valid until the next call.
+   virtual HASource<T> Rows( int y0, int y1 ) = 0;
+};
+
+// Receives the HA samples of an image a strip of rows at a time
+template <typename T>
+class HAStripSink
+{
+public:
+
+   virtual ~HAStripSink()
+   {
+   }
+
+   // Destination for rows [y0,y1), addressed with image coordinates. Valid
+   // until Commit() or the next call.
+   virtual HAView<T> Rows( int y0, int y1 ) = 0;
+
+   // Rows [y0,y1) obtained from Rows() are complete
+   virtual void Commit( int y0, int y1 ) = 0;
+
+   // True if Rows() for rows already committed returns the committed
+   // samples, so they can be revised in place
+   virtual bool IsRereadable() const
+   {
+      return false;
+   }
+};
+
+// Strip source over an image in memory; no samples are copied
+template <typename T>
+class HAImageStripSource : public HAStripSource<T>
+{
+public:
+
+   explicit HAImageStripSource( const HASource<T>& image ) : m_image( image )
+   {
+   }
+
+   int Width() const override
+   {
+      return m_image.width;
+   }
+
+   int Height() const override
+   {
+      return m_image.height;
+   }
+
+   HASource<T> Rows( int, int ) override
+   {
+      return m_image;
+   }
+
+private:
+
+   HASource<T> m_image;
+};
+
+// Strip sink over an image in memory; no samples are copied
+template <typename T>
+class HAImageStripSink : public HAStripSink<T>
+{
+public:
+
+   explicit HAImageStripSink( const HAView<T>& image ) : m_image( image )
+   {
+   }
+
+   HAView<T> Rows( int, int ) override
+   {
+      return m_image;
+   }
+
+   void Commit( int, int ) override
+   {
+   }
+
+   bool IsRereadable() const override
+   {
+      return true;
+   }
+
+private:
+
+   HAView<T> m_image;
+};
+
+/*
+ * Temporary file accessed through memory-mapped windows. The file is deleted
+ * when closed (on POSIX systems, as soon as it is created), so it never
+ * outlives the process. Only the window mapped at a time counts towards the
+ * process's memory; dirty pages are written back by the operating system.
+ */
+class HAScratchFile
+{
+public:
+
+   // Creates an empty file in directory, or in the system temporary
+   // directory if directory is empty
+   HAScratchFile( std::uint64_t size, const std::string& directory = std::string() ) : m_size( size )
+   {
+#ifdef _WIN32
+      char dir[MAX_PATH + 1], path[MAX_PATH + 1];
+      if ( directory.empty() )
+         GetTempPathA( sizeof( dir ), dir );
+      else
+         std::snprintf( dir, sizeof( dir ), "%s", directory.c_str() );
+      if ( GetTempFileNameA( dir, "rha", 0, path ) == 0 )
+         throw std::runtime_error( "Unable to create a scratch file in " + std::string( dir ) );
+      m_file = CreateFileA( path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                            FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr );
+      if ( m_file == INVALID_HANDLE_VALUE )
+         throw std::runtime_error( "Unable to open scratch file " + std::string( path ) );
+      m_mapping = CreateFileMappingA( m_file, nullptr, PAGE_READWRITE, DWORD( size >> 32 ), DWORD( size ), nullptr );
+      if ( m_mapping == nullptr )
+      {
+         CloseHandle( m_file );
+         throw std::runtime_error( "Unable to reserve " + std::to_string( size ) + " bytes of scratch file space" );
+      }
+      SYSTEM_INFO info;
+      GetSystemInfo( &info );
+      m_granularity = info.dwAllocationGranularity;
+#else
+      std::string pattern = directory;
+      if ( pattern.empty() )
+      {
+         const char* tmp = std::getenv( "TMPDIR" );
+         pattern = ( tmp != nullptr && *tmp != '\0' ) ? tmp : "/tmp";
+      }
+      pattern += "/rgbtoha-XXXXXX";
+      std::vector<char> path( pattern.begin(), pattern.end() );
+      path.push_back( '\0' );
+      m_file = mkstemp( path.data() );
+      if ( m_file < 0 )
+         throw std::runtime_error( "Unable to create a scratch file " + pattern );
+      unlink( path.data() );
+      if ( ftruncate( m_file, off_t( size ) ) != 0 )
+      {
+         close( m_file );
+         throw std::runtime_error( "Unable to reserve " + std::to_string( size ) + " bytes of scratch file space" );
+      }
+      m_granularity = std::uint64_t( sysconf( _SC_PAGESIZE ) );
+#endif
+   }
+
+   ~HAScratchFile()
+   {
+      Unmap();
+#ifdef _WIN32
+      CloseHandle( m_mapping );
+      CloseHandle( m_file );
+#else
+      close( m_file );
+#endif
+   }
+
+   HAScratchFile( const HAScratchFile& ) = delete;
+   HAScratchFile& operator =( const HAScratchFile& ) = delete;
+
+   std::uint64_t Size() const
+   {
+      return m_size;
+   }
+
+   // Maps bytes [offset,offset+count), replacing the previous window
+   void* Map( std::uint64_t offset, std::size_t count )
+   {
+      Unmap();
+      std::uint64_t base = offset - offset % m_granularity;
+      m_windowSize = std::size_t( offset - base ) + count;
+#ifdef _WIN32
+      m_window = MapViewOfFile( m_mapping, FILE_MAP_ALL_ACCESS, DWORD( base >> 32 ), DWORD( base ), m_windowSize );
+      if ( m_window == nullptr )
+#else
+      m_window = mmap( nullptr, m_windowSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_file, off_t( base ) );
+      if ( m_window == MAP_FAILED )
+#endif
+      {
+         m_window = nullptr;
+         throw std::runtime_error( "Unable to map scratch file window" );
+      }
+      return static_cast<std::uint8_t*>( m_window ) + ( offset - base );
+   }
+
+   void Unmap()
+   {
+      if ( m_window != nullptr )
+      {
+#ifdef _WIN32
+         UnmapViewOfFile( m_window );
+#else
+         munmap( m_window, m_windowSize );
+#endif
+         m_window = nullptr;
+      }
+   }
+
+private:
+
+#ifdef _WIN32
+   HANDLE        m_file = INVALID_HANDLE_VALUE;
+   HANDLE        m_mapping = nullptr;
+#else
+   int           m_file = -1;
+#endif
+   std::uint64_t m_size;
+   std::uint64_t m_granularity = 4096;
+   void*         m_window = nullptr;
+   std::size_t   m_windowSize = 0;
+};
+
+// Rereadable strip sink backed by an HAScratchFile
+template <typename T>
+class HAScratchStripSink : public HAStripSink<T>
+{
+public:
+
+   HAScratchStripSink( int width, int height, const std::string& directory ) :
+      m_width( width ), m_file( std::uint64_t( sizeof( T ) )*width*height, directory )
+   {
+   }
+
+   HAView<T> Rows( int y0, int y1 ) override
+   {
+      const std::uint64_t rowBytes = std::uint64_t( sizeof( T ) )*m_width;
+      T* data = static_cast<T*>( m_file.Map( y0*rowBytes, std::size_t( ( y1 - y0 )*rowBytes ) ) );
+      return HAView<T>( data, m_width, 0, y0 );
+   }
+
+   void Commit( int, int ) override
+   {
+      m_file.Unmap();
+   }
+
+   bool IsRereadable() const override
+   {
+      return true;
+   }
+
+private:
+
+   int           m_width;
+   HAScratchFile m_file;
+};
+
+/*
+ * Streaming pipeline: HAFusedPipeline over horizontal strips of a source
+ * that need not fit in memory, with the same result as a whole-image run.
+ *
+ * Strip height is derived from a memory budget: each strip holds its rows of
+ * source samples plus SourceHalo() rows above and below, its rows of output
+ * and, with contrast boost, a window of the intermediate image, on top of a
+ * fixed per-thread tile workspace. Peak working memory is
+ * therefore a fixed multiple of the strip size, independent of the image
+ * height, and stays within the budget whenever the budget exceeds the
+ * workspace and one tile row of strips.
+ *
+ * Up to three passes are made over the strips: moments (enhancement only),
+ * the tile stages, and the contrast stretch, which needs the histogram of the
+ * whole image before any output is final. With contrast boost the unstretched
+ * output is kept in the sink itself if it is rereadable, in memory if it fits
+ * the budget, and otherwise in a memory-mapped scratch file.
+ */
+class HAStreamingPipeline
+{
+public:
+
+   // Per-thread tile workspace reserved out of the budget
+   static constexpr std::size_t WorkspaceBytesPerThread = std::size_t( 4 ) << 20;
+
+   // budgetBytes of 0 means no limit: a single strip
+   HAStreamingPipeline( const HAParameters& params, std::size_t budgetBytes,
+                        const std::string& scratchDirectory = std::string() ) :
+      m_pipeline( params ), m_params( params ), m_budget( budgetBytes ), m_scratchDirectory( scratchDirectory )
+   {
+   }
+
+   const char* ISA() const
+   {
+      return m_pipeline.ISA();
+   }
+
+   const HAColorLUT* LUT() const
+   {
+      return m_pipeline.LUT();
+   }
+
+   // Rows per strip for an image of the given size and sample type
+   template <typename T>
+   int StripRows( int width, int height ) const
+   {
+      if ( m_budget == 0 )
+         return height;
+      const int tileHeight = m_pipeline.TileHeight();
+      const std::size_t reserve = WorkspaceBytesPerThread*HANumberOfThreads();
+      // 3 source channels, output and, with contrast boost, a scratch window
+      const std::size_t rowBytes = ( ( m_params.contrastBoost > 0 ) ? 5 : 4 )*sizeof( T )*std::size_t( width );
+      const std::size_t haloBytes = 2*m_pipeline.SourceHalo()*3*sizeof( T )*std::size_t( width );
+      std::size_t available = ( m_budget > reserve + haloBytes ) ? m_budget - reserve - haloBytes : 0;
+      int rows = int( std::min<std::size_t>( available/rowBytes, std::size_t( height ) ) );
+      return std::min( height, std::max( tileHeight, rows - rows % tileHeight ) );
+   }
+
+   template <typename T>
+   HARunSummary Run( HAStripSource<T>& source, HAStripSink<T>& sink, HAProfiler* profiler = nullptr ) const
+   {
+      const int width = source.Width();
+      const int height = source.Height();
+      const int stripRows = StripRows<T>( width, height );
+      const int halo = m_pipeline.SourceHalo();
+
+      HAFusedPipeline::Workspace ws;
+      HARunSummary summary;
+
+      // Rows [y0,y1) of the source widened by rows on each side, as a whole
+      // image source
+      auto sourceRows = [&]( int y0, int y1, int rows )
+      {
+         HASource<T> s = source.Rows( std::max( 0, y0 - rows ), std::min( height, y1 + rows ) );
+         s.width = width;
+         s.height = height;
+         return s;
+      };
+
+      HAMoments moments;
+      if ( m_params.enhancementStrength > 0 )
+         for ( int y0 = 0; y0 < height; y0 += stripRows )
+         {
+            int y1 = std::min( height, y0 + stripRows );
+            m_pipeline.AccumulateMoments( sourceRows( y0, y1, 0 ), y0, y1, moments, ws, profiler );
+         }
+
+      // Unstretched output goes where it can be revised once the histogram
+      // is complete
+      const bool boost = m_params.contrastBoost > 0;
+      std::vector<T> memory;
+      std::unique_ptr<HAStripSink<T>> intermediate;
+      HAStripSink<T>* target = &sink;
+      if ( boost && !sink.IsRereadable() )
+      {
+         const std::size_t imageBytes = sizeof( T )*std::size_t( width )*height;
+         const std::size_t stripBytes = std::size_t( 4 )*sizeof( T )*width*( stripRows + 2*halo );
+         if ( m_budget == 0 || imageBytes + stripBytes + ws.Bytes() <= m_budget )
+         {
+            memory.resize( std::size_t( width )*height );
+            intermediate.reset( new HAImageStripSink<T>( HAView<T>( memory.data(), width ) ) );
+            summary.workingBytes += imageBytes;
+         }
+         else
+         {
+            intermediate.reset( new HAScratchStripSink<T>( width, height, m_scratchDirectory ) );
+            summary.scratchFileBytes = imageBytes;
+         }
+         target = intermediate.get();
+      }
+
+      for ( int y0 = 0; y0 < height; y0 += stripRows )
+      {
+         int y1 = std::min( height, y0 + stripRows );
+         m_pipeline.ProcessRows( sourceRows( y0, y1, halo ), target->Rows( y0, y1 ), y0, y1, moments, ws, profiler );
+         target->Commit( y0, y1 );
+      }
+
+      float p5, range;
+      const bool stretch = m_pipeline.ContrastRange( ws, p5, range );
+      if ( target != &sink || stretch )
+         for ( int y0 = 0; y0 < height; y0 += stripRows )
+         {
+            int y1 = std::min( height, y0 + stripRows );
+            HAView<T> rows = target->Rows( y0, y1 );
+            if ( stretch )
+               m_pipeline.Stretch( rows, width, height, y0, y1, p5, range, ws, profiler );
+            if ( target != &sink )
+            {
+               HAView<T> out = sink.Rows( y0, y1 );
+               for ( int y = y0; y < y1; ++y )
+                  std::memcpy( out.At( 0, y ), rows.At( 0, y ), sizeof( T )*width );
+            }
+            target->Commit( y0, y1 );
+            if ( target != &sink )
+               sink.Commit( y0, y1 );
+         }
+
+      summary.workingBytes += ws.Bytes();
+      summary.stripRows = stripRows;
+      return summary;
+   }
+
+private:
+
+   HAFusedPipeline m_pipeline;
+   HAParameters    m_params;
+   std::size_t     m_budget;
+   std::string     m_scratchDirectory;
+};
+
+} // pcl
+
+#endif   // __RGBToHAStreaming_h
@@ -0,0 +1,423 @@
+/*
+ * RGB to HA Conversion Thread Pool for PixInsight
+ * Persistent work-stealing worker pool shared by every parallel stage
+ */
+
+#ifndef __RGBToHAThreadPool_h
+#define __RGBToHAThreadPool_h
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined( __APPLE__ )
+#include <pthread.h>
+#include <pthread/qos.h>
+#elif defined( __linux__ )
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace pcl
+{
+
+// Limits on the worker threads of the module-wide pool
+struct HAWorkerPolicy
+{
+   int              maxThreads = 0;     // cap on threads per loop, the caller included; 0 for none
+   std::vector<int> cpus;               // CPUs the workers may run on; empty for any
+   bool             background = false; // workers below normal priority
+};
+
+/*
+ * Worker threads live as long as the module. A parallel loop is a job whose
+ * index space is split evenly among its participants: the calling thread is
+ * always participant 0, and idle workers join as participants 1, 2, ... Each
+ * participant consumes its own range from the front; once it runs dry it
+ * steals the back half of the largest remaining range. Uneven work (bilateral
+ * tiles near edges, transcendental-heavy tiles) therefore balances without a
+ * central queue, and a participant index never runs on two threads at once,
+ * so callers can keep per-participant scratch buffers.
+ *
+ * The caller never blocks while work remains: it executes indices of its own
+ * job until none are left, then waits only for indices already in flight.
+ * Loops may be nested; a worker that issues a loop becomes participant 0 of it.
+ *
+ * A worker policy caps the thread count, pins workers to a set of CPUs (not
+ * on macOS, which has no affinity API) and lowers their priority: nice 10 on
+ * Linux, below normal on Windows, the utility QoS class on macOS. Callers
+ * keep their own CPU and priority. Both are best effort: a CPU set the
+ * system rejects leaves workers unpinned.
+ */
+class HAThreadPool
+{
+public:
+
+   // The module-wide pool, started on first use
+   static HAThreadPool& Instance()
+   {
+      std::lock_guard<std::mutex> lock( InstanceMutex() );
+      HAThreadPool*& pool = InstancePointer();
+      if ( pool == nullptr )
+      {
+         const HAWorkerPolicy& policy = ConfiguredPolicy();
+         int threads = ConfiguredThreads();
+         if ( threads <= 0 )
+            threads = policy.cpus.empty() ? int( std::thread::hardware_concurrency() ) : int( policy.cpus.size() );
+         if ( policy.maxThreads > 0 )
+            threads = std::min( threads, policy.maxThreads );
+         pool = new HAThreadPool( std::max( 1, threads ) - 1, policy );
+      }
+      return *pool;
+   }
+
+   // Total threads per loop (the caller included) for the module-wide pool;
+   // 0 selects one per hardware thread, or per CPU of the policy. Takes
+   // effect by restarting the pool, so it must not be called while a loop is
+   // running.
+   static void Configure( int numberOfThreads )
+   {
+      Shutdown();
+      std::lock_guard<std::mutex> lock( InstanceMutex() );
+      ConfiguredThreads() = std::max( 0, numberOfThreads );
+   }
+
+   // Worker policy of the module-wide pool, taking effect as Configure() does
+   static void SetPolicy( const HAWorkerPolicy& policy )
+   {
+      Shutdown();
+      std::lock_guard<std::mutex> lock( InstanceMutex() );
+      ConfiguredPolicy() = policy;
+   }
+
+   static HAWorkerPolicy Policy()
+   {
+      std::lock_guard<std::mutex> lock( InstanceMutex() );
+      return ConfiguredPolicy();
+   }
+
+   // Stops and joins all workers; called when the module is unloaded
+   static void Shutdown()
+   {
+      std::lock_guard<std::mutex> lock( InstanceMutex() );
+      HAThreadPool*& pool = InstancePointer();
+      delete pool;
+      pool = nullptr;
+   }
+
+   explicit HAThreadPool( int numberOfWorkers, const HAWorkerPolicy& policy = HAWorkerPolicy() )
+   {
+      for ( int i = 0; i < numberOfWorkers; ++i )
+         m_workers.emplace_back( [this, policy]()
+         {
+            ApplyPolicy( policy );
+            WorkerLoop();
+         } );
+   }
+
+   ~HAThreadPool()
+   {
+      {
+         std::lock_guard<std::mutex> lock( m_mutex );
+         m_stop = true;
+      }
+      m_wake.notify_all();
+      for ( std::thread& worker : m_workers )
+         worker.join();
+   }
+
+   HAThreadPool( const HAThreadPool& ) = delete;
+   HAThreadPool& operator =( const HAThreadPool& ) = delete;
+
+   // Maximum number of threads taking part in one loop, the caller included
+   int NumberOfThreads() const
+   {
+      return int( m_workers.size() ) + 1;
+   }
+
+   // Calls func( index, slot ) for every index in [0,count). slot is the
+   // participant index, unique among the threads running this loop and in
+   // [0,NumberOfThreads()).
+   template <typename F>
+   void ParallelFor( int count, F&& func )
+   {
+      if ( count <= 0 )
+         return;
+
+      // Nothing to share: no wakeups, no synchronization
+      if ( count == 1 || m_workers.empty() )
+      {
+         for ( int i = 0; i < count; ++i )
+            func( i, 0 );
+         return;
+      }
+
+      typedef typename std::remove_reference<F>::type Func;
+      Job job( count, std::min( count, NumberOfThreads() ), &Invoke<Func>, &func );
+
+      {
+         std::lock_guard<std::mutex> lock( m_mutex );
+         m_jobs.push_back( &job );
+      }
+      m_wake.notify_all();
+
+      Participate( job, 0 );
+
+      {
+         std::unique_lock<std::mutex> lock( m_mutex );
+         m_jobs.erase( std::find( m_jobs.begin(), m_jobs.end(), &job ) );
+         m_done.wait( lock, [&]() { return job.remaining.load() == 0 && job.participants == 0; } );
+      }
+
+      if ( job.error )
+         std::rethrow_exception( job.error );
+   }
+
+private:
+
+   // Contiguous run of indices owned by one participant. Written under lock;
+   // thieves may read the bounds without it to pick a victim.
+   struct Range
+   {
+      std::mutex lock;
+      std::atomic<int> begin{ 0 };
+      std::atomic<int> end{ 0 };
+
+      int Size() const
+      {
+         return end.load( std::memory_order_relaxed ) - begin.load( std::memory_order_relaxed );
+      }
+   };
+
+   struct Job
+   {
+      void (*invoke)( void*, int, int );
+      void* func;
+      int slots;
+      std::unique_ptr<Range[]> ranges;
+      std::atomic<int> remaining;
+      std::atomic<int> nextSlot;
+      int participants = 0;          // workers inside Participate(), guarded by m_mutex
+      std::mutex errorLock;
+      std::exception_ptr error;
+
+      Job( int count, int n, void (*f)( void*, int, int ), void* context ) :
+         invoke( f ), func( context ), slots( n ), ranges( new Range[n] ), remaining( count ), nextSlot( 1 )
+      {
+         for ( int i = 0; i < n; ++i )
+         {
+            ranges[i].begin = int( ( long long )count*i/n );
+            ranges[i].end = int( ( long long )count*( i + 1 )/n );
+         }
+      }
+
+      bool IsJoinable() const
+      {
+         return nextSlot.load() < slots && remaining.load() > 0;
+      }
+   };
+
+   template <typename Func>
+   static void Invoke( void* func, int index, int slot )
+   {
+      ( *static_cast<Func*>( func ) )( index, slot );
+   }
+
+   // Next index for slot: from its own range, else stolen from the fullest one
+   static bool Next( Job& job, int slot, int& index )
+   {
+      Range& own = job.ranges[slot];
+      {
+         std::lock_guard<std::mutex> lock( own.lock );
+         if ( own.begin < own.end )
+         {
+            index = own.begin++;
+            return true;
+         }
+      }
+
+      for ( ;; )
+      {
+         int victim = -1, largest = 0;
+         for ( int i = 0; i < job.slots; ++i )
+            if ( i != slot )
+            {
+               int size = job.ranges[i].Size();
+               if ( size > largest )
+               {
+                  largest = size;
+                  victim = i;
+               }
+            }
+         if ( victim < 0 )
+            return false;
+
+         int begin, end;
+         {
+            std::lock_guard<std::mutex> lock( job.ranges[victim].lock );
+            Range& r = job.ranges[victim];
+            if ( r.begin >= r.end )
+               continue;
+            begin = r.begin + ( r.end - r.begin )/2;
+            end = r.end;
+            r.end = begin;
+         }
+
+         std::lock_guard<std::mutex> lock( own.lock );
+         own.begin = begin + 1;
+         own.end = end;
+         index = begin;
+         return true;
+      }
+   }
+
+   void Participate( Job& job, int slot )
+   {
+      for ( int index; Next( job, slot, index ); )
+      {
+         try
+         {
+            job.invoke( job.func, index, slot );
+         }
+         catch ( ... )
+         {
+            std::lock_guard<std::mutex> lock( job.errorLock );
+            if ( !job.error )
+               job.error = std::current_exception();
+         }
+
+         if ( job.remaining.fetch_sub( 1 ) == 1 )
+         {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_done.notify_all();
+         }
+      }
+   }
+
+   void WorkerLoop()
+   {
+      std::unique_lock<std::mutex> lock( m_mutex );
+      for ( ;; )
+      {
+         Job* job = nullptr;
+         m_wake.wait( lock, [&]()
+         {
+            if ( m_stop )
+               return true;
+            for ( Job* j : m_jobs )
+               if ( j->IsJoinable() )
+                  return ( job = j ) != nullptr;
+            return false;
+         } );
+         if ( job == nullptr )
+            return;
+
+         int slot = job->nextSlot.fetch_add( 1 );
+         if ( slot >= job->slots )
+            continue;
+
+         ++job->participants;
+         lock.unlock();
+         Participate( *job, slot );
+         lock.lock();
+         if ( --job->participants == 0 )
+            m_done.notify_all();
+      }
+   }
+
+   // Pins the calling thread and lowers its priority as policy asks
+   static void ApplyPolicy( const HAWorkerPolicy& policy )
+   {
+#ifdef _WIN32
+      DWORD_PTR mask = 0;
+      for ( int cpu : policy.cpus )
+         if ( cpu >= 0 && cpu < int( 8*sizeof( mask ) ) )
+            mask |= DWORD_PTR( 1 ) << cpu;
+      if ( mask != 0 )
+         SetThreadAffinityMask( GetCurrentThread(), mask );
+      if ( policy.background )
+         SetThreadPriority( GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL );
+#elif defined( __APPLE__ )
+      if ( policy.background )
+         pthread_set_qos_class_self_np( QOS_CLASS_UTILITY, 0 );
+#elif defined( __linux__ )
+      if ( !policy.cpus.empty() )
+      {
+         cpu_set_t set;
+         CPU_ZERO( &set );
+         for ( int cpu : policy.cpus )
+            if ( cpu >= 0 && cpu < CPU_SETSIZE )
+               CPU_SET( cpu, &set );
+         pthread_setaffinity_np( pthread_self(), sizeof( set ), &set );
+      }
+      // Linux threads have their own nice value
+      if ( policy.background )
+         setpriority( PRIO_PROCESS, id_t( syscall( SYS_gettid ) ), 10 );
+#else
+      (void)policy;
+#endif
+   }
+
+   static HAThreadPool*& InstancePointer()
+   {
+      static HAThreadPool* pool = nullptr;
+      return pool;
+   }
+
+   static int& ConfiguredThreads()
+   {
+      static int threads = 0;
+      return threads;
+   }
+
+   static HAWorkerPolicy& ConfiguredPolicy()
+   {
+      static HAWorkerPolicy policy;
+      return policy;
+   }
+
+   static std::mutex& InstanceMutex()
+   {
+      static std::mutex mutex;
+      return mutex;
+   }
+
+   std::vector<std::thread> m_workers;
+   std::vector<Job*>        m_jobs;
+   std::mutex               m_mutex;
+   std::condition_variable  m_wake;
+   std::condition_variable  m_done;
+   bool                     m_stop = false;
+};
+
+inline int HANumberOfThreads()
+{
+   return HAThreadPool::Instance().NumberOfThreads();
+}
+
+// Calls func( index, slot ) for every index in [0,count) on the module pool;
+// slot is in [0,HANumberOfThreads()).
+template <typename F>
+void HAParallelFor( int count, F&& func )
+{
+   HAThreadPool::Instance().ParallelFor( count, std::forward<F>( func ) );
+}
+
+} // pcl
+
+#endif   // __RGBToHAThreadPool_h
@@ -0,0 +1,395 @@
+/*
+ * RGB to HA Conversion Auto-Tuner for PixInsight
+ * Per-machine choice of conversion kernels, tile size and thread count
+ */
+
+#ifndef __RGBToHATuner_h
+#define __RGBToHATuner_h
+
+#include "RGBToHAEngine.h"
+#include "RGBToHAPreferences.h"
+#include "RGBToHAStarField.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace pcl
+{
+
+// Module-wide execution settings of one machine
+struct HATuning
+{
+   std::string isa;                            // conversion kernels, empty for the fastest supported
+   int    tileWidth = HATileDefaults::Width;   // HAFusedPipeline tiles
+   int    tileHeight = HATileDefaults::Height;
+   int    threads = 0;                         // per parallel loop, 0 for one per hardware thread
+   bool   manual = false;                      // set by hand rather than calibrated
+   double megapixelsPerSecond = 0;             // calibration throughput, if calibrated
+};
+
+// One candidate timed by HATuner::Calibrate()
+struct HATunerTrial
+{
+   std::string stage;     // "kernels", "tiles" or "threads"
+   std::string candidate; // "avx2 linear", "256x64", "8", ...
+   double      megapixelsPerSecond;
+};
+
+/*
+ * Startup auto-tuner. Calibrate() times short runs on synthetic data and
+ * picks, in turn:
+ *
+ * kernels  the instruction set whose conversion kernels (linear, neural,
+ *          blend, sigmoid) take the least time in total on cache-resident
+ *          rows, each kernel weighed against its fastest variant;
+ * tiles    the HAFusedPipeline tile size with the highest throughput of a
+ *          Quality run over a 0.5 MP star field on every thread of the pool;
+ * threads  the fewest threads, down to a quarter of them, within
+ *          ThreadTolerance of the throughput of all of them, leaving cores
+ *          that add nothing (memory bound stages, SMT siblings) to the rest
+ *          of the machine. Compared on a field of TilesPerThread tiles per
+ *          thread, so that every thread stays as busy as on a full-size
+ *          frame: the few tiles of the 0.5 MP field would leave cores idle
+ *          and let fewer threads look as fast. Where that field would
+ *          exceed ThreadFieldPixels, one thread per core is kept.
+ *
+ * A calibration makes about 30 such runs: a second or so on one core, a
+ * fraction of that on many. Its result is kept as a profile,
+ * machine-<host>.conf (HASettingsFile; RGBTOHA_PROFILE overrides the path),
+ * which applies only to a machine of the same MachineSignature(): a profile
+ * carried to other hardware is ignored. Settings chosen by hand are saved
+ * the same way, marked manual. The limits of HAPreferences apply over both.
+ */
+class HATuner
+{
+public:
+
+   static constexpr int    ProfileVersion = 1;
+   static constexpr int    MinTileSize = 16;
+   static constexpr int    MaxTileSize = 4096;
+   static constexpr double ThreadTolerance = 0.03;
+   static constexpr int    TilesPerThread = 8;
+   static constexpr double ThreadFieldPixels = 16*1048576.0;
+
+   // CPU, hardware threads and fastest supported kernels
+   static std::string MachineSignature()
+   {
+      std::string signature = HACPUName();
+      signature += "; " + std::to_string( HardwareThreads() ) + " threads; ";
+      for ( const char* isa : { "avx512", "avx2", "sse4.2", "neon", "scalar" } )
+         if ( HAConversionKernelsFor( isa ) != nullptr )
+         {
+            signature += isa;
+            break;
+         }
+      return signature;
+   }
+
+   // Profile file of this host (HASettingsFile)
+   static std::string ProfilePath()
+   {
+      return HASettingsFile::PathFor( "machine", "RGBTOHA_PROFILE" );
+   }
+
+   // Reads a profile; false if there is none, or it is unreadable, of
+   // another version or of another machine
+   static bool Load( HATuning& tuning, const std::string& path = ProfilePath() )
+   {
+      std::map<std::string, std::string> values;
+      if ( !HASettingsFile::Read( path, values ) )
+         return false;
+
+      HATuning loaded;
+      loaded.manual = values["source"] == "manual";
+      loaded.isa = values["isa"];
+      loaded.tileWidth = std::atoi( values["tileWidth"].c_str() );
+      loaded.tileHeight = std::atoi( values["tileHeight"].c_str() );
+      loaded.threads = std::atoi( values["threads"].c_str() );
+      loaded.megapixelsPerSecond = std::atof( values["megapixelsPerSecond"].c_str() );
+      if ( std::atoi( values["version"].c_str() ) != ProfileVersion || values["machine"] != MachineSignature() ||
+           !Valid( loaded ) )
+         return false;
+      tuning = loaded;
+      return true;
+   }
+
+   // Writes a profile. Throws std::runtime_error.
+   static void Save( const HATuning& tuning, const std::string& path = ProfilePath() )
+   {
+      if ( !Valid( tuning ) )
+         throw std::runtime_error( "HATuner: invalid settings" );
+      HASettingsFile::Write( path, "RGB to HA machine profile",
+                             { { "version", std::to_string( ProfileVersion ) },
+                               { "machine", MachineSignature() },
+                               { "source", tuning.manual ? "manual" : "calibrated" },
+                               { "isa", tuning.isa },
+                               { "tileWidth", std::to_string( tuning.tileWidth ) },
+                               { "tileHeight", std::to_string( tuning.tileHeight ) },
+                               { "threads", std::to_string( tuning.threads ) },
+                               { "megapixelsPerSecond", std::to_string( tuning.megapixelsPerSecond ) } } );
+   }
+
+   // Makes tuning the module-wide setting for pipelines created from now on.
+   // Restarts the thread pool, so no parallel loop may be running. Returns
+   // false if its kernels are unavailable here; the fastest are used instead.
+   static bool Apply( const HATuning& tuning )
+   {
+      const bool available = HASelectConversionKernels( tuning.isa.c_str() );
+      if ( !available )
+         HASelectConversionKernels( nullptr );
+      HATileDefaults& tiles = HATileDefaults::Instance();
+      tiles.width = std::max( MinTileSize, std::min( MaxTileSize, tuning.tileWidth ) );
+      tiles.height = std::max( MinTileSize, std::min( MaxTileSize, tuning.tileHeight ) );
+      HAThreadPool::Configure( tuning.threads );
+
+      std::lock_guard<std::mutex> lock( StateMutex() );
+      ActiveTuning() = tuning;
+      return available;
+   }
+
+   // "avx2 kernels, 256x64 tiles, 8 threads, calibrated"
+   static std::string Summary( const HATuning& tuning )
+   {
+      std::string text = tuning.isa.empty() ? std::string( "fastest kernels" ) : tuning.isa + " kernels";
+      text += ", " + std::to_string( tuning.tileWidth ) + 'x' + std::to_string( tuning.tileHeight ) + " tiles, ";
+      text += ( tuning.threads > 0 ) ? std::to_string( tuning.threads ) + " threads" : std::string( "all threads" );
+      return text + ( tuning.manual ? ", set by hand" : ", calibrated" );
+   }
+
+   // Settings last applied, or the defaults
+   static HATuning Active()
+   {
+      std::lock_guard<std::mutex> lock( StateMutex() );
+      return ActiveTuning();
+   }
+
+   // Times the candidates and returns the best settings, which are not
+   // applied: the active settings are restored on return. Restarts the
+   // thread pool, so no parallel loop may be running.
+   static HATuning Calibrate( std::vector<HATunerTrial>* trials = nullptr )
+   {
+      const HATuning previous = Active();
+      HATuning tuning;
+      try
+      {
+         tuning.isa = CalibrateKernels( trials );
+         HASelectConversionKernels( tuning.isa.c_str() );
+
+         HAStarField<float> field( 1024, 512 );
+         const HASource<float> source = field.Source();
+         std::vector<float> output( std::size_t( field.width )*field.height );
+         const HAView<float> view( output.data(), field.width );
+
+         HAThreadPool::Configure( 0 );
+         double best = 0;
+         for ( int width : { 128, 256, 512 } )
+            for ( int height : { 32, 64, 128 } )
+            {
+               const double rate = Throughput( source, view, width, height );
+               Record( trials, "tiles", std::to_string( width ) + 'x' + std::to_string( height ), rate );
+               if ( rate > best )
+               {
+                  best = rate;
+                  tuning.tileWidth = width;
+                  tuning.tileHeight = height;
+               }
+            }
+         tuning.megapixelsPerSecond = best;
+
+         // Fewer threads, down to a quarter, kept if within tolerance of all
+         // the pool has (one per hardware thread, within the preferences)
+         const int all = HANumberOfThreads();
+         const int tilesPerRow = ( field.width + tuning.tileWidth - 1 )/tuning.tileWidth;
+         const int tileRows = ( TilesPerThread*all + tilesPerRow - 1 )/tilesPerRow;
+         const int height = std::max( field.height, tileRows*tuning.tileHeight );
+         if ( all > 1 && double( field.width )*height <= ThreadFieldPixels )
+         {
+            // The tile field, or a taller one with enough tiles
+            std::unique_ptr<HAStarField<float>> tall;
+            std::vector<float> tallOutput;
+            HASource<float> threadSource = source;
+            HAView<float> threadView = view;
+            double full = best;
+            if ( height > field.height )
+            {
+               tall.reset( new HAStarField<float>( field.width, height ) );
+               tallOutput.resize( std::size_t( field.width )*height );
+               threadSource = tall->Source();
+               threadView = HAView<float>( tallOutput.data(), field.width );
+               full = Throughput( threadSource, threadView, tuning.tileWidth, tuning.tileHeight );
+               Record( trials, "threads", std::to_string( all ), full );
+               tuning.megapixelsPerSecond = full;
+            }
+
+            for ( int n : { 3*all/4, all/2, all/4 } )
+               if ( n >= 1 && n < ( ( tuning.threads > 0 ) ? tuning.threads : all ) )
+               {
+                  HAThreadPool::Configure( n );
+                  const double rate = Throughput( threadSource, threadView, tuning.tileWidth, tuning.tileHeight );
+                  Record( trials, "threads", std::to_string( n ), rate );
+                  if ( rate >= ( 1 - ThreadTolerance )*full )
+                  {
+                     tuning.threads = n;
+                     tuning.megapixelsPerSecond = rate;
+                  }
+               }
+         }
+      }
+      catch ( ... )
+      {
+         Apply( previous );
+         throw;
+      }
+      Apply( previous );
+      return tuning;
+   }
+
+private:
+
+   static int HardwareThreads()
+   {
+      return std::max( 1, int( std::thread::hardware_concurrency() ) );
+   }
+
+   static bool Valid( const HATuning& tuning )
+   {
+      return tuning.tileWidth >= MinTileSize && tuning.tileWidth <= MaxTileSize &&
+             tuning.tileHeight >= MinTileSize && tuning.tileHeight <= MaxTileSize &&
+             tuning.threads >= 0 && tuning.threads <= 4096;
+   }
+
+   static double Now()
+   {
+      return std::chrono::duration<double>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+   }
+
+   static void Record( std::vector<HATunerTrial>* trials, const char* stage, const std::string& candidate,
+                       double megapixelsPerSecond )
+   {
+      if ( trials != nullptr )
+         trials->push_back( HATunerTrial{ stage, candidate, megapixelsPerSecond } );
+   }
+
+   // Instruction set of the kernels with the least weighted time; only those
+   // HASelectConversionKernels() accepts take part
+   static std::string CalibrateKernels( std::vector<HATunerTrial>* trials )
+   {
+      const int n = 4096, calls = 32;
+      std::vector<float> r( n ), g( n ), b( n ), x( n ), out( n );
+      std::uint32_t seed = 1;
+      for ( int i = 0; i < n; ++i )
+      {
+         r[i] = Random( seed );
+         g[i] = Random( seed );
+         b[i] = Random( seed );
+         x[i] = 16*Random( seed ) - 8;
+      }
+      const HAKernelArgs args;
+      const float* rows[3] = { r.data(), g.data(), b.data() };
+      const float weights[3] = { 0.5f, 0.3f, 0.2f };
+
+      static const char* names[] = { "linear", "neural", "blend", "sigmoid" };
+      std::vector<const HAConversionKernels*> candidates;
+      std::vector<std::vector<double>> rates;
+      for ( const char* isa : { "scalar", "sse4.2", "avx2", "avx512", "neon" } )
+      {
+         const HAConversionKernels* k = HAConversionKernelsFor( isa );
+         if ( k == nullptr || !HASelectConversionKernels( isa ) )
+            continue;
+         candidates.push_back( k );
+         rates.emplace_back();
+         for ( int kernel = 0; kernel < 4; ++kernel )
+         {
+            double best = 0;
+            for ( int run = 0; run < 6; ++run ) // the first warms up
+            {
+               const double start = Now();
+               for ( int call = 0; call < calls; ++call )
+                  switch ( kernel )
+                  {
+                  case 0: k->linear( r.data(), g.data(), b.data(), out.data(), n, args ); break;
+                  case 1: k->neural( r.data(), g.data(), b.data(), out.data(), n, args ); break;
+                  case 2: k->blend( rows, weights, 3, out.data(), n ); break;
+                  case 3: k->sigmoid( x.data(), out.data(), n ); break;
+                  }
+               const double seconds = Now() - start;
+               if ( run == 1 || ( run > 1 && seconds < best ) )
+                  best = seconds;
+            }
+            rates.back().push_back( double( n )*calls/std::max( best, 1e-9 )/1e6 );
+            Record( trials, "kernels", std::string( isa ) + ' ' + names[kernel], rates.back().back() );
+         }
+      }
+      if ( candidates.empty() )
+         return std::string();
+
+      // Time per pixel relative to the fastest variant, summed over kernels
+      std::size_t chosen = 0;
+      double bestScore = 0;
+      for ( std::size_t i = 0; i < candidates.size(); ++i )
+      {
+         double score = 0;
+         for ( int kernel = 0; kernel < 4; ++kernel )
+         {
+            double fastest = 0;
+            for ( const std::vector<double>& isaRates : rates )
+               fastest = std::max( fastest, isaRates[kernel] );
+            score += fastest/rates[i][kernel];
+         }
+         if ( i == 0 || score < bestScore )
+         {
+            bestScore = score;
+            chosen = i;
+         }
+      }
+      return candidates[chosen]->isa;
+   }
+
+   // Best of two Quality runs after one to warm up, in megapixels per second
+   static double Throughput( const HASource<float>& source, const HAView<float>& output, int tileWidth, int tileHeight )
+   {
+      const HAFusedPipeline pipeline( HAParameters(), tileWidth, tileHeight );
+      double best = 0;
+      for ( int run = 0; run < 3; ++run )
+      {
+         const double start = Now();
+         pipeline.Run( source, output );
+         const double seconds = Now() - start;
+         if ( run == 1 || ( run > 1 && seconds < best ) )
+            best = seconds;
+      }
+      return double( source.width )*source.height/std::max( best, 1e-9 )/1e6;
+   }
+
+   // Uniform in [0,1), deterministic
+   static float Random( std::uint32_t& state )
+   {
+      state = state*1664525u + 1013904223u;
+      return float( state >> 8 )/16777216.0f;
+   }
+
+   static std::mutex& StateMutex()
+   {
+      static std::mutex mutex;
+      return mutex;
+   }
+
+   static HATuning& ActiveTuning()
+   {
+      static HATuning tuning;
+      return tuning;
+   }
+};
+
+} // pcl
+
+#endif   // __RGBToHATuner_h